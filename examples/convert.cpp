@@ -2,22 +2,256 @@
 #include "libforest/libforest.h"
 #include <chrono>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 
 using namespace libf;
 
 /**
- * Command line tool for converting between CSV and DAT files.
- * 
+ * A block of consecutive data points passing through the pipeline.
+ */
+struct Batch {
+    /**
+     * The position of the batch in the output
+     */
+    int index;
+    /**
+     * The raw lines (text input formats only)
+     */
+    std::string text;
+    /**
+     * The data points (binary input format only)
+     */
+    DataStorage::ptr storage;
+    /**
+     * The formatted output
+     */
+    std::string output;
+    /**
+     * The number of data points in the batch
+     */
+    int size;
+};
+
+/**
+ * The state shared between the reader, the parse workers and the writer. At
+ * most maxBatches batches are in flight at any time, which bounds the memory
+ * independent of the size of the data set.
+ */
+struct Pipeline {
+    Pipeline() : maxBatches(0), numBatches(0), readerFinished(false), failed(false) {}
+    
+    std::mutex mutex;
+    /**
+     * Signaled if a batch can be parsed or the reader is done
+     */
+    std::condition_variable workAvailable;
+    /**
+     * Signaled if a batch has been formatted
+     */
+    std::condition_variable batchDone;
+    /**
+     * Signaled if a batch has been written
+     */
+    std::condition_variable slotFree;
+    /**
+     * Batches waiting to be parsed
+     */
+    std::deque< std::shared_ptr<Batch> > work;
+    /**
+     * Formatted batches waiting to be written by index
+     */
+    std::map< int, std::shared_ptr<Batch> > done;
+    /**
+     * The maximum number of batches in flight
+     */
+    int maxBatches;
+    /**
+     * The number of batches in flight
+     */
+    int numBatches;
+    /**
+     * True if all batches have been read
+     */
+    bool readerFinished;
+    /**
+     * True if one of the stages failed
+     */
+    bool failed;
+    /**
+     * The first error that occurred in one of the threads
+     */
+    std::exception_ptr error;
+    
+    /**
+     * Stops the pipeline after an error.
+     */
+    void fail(std::exception_ptr _error)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!failed)
+        {
+            failed = true;
+            error = _error;
+        }
+        workAvailable.notify_all();
+        batchDone.notify_all();
+        slotFree.notify_all();
+    }
+    
+    /**
+     * Waits until a new batch may be created. Returns false if the pipeline
+     * failed.
+     */
+    bool acquireSlot()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        slotFree.wait(lock, [this]() { return failed || numBatches < maxBatches; });
+        numBatches++;
+        return !failed;
+    }
+    
+    /**
+     * Hands a batch to the parse workers.
+     */
+    void pushWork(std::shared_ptr<Batch> batch)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        work.push_back(batch);
+        workAvailable.notify_one();
+    }
+    
+    /**
+     * Marks the end of the input.
+     */
+    void finishReading()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        readerFinished = true;
+        workAvailable.notify_all();
+        batchDone.notify_all();
+    }
+};
+
+/**
+ * Returns the format for a file name based on its extension.
+ */
+std::string guessFormat(const boost::filesystem::path & file)
+{
+    const std::string extension = file.extension().string();
+    if (extension == ".csv")
+    {
+        return "csv";
+    }
+    else if (extension == ".dat" || extension == ".bin")
+    {
+        return "dat";
+    }
+    else if (extension == ".libsvm" || extension == ".svm" || extension == ".txt")
+    {
+        return "libsvm";
+    }
+    return "";
+}
+
+/**
+ * Determines the dimensionality of a LIBSVM file by scanning for the largest
+ * feature index. This only needs constant memory.
+ */
+int scanLIBSVMDimensionality(const std::string & filename)
+{
+    std::ifstream stream(filename);
+    std::string line;
+    int dimensionality = 0;
+    
+    while (std::getline(stream, line))
+    {
+        if (line.size() == 0 || line[0] == '#')
+        {
+            continue;
+        }
+        
+        // The index is the number in front of every colon
+        for (size_t colon = line.find(':'); colon != std::string::npos; colon = line.find(':', colon + 1))
+        {
+            size_t begin = colon;
+            while (begin > 0 && line[begin - 1] >= '0' && line[begin - 1] <= '9')
+            {
+                begin--;
+            }
+            dimensionality = std::max(dimensionality, std::atoi(line.c_str() + begin));
+        }
+    }
+    
+    return dimensionality;
+}
+
+/**
+ * Appends the data lines of a LIBSVM text to the output, skipping empty lines
+ * and comments. Returns the number of copied lines. 
+ */
+int copyLIBSVMLines(const std::string & text, std::string & output)
+{
+    int numLines = 0;
+    size_t begin = 0;
+    while (begin < text.size())
+    {
+        size_t end = text.find('\n', begin);
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+        
+        const size_t first = text.find_first_not_of(" \t\r", begin);
+        if (first < end && text[first] != '#')
+        {
+            output.append(text, begin, end - begin);
+            output.push_back('\n');
+            numLines++;
+        }
+        
+        begin = end + 1;
+    }
+    
+    return numLines;
+}
+
+/**
+ * Command line tool for converting between CSV, LIBSVM and DAT files. The
+ * input is streamed through a pipeline: A reader thread reads batches of
+ * lines (or binary data points), parse workers convert and format the batches
+ * in parallel and the main thread writes them in order. The memory usage
+ * is bounded by 2 batches per thread.
+ *
  * Usage:
  * $ ./examples/cli_convert --help
  * Allowed options:
  *   --help                   produce help message
  *   --in-file arg            path to input file
  *   --out-file arg           path to output file
+ *   --in-format arg          input format (csv, libsvm, dat); guessed from
+ *                            the file extension by default
+ *   --out-format arg         output format (csv, libsvm, dat); guessed from
+ *                            the file extension by default
  *   --csv-to-dat             convert CSV to DAT
+ *   --dat-to-csv             convert DAT to CSV
  *   --csv-label-col arg (=0) CSV column for label
+ *   --csv-separator arg (= ) CSV column separator
+ *   --libsvm-dim arg (=0)    dimensionality of LIBSVM input files (scanned if
+ *                            0)
+ *   --dat-feature-type arg (=float) feature type of written DAT files (uint8,
+ *                            uint16, half, float, double)
+ *   --num-threads arg (=1)   number of parse workers
+ *   --batch-size arg (=16384) number of data points per batch
  */
 int main(int argc, const char** argv)
 {
@@ -26,10 +260,16 @@ int main(int argc, const char** argv)
         ("help", "produce help message")
         ("in-file", boost::program_options::value<std::string>(), "path to input file")
         ("out-file", boost::program_options::value<std::string>(), "path to output file")
+        ("in-format", boost::program_options::value<std::string>(), "input format (csv, libsvm, dat); guessed from the file extension by default")
+        ("out-format", boost::program_options::value<std::string>(), "output format (csv, libsvm, dat); guessed from the file extension by default")
         ("csv-to-dat", "convert CSV to DAT")
         ("dat-to-csv", "convert DAT to CSV")
         ("csv-label-col", boost::program_options::value<int>()->default_value(0), "CSV column for label")
-        ("csv-separator", boost::program_options::value<std::string>()->default_value(" "), "CSV column separator");
+        ("csv-separator", boost::program_options::value<std::string>()->default_value(" "), "CSV column separator")
+        ("libsvm-dim", boost::program_options::value<int>()->default_value(0), "dimensionality of LIBSVM input files (scanned if 0)")
+        ("dat-feature-type", boost::program_options::value<std::string>()->default_value("float"), "feature type of written DAT files (uint8, uint16, half, float, double)")
+        ("num-threads", boost::program_options::value<int>()->default_value(1), "number of parse workers")
+        ("batch-size", boost::program_options::value<int>()->default_value(16384), "number of data points per batch");
     
     boost::program_options::positional_options_description positionals;
     positionals.add("in-file", 1);
@@ -38,7 +278,7 @@ int main(int argc, const char** argv)
     boost::program_options::variables_map parameters;
     boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positionals).run(), parameters);
     boost::program_options::notify(parameters);
-
+    
     if (parameters.find("help") != parameters.end())
     {
         std::cout << desc << std::endl;
@@ -54,28 +294,348 @@ int main(int argc, const char** argv)
     
     boost::filesystem::path outFile(parameters["out-file"].as<std::string>());
     
-    DataStorage::ptr storage = DataStorage::Factory::create();
-    
+    // Determine the formats
+    std::string inFormat = guessFormat(inFile);
+    std::string outFormat = guessFormat(outFile);
     if (parameters.find("csv-to-dat") != parameters.end())
     {
-        CSVDataReader reader;
-        reader.setClassLabelColumnIndex(parameters["csv-label-col"].as<int>());
-        reader.setReadClassLabels(true);
-        reader.setColumnSeparator(parameters["csv-separator"].as<std::string>());
-        reader.read(inFile.string(), storage);
-        LibforestDataWriter writer;
-        writer.write(outFile.string(), storage);
+        inFormat = "csv";
+        outFormat = "dat";
     }
     else if (parameters.find("dat-to-csv") != parameters.end())
     {
-        LibforestDataReader reader;
-        CSVDataWriter writer;
-        auto storage = DataStorage::Factory::create();
-        reader.read(inFile.string(), storage);
-        writer.write(outFile.string(), storage);
+        inFormat = "dat";
+        outFormat = "csv";
     }
-
-    // Other conversions not possible yet.
+    if (parameters.find("in-format") != parameters.end())
+    {
+        inFormat = parameters["in-format"].as<std::string>();
+    }
+    if (parameters.find("out-format") != parameters.end())
+    {
+        outFormat = parameters["out-format"].as<std::string>();
+    }
+    
+    const int numThreads = parameters["num-threads"].as<int>();
+    const int batchSize = parameters["batch-size"].as<int>();
+    if (numThreads < 1 || batchSize < 1)
+    {
+        std::cout << "The number of threads and the batch size must be positive." << std::endl;
+        return 1;
+    }
+    
+    // Set up the reader
+    std::shared_ptr<AbstractDataReader> reader;
+    if (inFormat == "csv")
+    {
+        std::shared_ptr<CSVDataReader> csvReader = std::make_shared<CSVDataReader>();
+        csvReader->setClassLabelColumnIndex(parameters["csv-label-col"].as<int>());
+        csvReader->setReadClassLabels(true);
+        csvReader->setColumnSeparator(parameters["csv-separator"].as<std::string>());
+        reader = csvReader;
+    }
+    else if (inFormat == "libsvm")
+    {
+        // Every batch is parsed on its own, thus the dimensionality has to
+        // be fixed in advance. LIBSVM output does not parse the input.
+        int dimensionality = parameters["libsvm-dim"].as<int>();
+        if (dimensionality == 0 && outFormat != "libsvm")
+        {
+            dimensionality = scanLIBSVMDimensionality(inFile.string());
+        }
+        
+        std::shared_ptr<LIBSVMDataReader> libsvmReader = std::make_shared<LIBSVMDataReader>();
+        libsvmReader->setDimensionality(dimensionality);
+        reader = libsvmReader;
+    }
+    else if (inFormat != "dat")
+    {
+        std::cout << "Unknown input format." << std::endl;
+        return 1;
+    }
+    
+    // Set up the writer
+    std::shared_ptr<AbstractDataWriter> writer;
+    if (outFormat == "csv")
+    {
+        std::shared_ptr<CSVDataWriter> csvWriter = std::make_shared<CSVDataWriter>();
+        csvWriter->setClassLabelColumnIndex(parameters["csv-label-col"].as<int>());
+        csvWriter->setWriteClassLabels(true);
+        csvWriter->setColumnSeparator(parameters["csv-separator"].as<std::string>());
+        writer = csvWriter;
+    }
+    else if (outFormat == "libsvm")
+    {
+        writer = std::make_shared<LIBSVMDataWriter>();
+    }
+    else if (outFormat == "dat")
+    {
+        std::shared_ptr<LibforestDataWriter> datWriter = std::make_shared<LibforestDataWriter>();
+        const std::string featureType = parameters["dat-feature-type"].as<std::string>();
+        if (featureType == "uint8")
+        {
+            datWriter->setFeatureType(LibforestDataWriter::FEATURE_TYPE_UINT8);
+        }
+        else if (featureType == "uint16")
+        {
+            datWriter->setFeatureType(LibforestDataWriter::FEATURE_TYPE_UINT16);
+        }
+        else if (featureType == "half")
+        {
+            datWriter->setFeatureType(LibforestDataWriter::FEATURE_TYPE_HALF);
+        }
+        else if (featureType == "double")
+        {
+            datWriter->setFeatureType(LibforestDataWriter::FEATURE_TYPE_DOUBLE);
+        }
+        else if (featureType != "float")
+        {
+            std::cout << "Unknown feature type." << std::endl;
+            return 1;
+        }
+        writer = datWriter;
+    }
+    else
+    {
+        std::cout << "Unknown output format." << std::endl;
+        return 1;
+    }
+    
+    std::ifstream inStream(inFile.string(), std::ios::binary);
+    std::ofstream outStream(outFile.string(), std::ios::binary);
+    if (!inStream.is_open() || !outStream.is_open())
+    {
+        std::cout << "Could not open files." << std::endl;
+        return 1;
+    }
+    
+    // The header is rewritten with the correct number of data points at the
+    // end
+    writer->writeHeader(outStream, 0);
+    
+    // LIBSVM is copied line by line: Parsing it would create dense data 
+    // points, i.e. batchSize*D floats per batch for sparse data
+    const bool copyLines = (inFormat == "libsvm" && outFormat == "libsvm");
+    
+    Pipeline pipeline;
+    pipeline.maxBatches = 2*numThreads;
+    
+    const auto start = std::chrono::high_resolution_clock::now();
+    
+    // The reader thread splits the input into batches
+    std::thread readerThread([&]() {
+        try
+        {
+            int index = 0;
+            
+            if (inFormat == "dat")
+            {
+                LibforestDataReader datReader;
+                int N;
+                int featureType;
+                datReader.readHeader(inStream, N, featureType);
+                
+                for (int n = 0; n < N; n += batchSize)
+                {
+                    if (!pipeline.acquireSlot())
+                    {
+                        return;
+                    }
+                    
+                    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+                    batch->index = index++;
+                    batch->size = std::min(batchSize, N - n);
+                    batch->storage = DataStorage::Factory::create();
+                    datReader.readDataPoints(inStream, batch->storage, featureType, batch->size);
+                    
+                    if (!inStream)
+                    {
+                        throw IOException("Unexpected end of data file.");
+                    }
+                    
+                    pipeline.pushWork(batch);
+                }
+            }
+            else
+            {
+                std::string line;
+                bool more = true;
+                while (more)
+                {
+                    if (!pipeline.acquireSlot())
+                    {
+                        return;
+                    }
+                    
+                    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+                    batch->index = index++;
+                    batch->size = 0;
+                    while (batch->size < batchSize && (more = static_cast<bool>(std::getline(inStream, line))))
+                    {
+                        batch->text += line;
+                        batch->text.push_back('\n');
+                        batch->size++;
+                    }
+                    
+                    pipeline.pushWork(batch);
+                }
+            }
+            
+            pipeline.finishReading();
+        }
+        catch (...)
+        {
+            pipeline.fail(std::current_exception());
+        }
+    });
+    
+    // The workers parse and format the batches
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; t++)
+    {
+        workers.push_back(std::thread([&]() {
+            try
+            {
+                while (true)
+                {
+                    std::shared_ptr<Batch> batch;
+                    {
+                        std::unique_lock<std::mutex> lock(pipeline.mutex);
+                        pipeline.workAvailable.wait(lock, [&pipeline]() {
+                            return pipeline.failed || pipeline.readerFinished || !pipeline.work.empty();
+                        });
+                        
+                        if (pipeline.failed || pipeline.work.empty())
+                        {
+                            return;
+                        }
+                        
+                        batch = pipeline.work.front();
+                        pipeline.work.pop_front();
+                    }
+                    
+                    if (copyLines)
+                    {
+                        batch->size = copyLIBSVMLines(batch->text, batch->output);
+                        batch->text = std::string();
+                        
+                        std::lock_guard<std::mutex> lock(pipeline.mutex);
+                        pipeline.done[batch->index] = batch;
+                        pipeline.batchDone.notify_all();
+                        continue;
+                    }
+                    
+                    if (!batch->storage)
+                    {
+                        batch->storage = DataStorage::Factory::create();
+                        std::istringstream text(batch->text);
+                        reader->read(text, batch->storage);
+                        batch->text = std::string();
+                    }
+                    
+                    std::ostringstream output;
+                    writer->writeDataPoints(output, batch->storage);
+                    batch->output = output.str();
+                    batch->size = batch->storage->getSize();
+                    batch->storage.reset();
+                    
+                    {
+                        std::lock_guard<std::mutex> lock(pipeline.mutex);
+                        pipeline.done[batch->index] = batch;
+                        pipeline.batchDone.notify_all();
+                    }
+                }
+            }
+            catch (...)
+            {
+                pipeline.fail(std::current_exception());
+            }
+        }));
+    }
+    
+    // Write the batches in order
+    int numDataPoints = 0;
+    uint64_t numBytes = 0;
+    auto lastReport = start;
+    for (int index = 0; ; index++)
+    {
+        std::shared_ptr<Batch> batch;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.batchDone.wait(lock, [&pipeline, index]() {
+                return pipeline.failed || pipeline.done.count(index) > 0 ||
+                        (pipeline.readerFinished && pipeline.work.empty() && pipeline.numBatches == 0);
+            });
+            
+            if (pipeline.failed || pipeline.done.count(index) == 0)
+            {
+                break;
+            }
+            
+            batch = pipeline.done[index];
+            pipeline.done.erase(index);
+        }
+        
+        outStream.write(batch->output.data(), batch->output.size());
+        if (!outStream)
+        {
+            pipeline.fail(std::make_exception_ptr(IOException("Could not write the output file.")));
+            break;
+        }
+        numDataPoints += batch->size;
+        numBytes += batch->output.size();
+        
+        {
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            pipeline.numBatches--;
+            pipeline.slotFree.notify_one();
+            pipeline.batchDone.notify_all();
+        }
+        
+        const auto now = std::chrono::high_resolution_clock::now();
+        const double elapsed = std::chrono::duration<double>(now - start).count();
+        if (std::chrono::duration<double>(now - lastReport).count() >= 1)
+        {
+            std::printf("\r%d data points (%.0f points/s, %.1f MB/s written)", numDataPoints, numDataPoints/elapsed, numBytes/elapsed/1e6);
+            std::fflush(stdout);
+            lastReport = now;
+        }
+    }
+    
+    readerThread.join();
+    for (size_t t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+    }
+    
+    if (pipeline.failed)
+    {
+        try
+        {
+            std::rethrow_exception(pipeline.error);
+        }
+        catch (std::exception & e)
+        {
+            std::cout << std::endl << "Conversion failed: " << e.what() << std::endl;
+        }
+        return 1;
+    }
+    
+    // Now that the number of data points is known, rewrite the header
+    outStream.seekp(0);
+    writer->writeHeader(outStream, numDataPoints);
+    outStream.close();
+    if (!outStream)
+    {
+        std::cout << std::endl << "Conversion failed: Could not write the output file." << std::endl;
+        return 1;
+    }
+    
+    const double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    const double inBytes = static_cast<double>(boost::filesystem::file_size(inFile));
+    
+    std::printf("\rConverted %d data points in %.2fs (%.0f points/s, %.1f MB/s read, %.1f MB/s written)\n",
+            numDataPoints, elapsed, numDataPoints/elapsed, inBytes/elapsed/1e6, numBytes/elapsed/1e6);
     
     return 0;
 }
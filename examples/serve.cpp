@@ -0,0 +1,569 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <algorithm>
+#include <cerrno>
+#include <signal.h>
+#include <pthread.h>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "libforest/libforest.h"
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace libf;
+
+/**
+ * Prediction daemon for random forests written with RandomForest::write.
+ * Requests are answered either on stdin/stdout or on a UNIX domain socket
+ * where every connection is served by its own thread. The model file is
+ * watched and reloaded when it changes; requests in flight finish with the
+ * model they started with. To replace the model, write the new file next to
+ * it and rename it over the old one.
+ *
+ * Protocol (all integers are int32, all floats are float32, host byte
+ * order):
+ *
+ *  Request:  command
+ *            command = 1 (classify): N D x_1 ... x_N, each x_n has D floats
+ *            command = 2 (stats)
+ *  Response: status
+ *            status = 0, classify: N C p_1 ... p_N, each p_n has C floats
+ *                                  with the normalized posterior p(c | x_n)
+ *            status = 0, stats: L followed by L bytes of text
+ *            status = 1 (error): L followed by L bytes of error message
+ *
+ * Usage:
+ *
+ * $ ./examples/libforest-serve --help
+ * Allowed options:
+ *   --help                        produce help message
+ *   --model arg                   path to the forest
+ *   --socket arg                  path to the UNIX domain socket, if not given
+ *                                 stdin/stdout is used
+ *   --reload-interval arg (=1000) interval in ms in which the model file is
+ *                                 checked for changes
+ *   --profile arg                 write the node visit counts of the current
+ *                                 model as CSV to this file on shutdown
+ */
+
+const static int COMMAND_CLASSIFY = 1;
+const static int COMMAND_STATS = 2;
+
+const static int STATUS_OK = 0;
+const static int STATUS_ERROR = 1;
+
+/**
+ * Upper bounds on the size of a single request.
+ */
+const static int MAX_DIMENSIONALITY = 1 << 24;
+const static int64_t MAX_REQUEST_FLOATS = 1 << 28;
+
+/**
+ * A loaded model together with the information needed to validate requests.
+ */
+struct Model {
+    RandomForest<DecisionTree>::ptr forest;
+    /**
+     * The largest feature index tested by any node
+     */
+    int maxFeature;
+    /**
+     * The number of classes
+     */
+    int numClasses;
+    /**
+     * When the model was loaded
+     */
+    std::chrono::system_clock::time_point loaded;
+};
+
+/**
+ * The current model. Connections take a reference for each request, such
+ * that swapping the model never invalidates requests in flight.
+ */
+static std::shared_ptr<const Model> currentModel;
+static std::mutex modelMutex;
+
+static std::shared_ptr<const Model> getModel()
+{
+    std::lock_guard<std::mutex> lock(modelMutex);
+    return currentModel;
+}
+
+static void setModel(std::shared_ptr<const Model> model)
+{
+    std::lock_guard<std::mutex> lock(modelMutex);
+    currentModel = model;
+}
+
+static LatencyHistogram latencies;
+static std::atomic<int> numReloads(0);
+static std::atomic<bool> terminating(false);
+static bool profiling = false;
+
+static void handleSignal(int)
+{
+    terminating = true;
+}
+
+/**
+ * Blocks the termination signals in the calling thread, such that they 
+ * interrupt the blocking calls of the main thread.
+ */
+static void blockSignals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+}
+
+/**
+ * A client connection that is served by its own thread. The socket is 
+ * closed by the main thread after joining the thread, such that it can be
+ * shut down safely on termination.
+ */
+struct Connection {
+    Connection(int _socket) : socket(_socket), done(false) {}
+    
+    int socket;
+    std::thread thread;
+    std::atomic<bool> done;
+};
+
+/**
+ * Loads a model and checks that the whole file has been consumed.
+ */
+static std::shared_ptr<const Model> loadModel(const std::string & filename) throw(IOException)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    if (!stream)
+    {
+        throw IOException("Could not open model file.");
+    }
+    
+    auto model = std::make_shared<Model>();
+    model->forest = std::make_shared< RandomForest<DecisionTree> >();
+    model->forest->read(stream);
+    
+    if (stream.fail() || stream.peek() != std::ifstream::traits_type::eof())
+    {
+        throw IOException("The model file is incomplete or corrupted.");
+    }
+    if (model->forest->getSize() == 0)
+    {
+        throw IOException("The model does not contain any trees.");
+    }
+    
+    model->maxFeature = -1;
+    model->numClasses = 0;
+    for (int t = 0; t < model->forest->getSize(); t++)
+    {
+        DecisionTree::ptr tree = model->forest->getTree(t);
+        for (int v = 0; v < tree->getNumNodes(); v++)
+        {
+            if (tree->getNodeConfig(v).isLeafNode())
+            {
+                const int C = static_cast<int>(tree->getNodeData(v).histogram.size());
+                if (model->numClasses != 0 && model->numClasses != C)
+                {
+                    throw IOException("The leaf histograms have different sizes.");
+                }
+                model->numClasses = C;
+            }
+            else
+            {
+                model->maxFeature = std::max(model->maxFeature, tree->getNodeConfig(v).getSplitFeature());
+            }
+        }
+    }
+    model->loaded = std::chrono::system_clock::now();
+    
+    if (profiling)
+    {
+        model->forest->enableProfiling();
+    }
+    
+    return model;
+}
+
+/**
+ * Reloads the model whenever the modification time or size of the file
+ * changes. A model that fails to load is ignored and the old one is kept.
+ */
+static void watchModel(const std::string & filename, int interval)
+{
+    blockSignals();
+    
+    boost::filesystem::path path(filename);
+    std::time_t lastModified = boost::filesystem::last_write_time(path);
+    boost::uintmax_t lastSize = boost::filesystem::file_size(path);
+    
+    while (!terminating)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        
+        boost::system::error_code error;
+        const std::time_t modified = boost::filesystem::last_write_time(path, error);
+        const boost::uintmax_t size = boost::filesystem::file_size(path, error);
+        
+        if (error || (modified == lastModified && size == lastSize))
+        {
+            continue;
+        }
+        
+        try
+        {
+            setModel(loadModel(filename));
+            numReloads++;
+            lastModified = modified;
+            lastSize = size;
+            std::cerr << "Reloaded model " << filename << std::endl;
+        }
+        catch (std::exception & e)
+        {
+            // The file may still be written, try again next time
+            std::cerr << "Could not reload model: " << e.what() << std::endl;
+        }
+    }
+}
+
+/**
+ * Reads exactly size bytes. Returns false on end of file.
+ */
+static bool readFully(int fd, void* buffer, size_t size)
+{
+    char* data = static_cast<char*>(buffer);
+    while (size > 0)
+    {
+        const ssize_t count = ::read(fd, data, size);
+        if (count < 0 && errno == EINTR && !terminating)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+/**
+ * Writes exactly size bytes. Returns false on error.
+ */
+static bool writeFully(int fd, const void* buffer, size_t size)
+{
+    const char* data = static_cast<const char*>(buffer);
+    while (size > 0)
+    {
+        const ssize_t count = ::write(fd, data, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+template <class T>
+static void append(std::vector<char> & buffer, const T & value)
+{
+    const char* data = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), data, data + sizeof(T));
+}
+
+static bool writeMessage(int fd, int status, const std::string & message)
+{
+    std::vector<char> buffer;
+    append(buffer, status);
+    append(buffer, static_cast<int>(message.size()));
+    buffer.insert(buffer.end(), message.begin(), message.end());
+    return writeFully(fd, buffer.data(), buffer.size());
+}
+
+/**
+ * Answers a classification request. Returns false if the connection should
+ * be closed.
+ */
+static bool classify(int in, int out)
+{
+    int N, D;
+    if (!readFully(in, &N, sizeof(int)) || !readFully(in, &D, sizeof(int)))
+    {
+        return false;
+    }
+    
+    const auto start = std::chrono::steady_clock::now();
+    
+    if (N < 0 || D < 0 || D > MAX_DIMENSIONALITY || static_cast<int64_t>(N)*D > MAX_REQUEST_FLOATS)
+    {
+        // The request cannot be skipped safely
+        writeMessage(out, STATUS_ERROR, "Invalid request size.");
+        return false;
+    }
+    
+    std::vector<float> data(static_cast<size_t>(N)*D);
+    if (!readFully(in, data.data(), data.size()*sizeof(float)))
+    {
+        return false;
+    }
+    
+    // Use the same model for the whole request
+    std::shared_ptr<const Model> model = getModel();
+    if (D <= model->maxFeature)
+    {
+        return writeMessage(out, STATUS_ERROR, "The data points have too few dimensions for the model.");
+    }
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < N; n++)
+    {
+        storage->addDataPoint(Eigen::Map<const DataPoint>(&data[static_cast<size_t>(n)*D], D));
+    }
+    
+    std::vector< std::vector<float> > probabilities;
+    if (N > 0)
+    {
+        model->forest->classLogPosteriors(storage, probabilities);
+    }
+    
+    const int C = model->numClasses;
+    std::vector<char> buffer;
+    buffer.reserve(3*sizeof(int) + static_cast<size_t>(N)*C*sizeof(float));
+    append(buffer, STATUS_OK);
+    append(buffer, N);
+    append(buffer, C);
+    
+    for (int n = 0; n < N; n++)
+    {
+        // Normalize the summed log posteriors
+        const std::vector<float> & p = probabilities[n];
+        const float max = *std::max_element(p.begin(), p.end());
+        
+        float total = 0;
+        for (int c = 0; c < C; c++)
+        {
+            total += std::exp(p[c] - max);
+        }
+        for (int c = 0; c < C; c++)
+        {
+            append(buffer, std::exp(p[c] - max)/total);
+        }
+    }
+    
+    if (!writeFully(out, buffer.data(), buffer.size()))
+    {
+        return false;
+    }
+    
+    latencies.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    return true;
+}
+
+static std::string getStats()
+{
+    std::shared_ptr<const Model> model = getModel();
+    const std::time_t loaded = std::chrono::system_clock::to_time_t(model->loaded);
+    
+    // std::ctime shares a static buffer between threads
+    std::tm local;
+    char loadedTime[64];
+    localtime_r(&loaded, &local);
+    std::strftime(loadedTime, sizeof(loadedTime), "%a %b %e %H:%M:%S %Y", &local);
+    
+    std::stringstream stream;
+    stream << "trees: " << model->forest->getSize() << std::endl;
+    stream << "classes: " << model->numClasses << std::endl;
+    stream << "reloads: " << numReloads << std::endl;
+    stream << "loaded: " << loadedTime << std::endl;
+    latencies.print(stream);
+    
+    return stream.str();
+}
+
+/**
+ * Serves a single connection until it is closed.
+ */
+static void serve(int in, int out)
+{
+    int command;
+    while (!terminating && readFully(in, &command, sizeof(int)))
+    {
+        bool keepOpen;
+        if (command == COMMAND_CLASSIFY)
+        {
+            keepOpen = classify(in, out);
+        }
+        else if (command == COMMAND_STATS)
+        {
+            keepOpen = writeMessage(out, STATUS_OK, getStats());
+        }
+        else
+        {
+            writeMessage(out, STATUS_ERROR, "Unknown command.");
+            keepOpen = false;
+        }
+        
+        if (!keepOpen)
+        {
+            break;
+        }
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    boost::program_options::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("model", boost::program_options::value<std::string>(), "path to the forest")
+        ("socket", boost::program_options::value<std::string>(), "path to the UNIX domain socket, if not given stdin/stdout is used")
+        ("reload-interval", boost::program_options::value<int>()->default_value(1000), "interval in ms in which the model file is checked for changes")
+        ("profile", boost::program_options::value<std::string>(), "write the node visit counts of the current model as CSV to this file on shutdown");
+    
+    boost::program_options::positional_options_description positionals;
+    positionals.add("model", 1);
+    
+    boost::program_options::variables_map parameters;
+    boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positionals).run(), parameters);
+    boost::program_options::notify(parameters);
+    
+    if (parameters.find("help") != parameters.end() || parameters.find("model") == parameters.end())
+    {
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+    
+    const std::string modelFile = parameters["model"].as<std::string>();
+    profiling = parameters.find("profile") != parameters.end();
+    
+    try
+    {
+        setModel(loadModel(modelFile));
+    }
+    catch (std::exception & e)
+    {
+        std::cerr << "Could not load model: " << e.what() << std::endl;
+        return 1;
+    }
+    
+    // Interrupt blocking calls on termination
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handleSignal;
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
+    signal(SIGPIPE, SIG_IGN);
+    
+    std::thread watcher(watchModel, modelFile, parameters["reload-interval"].as<int>());
+    
+    if (parameters.find("socket") == parameters.end())
+    {
+        serve(STDIN_FILENO, STDOUT_FILENO);
+        terminating = true;
+    }
+    else
+    {
+        const std::string socketFile = parameters["socket"].as<std::string>();
+        
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketFile.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "The socket path is too long." << std::endl;
+            return 1;
+        }
+        std::strcpy(address.sun_path, socketFile.c_str());
+        
+        const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socketFile.c_str());
+        if (server < 0
+                || bind(server, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0
+                || listen(server, 64) < 0)
+        {
+            std::cerr << "Could not listen on " << socketFile << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        
+        std::list< std::unique_ptr<Connection> > connections;
+        while (!terminating)
+        {
+            const int client = accept(server, 0, 0);
+            
+            // Clean up the connections that have been closed
+            for (auto it = connections.begin(); it != connections.end(); )
+            {
+                if ((*it)->done)
+                {
+                    (*it)->thread.join();
+                    close((*it)->socket);
+                    it = connections.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            
+            if (client < 0)
+            {
+                continue;
+            }
+            
+            connections.push_back(std::unique_ptr<Connection>(new Connection(client)));
+            Connection* connection = connections.back().get();
+            connection->thread = std::thread([connection] () {
+                blockSignals();
+                serve(connection->socket, connection->socket);
+                connection->done = true;
+            });
+        }
+        
+        close(server);
+        unlink(socketFile.c_str());
+        
+        // Interrupt the requests in flight and wait for the connections, 
+        // such that no request outlives the model and the statistics
+        for (auto it = connections.begin(); it != connections.end(); ++it)
+        {
+            shutdown((*it)->socket, SHUT_RDWR);
+            (*it)->thread.join();
+            close((*it)->socket);
+        }
+    }
+    
+    watcher.join();
+    latencies.print(std::cerr);
+    
+    if (profiling)
+    {
+        std::ofstream profile(parameters["profile"].as<std::string>());
+        getModel()->forest->writeProfile(profile);
+    }
+    
+    return 0;
+}
@@ -13,6 +13,7 @@
 #include <memory>
 #include <Eigen/Dense>
 #include <type_traits>
+#include <algorithm>
 
 #include "tree.h"
 #include "io.h"
@@ -44,6 +45,14 @@ namespace libf {
          */
         virtual void classLogPosterior(const DataPoint & x, std::vector<float> & probabilities) const = 0;
         
+        /**
+         * Returns the class log posteriors of an entire data set. 
+         * 
+         * @param storage The data points to evaluate
+         * @param probabilities The log posterior probabilities of every point
+         */
+        virtual void classLogPosteriors(AbstractDataStorage::ptr storage, std::vector< std::vector<float> > & probabilities) const;
+        
         /**
          * Reads the classifier from a stream. 
          * 
@@ -180,6 +189,15 @@ namespace libf {
         typedef std::shared_ptr<DecisionTree> ptr;
     };
     
+    /**
+     * This class represents a decision tree with threshold splits on 
+     * numerical features and subset splits on categorical features.
+     */
+    class CategoricalDecisionTree : public AbstractCategoricalSplitTree< AbstractTreeClassifier<CategoricalSplitTreeNodeConfig, TreeClassifierNodeData> > {
+    public:
+        typedef std::shared_ptr<CategoricalDecisionTree> ptr;
+    };
+    
     /**
      * This class represents an online decision tree.
      */
@@ -204,6 +222,72 @@ namespace libf {
         typedef std::shared_ptr<DotProductDecisionTree> ptr;
     };
     
+    /**
+     * The node data of multi-output trees. 
+     */
+    class MultiOutputNodeData : public AbstractNodeData {
+    public:
+        /**
+         * Reads the data from a stream. 
+         * 
+         * @param stream The stream to read the data from
+         */
+        virtual void read(std::istream & stream)
+        {
+            readBinary(stream, histograms);
+        }
+        
+        /**
+         * Writes the data to a stream
+         * 
+         * @param stream The stream to write the data to.
+         */
+        virtual void write(std::ostream & stream) const
+        {
+            writeBinary(stream, histograms);
+        }
+        
+        /**
+         * The log posterior histogram of every output
+         */
+        std::vector< std::vector<float> > histograms;
+    };
+    
+    /**
+     * This class represents a decision tree that predicts several class 
+     * labels at once. All outputs share the tree structure and every leaf 
+     * stores one log posterior per output, such that a single traversal 
+     * yields all predictions. As a plain classifier, the tree predicts the
+     * first output. 
+     */
+    class MultiOutputDecisionTree : public AbstractAxisAlignedSplitTree< AbstractTree<AxisAlignedSplitTreeNodeConfig, MultiOutputNodeData, AbstractClassifier> > {
+    public:
+        typedef std::shared_ptr<MultiOutputDecisionTree> ptr;
+        
+        /**
+         * Returns the class log posterior log(p(c | x)) of the first output.
+         * 
+         * @param x The data point
+         * @param probabilities The vector of log posterior probabilities
+         */
+        void classLogPosterior(const DataPoint & x, std::vector<float> & probabilities) const
+        {
+            probabilities = this->getNodeData(this->findLeafNode(x)).histograms[0];
+        }
+        
+        /**
+         * Returns the class log posteriors of all outputs. The probabilities
+         * are not normalized. 
+         * 
+         * @param x The data point
+         * @param probabilities The log posterior probabilities of every output
+         */
+        void outputLogPosteriors(const DataPoint & x, std::vector< std::vector<float> > & probabilities) const
+        {
+            probabilities = this->getNodeData(this->findLeafNode(x)).histograms;
+        }
+    };
+    
     /**
      * This class implements random forest classifiers.
      */
@@ -242,6 +326,222 @@ namespace libf {
                 }
             }
         }
+        
+        /**
+         * Returns the class log posteriors of an entire data set. The trees 
+         * are evaluated one after another on all points, such that each tree
+         * stays in cache for the whole batch. 
+         * 
+         * @param storage The data points to evaluate
+         * @param probabilities The log posterior probabilities of every point
+         */
+        void classLogPosteriors(AbstractDataStorage::ptr storage, std::vector< std::vector<float> > & probabilities) const
+        {
+            BOOST_ASSERT_MSG(this->getSize() > 0, "Cannot classify a point from an empty ensemble.");
+            
+            const int N = storage->getSize();
+            probabilities.resize(N);
+            
+            std::vector<float> currentHist;
+            for (int i = 0; i < this->getSize(); i++)
+            {
+                const TreeType & tree = *this->getTree(i);
+                
+                for (int n = 0; n < N; n++)
+                {
+                    tree.classLogPosterior(storage->getDataPoint(n), currentHist);
+                    
+                    if (i == 0)
+                    {
+                        probabilities[n] = currentHist;
+                    }
+                    else
+                    {
+                        for (size_t c = 0; c < currentHist.size(); c++)
+                        {
+                            probabilities[n][c] += currentHist[c];
+                        }
+                    }
+                }
+            }
+        }
+        
+        /**
+         * Returns the class log posteriors of all outputs of a forest of 
+         * multi-output trees. Every tree is traversed once for all outputs.
+         * 
+         * @param x The data point
+         * @param probabilities The log posterior probabilities of every output
+         */
+        void outputLogPosteriors(const DataPoint & x, std::vector< std::vector<float> > & probabilities) const
+        {
+            BOOST_ASSERT_MSG(this->getSize() > 0, "Cannot classify a point from an empty ensemble.");
+            
+            for (int i = 0; i < this->getSize(); i++)
+            {
+                const TreeType & tree = *this->getTree(i);
+                const std::vector< std::vector<float> > & hists = tree.getNodeData(tree.findLeafNode(x)).histograms;
+                
+                if (i == 0)
+                {
+                    probabilities = hists;
+                    continue;
+                }
+                
+                for (size_t k = 0; k < hists.size(); k++)
+                {
+                    for (size_t c = 0; c < hists[k].size(); c++)
+                    {
+                        probabilities[k][c] += hists[k][c];
+                    }
+                }
+            }
+        }
+        
+        /**
+         * Assigns a class label per output to a data point using a forest of
+         * multi-output trees. 
+         * 
+         * @param x The data point
+         * @param labels The class label of every output
+         */
+        void classifyOutputs(const DataPoint & x, std::vector<int> & labels) const
+        {
+            std::vector< std::vector<float> > probabilities;
+            outputLogPosteriors(x, probabilities);
+            
+            labels.resize(probabilities.size());
+            for (size_t k = 0; k < probabilities.size(); k++)
+            {
+                labels[k] = static_cast<int>(std::max_element(probabilities[k].begin(), probabilities[k].end()) - probabilities[k].begin());
+            }
+        }
+        
+        /**
+         * Returns the class log posterior of a data point whose features are
+         * computed on demand. Only the features tested on the paths through
+         * the trees are requested. This requires trees with axis aligned 
+         * splits. 
+         * 
+         * @param feature A function object that returns the d-th feature
+         * @param probabilities A vector of log posterior probabilities
+         */
+        template <class FeatureFunction>
+        void classLogPosteriorLazy(const FeatureFunction & feature, std::vector<float> & probabilities) const
+        {
+            BOOST_ASSERT_MSG(this->getSize() > 0, "Cannot classify a point from an empty ensemble.");
+            
+            for (int i = 0; i < this->getSize(); i++)
+            {
+                const TreeType & tree = *this->getTree(i);
+                const std::vector<float> & hist = tree.getNodeData(tree.findLeafNodeLazy(feature)).histogram;
+                
+                if (i == 0)
+                {
+                    probabilities = hist;
+                }
+                else
+                {
+                    for (size_t c = 0; c < hist.size(); c++)
+                    {
+                        probabilities[c] += hist[c];
+                    }
+                }
+            }
+        }
+        
+        /**
+         * Returns the class log posteriors of all data points of a feature 
+         * provider. All points are passed through all trees simultaneously. 
+         * In each round, the features needed by the current nodes are 
+         * collected and fetched with a single batch request; the memo 
+         * ensures that every feature is computed at most once. 
+         * 
+         * @param memo The memo of the feature provider
+         * @param probabilities The log posterior probabilities of every point
+         */
+        void classLogPosteriorLazy(FeatureMemo & memo, std::vector< std::vector<float> > & probabilities) const
+        {
+            BOOST_ASSERT_MSG(this->getSize() > 0, "Cannot classify a point from an empty ensemble.");
+            
+            const int N = memo.getProvider()->getSize();
+            const int T = this->getSize();
+            
+            // The current node of every (point, tree) pair
+            std::vector<int> nodes(N*T, 0);
+            std::vector<int> active(N*T);
+            for (int i = 0; i < N*T; i++)
+            {
+                active[i] = i;
+            }
+            
+            std::vector< std::pair<int, int> > requests;
+            while (active.size() > 0)
+            {
+                // Advance all pairs as far as the known features allow
+                requests.clear();
+                size_t numActive = 0;
+                for (size_t k = 0; k < active.size(); k++)
+                {
+                    const int i = active[k];
+                    const int n = i / T;
+                    const TreeType & tree = *this->getTree(i % T);
+                    
+                    int node = nodes[i];
+                    while (!tree.getNodeConfig(node).isLeafNode())
+                    {
+                        const int d = tree.getNodeConfig(node).getSplitFeature();
+                        if (!memo.isComputed(n, d))
+                        {
+                            requests.push_back(std::make_pair(n, d));
+                            break;
+                        }
+                        
+                        if (memo.get(n, d) < tree.getNodeConfig(node).getThreshold())
+                        {
+                            node = tree.getNodeConfig(node).getLeftChild();
+                        }
+                        else
+                        {
+                            node = tree.getNodeConfig(node).getRightChild();
+                        }
+                    }
+                    nodes[i] = node;
+                    
+                    if (!tree.getNodeConfig(node).isLeafNode())
+                    {
+                        active[numActive++] = i;
+                    }
+                }
+                active.resize(numActive);
+                
+                // Fetch the missing features of this round at once
+                memo.prefetch(requests);
+            }
+            
+            // Accumulate the leaf histograms
+            probabilities.resize(N);
+            for (int n = 0; n < N; n++)
+            {
+                for (int t = 0; t < T; t++)
+                {
+                    const TreeType & tree = *this->getTree(t);
+                    const std::vector<float> & hist = tree.getNodeData(tree.profileLeaf(nodes[n*T + t])).histogram;
+                    
+                    if (t == 0)
+                    {
+                        probabilities[n] = hist;
+                    }
+                    else
+                    {
+                        for (size_t c = 0; c < hist.size(); c++)
+                        {
+                            probabilities[n][c] += hist[c];
+                        }
+                    }
+                }
+            }
+        }
     };
     
     /**
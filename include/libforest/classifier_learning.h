@@ -23,11 +23,33 @@ namespace libf {
      */
     class AbstractTreeClassifierLearner : public AbstractTreeLearner {
     public:
+        /**
+         * Each tree is learned on the complete training set (or bootstrap 
+         * sample).
+         */
+        const static int SUBSAMPLING_NONE = 0;
+        /**
+         * Each tree is learned on a uniform subsample drawn without 
+         * replacement.
+         */
+        const static int SUBSAMPLING_UNIFORM = 1;
+        /**
+         * Each tree is learned on a subsample drawn without replacement that
+         * preserves the class proportions.
+         */
+        const static int SUBSAMPLING_STRATIFIED = 2;
+        /**
+         * Each tree is learned on a subsample drawn without replacement that
+         * contains the same number of points per class (if available).
+         */
+        const static int SUBSAMPLING_BALANCED = 3;
         
         AbstractTreeClassifierLearner() : 
                 smoothingParameter(1),
                 useBootstrap(false),
-                numBootstrapExamples(-1) {}
+                numBootstrapExamples(-1),
+                subsamplingMethod(SUBSAMPLING_NONE),
+                numSubsamplingExamples(-1) {}
         
        /**
          * Sets the smoothing parameter. The smoothing parameter is the value 
@@ -72,7 +94,8 @@ namespace libf {
         }
         
         /**
-         * Sets the number of samples to use for bootstrapping.
+         * Sets the number of samples to use for bootstrapping. If negative,
+         * the total weight of the training set is used. 
          * 
          * @param _numBootstrapExamples The number of bootstrap samples
          */
@@ -91,7 +114,76 @@ namespace libf {
             return numBootstrapExamples;
         }
         
+        /**
+         * Sets the subsampling method. If subsampling is used, every tree is
+         * learned on a random subset of the training data that is drawn 
+         * without replacement. Leaf histograms are computed on this subset. 
+         * Bootstrapping (if enabled) is then performed on the subset. 
+         * 
+         * @param _subsamplingMethod The subsampling method
+         */
+        void setSubsamplingMethod(int _subsamplingMethod)
+        {
+            BOOST_ASSERT_MSG(SUBSAMPLING_NONE <= _subsamplingMethod && _subsamplingMethod <= SUBSAMPLING_BALANCED, "Invalid subsampling method.");
+            subsamplingMethod = _subsamplingMethod;
+        }
+        
+        /**
+         * Returns the subsampling method.
+         * 
+         * @return The subsampling method
+         */
+        int getSubsamplingMethod() const
+        {
+            return subsamplingMethod;
+        }
+        
+        /**
+         * Sets the number of examples per tree when subsampling.
+         * 
+         * @param _numSubsamplingExamples The number of examples per tree
+         */
+        void setNumSubsamplingExamples(int _numSubsamplingExamples)
+        {
+            numSubsamplingExamples = _numSubsamplingExamples;
+        }
+        
+        /**
+         * Returns the number of examples per tree when subsampling.
+         * 
+         * @return The number of examples per tree
+         */
+        int getNumSubsamplingExamples() const
+        {
+            return numSubsamplingExamples;
+        }
+        
+        /**
+         * Prepares learning several trees on the same training set. For 
+         * stratified and balanced subsampling, the points are grouped by 
+         * class once instead of for every tree. The grouping is used by all
+         * calls to learn with this storage until releaseSubsampling is 
+         * called. 
+         * 
+         * @param storage The training set
+         */
+        virtual void prepareSubsampling(AbstractDataStorage::ptr storage);
+        
+        /**
+         * Releases the data computed by prepareSubsampling. 
+         */
+        void releaseSubsampling();
+        
     protected:
+        /**
+         * Draws the training subset for a single tree according to the 
+         * subsampling method. 
+         * 
+         * @param storage The complete training set
+         * @return The subset to learn the tree on
+         */
+        AbstractDataStorage::ptr subsample(AbstractDataStorage::ptr storage) const;
+        
         /**
          * The smoothing parameter for the histograms
          */
@@ -104,6 +196,22 @@ namespace libf {
          * The number of bootstrap examples that shall be used.
          */
         int numBootstrapExamples;
+        /**
+         * The subsampling method
+         */
+        int subsamplingMethod;
+        /**
+         * The number of examples per tree when subsampling.
+         */
+        int numSubsamplingExamples;
+        /**
+         * The training set grouped by class (see prepareSubsampling)
+         */
+        ClassIndex::ptr classIndex;
+        /**
+         * The training set the class index belongs to
+         */
+        AbstractDataStorage::ptr classIndexStorage;
     };
     
     /**
@@ -115,7 +223,70 @@ namespace libf {
             public OfflineLearnerInterface<DecisionTree> {
     public:
         
-        DecisionTreeLearner() : AbstractTreeClassifierLearner() {}
+        DecisionTreeLearner() : 
+                AbstractTreeClassifierLearner(),
+                maxSplitExamples(-1),
+                useLevelWiseTraining(false) {}
+        
+        /**
+         * Sets the maximum number of examples the split of a node is chosen
+         * on. At nodes with more examples, the split is chosen on a random 
+         * subset of this size and all examples are then partitioned with the
+         * chosen split. This avoids sorting millions of examples per feature
+         * at the top levels of the tree, where a subset gives nearly the same
+         * split. The leaf histograms are still computed on all examples. A 
+         * negative value disables this.
+         * 
+         * @param _maxSplitExamples The maximum number of examples per split
+         */
+        void setMaxSplitExamples(int _maxSplitExamples)
+        {
+            maxSplitExamples = _maxSplitExamples;
+        }
+        
+        /**
+         * Returns the maximum number of examples the split of a node is 
+         * chosen on.
+         * 
+         * @return The maximum number of examples per split
+         */
+        int getMaxSplitExamples() const
+        {
+            return maxSplitExamples;
+        }
+        
+        /**
+         * Sets whether the tree is grown level by level. Instead of sorting 
+         * the examples of every node separately, each feature column of the
+         * data set is sorted once and every level scans the columns sampled 
+         * by its nodes once, in sorted order, for all nodes at the same time.
+         * The memory accesses are then sequential over whole columns. 
+         * 
+         * Memory: The sorted columns take 4 bytes per example and used 
+         * feature. They are sorted on the base data set (see 
+         * AbstractDataStorage::getBaseStorage) and shared by all trees that
+         * are learned at the same time, e.g. by the threads of a 
+         * RandomForestLearner, and released once no tree is learned anymore.
+         * Every tree additionally needs 8 bytes per training example and 4
+         * bytes per example of the base data set. The maximum 
+         * number of split examples is ignored in this mode.
+         * 
+         * @param _useLevelWiseTraining If true, the tree is grown level-wise
+         */
+        void setUseLevelWiseTraining(bool _useLevelWiseTraining)
+        {
+            useLevelWiseTraining = _useLevelWiseTraining;
+        }
+        
+        /**
+         * Returns whether the tree is grown level by level.
+         * 
+         * @return True if the tree is grown level-wise
+         */
+        bool getUseLevelWiseTraining() const
+        {
+            return useLevelWiseTraining;
+        }
         
         /**
          * Learns a decision tree on a data set.
@@ -138,6 +309,176 @@ namespace libf {
             State state;
             return this->learn(storage, state);
         }
+        
+    private:
+        /**
+         * Grows a tree level by level.
+         * 
+         * @param storage The training set
+         * @param numFeatures The number of features sampled per node
+         * @param state The learning state
+         * @return The learned tree
+         */
+        DecisionTree::ptr learnLevelWise(AbstractDataStorage::ptr storage, int numFeatures, State & state);
+        
+        /**
+         * The sorted feature columns of a base data set
+         */
+        struct PresortedColumns;
+        
+        /**
+         * The maximum number of examples the split of a node is chosen on
+         */
+        int maxSplitExamples;
+        /**
+         * Whether the tree is grown level by level
+         */
+        bool useLevelWiseTraining;
+        /**
+         * The sorted columns used by the trees that are currently learned 
+         * level-wise
+         */
+        std::shared_ptr<PresortedColumns> presortedColumns;
+    };
+    
+    /**
+     * This is a decision tree learner for data sets with categorical 
+     * features. Categorical features must be encoded as integers in 
+     * [0, K-1]. For these features, the best subset split is found by sorting
+     * the categories by their class rate and evaluating the K-1 ordered 
+     * partitions. This is optimal for binary problems and a good heuristic
+     * otherwise (the rate of the majority class is used). All other features
+     * are split by thresholds as in DecisionTreeLearner. 
+     */
+    class CategoricalDecisionTreeLearner : 
+            public AbstractTreeClassifierLearner, 
+            public OfflineLearnerInterface<CategoricalDecisionTree> {
+    public:
+        
+        CategoricalDecisionTreeLearner() : AbstractTreeClassifierLearner() {}
+        
+        /**
+         * Sets the number of categories for every feature. A value of 0 
+         * indicates a numerical feature. Features not listed are numerical.
+         * 
+         * @param _numCategories The number of categories per feature
+         */
+        void setNumCategories(const std::vector<int> & _numCategories)
+        {
+            numCategories = _numCategories;
+        }
+        
+        /**
+         * Returns the number of categories per feature. 
+         * 
+         * @return The number of categories per feature
+         */
+        const std::vector<int> & getNumCategories() const
+        {
+            return numCategories;
+        }
+        
+        /**
+         * Learns a decision tree on a data set.
+         * 
+         * @param storage The training set
+         * @param state The learning state
+         * @return The learned tree
+         */
+        virtual CategoricalDecisionTree::ptr learn(AbstractDataStorage::ptr storage, State & state);
+        
+        /**
+         * Learns a decision tree on a data set.
+         * 
+         * @param storage The training set
+         * @return The learned tree
+         */
+        virtual CategoricalDecisionTree::ptr learn(AbstractDataStorage::ptr storage)
+        {
+            // Just create a state and don't do anything with it
+            State state;
+            return this->learn(storage, state);
+        }
+        
+    private:
+        /**
+         * The number of categories per feature (0 = numerical)
+         */
+        std::vector<int> numCategories;
+    };
+    
+    /**
+     * This learns decision trees that predict several class labels at once.
+     * The labels are taken from a label matrix; the class labels of the 
+     * data storage are not used. The split objective is the sum of the 
+     * entropies of all outputs, such that all outputs share one tree 
+     * structure, and every leaf stores one log posterior per output. 
+     * Stratified and balanced subsampling are not supported, as they 
+     * depend on the class labels of the storage. 
+     */
+    class MultiOutputDecisionTreeLearner : 
+            public AbstractTreeClassifierLearner, 
+            public OfflineLearnerInterface<MultiOutputDecisionTree> {
+    public:
+        
+        MultiOutputDecisionTreeLearner() : AbstractTreeClassifierLearner() {}
+        
+        /**
+         * Sets the labels. The rows of the matrix correspond to the points
+         * of the base storage of the training set. 
+         * 
+         * @param _labels The label matrix
+         */
+        void setLabels(LabelMatrix::ptr _labels)
+        {
+            labels = _labels;
+        }
+        
+        /**
+         * Returns the labels.
+         * 
+         * @return The label matrix
+         */
+        LabelMatrix::ptr getLabels() const
+        {
+            return labels;
+        }
+        
+        /**
+         * Throws a ConfigurationException for stratified and balanced 
+         * subsampling. 
+         * 
+         * @param storage The training set
+         */
+        virtual void prepareSubsampling(AbstractDataStorage::ptr storage);
+        
+        /**
+         * Learns a multi-output decision tree on a data set.
+         * 
+         * @param storage The training set
+         * @param state The learning state
+         * @return The learned tree
+         */
+        virtual MultiOutputDecisionTree::ptr learn(AbstractDataStorage::ptr storage, State & state);
+        
+        /**
+         * Learns a multi-output decision tree on a data set.
+         * 
+         * @param storage The training set
+         * @return The learned tree
+         */
+        virtual MultiOutputDecisionTree::ptr learn(AbstractDataStorage::ptr storage)
+        {
+            // Just create a state and don't do anything with it
+            State state;
+            return this->learn(storage, state);
+        }
+        
+    private:
+        /**
+         * The labels of all outputs
+         */
+        LabelMatrix::ptr labels;
     };
     
     /**
@@ -431,6 +772,9 @@ namespace libf {
             
             // Set up the empty random forest
             auto forest = ForestFactory< RandomForest<typename L::HypothesisType> >::create();
+            
+            // Compute what the subsampling of all trees needs only once
+            treeLearner.prepareSubsampling(storage);
 
             #pragma omp parallel for num_threads(this->numThreads)
             for (int i = 0; i < this->getNumTrees(); i++)
@@ -455,6 +799,8 @@ namespace libf {
                 }
             }
             
+            treeLearner.releaseSubsampling();
+            
             state.terminated = true;
             
             return forest;
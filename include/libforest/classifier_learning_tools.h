@@ -2,6 +2,9 @@
 #define LIBF_CLASSIFIER_LEARNING_TOOLS_H
 
 #include "classifier.h"
+#include "error_handling.h"
+#include "io.h"
+#include <cmath>
 
 namespace libf {
 
@@ -46,7 +49,7 @@ namespace libf {
             for (int n = 0; n < storage->getSize(); n++)
             {
                 int leafNode = tree->findLeafNode(storage->getDataPoint(n));
-                tree->getNodeData(leafNode).histogram[storage->getClassLabel(n)] += 1;
+                tree->getNodeData(leafNode).histogram[storage->getClassLabel(n)] += storage->getWeight(n);
             }
 
             // Normalize the histograms
@@ -68,6 +71,291 @@ namespace libf {
             }
         }
     };
+    
+    /**
+     * Refits the leaf posteriors of a random forest on newly labeled data
+     * without changing the tree structure. The raw, weighted class counts of
+     * all leaves are kept alongside the log posteriors of the trees. Batches
+     * are pushed through each tree in turn and added to the counts, after
+     * which refit() derives the smoothed log posteriors from the counts
+     * again. This costs a fraction of learning a new forest.
+     * 
+     * The counts start at zero, or are seeded with the training data to 
+     * refine the posteriors of the forest. They are not part of the forest. 
+     * Use read() and write() to keep them next to a model that is refitted 
+     * repeatedly.
+     */
+    template <class TreeType>
+    class LeafRefitter {
+    public:
+        typedef std::shared_ptr< LeafRefitter<TreeType> > ptr;
+        
+        /**
+         * Creates a refitter with zero counts.
+         * 
+         * @param _forest The forest whose leaves are refitted
+         * @param _numClasses The number of classes
+         */
+        LeafRefitter(typename RandomForest<TreeType>::ptr _forest, int _numClasses) : 
+                forest(_forest),
+                numClasses(_numClasses),
+                smoothingParameter(1),
+                numThreads(1)
+        {
+            BOOST_ASSERT_MSG(numClasses > 0, "The number of classes must be positive.");
+            reset();
+        }
+        
+        /**
+         * Creates a refitter whose counts are seeded with the training data,
+         * such that later batches refine the posteriors of the forest instead
+         * of replacing them. Every tree counts all training data points, not
+         * only its own bootstrap sample. The number of classes is taken from
+         * the training data.
+         * 
+         * @param _forest The forest whose leaves are refitted
+         * @param trainingStorage The data points the forest was learned on
+         */
+        LeafRefitter(typename RandomForest<TreeType>::ptr _forest, AbstractDataStorage::ptr trainingStorage) : 
+                forest(_forest),
+                numClasses(trainingStorage->getClasscount()),
+                smoothingParameter(1),
+                numThreads(1)
+        {
+            BOOST_ASSERT_MSG(numClasses > 0, "The number of classes must be positive.");
+            reset();
+            update(trainingStorage);
+        }
+        
+        /**
+         * Sets the smoothing parameter. It is added to each count when the
+         * posteriors are derived.
+         * 
+         * @param _smoothingParameter The smoothing parameter
+         */
+        void setSmoothingParameter(float _smoothingParameter)
+        {
+            smoothingParameter = _smoothingParameter;
+        }
+        
+        /**
+         * Returns the smoothing parameter.
+         * 
+         * @return The smoothing parameter
+         */
+        float getSmoothingParameter() const
+        {
+            return smoothingParameter;
+        }
+        
+        /**
+         * Sets the number of threads. The trees are distributed over the 
+         * threads.
+         * 
+         * @param _numThreads The number of threads
+         */
+        void setNumThreads(int _numThreads) throw(ConfigurationException)
+        {
+#ifndef LIBF_ENABLE_OPENMP
+            if (_numThreads != 1)
+            {
+                throw ConfigurationException("OpenMP support is disabled. Set number of threads to 1.");
+            }
+#endif
+            BOOST_ASSERT_MSG(_numThreads > 0, "The number of threads must be positive.");
+            numThreads = _numThreads;
+        }
+        
+        /**
+         * Returns the number of threads.
+         * 
+         * @return The number of threads
+         */
+        int getNumThreads() const
+        {
+            return numThreads;
+        }
+        
+        /**
+         * Sets all counts to zero.
+         */
+        void reset()
+        {
+            const int T = forest->getSize();
+            counts.resize(T);
+            
+            for (int t = 0; t < T; t++)
+            {
+                counts[t].assign(forest->getTree(t)->getNumNodes()*numClasses, 0);
+            }
+        }
+        
+        /**
+         * Adds a batch of labeled data points to the counts. 
+         * 
+         * @param storage The labeled data points
+         */
+        void update(AbstractDataStorage::ptr storage)
+        {
+            const int T = forest->getSize();
+            const int N = storage->getSize();
+            
+            BOOST_ASSERT_MSG(static_cast<int>(counts.size()) == T, "The forest has changed since the counts were set up.");
+            
+            // Every tree only touches its own counts. The batch is pushed 
+            // through one tree at a time such that the tree stays in cache.
+            #pragma omp parallel for num_threads(numThreads)
+            for (int t = 0; t < T; t++)
+            {
+                const TreeType & tree = *forest->getTree(t);
+                float* treeCounts = counts[t].data();
+                
+                for (int n = 0; n < N; n++)
+                {
+                    const int label = storage->getClassLabel(n);
+                    BOOST_ASSERT_MSG(0 <= label && label < numClasses, "Invalid class label.");
+                    
+                    const int leaf = tree.findLeafNode(storage->getDataPoint(n));
+                    treeCounts[leaf*numClasses + label] += storage->getWeight(n);
+                }
+            }
+        }
+        
+        /**
+         * Multiplies all counts by a factor. Decaying the counts before
+         * adding a batch lets old data fade out.
+         * 
+         * @param factor The factor in [0, 1]
+         */
+        void decay(float factor)
+        {
+            BOOST_ASSERT_MSG(0 <= factor && factor <= 1, "The decay factor must be in [0, 1].");
+            
+            for (size_t t = 0; t < counts.size(); t++)
+            {
+                for (size_t i = 0; i < counts[t].size(); i++)
+                {
+                    counts[t][i] *= factor;
+                }
+            }
+        }
+        
+        /**
+         * Derives the smoothed log posteriors of all leaves from the counts.
+         * The histograms are overwritten in place, refit a copy of a forest
+         * that is being used for classification.
+         */
+        void refit()
+        {
+            const int T = forest->getSize();
+            const int C = numClasses;
+            
+            BOOST_ASSERT_MSG(static_cast<int>(counts.size()) == T, "The forest has changed since the counts were set up.");
+            
+            #pragma omp parallel for num_threads(numThreads)
+            for (int t = 0; t < T; t++)
+            {
+                TreeType & tree = *forest->getTree(t);
+                
+                for (int v = 0; v < tree.getNumNodes(); v++)
+                {
+                    if (!tree.getNodeConfig(v).isLeafNode())
+                    {
+                        continue;
+                    }
+                    
+                    const float* count = &counts[t][v*C];
+                    std::vector<float> & hist = tree.getNodeData(v).histogram;
+                    hist.resize(C);
+                    
+                    float total = 0;
+                    for (int c = 0; c < C; c++)
+                    {
+                        total += count[c];
+                    }
+                    for (int c = 0; c < C; c++)
+                    {
+                        hist[c] = std::log((count[c] + smoothingParameter)/(total + C*smoothingParameter));
+                    }
+                }
+            }
+        }
+        
+        /**
+         * Returns the count of a class at a node.
+         * 
+         * @param tree The tree index
+         * @param node The node index
+         * @param c The class label
+         * @return The weighted number of data points
+         */
+        float getCount(int tree, int node, int c) const
+        {
+            return counts[tree][node*numClasses + c];
+        }
+        
+        /**
+         * Reads the counts from a stream. The counts must have been written 
+         * for the same forest and number of classes. 
+         * 
+         * @param stream The stream to read from
+         */
+        void read(std::istream & stream) throw(IOException)
+        {
+            std::vector< std::vector<float> > newCounts;
+            readBinary(stream, newCounts);
+            
+            if (!stream)
+            {
+                throw IOException("Could not read the leaf counts.");
+            }
+            if (static_cast<int>(newCounts.size()) != forest->getSize())
+            {
+                throw IOException("The leaf counts do not match the number of trees.");
+            }
+            for (int t = 0; t < forest->getSize(); t++)
+            {
+                if (static_cast<int>(newCounts[t].size()) != forest->getTree(t)->getNumNodes()*numClasses)
+                {
+                    throw IOException("The leaf counts do not match the tree size and number of classes.");
+                }
+            }
+            
+            counts.swap(newCounts);
+        }
+        
+        /**
+         * Writes the counts to a stream.
+         * 
+         * @param stream The stream to write to
+         */
+        void write(std::ostream & stream) const
+        {
+            writeBinary(stream, counts);
+        }
+        
+    private:
+        /**
+         * The forest
+         */
+        typename RandomForest<TreeType>::ptr forest;
+        /**
+         * The number of classes
+         */
+        int numClasses;
+        /**
+         * The smoothing parameter
+         */
+        float smoothingParameter;
+        /**
+         * The number of threads
+         */
+        int numThreads;
+        /**
+         * The class counts of every tree, node-major
+         */
+        std::vector< std::vector<float> > counts;
+    };
 }
 
 #endif
\ No newline at end of file
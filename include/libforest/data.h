@@ -4,13 +4,16 @@
 #include <vector>
 #include <utility>
 #include <map>
+#include <unordered_map>
 #include <cassert>
 #include <string>
 #include <iostream>
 #include <Eigen/Dense>
 #include <memory>
 #include <functional>
+#include <algorithm>
 #include "error_handling.h"
+#include "memory.h"
 
 namespace libf {
     /**
@@ -18,6 +21,7 @@ namespace libf {
      */
     class DataStorage;
     class ReferenceDataStorage;
+    class ClassIndex;
     
     /**
      * We use eigen3 vectors for data points. This allows us to build quickly
@@ -155,6 +159,31 @@ namespace libf {
          */
         virtual int getClasscount() const = 0;
         
+        /**
+         * Returns the weight of the i-th data point. The weight is the number
+         * of identical examples the data point stands for (see 
+         * DeduplicateTool). 
+         * 
+         * @param i The data point index
+         * @return The weight of the i-th data point
+         */
+        virtual int getWeight(int i) const = 0;
+        
+        /**
+         * Returns true if any data point has a weight other than 1.
+         * 
+         * @return True if the storage is weighted
+         */
+        virtual bool isWeighted() const = 0;
+        
+        /**
+         * Returns the sum of the weights of all data points, i.e. the number
+         * of examples the storage stands for. 
+         * 
+         * @return The total weight
+         */
+        int getTotalWeight() const;
+        
         /**
          * Returns the i-th vector from the storage
          * 
@@ -170,6 +199,23 @@ namespace libf {
          */
         virtual void removeDataPoint(int i) = 0;
         
+        /**
+         * Removes several vectors from the storage in a single pass. The 
+         * remaining points keep their relative order. 
+         * 
+         * @param indices The indices of the data points to delete
+         */
+        virtual void removeDataPoints(const std::vector<int> & indices) = 0;
+        
+        /**
+         * Removes the i-th vector from the storage in constant time by 
+         * replacing it with the last vector. This changes the order of the 
+         * data points. 
+         * 
+         * @param i The index of the data point to delete
+         */
+        virtual void swapRemoveDataPoint(int i) = 0;
+        
         /**
          * Returns the number of data points. 
          * 
@@ -177,6 +223,24 @@ namespace libf {
          */
         virtual int getSize() const = 0;
         
+        /**
+         * Returns the storage that actually holds the data points. For 
+         * reference storages, this is the underlying data storage.
+         * 
+         * @return The storage holding the data points
+         * @internal
+         */
+        virtual std::shared_ptr<const DataStorage> getBaseStorage() const = 0;
+        
+        /**
+         * Returns the index of the i-th data point in the base storage. 
+         * 
+         * @param i The index of the data point in this storage
+         * @return The index of the data point in the base storage
+         * @internal
+         */
+        virtual int getBaseIndex(int i) const = 0;
+        
         /**
          * Returns the dimensionality of the data storage. 
          * 
@@ -201,14 +265,57 @@ namespace libf {
         std::shared_ptr<ReferenceDataStorage> excerpt(int begin, int end) const;
         
         /**
-         * Bootstrap-samples the data storage. 
+         * Bootstrap-samples the data storage. Every data point is drawn with
+         * probability proportional to its weight, i.e. sampling a weighted
+         * storage is equivalent to sampling the examples it stands for. For 
+         * weighted storages, a point that is drawn several times is added 
+         * once with the number of draws as weight. 
          * 
-         * @param N The number of data points to sample
+         * @param N The number of examples to sample
          * @param sampled Array of flags. sampled[i] == true <=> point i was sampled
          * @param referenceStorage The shallow storage to put the data points in
          */
         std::shared_ptr<ReferenceDataStorage> bootstrap(int N, std::vector<bool> & sampled) const;
         
+        /**
+         * Samples N distinct examples (without replacement). This takes 
+         * O(N log N) time, independent of the size of the storage. A weighted storage
+         * is sampled as the examples it stands for, which takes O(N + M) 
+         * time for M data points; every sampled data point is weighted by 
+         * the number of its examples that were sampled. 
+         * 
+         * @param N The number of examples to sample (at most the total weight)
+         * @return A data storage with the sampled points
+         */
+        std::shared_ptr<ReferenceDataStorage> subsample(int N) const;
+        
+        /**
+         * Samples N distinct data points (without replacement) per class. If 
+         * balanced is false, the class proportions of this storage are 
+         * preserved. Otherwise, every class contributes the same number of 
+         * points as far as possible: Points that small classes cannot 
+         * contribute are drawn from the larger classes. Unlabeled points are
+         * not sampled. As for subsample, weighted storages are sampled as the
+         * examples they stand for. 
+         * 
+         * @param N The total number of data points to sample
+         * @param balanced Whether to sample the same number of points per class
+         * @return A data storage with the sampled points
+         */
+        std::shared_ptr<ReferenceDataStorage> stratifiedSubsample(int N, bool balanced) const;
+        
+        /**
+         * Same as stratifiedSubsample(N, balanced), but uses a precomputed 
+         * grouping of the points by class. Drawing M points then takes 
+         * O(C + M log M) time for C classes instead of O(size). 
+         * 
+         * @param N The total number of data points to sample
+         * @param balanced Whether to sample the same number of points per class
+         * @param classIndex The points of this storage grouped by class
+         * @return A data storage with the sampled points
+         */
+        std::shared_ptr<ReferenceDataStorage> stratifiedSubsample(int N, bool balanced, const ClassIndex & classIndex) const;
+        
         /**
          * Permutes the data points according to some permutation. Please 
          * notice that this will also change reference data storage that depend
@@ -295,6 +402,8 @@ namespace libf {
         {
             dataPoints = other.dataPoints;
             classcount = other.classcount;
+            classLabels = other.classLabels;
+            weights = other.weights;
         }
         
         /**
@@ -334,6 +443,51 @@ namespace libf {
             return classcount;
         }
         
+        /**
+         * Returns the weight of the i-th data point. 
+         * 
+         * @param i The data point index
+         * @return The weight of the i-th data point
+         */
+        int getWeight(int i) const
+        {
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "Data point index out of bounds.");
+            return weights.size() > 0 ? weights[i] : 1;
+        }
+        
+        /**
+         * Sets the weight of the i-th data point. 
+         * 
+         * @param i The data point index
+         * @param weight The new weight (positive)
+         */
+        void setWeight(int i, int weight)
+        {
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "Data point index out of bounds.");
+            BOOST_ASSERT_MSG(weight > 0, "Weights must be positive.");
+            
+            // The weights are only stored once a weight differs from 1
+            if (weights.size() == 0)
+            {
+                if (weight == 1)
+                {
+                    return;
+                }
+                weights.resize(getSize(), 1);
+            }
+            weights[i] = weight;
+        }
+        
+        /**
+         * Returns true if any data point has a weight other than 1.
+         * 
+         * @return True if the storage is weighted
+         */
+        bool isWeighted() const
+        {
+            return weights.size() > 0;
+        }
+        
         /**
          * Returns the i-th vector from the storage
          * 
@@ -371,6 +525,30 @@ namespace libf {
             return dataPoints.size();
         }
         
+        /**
+         * Returns the storage that actually holds the data points, i.e. this
+         * storage.
+         * 
+         * @return This storage
+         * @internal
+         */
+        std::shared_ptr<const DataStorage> getBaseStorage() const
+        {
+            return std::static_pointer_cast<const DataStorage>(shared_from_this());
+        }
+        
+        /**
+         * Returns the index of the i-th data point in the base storage. 
+         * 
+         * @param i The index of the data point in this storage
+         * @return i
+         * @internal
+         */
+        int getBaseIndex(int i) const
+        {
+            return i;
+        }
+        
         /**
          * Add a single data point without a label.
          * 
@@ -383,6 +561,10 @@ namespace libf {
             
             dataPoints.push_back(point);
             classLabels.push_back(LIBF_NO_LABEL);
+            if (weights.size() > 0)
+            {
+                weights.push_back(1);
+            }
         }
         
         /**
@@ -399,12 +581,29 @@ namespace libf {
             
             dataPoints.push_back(point);
             classLabels.push_back(label);
+            if (weights.size() > 0)
+            {
+                weights.push_back(1);
+            }
             if (label >= classcount)
             {
                 classcount = label + 1;
             }
         }
         
+        /**
+         * Adds a single data point with a label and a weight. 
+         * 
+         * @param point The point to add to the storage
+         * @param label The class label of the point
+         * @param weight The weight of the point
+         */
+        void addDataPoint(const DataPoint & point, int label, int weight)
+        {
+            addDataPoint(point, label);
+            setWeight(getSize() - 1, weight);
+        }
+        
         /**
          * Removes the i-th vector from the storage
          * 
@@ -416,6 +615,39 @@ namespace libf {
             BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
             dataPoints.erase(dataPoints.begin() + i);
             classLabels.erase(classLabels.begin() + i);
+            if (weights.size() > 0)
+            {
+                weights.erase(weights.begin() + i);
+            }
+        }
+        
+        /**
+         * Removes several vectors from the storage in a single pass. The 
+         * remaining points keep their relative order. 
+         * 
+         * @param indices The indices of the data points to delete
+         */
+        void removeDataPoints(const std::vector<int> & indices);
+        
+        /**
+         * Removes the i-th vector from the storage in constant time by 
+         * replacing it with the last vector. This changes the order of the 
+         * data points. 
+         * 
+         * @param i The index of the data point to delete
+         */
+        void swapRemoveDataPoint(int i)
+        {
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
+            std::swap(dataPoints[i], dataPoints.back());
+            dataPoints.pop_back();
+            classLabels[i] = classLabels.back();
+            classLabels.pop_back();
+            if (weights.size() > 0)
+            {
+                weights[i] = weights.back();
+                weights.pop_back();
+            }
         }
         
         /**
@@ -425,6 +657,16 @@ namespace libf {
          */
         void addDataPoints(AbstractDataStorage::ptr storage);
         
+        /**
+         * Moves all data points from the given storage to this one without
+         * copying them. If this storage is empty, it takes over the contents
+         * of the given storage. The given storage is empty afterwards, so 
+         * reference storages on it must not be used anymore. 
+         * 
+         * @param storage the storage to move data points from
+         */
+        void moveDataPoints(DataStorage & storage);
+        
         /**
          * Permutes the data points according to some permutation. Please 
          * notice that this will also change reference data storage that depend
@@ -479,6 +721,10 @@ namespace libf {
          * These are the corresponding class labels to the data points
          */
         std::vector<int> classLabels;
+        /**
+         * The weights of the data points. This is empty if all weights are 1.
+         */
+        std::vector<int> weights;
     };
     
     /**
@@ -487,6 +733,13 @@ namespace libf {
      * bootstrap sampling. Obviously, this one only works as long as the other
      * storage is still alive. 
      * 
+     * Reference storages are always flat: If the given storage is itself a
+     * reference storage, the indices are composed when points are added. 
+     * Thus, every access is a single index lookup into the base data storage
+     * no matter how the view was built. Only the base storage is kept alive;
+     * a reference storage given to the constructor must stay alive as long
+     * as points are added by its indices.
+     * 
      * This should only be used by library developers. 
      * 
      * @internal
@@ -495,7 +748,15 @@ namespace libf {
     public:
         typedef std::shared_ptr<ReferenceDataStorage> ptr;
         
-        ReferenceDataStorage(AbstractDataStorage::const_ptr dataStorage) : dataStorage(dataStorage) {}
+        ReferenceDataStorage(AbstractDataStorage::const_ptr storage) : 
+                dataStorage(storage->getBaseStorage()), 
+                hasParentView(storage.get() != dataStorage.get())
+        {
+            if (hasParentView)
+            {
+                parentView = storage;
+            }
+        }
         
         /**
          * Returns the i-th class label. 
@@ -506,7 +767,7 @@ namespace libf {
         int getClassLabel(int i) const
         {
             BOOST_ASSERT_MSG(0 <= i && i < getSize(), "Data point index out of bounds.");
-            return dataStorage->getClassLabel(dataPointIndices[i]);
+            return dataStorage->DataStorage::getClassLabel(dataPointIndices[i]);
         }
         
         /**
@@ -519,6 +780,28 @@ namespace libf {
             return dataStorage->getClasscount();
         }
         
+        /**
+         * Returns the weight of the i-th data point. 
+         * 
+         * @param i The data point index
+         * @return The weight of the i-th data point
+         */
+        int getWeight(int i) const
+        {
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "Data point index out of bounds.");
+            return weights.size() > 0 ? weights[i] : dataStorage->DataStorage::getWeight(dataPointIndices[i]);
+        }
+        
+        /**
+         * Returns true if any data point has a weight other than 1.
+         * 
+         * @return True if the storage is weighted
+         */
+        bool isWeighted() const
+        {
+            return weights.size() > 0 || dataStorage->isWeighted();
+        }
+        
         /**
          * Returns the i-th vector from the storage
          * 
@@ -528,7 +811,7 @@ namespace libf {
         const DataPoint & getDataPoint(int i) const
         {
             BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
-            return dataStorage->getDataPoint(dataPointIndices[i]);
+            return dataStorage->DataStorage::getDataPoint(dataPointIndices[i]);
         }
         
         /**
@@ -541,6 +824,37 @@ namespace libf {
             // Check if the dimensionality is correct
             BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
             dataPointIndices.erase(dataPointIndices.begin() + i);
+            if (weights.size() > 0)
+            {
+                weights.erase(weights.begin() + i);
+            }
+        }
+        
+        /**
+         * Removes several vectors from the storage in a single pass. The 
+         * remaining points keep their relative order. 
+         * 
+         * @param indices The indices of the data points to delete
+         */
+        void removeDataPoints(const std::vector<int> & indices);
+        
+        /**
+         * Removes the i-th vector from the storage in constant time by 
+         * replacing it with the last vector. This changes the order of the 
+         * data points. 
+         * 
+         * @param i The index of the data point to delete
+         */
+        void swapRemoveDataPoint(int i)
+        {
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
+            dataPointIndices[i] = dataPointIndices.back();
+            dataPointIndices.pop_back();
+            if (weights.size() > 0)
+            {
+                weights[i] = weights.back();
+                weights.pop_back();
+            }
         }
         
         /**
@@ -554,16 +868,48 @@ namespace libf {
         }
         
         /**
-         * Add a single data point.
+         * Returns the data storage that holds the referenced data points.
          * 
-         * @param n The index of the data point to add
+         * @return The base data storage
+         * @internal
+         */
+        std::shared_ptr<const DataStorage> getBaseStorage() const
+        {
+            return dataStorage;
+        }
+        
+        /**
+         * Returns the index of the i-th data point in the base storage. 
+         * 
+         * @param i The index of the data point in this storage
+         * @return The index of the data point in the base storage
+         * @internal
          */
-        void addDataPoint(int n)
+        int getBaseIndex(int i) const
         {
-            BOOST_ASSERT_MSG(0 <= n && n < dataStorage->getSize(), "Invalid data point index from reference storage.");
-            dataPointIndices.push_back(n);
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
+            return dataPointIndices[i];
         }
         
+        /**
+         * Add a single data point. The point keeps its weight in the storage
+         * given to the constructor. 
+         * 
+         * @param n The index of the data point to add (in the storage given
+         *          to the constructor)
+         */
+        void addDataPoint(int n);
+        
+        /**
+         * Add a single data point with the given weight. The weight only 
+         * applies to this view, the referenced storage is not changed. 
+         * 
+         * @param n The index of the data point to add (in the storage given
+         *          to the constructor)
+         * @param weight The weight of the point in this storage (positive)
+         */
+        void addDataPoint(int n, int weight);
+        
         /**
          * Permutes the data points according to some permutation. Please 
          * notice that this will also change reference data storage that depend
@@ -575,122 +921,683 @@ namespace libf {
         
     private:
         /**
-         * The referenced data point indices
+         * The referenced data point indices (in the base storage)
          */
         std::vector<int> dataPointIndices;
         /**
-         * The reference data storage
+         * The weights of the data points if they differ from the weights in
+         * the base storage (empty otherwise)
          */
-        AbstractDataStorage::const_ptr dataStorage;
-    };
-    
-    /**
-     * This is the interface that has to be implemented if you wish to implement
-     * a custom data provider. 
-     */
-    class AbstractDataReader {
-    public:
-        virtual ~AbstractDataReader() {}
+        std::vector<int> weights;
+        /**
+         * The base data storage
+         */
+        std::shared_ptr<const DataStorage> dataStorage;
+        /**
+         * Whether the storage given to the constructor is a view on the base
+         * storage, such that indices passed to addDataPoint refer to it
+         */
+        bool hasParentView;
+        /**
+         * The view given to the constructor. The view is not kept alive, 
+         * a strong reference would hold all its indices as long as this one.
+         */
+        std::weak_ptr<const AbstractDataStorage> parentView;
         
         /**
-         * Reads a labeled dataset from a stream.
+         * Returns the view given to the constructor. 
          * 
-         * @param stream The stream to read the data from
-         * @param dataStorage The data storage to add the read data points to
+         * @return The parent view
          */
-        virtual void read(std::istream & stream, DataStorage::ptr dataStorage) = 0;
+        AbstractDataStorage::const_ptr lockParentView() const
+        {
+            AbstractDataStorage::const_ptr parent = parentView.lock();
+            BOOST_ASSERT_MSG(parent, "The storage given to the constructor no longer exists.");
+            return parent;
+        }
         
         /**
-         * Reads a labeled dataset from a file.
+         * Adds a data point by its index in the base storage. 
          * 
-         * @param filename The name of the file that shall be read
-         * @param dataStorage The data storage to add the read data points to
+         * @param index The index of the data point in the base storage
+         * @param weight The weight of the point in this storage (positive)
          */
-        virtual void read(const std::string & filename, DataStorage::ptr dataStorage) throw(IOException);
+        void addBaseDataPoint(int index, int weight);
     };
     
     /**
-     * This data provider reads data from a local CSV file. 
+     * The labeled data points of a data storage grouped by class. Stratified
+     * subsampling needs this grouping for every sample it draws; computing 
+     * it once allows to draw many samples, e.g. one per tree, in time 
+     * independent of the size of the storage. For weighted storages, the
+     * examples a point stands for are enumerated by cumulative weights. 
+     * Adding, removing or permuting points of the storage invalidates the 
+     * index. 
      */
-    class CSVDataReader : public AbstractDataReader {
+    class ClassIndex {
     public:
-        using AbstractDataReader::read;    
-
-        /**
-         * Constructor
-         */
-        CSVDataReader() : readClassLabels(true), classLabelColumnIndex(0), columnSeparator(",") {}
+        typedef std::shared_ptr<ClassIndex> ptr;
         
         /**
-         * Destructor.
+         * Groups the labeled points of a storage by class. 
+         * 
+         * @param storage The storage to group
          */
-        virtual ~CSVDataReader() {}
+        ClassIndex(const AbstractDataStorage & storage);
         
         /**
-         * Reads a dataset from a stream.
+         * Returns the number of classes.
          * 
-         * @param stream The stream to read the data from
-         * @param dataStorage The data storage to add the read data points to
+         * @return The number of classes
          */
-        virtual void read(std::istream & stream, DataStorage::ptr dataStorage);
+        int getClasscount() const
+        {
+            return static_cast<int>(indices.size());
+        }
         
         /**
-         * Sets whether or not class labels shall be read from the file. 
+         * Returns the number of examples of a class, i.e. the total weight of
+         * its points. 
          * 
-         * @param _readClassLabels Whether of not class labels shall be read. True => Read labels
+         * @param c The class
+         * @return The number of examples of class c
          */
-        void setReadClassLabels(bool _readClassLabels)
+        int getClassWeight(int c) const
         {
-            readClassLabels = _readClassLabels;
+            BOOST_ASSERT_MSG(0 <= c && c < getClasscount(), "Invalid class.");
+            return (cumulativeWeights[c].size() > 0 ? cumulativeWeights[c].back() : static_cast<int>(indices[c].size()));
         }
         
         /**
-         * Returns whether or not class labels shall be read from the file. 
+         * Returns the point that stands for an example of a class. 
          * 
-         * @return True if class labels are read
+         * @param c The class
+         * @param m The example, in [0, getClassWeight(c) - 1]
+         * @return The index of the point in the storage
          */
-        bool getReadClassLabels() const
+        int getPoint(int c, int m) const
         {
-            return readClassLabels;
+            BOOST_ASSERT_MSG(0 <= m && m < getClassWeight(c), "Invalid example.");
+            
+            if (cumulativeWeights[c].size() == 0)
+            {
+                return indices[c][m];
+            }
+            
+            const std::vector<int> & weights = cumulativeWeights[c];
+            return indices[c][std::upper_bound(weights.begin(), weights.end(), m) - weights.begin()];
         }
         
+    private:
         /**
-         * Sets the class label column index. 
+         * The points of every class
+         */
+        std::vector< std::vector<int> > indices;
+        /**
+         * The cumulative weights of the points of every class (empty for 
+         * unweighted storages)
+         */
+        std::vector< std::vector<int> > cumulativeWeights;
+    };
+    
+    /**
+     * Holds several class labels per data point, one for each output of a 
+     * multi-output classifier. The rows are indexed by the index of the data
+     * point in the base storage (see getBaseIndex), such that the matrix 
+     * also applies to all views of that storage, e.g. bootstrap samples. 
+     * Adding, removing or permuting points of the base storage invalidates
+     * the matrix. 
+     */
+    class LabelMatrix {
+    public:
+        typedef std::shared_ptr<LabelMatrix> ptr;
+        
+        /**
+         * Creates an empty label matrix.
          * 
-         * @param _classLabelColumnIndex The new index
+         * @param _numOutputs The number of labels per data point
          */
-        void setClassLabelColumnIndex(int _classLabelColumnIndex)
+        LabelMatrix(int _numOutputs) : 
+                numOutputs(_numOutputs), 
+                classcounts(_numOutputs, 0)
         {
-            BOOST_ASSERT_MSG(_classLabelColumnIndex >= 0, "The class label index must be non-negative.");
-            classLabelColumnIndex = _classLabelColumnIndex;
+            BOOST_ASSERT_MSG(numOutputs > 0, "The number of outputs must be positive.");
         }
         
         /**
-         * Returns the class label column index. 
+         * Appends the labels of the next data point.
          * 
-         * @return The class label column index
+         * @param _labels One label per output
          */
-        int getClassLabelColumnIndex() const
+        void addLabels(const std::vector<int> & _labels)
         {
-            return classLabelColumnIndex;
+            BOOST_ASSERT_MSG(static_cast<int>(_labels.size()) == numOutputs, "The number of labels does not match the number of outputs.");
+            
+            for (int k = 0; k < numOutputs; k++)
+            {
+                BOOST_ASSERT_MSG(_labels[k] >= 0, "The class labels must be consecutive and non-negative.");
+                classcounts[k] = std::max(classcounts[k], _labels[k] + 1);
+                labels.push_back(_labels[k]);
+            }
         }
         
         /**
-         * Sets the column separator. 
+         * Returns a label.
          * 
-         * @param _columnSeparator The new column separator
+         * @param i The index of the data point in the base storage
+         * @param k The output
+         * @return The class label
          */
-        void setColumnSeparator(const std::string & _columnSeparator)
+        int getLabel(int i, int k) const
         {
-            columnSeparator = _columnSeparator;
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
+            return labels[i*numOutputs + k];
         }
         
         /**
-         * Returns the column separator. 
+         * Returns the number of outputs.
          * 
-         * @return The column separator
+         * @return The number of labels per data point
          */
-        const std::string & getColumnSeparator() const
+        int getNumOutputs() const
+        {
+            return numOutputs;
+        }
+        
+        /**
+         * Returns the number of classes of an output.
+         * 
+         * @param k The output
+         * @return The number of classes
+         */
+        int getClasscount(int k) const
+        {
+            return classcounts[k];
+        }
+        
+        /**
+         * Returns the number of data points.
+         * 
+         * @return The number of rows
+         */
+        int getSize() const
+        {
+            return static_cast<int>(labels.size())/numOutputs;
+        }
+        
+    private:
+        /**
+         * The number of labels per data point
+         */
+        int numOutputs;
+        /**
+         * The number of classes per output
+         */
+        std::vector<int> classcounts;
+        /**
+         * The labels, row-major
+         */
+        std::vector<int> labels;
+    };
+    
+    /**
+     * A feature provider computes the features of a set of data points on 
+     * demand. Use this instead of a data storage when features are expensive
+     * to compute and only a few of them are needed, e.g. only the features 
+     * tested along the paths of a forest. 
+     */
+    class AbstractFeatureProvider {
+    public:
+        typedef std::shared_ptr<AbstractFeatureProvider> ptr;
+        
+        virtual ~AbstractFeatureProvider() {}
+        
+        /**
+         * Returns the number of data points. 
+         * 
+         * @return The number of data points
+         */
+        virtual int getSize() const = 0;
+        
+        /**
+         * Returns the dimensionality of the data points. 
+         * 
+         * @return The dimensionality
+         */
+        virtual int getDimensionality() const = 0;
+        
+        /**
+         * Computes a single feature. 
+         * 
+         * @param n The index of the data point
+         * @param d The index of the feature
+         * @return The feature value
+         */
+        virtual float computeFeature(int n, int d) = 0;
+        
+        /**
+         * Computes a set of features at once. Override this if lookups can 
+         * be batched. The default implementation calls computeFeature for 
+         * every request. 
+         * 
+         * @param requests The (data point, feature) pairs to compute
+         * @param values The feature values in the order of the requests
+         */
+        virtual void computeFeatures(const std::vector< std::pair<int, int> > & requests, std::vector<float> & values);
+    };
+    
+    /**
+     * Memorizes the features computed by a feature provider, such that every
+     * feature is computed at most once. Create a new memo per request. 
+     */
+    class FeatureMemo {
+    public:
+        /**
+         * Constructor
+         * 
+         * @param _provider The feature provider
+         */
+        FeatureMemo(AbstractFeatureProvider::ptr _provider) : 
+                provider(_provider), 
+                N(_provider->getSize()),
+                D(_provider->getDimensionality()),
+                numComputed(0) {}
+        
+        /**
+         * Returns the feature provider. 
+         * 
+         * @return The feature provider
+         */
+        AbstractFeatureProvider::ptr getProvider() const
+        {
+            return provider;
+        }
+        
+        /**
+         * Returns whether a feature has already been computed. 
+         * 
+         * @param n The index of the data point
+         * @param d The index of the feature
+         * @return True if the feature is known
+         */
+        bool isComputed(int n, int d) const
+        {
+            return values.find(getIndex(n, d)) != values.end();
+        }
+        
+        /**
+         * Returns a feature and computes it if necessary. 
+         * 
+         * @param n The index of the data point
+         * @param d The index of the feature
+         * @return The feature value
+         */
+        float get(int n, int d)
+        {
+            const size_t i = getIndex(n, d);
+            auto it = values.find(i);
+            if (it != values.end())
+            {
+                return it->second;
+            }
+            
+            const float value = provider->computeFeature(n, d);
+            values[i] = value;
+            numComputed++;
+            return value;
+        }
+        
+        /**
+         * Computes all requested features that are not yet known with a 
+         * single call to the provider. 
+         * 
+         * @param requests The (data point, feature) pairs
+         */
+        void prefetch(const std::vector< std::pair<int, int> > & requests);
+        
+        /**
+         * Returns the number of features computed so far. 
+         * 
+         * @return The number of computed features
+         */
+        int getNumComputed() const
+        {
+            return numComputed;
+        }
+        
+    private:
+        /**
+         * Returns the key of a feature in the memo. 
+         * 
+         * @param n The index of the data point
+         * @param d The index of the feature
+         * @return The key
+         */
+        size_t getIndex(int n, int d) const
+        {
+            BOOST_ASSERT_MSG(0 <= n && n < N, "Invalid data point index.");
+            BOOST_ASSERT_MSG(0 <= d && d < D, "Invalid feature index.");
+            return static_cast<size_t>(n)*D + d;
+        }
+        
+        /**
+         * The feature provider
+         */
+        AbstractFeatureProvider::ptr provider;
+        /**
+         * The number of data points
+         */
+        int N;
+        /**
+         * The dimensionality
+         */
+        int D;
+        /**
+         * The memorized values. Only the features that are actually 
+         * requested are stored, such that the memo stays small for large
+         * providers. 
+         */
+        std::unordered_map<size_t, float> values;
+        /**
+         * The number of computed features
+         */
+        int numComputed;
+    };
+    
+    /**
+     * Holds a labeled data set in a single contiguous feature matrix of 
+     * narrow scalars, e.g. one byte per feature for 8 bit image data instead
+     * of four (see LibforestDataWriter::FEATURE_TYPE_UINT8 etc.). Features 
+     * are converted to float on access. 
+     * 
+     * The storage is a feature provider, such that forests can classify it 
+     * without widening (see RandomForest::classLogPosteriorLazy).
+     *
+     * The memory savings apply to storing and classifying only: the
+     * learners take an AbstractDataStorage of float data points and cannot
+     * train on this storage directly. Training requires toDataStorage,
+     * which widens the converted points to float again; converting blocks
+     * (e.g. one bootstrap sample per tree) bounds the peak footprint.
+     * 
+     * The feature matrix is allocated from the default memory resource at 
+     * the time the storage is created, e.g. from a HugePageMemoryResource
+     * for large data sets. 
+     */
+    class CompactDataStorage : public AbstractFeatureProvider {
+    public:
+        typedef std::shared_ptr<CompactDataStorage> ptr;
+        
+        /**
+         * Constructor
+         * 
+         * @param _featureType The scalar type of the features
+         */
+        CompactDataStorage(int _featureType);
+        
+        virtual ~CompactDataStorage() {}
+        
+        /**
+         * Returns the scalar type of the features. 
+         * 
+         * @return The feature type
+         */
+        int getFeatureType() const
+        {
+            return featureType;
+        }
+        
+        /**
+         * Returns the number of data points. 
+         * 
+         * @return The number of data points
+         */
+        int getSize() const
+        {
+            return static_cast<int>(classLabels.size());
+        }
+        
+        /**
+         * Returns the dimensionality of the data points. 
+         * 
+         * @return The dimensionality
+         */
+        int getDimensionality() const
+        {
+            return D;
+        }
+        
+        /**
+         * Returns the number of classes. 
+         * 
+         * @return The number of observed classes
+         */
+        int getClasscount() const
+        {
+            return classcount;
+        }
+        
+        /**
+         * Returns the i-th class label. 
+         * 
+         * @param i The data point index
+         * @return The class label of the i-th data point
+         */
+        int getClassLabel(int i) const
+        {
+            BOOST_ASSERT_MSG(0 <= i && i < getSize(), "The data point index is out of bounds.");
+            return classLabels[i];
+        }
+        
+        /**
+         * Returns a single feature. 
+         * 
+         * @param n The index of the data point
+         * @param d The index of the feature
+         * @return The feature value
+         */
+        float getFeature(int n, int d) const;
+        
+        /**
+         * Returns a single feature. 
+         * 
+         * @param n The index of the data point
+         * @param d The index of the feature
+         * @return The feature value
+         */
+        float computeFeature(int n, int d)
+        {
+            return getFeature(n, d);
+        }
+        
+        /**
+         * Converts the n-th data point to float. 
+         * 
+         * @param n The index of the data point
+         * @param x The converted data point
+         */
+        void getDataPoint(int n, DataPoint & x) const;
+        
+        /**
+         * Adds a data point. Integer types are rounded and clamped.
+         * 
+         * @param x The data point
+         * @param label The class label
+         */
+        void addDataPoint(const DataPoint & x, int label);
+        
+        /**
+         * Adds a data point whose features are already stored with the 
+         * feature type of this storage. 
+         * 
+         * @param features The D features
+         * @param _D The dimensionality of the data point
+         * @param label The class label
+         */
+        void addRawDataPoint(const unsigned char* features, int _D, int label);
+        
+        /**
+         * Converts a block of data points to a data storage. 
+         * 
+         * @param begin The index of the first data point
+         * @param end The index of the last data point
+         * @return A data storage with the converted data points
+         */
+        DataStorage::ptr toDataStorage(int begin, int end) const;
+        
+        /**
+         * Converts all data points to a data storage. 
+         * 
+         * @return A data storage with the converted data points
+         */
+        DataStorage::ptr toDataStorage() const
+        {
+            return toDataStorage(0, getSize() - 1);
+        }
+        
+        /**
+         * Returns the number of bytes used for the features. 
+         * 
+         * @return The size of the feature matrix in bytes
+         */
+        size_t getFeatureBytes() const
+        {
+            return features.size();
+        }
+        
+    private:
+        /**
+         * The scalar type of the features
+         */
+        int featureType;
+        /**
+         * The size of a single feature in bytes
+         */
+        int featureSize;
+        /**
+         * The dimensionality
+         */
+        int D;
+        /**
+         * The total number of classes
+         */
+        int classcount;
+        /**
+         * The features of all data points, one row after the other
+         */
+        std::vector< unsigned char, Allocator<unsigned char> > features;
+        /**
+         * The class labels
+         */
+        std::vector<int> classLabels;
+    };
+    
+    /**
+     * This is the interface that has to be implemented if you wish to implement
+     * a custom data provider. 
+     */
+    class AbstractDataReader {
+    public:
+        virtual ~AbstractDataReader() {}
+        
+        /**
+         * Reads a labeled dataset from a stream.
+         * 
+         * @param stream The stream to read the data from
+         * @param dataStorage The data storage to add the read data points to
+         */
+        virtual void read(std::istream & stream, DataStorage::ptr dataStorage) = 0;
+        
+        /**
+         * Reads a labeled dataset from a file.
+         * 
+         * @param filename The name of the file that shall be read
+         * @param dataStorage The data storage to add the read data points to
+         */
+        virtual void read(const std::string & filename, DataStorage::ptr dataStorage) throw(IOException);
+    };
+    
+    /**
+     * This data provider reads data from a local CSV file. 
+     */
+    class CSVDataReader : public AbstractDataReader {
+    public:
+        using AbstractDataReader::read;    
+
+        /**
+         * Constructor
+         */
+        CSVDataReader() : readClassLabels(true), classLabelColumnIndex(0), columnSeparator(",") {}
+        
+        /**
+         * Destructor.
+         */
+        virtual ~CSVDataReader() {}
+        
+        /**
+         * Reads a dataset from a stream.
+         * 
+         * @param stream The stream to read the data from
+         * @param dataStorage The data storage to add the read data points to
+         */
+        virtual void read(std::istream & stream, DataStorage::ptr dataStorage);
+        
+        /**
+         * Sets whether or not class labels shall be read from the file. 
+         * 
+         * @param _readClassLabels Whether of not class labels shall be read. True => Read labels
+         */
+        void setReadClassLabels(bool _readClassLabels)
+        {
+            readClassLabels = _readClassLabels;
+        }
+        
+        /**
+         * Returns whether or not class labels shall be read from the file. 
+         * 
+         * @return True if class labels are read
+         */
+        bool getReadClassLabels() const
+        {
+            return readClassLabels;
+        }
+        
+        /**
+         * Sets the class label column index. 
+         * 
+         * @param _classLabelColumnIndex The new index
+         */
+        void setClassLabelColumnIndex(int _classLabelColumnIndex)
+        {
+            BOOST_ASSERT_MSG(_classLabelColumnIndex >= 0, "The class label index must be non-negative.");
+            classLabelColumnIndex = _classLabelColumnIndex;
+        }
+        
+        /**
+         * Returns the class label column index. 
+         * 
+         * @return The class label column index
+         */
+        int getClassLabelColumnIndex() const
+        {
+            return classLabelColumnIndex;
+        }
+        
+        /**
+         * Sets the column separator. 
+         * 
+         * @param _columnSeparator The new column separator
+         */
+        void setColumnSeparator(const std::string & _columnSeparator)
+        {
+            columnSeparator = _columnSeparator;
+        }
+        
+        /**
+         * Returns the column separator. 
+         * 
+         * @return The column separator
+         */
+        const std::string & getColumnSeparator() const
         {
             return columnSeparator;
         }
@@ -724,7 +1631,12 @@ namespace libf {
     class LIBSVMDataReader : public AbstractDataReader {
     public:
         using AbstractDataReader::read;
-        LIBSVMDataReader() : convertBinaryLabels(false) {}
+        /**
+         * The number of bytes that are parsed by a thread at once
+         */
+        const static int BYTES_PER_CHUNK = 1 << 24;
+        
+        LIBSVMDataReader() : convertBinaryLabels(false), dimensionality(0), numThreads(1) {}
         
         virtual ~LIBSVMDataReader() {}
         
@@ -756,24 +1668,78 @@ namespace libf {
         {
             return convertBinaryLabels;
         }
-    private:
+        
         /**
-         * Parses a single line and feeds.
+         * Sets a fixed dimensionality. If it is 0, the dimensionality is the 
+         * largest feature index in the file. A fixed dimensionality is 
+         * required if a file is read in several parts. 
          * 
-         * @param line The string of the line
-         * @param result The class label is stored in first, the dimension:feature list is stored in second
+         * @param _dimensionality The dimensionality or 0
+         */
+        void setDimensionality(int _dimensionality)
+        {
+            BOOST_ASSERT_MSG(_dimensionality >= 0, "The dimensionality must be non-negative.");
+            dimensionality = _dimensionality;
+        }
+        
+        /**
+         * Returns the fixed dimensionality (0 if it is determined from the
+         * file).
+         * 
+         * @return The dimensionality
+         */
+        int getDimensionality() const
+        {
+            return dimensionality;
+        }
+        
+        /**
+         * Sets the number of threads used for parsing.
+         * 
+         * @param _numThreads The number of threads
+         */
+        void setNumThreads(int _numThreads) throw(ConfigurationException)
+        {
+#ifndef LIBF_ENABLE_OPENMP
+            if (_numThreads != 1)
+            {
+                throw ConfigurationException("OpenMP support is disabled. Set number of threads to 1.");
+            }
+#endif
+            BOOST_ASSERT_MSG(_numThreads > 0, "The number of threads must be positive.");
+            numThreads = _numThreads;
+        }
+        
+        /**
+         * Returns the number of threads.
+         * 
+         * @return The number of threads
          */
-        void parseLine(const std::string & line, std::pair<int, std::vector< std::pair<int, float> > > & result) const;
+        int getNumThreads() const
+        {
+            return numThreads;
+        }
+        
+    private:
         
         /**
          * If true, the labels -1 and 1 are converted to 0 and 1
          */
         bool convertBinaryLabels;
+        /**
+         * The fixed dimensionality (0 = determined from the file)
+         */
+        int dimensionality;
+        /**
+         * The number of threads
+         */
+        int numThreads;
     };
     
     /**
      * Reads the data set from a binary libforest format. This is the fastest
-     * way to load a data set. 
+     * way to load a data set. Files with narrow feature types (see 
+     * LibforestDataWriter::setFeatureType) are converted on the fly.
      */
     class LibforestDataReader : public AbstractDataReader {
     public:
@@ -786,6 +1752,44 @@ namespace libf {
          */
         virtual void read(std::istream & stream, DataStorage::ptr dataStorage);
         
+        /**
+         * Reads the header of a data set. Use this together with 
+         * readDataPoints in order to read a data set in several parts. 
+         * 
+         * @param stream The stream to read from
+         * @param N The number of data points in the file
+         * @param featureType The feature type used in the file
+         */
+        void readHeader(std::istream & stream, int & N, int & featureType) throw(IOException);
+        
+        /**
+         * Reads a number of labeled data points that follow the header. 
+         * 
+         * @param stream The stream to read from
+         * @param dataStorage The data storage to add the read data points to
+         * @param featureType The feature type used in the file
+         * @param M The number of data points to read
+         */
+        void readDataPoints(std::istream & stream, DataStorage::ptr dataStorage, int featureType, int M);
+        
+        /**
+         * Reads a labeled dataset from a stream into a compact storage. If
+         * the file uses the feature type of the storage, the features are 
+         * copied without conversion. 
+         * 
+         * @param stream The stream to read the data from
+         * @param dataStorage The compact storage to add the data points to
+         */
+        void read(std::istream & stream, CompactDataStorage::ptr dataStorage);
+        
+        /**
+         * Reads a labeled dataset from a file into a compact storage. 
+         * 
+         * @param filename The name of the file that shall be read
+         * @param dataStorage The compact storage to add the data points to
+         */
+        void read(const std::string & filename, CompactDataStorage::ptr dataStorage) throw(IOException);
+        
     private:
         /**
          * Reads a single data point from a stream
@@ -794,6 +1798,145 @@ namespace libf {
          * @param v The data point where the data shall be saved into
          */
         void readDataPoint(std::istream & stream, DataPoint & v);
+        
+        /**
+         * Reads a single data point whose features are stored with the given
+         * scalar type.
+         * 
+         * @param stream The data stream 
+         * @param v The data point where the data shall be saved into
+         * @param featureType The feature type used in the file
+         */
+        void readDataPoint(std::istream & stream, DataPoint & v, int featureType);
+    };
+    
+    /**
+     * Wraps another reader and caches the read and preprocessed data set in
+     * the binary libforest format. The cache file is keyed by a checksum of 
+     * the source file and a pipeline key that identifies the reader and 
+     * preprocessing configuration. If a matching cache file exists, it is 
+     * read instead of parsing and preprocessing the source file again. 
+     * 
+     * Note: The pipeline key must change whenever the configuration of the 
+     * wrapped reader or the preprocessing changes. The weights of the data
+     * points are stored after the data points, such that pipelines that
+     * merge data points (e.g. DeduplicateTool) are cached faithfully. 
+     */
+    class CachedDataReader : public AbstractDataReader {
+    public:
+        /**
+         * Constructor
+         * 
+         * @param _reader The reader used for the source files
+         */
+        CachedDataReader(std::shared_ptr<AbstractDataReader> _reader) : 
+                reader(_reader), 
+                cacheDirectory(".libforest-cache") {}
+        
+        virtual ~CachedDataReader() {}
+        
+        /**
+         * Reads and preprocesses a dataset from a stream. Streams are not 
+         * cached. 
+         * 
+         * @param stream The stream to read the data from
+         * @param dataStorage The data storage to add the read data points to
+         */
+        virtual void read(std::istream & stream, DataStorage::ptr dataStorage);
+        
+        /**
+         * Reads and preprocesses a dataset from a file or from the cache. 
+         * 
+         * @param filename The name of the file that shall be read
+         * @param dataStorage The data storage to add the read data points to
+         */
+        virtual void read(const std::string & filename, DataStorage::ptr dataStorage) throw(IOException);
+        
+        /**
+         * Sets the preprocessing pipeline. The pipeline is applied to the 
+         * freshly read data set before it is cached. 
+         * 
+         * @param _pipelineKey A string that identifies the configuration
+         * @param _pipeline The preprocessing function
+         */
+        void setPipeline(const std::string & _pipelineKey, std::function<void(DataStorage::ptr)> _pipeline)
+        {
+            pipelineKey = _pipelineKey;
+            pipeline = _pipeline;
+        }
+        
+        /**
+         * Returns the pipeline key.
+         * 
+         * @return The pipeline key
+         */
+        const std::string & getPipelineKey() const
+        {
+            return pipelineKey;
+        }
+        
+        /**
+         * Sets the directory where the cache files are stored. 
+         * 
+         * @param _cacheDirectory The cache directory
+         */
+        void setCacheDirectory(const std::string & _cacheDirectory)
+        {
+            cacheDirectory = _cacheDirectory;
+        }
+        
+        /**
+         * Returns the cache directory.
+         * 
+         * @return The cache directory
+         */
+        const std::string & getCacheDirectory() const
+        {
+            return cacheDirectory;
+        }
+        
+        /**
+         * Returns the name of the cache file for a source file. 
+         * 
+         * @param filename The name of the source file
+         * @return The name of the cache file
+         */
+        std::string getCacheFilename(const std::string & filename) const throw(IOException);
+        
+    private:
+        /**
+         * Reads a cache file including the weights. 
+         * 
+         * @param cacheFilename The name of the cache file
+         * @param storage The storage to add the cached data points to
+         * @return False if the cache file is incomplete or outdated
+         */
+        bool readCache(const std::string & cacheFilename, DataStorage::ptr storage) const;
+        
+        /**
+         * Writes a cache file including the weights. 
+         * 
+         * @param cacheFilename The name of the cache file
+         * @param storage The data points to cache
+         */
+        void writeCache(const std::string & cacheFilename, DataStorage::ptr storage) const throw(IOException);
+        
+        /**
+         * The reader for the source files
+         */
+        std::shared_ptr<AbstractDataReader> reader;
+        /**
+         * The preprocessing pipeline
+         */
+        std::function<void(DataStorage::ptr)> pipeline;
+        /**
+         * Identifies the preprocessing configuration
+         */
+        std::string pipelineKey;
+        /**
+         * The directory where the cache files are stored
+         */
+        std::string cacheDirectory;
     };
     
     /**
@@ -801,15 +1944,86 @@ namespace libf {
      */
     class AbstractDataWriter {
     public:
+        /**
+         * The number of rows that are formatted by a thread at once
+         */
+        const static int ROWS_PER_CHUNK = 4096;
+        
+        AbstractDataWriter() : numThreads(1) {}
+        
+        virtual ~AbstractDataWriter() {}
+        
         /**
          * Writes the data to a stream. 
          */
-        virtual void write(std::ostream & stream, DataStorage::ptr dataStorage) = 0;
+        virtual void write(std::ostream & stream, DataStorage::ptr dataStorage);
         
         /**
          * Writes the data to a file and add them to the data storage. 
          */
         virtual void write(const std::string & filename, DataStorage::ptr dataStorage) throw(IOException);
+        
+        /**
+         * Writes the file header. Headers have a fixed size, such that they 
+         * can be rewritten once the number of data points is known when 
+         * writing a data set in several parts. 
+         * 
+         * @param stream The stream to write to
+         * @param N The total number of data points
+         */
+        virtual void writeHeader(std::ostream & stream, int N) {}
+        
+        /**
+         * Writes the data points without any header. A data set can be 
+         * written in several parts by calling this function repeatedly. 
+         * 
+         * @param stream The stream to write to
+         * @param dataStorage The data points to write
+         */
+        virtual void writeDataPoints(std::ostream & stream, DataStorage::ptr dataStorage) = 0;
+        
+        /**
+         * Sets the number of threads used for formatting the rows.
+         * 
+         * @param _numThreads The number of threads
+         */
+        void setNumThreads(int _numThreads) throw(ConfigurationException)
+        {
+#ifndef LIBF_ENABLE_OPENMP
+            if (_numThreads != 1)
+            {
+                throw ConfigurationException("OpenMP support is disabled. Set number of threads to 1.");
+            }
+#endif
+            BOOST_ASSERT_MSG(_numThreads > 0, "The number of threads must be positive.");
+            numThreads = _numThreads;
+        }
+        
+        /**
+         * Returns the number of threads.
+         * 
+         * @return The number of threads
+         */
+        int getNumThreads() const
+        {
+            return numThreads;
+        }
+        
+    protected:
+        /**
+         * Formats the rows in chunks of ROWS_PER_CHUNK rows in parallel and
+         * writes the chunks to the stream in order. 
+         * 
+         * @param stream The stream to write to
+         * @param N The number of rows
+         * @param formatRow Appends the n-th row to a buffer
+         */
+        void writeRows(std::ostream & stream, int N, const std::function<void(int, std::string &)> & formatRow) const;
+        
+        /**
+         * The number of threads
+         */
+        int numThreads;
     };
     
     
@@ -823,9 +2037,9 @@ namespace libf {
         CSVDataWriter() : writeClassLabels(true), classLabelColumnIndex(0), columnSeparator(",") {}
         
         /**
-         * Writes the data to a stream. 
+         * Writes the data points without any header. 
          */
-        virtual void write(std::ostream & stream, DataStorage::ptr dataStorage);
+        virtual void writeDataPoints(std::ostream & stream, DataStorage::ptr dataStorage);
         
         /**
          * Sets whether or not class labels shall be written to the file. 
@@ -906,26 +2120,88 @@ namespace libf {
     /**
      * Writes the data set to a binary libforest format. This is the fastest
      * way to save a data set. 
+     * 
+     * By default, features are written as 32 bit floats. For 8 bit images or
+     * 16 bit sensor data, a narrower feature type can be chosen which reduces
+     * the file size and the amount of data that has to be read by 2-4x. 
+     * Integer feature types are rounded and clamped to their range.
      */
     class LibforestDataWriter : public AbstractDataWriter {
     public:
         using AbstractDataWriter::write;
         
-        LibforestDataWriter() {}
+        /**
+         * Marks files that carry an explicit feature type. Legacy files start
+         * with the (non-negative) number of data points.
+         */
+        static const int FORMAT_TAG = -1;
+        /**
+         * Features are stored as unsigned 8 bit integers.
+         */
+        static const int FEATURE_TYPE_UINT8 = 1;
+        /**
+         * Features are stored as unsigned 16 bit integers.
+         */
+        static const int FEATURE_TYPE_UINT16 = 2;
+        /**
+         * Features are stored as IEEE 754 half precision floats.
+         */
+        static const int FEATURE_TYPE_HALF = 3;
+        /**
+         * Features are stored as single precision floats (default).
+         */
+        static const int FEATURE_TYPE_FLOAT = 4;
+        /**
+         * Features are stored as double precision floats.
+         */
+        static const int FEATURE_TYPE_DOUBLE = 5;
+        
+        LibforestDataWriter() : featureType(FEATURE_TYPE_FLOAT) {}
         
         /**
-         * Writes the data to a stream. 
+         * Writes the feature type and the number of data points. 
          */
-        virtual void write(std::ostream & stream, DataStorage::ptr dataStorage);
+        virtual void writeHeader(std::ostream & stream, int N);
+        
+        /**
+         * Writes the data points without any header. 
+         */
+        virtual void writeDataPoints(std::ostream & stream, DataStorage::ptr dataStorage);
+        
+        /**
+         * Sets the scalar type used to store the features. 
+         * 
+         * @param _featureType The feature type
+         */
+        void setFeatureType(int _featureType)
+        {
+            BOOST_ASSERT_MSG(FEATURE_TYPE_UINT8 <= _featureType && _featureType <= FEATURE_TYPE_DOUBLE, "Invalid feature type.");
+            featureType = _featureType;
+        }
+        
+        /**
+         * Returns the scalar type used to store the features.
+         * 
+         * @return The feature type
+         */
+        int getFeatureType() const
+        {
+            return featureType;
+        }
         
     private:
         /**
-         * Writes a single data point to a stream
+         * Appends a single data point to a buffer
          * 
-         * @param stream The data stream 
-         * @param v The data point where the data shall be saved into
+         * @param buffer The buffer
+         * @param v The data point that shall be written
          */
-        void writeDataPoint(std::ostream & stream, DataPoint & v);
+        void writeDataPoint(std::string & buffer, const DataPoint & v) const;
+        
+        /**
+         * The scalar type used to store the features.
+         */
+        int featureType;
     };
     
     /**
@@ -936,9 +2212,14 @@ namespace libf {
         using AbstractDataWriter::write;
         
         /**
-         * Writes the data to a stream. 
+         * Writes a comment with the number of data points. 
          */
-        virtual void write(std::ostream & stream, DataStorage::ptr dataStorage);
+        virtual void writeHeader(std::ostream & stream, int N);
+        
+        /**
+         * Writes the data points without any header. 
+         */
+        virtual void writeDataPoints(std::ostream & stream, DataStorage::ptr dataStorage);
         
         /**
          * Writers a single data point to a stream
@@ -947,6 +2228,14 @@ namespace libf {
          * @param v The data point where the data shall be saved into
          */
         void writeDataPoint(std::ostream & stream, const DataPoint & v);
+        
+        /**
+         * Appends a single data point to a buffer
+         * 
+         * @param buffer The buffer
+         * @param v The data point that shall be written
+         */
+        void writeDataPoint(std::string & buffer, const DataPoint & v) const;
     };
 }
 
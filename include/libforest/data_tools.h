@@ -2,6 +2,7 @@
 #define	LIBF_DATA_TOOLS_H
 
 #include "data.h"
+#include <random>
 
 namespace libf {
     
@@ -162,22 +163,37 @@ namespace libf {
         float cluster(DataStorage::ptr storage, DataStorage::ptr centers, 
                 std::vector<int> & labels);
         
+        /**
+         * Run vanilla k-means clustering and draw the initial centers from 
+         * the given generator. Several threads may cluster at the same time
+         * if each one uses its own generator. 
+         * 
+         * @param storage The data storage to run k-means on
+         * @param centers The found centers will be written here
+         * @param labels The corresponding labels will be written here
+         * @param g The random number generator for the initial centers
+         */
+        float cluster(DataStorage::ptr storage, DataStorage::ptr centers, 
+                std::vector<int> & labels, std::mt19937 & g);
+        
     private:
         /**
          * Initialize the centers according to k-means++.
          * 
          * @param storage The data storage containing all points to cluster
          * @param centers The initial centers are written here
+         * @param g The random number generator
          */
-        void initCentersPP(AbstractDataStorage::ptr storage, DataStorage::ptr centers);
+        void initCentersPP(AbstractDataStorage::ptr storage, DataStorage::ptr centers, std::mt19937 & g);
         
         /**
          * Initialize the centers randomly
          * 
          * @param storage The data storage containing all points to cluster
          * @param centers The initial centers are written here
+         * @param g The random number generator
          */
-        void initCentersRandom(AbstractDataStorage::ptr storage, DataStorage::ptr centers);
+        void initCentersRandom(AbstractDataStorage::ptr storage, DataStorage::ptr centers, std::mt19937 & g);
         
         /**
          * Number of clusters to generate.
@@ -202,6 +218,234 @@ namespace libf {
         
     };
     
+    /**
+     * Hierarchical k-means (vocabulary tree) based on:
+     * 
+     *  D. Nistér, H. Stewénius.
+     *  Scalable Recognition with a Vocabulary Tree.
+     *  Proceedings of the IEEE Conference on Computer Vision and Pattern 
+     *  Recognition, 2006.
+     * 
+     * The data is clustered into b clusters with k-means, and every cluster
+     * is clustered again, up to a depth of L. The leaves are the words of 
+     * the vocabulary, up to b^L of them. A point is assigned to a word by 
+     * descending to the nearest child center at every level, which takes 
+     * b*L instead of b^L distance computations. 
+     * 
+     * As in the trees, the nodes are kept in one array and the children of
+     * a node are stored next to each other; a first child index of 0 marks
+     * a leaf. The centers of all nodes are the columns of one matrix, such
+     * that the children's centers are contiguous.
+     */
+    class HierarchicalKMeans {
+    public:
+        typedef std::shared_ptr<HierarchicalKMeans> ptr;
+        
+        HierarchicalKMeans() : 
+                branchingFactor(10),
+                depth(3),
+                numThreads(1),
+                numWords(0) {}
+        
+        /**
+         * Sets the number of clusters per node.
+         * 
+         * @param _branchingFactor The branching factor b
+         */
+        void setBranchingFactor(int _branchingFactor)
+        {
+            BOOST_ASSERT_MSG(_branchingFactor >= 2, "The branching factor must be at least 2.");
+            branchingFactor = _branchingFactor;
+        }
+        
+        /**
+         * Returns the number of clusters per node.
+         * 
+         * @return The branching factor b
+         */
+        int getBranchingFactor() const
+        {
+            return branchingFactor;
+        }
+        
+        /**
+         * Sets the depth of the tree.
+         * 
+         * @param _depth The depth L
+         */
+        void setDepth(int _depth)
+        {
+            BOOST_ASSERT_MSG(_depth >= 1, "The depth must be positive.");
+            depth = _depth;
+        }
+        
+        /**
+         * Returns the depth of the tree.
+         * 
+         * @return The depth L
+         */
+        int getDepth() const
+        {
+            return depth;
+        }
+        
+        /**
+         * Sets the number of threads. The clusterings of the nodes at the 
+         * same level are computed in parallel. 
+         * 
+         * @param _numThreads The number of threads
+         */
+        void setNumThreads(int _numThreads) throw(ConfigurationException)
+        {
+#ifndef LIBF_ENABLE_OPENMP
+            if (_numThreads != 1)
+            {
+                throw ConfigurationException("OpenMP support is disabled. Set number of threads to 1.");
+            }
+#endif
+            BOOST_ASSERT_MSG(_numThreads > 0, "The number of threads must be positive.");
+            numThreads = _numThreads;
+        }
+        
+        /**
+         * Returns the number of threads.
+         * 
+         * @return The number of threads
+         */
+        int getNumThreads() const
+        {
+            return numThreads;
+        }
+        
+        /**
+         * Returns the k-means configuration used at every node. The number 
+         * of clusters is set to the branching factor. 
+         * 
+         * @return The k-means configuration
+         */
+        KMeans & getKMeans()
+        {
+            return kmeans;
+        }
+        
+        /**
+         * Returns the k-means configuration used at every node. 
+         * 
+         * @return The k-means configuration
+         */
+        const KMeans & getKMeans() const
+        {
+            return kmeans;
+        }
+        
+        /**
+         * Builds the vocabulary tree. Nodes with at most b points are not 
+         * split further. 
+         * 
+         * @param storage The data points to cluster
+         */
+        void cluster(AbstractDataStorage::ptr storage);
+        
+        /**
+         * Returns the word of a data point.
+         * 
+         * @param x The data point
+         * @return The word index in [0, getNumWords() - 1]
+         */
+        int assign(const DataPoint & x) const;
+        
+        /**
+         * Returns the words of all points of a data storage.
+         * 
+         * @param storage The data points
+         * @param words The word of every point
+         */
+        void assign(AbstractDataStorage::ptr storage, std::vector<int> & words) const;
+        
+        /**
+         * Returns the number of words.
+         * 
+         * @return The number of leaves
+         */
+        int getNumWords() const
+        {
+            return numWords;
+        }
+        
+        /**
+         * Returns the number of nodes.
+         * 
+         * @return The number of nodes
+         */
+        int getNumNodes() const
+        {
+            return static_cast<int>(firstChild.size());
+        }
+        
+        /**
+         * Returns the center of a node.
+         * 
+         * @param node The node index
+         * @return The center
+         */
+        DataPoint getCenter(int node) const
+        {
+            return centers.col(node);
+        }
+        
+        /**
+         * Reads the vocabulary tree from a stream.
+         * 
+         * @param stream The stream to read from
+         */
+        void read(std::istream & stream);
+        
+        /**
+         * Writes the vocabulary tree to a stream.
+         * 
+         * @param stream The stream to write to
+         */
+        void write(std::ostream & stream) const;
+        
+    private:
+        /**
+         * The number of clusters per node
+         */
+        int branchingFactor;
+        /**
+         * The depth of the tree
+         */
+        int depth;
+        /**
+         * The number of threads
+         */
+        int numThreads;
+        /**
+         * The k-means configuration
+         */
+        KMeans kmeans;
+        /**
+         * The index of the first child of every node, 0 for leaves
+         */
+        std::vector<int> firstChild;
+        /**
+         * The number of children of every node
+         */
+        std::vector<int> numChildren;
+        /**
+         * The word of every leaf, -1 for inner nodes
+         */
+        std::vector<int> words;
+        /**
+         * The centers of all nodes, one per column
+         */
+        Eigen::MatrixXf centers;
+        /**
+         * The number of words
+         */
+        int numWords;
+    };
+    
     /**
      * Computes the relative frequency of the individual classes in a data storage.
      */
@@ -231,6 +475,60 @@ namespace libf {
         void measureAndPrint(AbstractDataStorage::ptr storage) const;
     };
     
+    /**
+     * Collapses identical rows (data point and class label) into a single 
+     * weighted row. Learners treat a point of weight w like w identical 
+     * points, so trees learned on the result are equivalent to the ones 
+     * learned on the original storage. 
+     */
+    class DeduplicateTool {
+    public:
+        DeduplicateTool() : numThreads(1) {}
+        
+        /**
+         * Creates a storage containing every distinct row once. The weight of 
+         * a row is the sum of the weights of its duplicates. The rows are 
+         * ordered by their first occurrence. 
+         * 
+         * @param storage The storage to deduplicate
+         * @return The deduplicated and weighted storage
+         */
+        DataStorage::ptr apply(AbstractDataStorage::ptr storage) const;
+        
+        /**
+         * Sets the number of threads used for hashing and grouping the rows.
+         * 
+         * @param _numThreads The number of threads
+         */
+        void setNumThreads(int _numThreads) throw(ConfigurationException)
+        {
+#ifndef LIBF_ENABLE_OPENMP
+            if (_numThreads != 1)
+            {
+                throw ConfigurationException("OpenMP support is disabled. Set number of threads to 1.");
+            }
+#endif
+            BOOST_ASSERT_MSG(_numThreads > 0, "The number of threads must be positive.");
+            numThreads = _numThreads;
+        }
+        
+        /**
+         * Returns the number of threads.
+         * 
+         * @return The number of threads
+         */
+        int getNumThreads() const
+        {
+            return numThreads;
+        }
+        
+    private:
+        /**
+         * The number of threads
+         */
+        int numThreads;
+    };
+    
     /**
      * Performs Z-Score normalization on a data set. 
      */
@@ -368,6 +666,188 @@ namespace libf {
         DataPoint mean;
     };
     
+    /**
+     * Reduces the dimensionality of a data set by a random projection 
+     * (Johnson-Lindenstrauss). The projection matrix does not depend on the
+     * data and can be very sparse, so that high dimensional data sets can be
+     * reduced in a single pass. Supported matrices:
+     * - METHOD_GAUSSIAN: Dense matrix with entries drawn from N(0, 1/M)
+     * - METHOD_ACHLIOPTAS: Entries sqrt(3/M)*{-1, 0, 1} with probabilities
+     *   {1/6, 2/3, 1/6}
+     * - METHOD_VERY_SPARSE: Like Achlioptas, but with s = sqrt(D) instead of 
+     *   3 (Li et al.)
+     */
+    class RandomProjection {
+    public:
+        /**
+         * Dense gaussian projection matrix
+         */
+        const static int METHOD_GAUSSIAN = 0;
+        /**
+         * Sparse projection matrix with density 1/3
+         */
+        const static int METHOD_ACHLIOPTAS = 1;
+        /**
+         * Sparse projection matrix with density 1/sqrt(D)
+         */
+        const static int METHOD_VERY_SPARSE = 2;
+        
+        RandomProjection() : method(METHOD_VERY_SPARSE), numDimensions(512), numThreads(1), inputDimensionality(0) {}
+        
+        /**
+         * Sets the type of the projection matrix.
+         * 
+         * @param _method The projection method
+         */
+        void setMethod(int _method)
+        {
+            BOOST_ASSERT_MSG(_method == METHOD_GAUSSIAN || _method == METHOD_ACHLIOPTAS || _method == METHOD_VERY_SPARSE, "Invalid projection method.");
+            method = _method;
+        }
+        
+        /**
+         * Returns the type of the projection matrix.
+         * 
+         * @return The projection method
+         */
+        int getMethod() const
+        {
+            return method;
+        }
+        
+        /**
+         * Sets the number of projected dimensions.
+         * 
+         * @param _numDimensions The number of projected dimensions
+         */
+        void setNumDimensions(int _numDimensions)
+        {
+            BOOST_ASSERT_MSG(_numDimensions > 0, "The number of dimensions must be positive.");
+            numDimensions = _numDimensions;
+        }
+        
+        /**
+         * Returns the number of projected dimensions.
+         * 
+         * @return The number of projected dimensions
+         */
+        int getNumDimensions() const
+        {
+            return numDimensions;
+        }
+        
+        /**
+         * Sets the number of threads used for applying the projection.
+         * 
+         * @param _numThreads The number of threads
+         */
+        void setNumThreads(int _numThreads) throw(ConfigurationException)
+        {
+#ifndef LIBF_ENABLE_OPENMP
+            if (_numThreads != 1)
+            {
+                throw ConfigurationException("OpenMP support is disabled. Set number of threads to 1.");
+            }
+#endif
+            BOOST_ASSERT_MSG(_numThreads > 0, "The number of threads must be positive.");
+            numThreads = _numThreads;
+        }
+        
+        /**
+         * Returns the number of threads.
+         * 
+         * @return The number of threads
+         */
+        int getNumThreads() const
+        {
+            return numThreads;
+        }
+        
+        /**
+         * Returns the dimensionality of the data points the projection was
+         * learned for. 
+         * 
+         * @return The input dimensionality
+         */
+        int getInputDimensionality() const
+        {
+            return inputDimensionality;
+        }
+        
+        /**
+         * Draws a projection matrix for the dimensionality of the given 
+         * storage. Only the dimensionality is used. 
+         * 
+         * @param storage A data storage to train the model on
+         */
+        void learn(AbstractDataStorage::ptr storage);
+        
+        /**
+         * Applies the projection to a single data point. 
+         * 
+         * @param x The data point to project
+         * @param result The projected data point
+         */
+        void project(const DataPoint & x, DataPoint & result) const;
+        
+        /**
+         * Applies the projection to a data storage. This only works on
+         * real data storages (no reference storages). 
+         * 
+         * @param storage A storage to apply the transformation 
+         */
+        void apply(DataStorage::ptr storage) const;
+        
+        /**
+         * Writes the learned model to a stream
+         * 
+         * @param stream to write the data to
+         */
+        void write(std::ostream & stream) const;
+        
+        /**
+         * Reads the model from a stream
+         * 
+         * @param stream The stream to read the model from
+         */
+        void read(std::istream & stream);
+        
+    private:
+        /**
+         * The type of the projection matrix
+         */
+        int method;
+        /**
+         * The number of projected dimensions
+         */
+        int numDimensions;
+        /**
+         * The number of threads
+         */
+        int numThreads;
+        /**
+         * The dimensionality of the data points
+         */
+        int inputDimensionality;
+        /**
+         * The dense projection matrix (METHOD_GAUSSIAN)
+         */
+        Eigen::MatrixXf R;
+        /**
+         * The sparse projection matrix in compressed row format. The non zero 
+         * entries of row m are at rowOffsets[m], ..., rowOffsets[m+1]-1.
+         */
+        std::vector<int> rowOffsets;
+        /**
+         * The column indices of the non zero entries
+         */
+        std::vector<int> columns;
+        /**
+         * The values of the non zero entries
+         */
+        std::vector<float> values;
+    };
+    
     /**
      * This class contains some useful feature space mappings. You can apply
      * a mapping by using the map operation on a DataStorage. 
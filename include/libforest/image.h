@@ -0,0 +1,417 @@
+#ifndef LIBF_IMAGE_H
+#define LIBF_IMAGE_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include "data.h"
+#include "classifier.h"
+
+/**
+ * This file contains a pipeline for dense per-pixel classification. Pixel
+ * features are computed on demand during tree traversal directly from the
+ * image, such that no per-pixel data points have to be created.
+ */
+
+namespace libf {
+    
+    /**
+     * An image prepared for computing pixel features. The channels are stored
+     * as separate float planes together with their integral images. Pixels
+     * outside the image are clamped to the border.
+     */
+    class FeatureImage {
+    public:
+        typedef std::shared_ptr<FeatureImage> ptr;
+        
+        /**
+         * Creates a feature image from an OpenCV image of any depth with up
+         * to 4 channels.
+         *
+         * @param image The image
+         */
+        FeatureImage(const cv::Mat & image);
+        
+        /**
+         * Creates a feature image from interleaved float data.
+         *
+         * @param width The width of the image
+         * @param height The height of the image
+         * @param numChannels The number of channels
+         * @param data The pixels in row-major order with interleaved channels
+         */
+        FeatureImage(int width, int height, int numChannels, const std::vector<float> & data);
+        
+        /**
+         * Returns the width of the image.
+         *
+         * @return The width
+         */
+        int getWidth() const
+        {
+            return width;
+        }
+        
+        /**
+         * Returns the height of the image.
+         *
+         * @return The height
+         */
+        int getHeight() const
+        {
+            return height;
+        }
+        
+        /**
+         * Returns the number of channels.
+         *
+         * @return The number of channels
+         */
+        int getNumChannels() const
+        {
+            return numChannels;
+        }
+        
+        /**
+         * Returns the value of a pixel. Coordinates outside the image are
+         * clamped.
+         *
+         * @param channel The channel
+         * @param x The column
+         * @param y The row
+         * @return The pixel value
+         */
+        float getPixel(int channel, int x, int y) const
+        {
+            x = std::min(std::max(x, 0), width - 1);
+            y = std::min(std::max(y, 0), height - 1);
+            return pixels[(channel*height + y)*width + x];
+        }
+        
+        /**
+         * Returns the mean over a box of size (2r+1)x(2r+1) using the integral
+         * image. The box is cropped to the image.
+         *
+         * @param channel The channel
+         * @param x The column of the center
+         * @param y The row of the center
+         * @param r The radius of the box
+         * @return The mean pixel value within the box
+         */
+        float getBoxMean(int channel, int x, int y, int r) const
+        {
+            const int x0 = std::min(std::max(x - r, 0), width - 1);
+            const int y0 = std::min(std::max(y - r, 0), height - 1);
+            const int x1 = std::min(std::max(x + r, 0), width - 1) + 1;
+            const int y1 = std::min(std::max(y + r, 0), height - 1) + 1;
+            
+            const double* I = &integral[channel*(height + 1)*(width + 1)];
+            const int stride = width + 1;
+            const double sum = I[y1*stride + x1] - I[y0*stride + x1] - I[y1*stride + x0] + I[y0*stride + x0];
+            
+            return static_cast<float>(sum/((x1 - x0)*(y1 - y0)));
+        }
+    
+    private:
+        /**
+         * Computes the integral images of all channels.
+         */
+        void computeIntegralImages();
+        
+        /**
+         * The width of the image
+         */
+        int width;
+        /**
+         * The height of the image
+         */
+        int height;
+        /**
+         * The number of channels
+         */
+        int numChannels;
+        /**
+         * The channel planes
+         */
+        std::vector<float> pixels;
+        /**
+         * The integral images of size (height+1)x(width+1) per channel
+         */
+        std::vector<double> integral;
+    };
+    
+    /**
+     * A single pixel feature. All offsets are relative to the pixel that is
+     * classified.
+     */
+    struct PixelFeature {
+        /**
+         * The feature type (see ImageFeatureBank)
+         */
+        int type;
+        /**
+         * The channel the feature is computed on
+         */
+        int channel;
+        /**
+         * The first offset
+         */
+        int dx1, dy1;
+        /**
+         * The second offset (difference features only)
+         */
+        int dx2, dy2;
+        /**
+         * The box radii (box features only)
+         */
+        int radius1, radius2;
+    };
+    
+    /**
+     * A bank of pixel features. The d-th feature of a pixel corresponds to
+     * dimension d of the data points trees are trained on, so that ordinary
+     * decision trees and forests can be used. Supported feature types:
+     * - FEATURE_PIXEL: I(p + u)
+     * - FEATURE_PIXEL_DIFFERENCE: I(p + u) - I(p + v)
+     * - FEATURE_BOX: Mean of I over the box around p + u
+     * - FEATURE_BOX_DIFFERENCE: Difference of the box means around p + u and
+     *   p + v
+     */
+    class ImageFeatureBank {
+    public:
+        typedef std::shared_ptr<ImageFeatureBank> ptr;
+        
+        const static int FEATURE_PIXEL = 0;
+        const static int FEATURE_PIXEL_DIFFERENCE = 1;
+        const static int FEATURE_BOX = 2;
+        const static int FEATURE_BOX_DIFFERENCE = 3;
+        
+        /**
+         * Adds a feature to the bank.
+         *
+         * @param feature The feature to add
+         */
+        void addFeature(const PixelFeature & feature)
+        {
+            BOOST_ASSERT_MSG(FEATURE_PIXEL <= feature.type && feature.type <= FEATURE_BOX_DIFFERENCE, "Invalid feature type.");
+            features.push_back(feature);
+        }
+        
+        /**
+         * Adds random features of all types.
+         *
+         * @param numFeatures The number of features to add
+         * @param numChannels The number of image channels
+         * @param maxOffset The maximum absolute offset
+         * @param maxRadius The maximum box radius
+         */
+        void generate(int numFeatures, int numChannels, int maxOffset, int maxRadius);
+        
+        /**
+         * Returns the number of features.
+         *
+         * @return The number of features
+         */
+        int getSize() const
+        {
+            return static_cast<int>(features.size());
+        }
+        
+        /**
+         * Returns the d-th feature.
+         *
+         * @param d The index of the feature
+         * @return The feature
+         */
+        const PixelFeature & getFeature(int d) const
+        {
+            BOOST_ASSERT_MSG(0 <= d && d < getSize(), "Invalid feature index.");
+            return features[d];
+        }
+        
+        /**
+         * Evaluates the d-th feature at a pixel.
+         *
+         * @param image The image
+         * @param d The index of the feature
+         * @param x The column of the pixel
+         * @param y The row of the pixel
+         * @return The feature value
+         */
+        float evaluate(const FeatureImage & image, int d, int x, int y) const
+        {
+            const PixelFeature & f = features[d];
+            switch (f.type)
+            {
+                case FEATURE_PIXEL:
+                    return image.getPixel(f.channel, x + f.dx1, y + f.dy1);
+                case FEATURE_PIXEL_DIFFERENCE:
+                    return image.getPixel(f.channel, x + f.dx1, y + f.dy1)
+                            - image.getPixel(f.channel, x + f.dx2, y + f.dy2);
+                case FEATURE_BOX:
+                    return image.getBoxMean(f.channel, x + f.dx1, y + f.dy1, f.radius1);
+                default:
+                    return image.getBoxMean(f.channel, x + f.dx1, y + f.dy1, f.radius1)
+                            - image.getBoxMean(f.channel, x + f.dx2, y + f.dy2, f.radius2);
+            }
+        }
+        
+        /**
+         * Computes all features at a pixel. Use this to create training
+         * data.
+         *
+         * @param image The image
+         * @param x The column of the pixel
+         * @param y The row of the pixel
+         * @param result The feature vector
+         */
+        void extract(const FeatureImage & image, int x, int y, DataPoint & result) const;
+        
+        /**
+         * Adds the pixels of an image as training examples.
+         *
+         * @param image The image
+         * @param labels The label image (integer type, negative labels are ignored)
+         * @param stride Only every stride-th pixel in each direction is used
+         * @param storage The storage to add the examples to
+         */
+        void extract(const FeatureImage & image, const cv::Mat & labels, int stride, DataStorage::ptr storage) const;
+        
+        /**
+         * Reads the feature bank from a stream.
+         *
+         * @param stream The stream to read from
+         */
+        void read(std::istream & stream);
+        
+        /**
+         * Writes the feature bank to a stream.
+         *
+         * @param stream The stream to write to
+         */
+        void write(std::ostream & stream) const;
+    
+    private:
+        /**
+         * The features
+         */
+        std::vector<PixelFeature> features;
+    };
+    
+    /**
+     * Classifies every pixel of an image with a random forest trained on
+     * features from an ImageFeatureBank. The image is split into tiles that
+     * are processed in parallel.
+     */
+    class PixelClassifier {
+    public:
+        typedef std::shared_ptr<PixelClassifier> ptr;
+        
+        /**
+         * Constructor
+         *
+         * @param _forest The forest
+         * @param _featureBank The feature bank the forest was trained with
+         */
+        PixelClassifier(RandomForest<DecisionTree>::ptr _forest, ImageFeatureBank::ptr _featureBank) :
+                forest(_forest),
+                featureBank(_featureBank),
+                tileSize(64),
+                numThreads(1) {}
+        
+        /**
+         * Sets the side length of the tiles.
+         *
+         * @param _tileSize The tile size in pixels
+         */
+        void setTileSize(int _tileSize)
+        {
+            BOOST_ASSERT_MSG(_tileSize > 0, "The tile size must be positive.");
+            tileSize = _tileSize;
+        }
+        
+        /**
+         * Returns the side length of the tiles.
+         *
+         * @return The tile size in pixels
+         */
+        int getTileSize() const
+        {
+            return tileSize;
+        }
+        
+        /**
+         * Sets the number of threads.
+         *
+         * @param _numThreads The number of threads
+         */
+        void setNumThreads(int _numThreads) throw(ConfigurationException)
+        {
+#ifndef LIBF_ENABLE_OPENMP
+            if (_numThreads != 1)
+            {
+                throw ConfigurationException("OpenMP support is disabled. Set number of threads to 1.");
+            }
+#endif
+            BOOST_ASSERT_MSG(_numThreads > 0, "The number of threads must be positive.");
+            numThreads = _numThreads;
+        }
+        
+        /**
+         * Returns the number of threads.
+         *
+         * @return The number of threads
+         */
+        int getNumThreads() const
+        {
+            return numThreads;
+        }
+        
+        /**
+         * Computes the normalized class posteriors of all pixels.
+         *
+         * @param image The image
+         * @param posteriors The posteriors in row-major order with C values per pixel
+         * @param C The number of classes
+         */
+        void posteriorMap(const FeatureImage & image, std::vector<float> & posteriors, int & C) const;
+        
+        /**
+         * Computes the posterior map as one CV_32F image per class.
+         *
+         * @param image The image
+         * @param posteriors The posterior image of each class
+         */
+        void posteriorMap(const FeatureImage & image, std::vector<cv::Mat> & posteriors) const;
+        
+        /**
+         * Computes the most likely class of every pixel.
+         *
+         * @param image The image
+         * @param labels The label image (CV_32S)
+         */
+        void classify(const FeatureImage & image, cv::Mat & labels) const;
+    
+    private:
+        /**
+         * The forest
+         */
+        RandomForest<DecisionTree>::ptr forest;
+        /**
+         * The feature bank
+         */
+        ImageFeatureBank::ptr featureBank;
+        /**
+         * The side length of the tiles
+         */
+        int tileSize;
+        /**
+         * The number of threads
+         */
+        int numThreads;
+    };
+}
+
+#endif
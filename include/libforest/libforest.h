@@ -10,5 +10,8 @@
 #include "estimator.h"
 #include "estimator_tools.h"
 #include "estimator_learning.h"
+#include "image.h"
+#include "memory.h"
+#include "serving.h"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,358 @@
+#ifndef LIBF_MEMORY_H
+#define LIBF_MEMORY_H
+
+/**
+ * This file contains the memory resources the large containers of the
+ * library allocate from, e.g. the node arrays of the trees and the feature
+ * matrix of CompactDataStorage. The resource is picked up when a container
+ * is created, such that setting the default resource before learning or
+ * loading a model or creating a data set determines where its memory lives.
+ * It also contains the per-thread scratch memory for temporaries.
+ */
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <cstddef>
+#include <type_traits>
+#include <Eigen/Dense>
+
+namespace libf {
+    
+    /**
+     * The interface of all memory resources.
+     */
+    class AbstractMemoryResource {
+    public:
+        typedef std::shared_ptr<AbstractMemoryResource> ptr;
+        
+        virtual ~AbstractMemoryResource() {}
+        
+        /**
+         * Allocates memory aligned for any fundamental type.
+         *
+         * @param bytes The number of bytes
+         * @return The memory
+         */
+        virtual void* allocate(size_t bytes) = 0;
+        
+        /**
+         * Releases memory.
+         *
+         * @param p The memory
+         * @param bytes The number of bytes that have been allocated
+         */
+        virtual void deallocate(void* p, size_t bytes) = 0;
+        
+        /**
+         * Returns the resource new containers allocate from.
+         *
+         * @return The default resource
+         */
+        static ptr getDefault();
+        
+        /**
+         * Sets the resource new containers allocate from. Existing
+         * containers keep their resource.
+         *
+         * @param resource The new default resource
+         */
+        static void setDefault(ptr resource);
+    };
+    
+    /**
+     * Allocates from the heap. This is the default resource.
+     */
+    class HeapMemoryResource : public AbstractMemoryResource {
+    public:
+        typedef std::shared_ptr<HeapMemoryResource> ptr;
+        
+        virtual void* allocate(size_t bytes);
+        virtual void deallocate(void* p, size_t bytes);
+    };
+    
+    /**
+     * Backs large allocations with transparent huge pages. Large allocations
+     * are mapped separately, aligned to the huge page size and marked for
+     * huge pages, which removes most TLB misses when traversing large
+     * forests. Small allocations come from the heap. Where huge pages are
+     * not available the allocations are still aligned.
+     */
+    class HugePageMemoryResource : public AbstractMemoryResource {
+    public:
+        typedef std::shared_ptr<HugePageMemoryResource> ptr;
+        
+        /**
+         * The size of a huge page
+         */
+        const static size_t HUGE_PAGE_SIZE = 2 << 20;
+        
+        /**
+         * Constructor. The minimum size cannot be changed afterwards, as it 
+         * decides how every allocation is released.
+         * 
+         * @param _minSize The minimum size of allocations that are backed by
+         *                 huge pages
+         */
+        HugePageMemoryResource(size_t _minSize = HUGE_PAGE_SIZE) : minSize(_minSize) {}
+        
+        /**
+         * Returns the minimum size of allocations that are backed by huge
+         * pages.
+         *
+         * @return The minimum size in bytes
+         */
+        size_t getMinSize() const
+        {
+            return minSize;
+        }
+        
+        virtual void* allocate(size_t bytes);
+        virtual void deallocate(void* p, size_t bytes);
+    
+    private:
+        /**
+         * The minimum size of allocations that are backed by huge pages
+         */
+        const size_t minSize;
+    };
+    
+    /**
+     * Hands out memory from large blocks and releases it all at once when the
+     * arena is destroyed. Deallocating single allocations does nothing. Use
+     * this for many objects with the same lifetime, e.g. the trees of a
+     * forest; the nodes of all trees are then packed densely. The blocks
+     * are taken from an upstream resource, e.g. a HugePageMemoryResource.
+     * The arena is thread-safe.
+     */
+    class ArenaMemoryResource : public AbstractMemoryResource {
+    public:
+        typedef std::shared_ptr<ArenaMemoryResource> ptr;
+        
+        /**
+         * Constructor
+         *
+         * @param _blockSize The size of the blocks
+         * @param _upstream The resource the blocks are allocated from
+         */
+        ArenaMemoryResource(size_t _blockSize = 2 << 20, AbstractMemoryResource::ptr _upstream = std::make_shared<HeapMemoryResource>()) :
+                blockSize(_blockSize),
+                upstream(_upstream),
+                offset(0),
+                used(0) {}
+        
+        /**
+         * Releases all blocks.
+         */
+        virtual ~ArenaMemoryResource();
+        
+        virtual void* allocate(size_t bytes);
+        virtual void deallocate(void* p, size_t bytes);
+        
+        /**
+         * Returns the number of bytes handed out.
+         *
+         * @return The number of bytes
+         */
+        size_t getUsedMemory() const;
+        
+        /**
+         * Returns the number of bytes taken from the upstream resource.
+         *
+         * @return The number of bytes
+         */
+        size_t getReservedMemory() const;
+    
+    private:
+        /**
+         * The size of the blocks
+         */
+        size_t blockSize;
+        /**
+         * The upstream resource
+         */
+        AbstractMemoryResource::ptr upstream;
+        /**
+         * The blocks and their sizes
+         */
+        std::vector< std::pair<char*, size_t> > blocks;
+        /**
+         * The offset within the last block
+         */
+        size_t offset;
+        /**
+         * The number of bytes handed out
+         */
+        size_t used;
+        /**
+         * Guards the blocks
+         */
+        mutable std::mutex mutex;
+    };
+    
+    /**
+     * A standard allocator that allocates from a memory resource.
+     */
+    template <class T>
+    class Allocator {
+    public:
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_copy_assignment;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+        
+        /**
+         * Creates an allocator for the default resource.
+         */
+        Allocator() : resource(AbstractMemoryResource::getDefault()) {}
+        
+        /**
+         * Creates an allocator for a resource.
+         *
+         * @param _resource The resource
+         */
+        Allocator(AbstractMemoryResource::ptr _resource) : resource(_resource) {}
+        
+        template <class U>
+        Allocator(const Allocator<U> & other) : resource(other.getResource()) {}
+        
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(resource->allocate(n*sizeof(T)));
+        }
+        
+        void deallocate(T* p, size_t n)
+        {
+            resource->deallocate(p, n*sizeof(T));
+        }
+        
+        /**
+         * Returns the resource.
+         *
+         * @return The resource
+         */
+        AbstractMemoryResource::ptr getResource() const
+        {
+            return resource;
+        }
+    
+    private:
+        /**
+         * The resource
+         */
+        AbstractMemoryResource::ptr resource;
+    };
+    
+    template <class T, class U>
+    bool operator==(const Allocator<T> & a, const Allocator<U> & b)
+    {
+        return a.getResource() == b.getResource();
+    }
+    
+    template <class T, class U>
+    bool operator!=(const Allocator<T> & a, const Allocator<U> & b)
+    {
+        return !(a == b);
+    }
+    
+    /**
+     * Per-thread scratch memory for the temporaries of the learners and
+     * estimators. Temporaries are taken within a scope and handed back when
+     * the scope ends, such that the next scope on the same thread reuses
+     * them. As the buffers keep their size, loops over data of fixed
+     * dimensionality stop allocating after the first call.
+     */
+    class ScratchArena {
+    public:
+        /**
+         * Takes temporaries from the arena of the calling thread and returns
+         * them on destruction. Scopes nest.
+         */
+        class Scope {
+        public:
+            Scope() : 
+                    arena(ScratchArena::local()),
+                    vectorMark(arena.numVectors),
+                    matrixMark(arena.numMatrices) {}
+            
+            ~Scope()
+            {
+                arena.numVectors = vectorMark;
+                arena.numMatrices = matrixMark;
+            }
+            
+            /**
+             * Returns a vector that is valid until the scope ends. The
+             * contents are undefined.
+             *
+             * @param rows The number of rows
+             * @return The vector
+             */
+            Eigen::VectorXf & getVector(int rows);
+            
+            /**
+             * Returns a matrix that is valid until the scope ends. The
+             * contents are undefined.
+             *
+             * @param rows The number of rows
+             * @param cols The number of columns
+             * @return The matrix
+             */
+            Eigen::MatrixXf & getMatrix(int rows, int cols);
+            
+        private:
+            Scope(const Scope &);
+            Scope & operator=(const Scope &);
+            
+            /**
+             * The arena of this thread
+             */
+            ScratchArena & arena;
+            /**
+             * The number of vectors in use when the scope was opened
+             */
+            size_t vectorMark;
+            /**
+             * The number of matrices in use when the scope was opened
+             */
+            size_t matrixMark;
+        };
+        
+        /**
+         * Returns the arena of the calling thread.
+         *
+         * @return The arena
+         */
+        static ScratchArena & local();
+        
+        /**
+         * Returns the number of bytes held by the arena.
+         *
+         * @return The number of bytes
+         */
+        size_t getReservedMemory() const;
+        
+    private:
+        ScratchArena() : numVectors(0), numMatrices(0) {}
+        
+        /**
+         * The vectors; a deque keeps references stable when growing
+         */
+        std::deque<Eigen::VectorXf> vectors;
+        /**
+         * The number of vectors in use
+         */
+        size_t numVectors;
+        /**
+         * The matrices
+         */
+        std::deque<Eigen::MatrixXf> matrices;
+        /**
+         * The number of matrices in use
+         */
+        size_t numMatrices;
+    };
+}
+
+#endif
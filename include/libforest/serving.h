@@ -0,0 +1,776 @@
+#ifndef LIBF_SERVING_H
+#define LIBF_SERVING_H
+
+/**
+ * This file contains tools for serving classifiers to many concurrent
+ * requests within a single process.
+ */
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <unordered_map>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
+
+#include "data.h"
+#include "classifier.h"
+
+namespace libf {
+    
+    /**
+     * A fixed set of persistent worker threads that execute tasks in the
+     * order in which they were enqueued.
+     */
+    class ThreadPool {
+    public:
+        typedef std::shared_ptr<ThreadPool> ptr;
+        
+        /**
+         * Starts the worker threads.
+         *
+         * @param numThreads The number of worker threads
+         */
+        ThreadPool(int numThreads);
+        
+        /**
+         * Finishes all enqueued tasks and joins the worker threads.
+         */
+        ~ThreadPool();
+        
+        /**
+         * Enqueues a task.
+         *
+         * @param task The task to execute
+         */
+        void enqueue(std::function<void()> task);
+        
+        /**
+         * Returns the number of worker threads.
+         *
+         * @return The number of worker threads
+         */
+        int getNumThreads() const
+        {
+            return static_cast<int>(workers.size());
+        }
+    
+    private:
+        /**
+         * The main loop of a worker thread
+         */
+        void work();
+        
+        /**
+         * The worker threads
+         */
+        std::vector<std::thread> workers;
+        /**
+         * The pending tasks
+         */
+        std::deque< std::function<void()> > tasks;
+        /**
+         * Guards the task queue
+         */
+        std::mutex mutex;
+        /**
+         * Signals new tasks and shutdown
+         */
+        std::condition_variable condition;
+        /**
+         * Whether the pool is shutting down
+         */
+        bool stopping;
+    };
+    
+    /**
+     * Coalesces concurrent single point requests into batches. A request
+     * waits at most the configured time for other requests to arrive; then
+     * the batch is evaluated with classLogPosteriors on a thread pool and the
+     * futures of all requests are completed. This trades a bounded increase
+     * in latency for the throughput of batched inference.
+     *
+     * The scheduler is itself a classifier, such that it can replace the
+     * wrapped classifier wherever single points are classified concurrently.
+     */
+    class MicroBatchingClassifier : public AbstractClassifier {
+    public:
+        typedef std::shared_ptr<MicroBatchingClassifier> ptr;
+        
+        /**
+         * Starts the scheduler.
+         *
+         * @param _classifier The classifier to evaluate the batches with
+         * @param _pool The pool the batches are evaluated on
+         */
+        MicroBatchingClassifier(AbstractClassifier::ptr _classifier, ThreadPool::ptr _pool);
+        
+        /**
+         * Completes all pending requests and stops the scheduler.
+         */
+        virtual ~MicroBatchingClassifier();
+        
+        /**
+         * Sets the maximum time a request waits for a batch to fill up.
+         *
+         * @param _maxWait The maximum waiting time in microseconds
+         */
+        void setMaxWait(int _maxWait)
+        {
+            BOOST_ASSERT_MSG(_maxWait >= 0, "The waiting time must be non-negative.");
+            std::lock_guard<std::mutex> lock(mutex);
+            maxWait = _maxWait;
+        }
+        
+        /**
+         * Returns the maximum time a request waits for a batch to fill up.
+         *
+         * @return The maximum waiting time in microseconds
+         */
+        int getMaxWait() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return maxWait;
+        }
+        
+        /**
+         * Sets the maximum batch size. Full batches are dispatched
+         * immediately.
+         *
+         * @param _maxBatchSize The maximum number of points per batch
+         */
+        void setMaxBatchSize(int _maxBatchSize)
+        {
+            BOOST_ASSERT_MSG(_maxBatchSize > 0, "The batch size must be positive.");
+            std::lock_guard<std::mutex> lock(mutex);
+            maxBatchSize = _maxBatchSize;
+        }
+        
+        /**
+         * Returns the maximum batch size.
+         *
+         * @return The maximum number of points per batch
+         */
+        int getMaxBatchSize() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return maxBatchSize;
+        }
+        
+        /**
+         * Submits a data point for classification.
+         *
+         * @param x The data point
+         * @return The future log posterior probabilities
+         */
+        std::future< std::vector<float> > submit(const DataPoint & x) const;
+        
+        /**
+         * Returns the class log posterior log(p(c | x)). This blocks until
+         * the batch containing x has been evaluated.
+         *
+         * @param x The data point
+         * @param probabilities A vector of log posterior probabilities
+         */
+        virtual void classLogPosterior(const DataPoint & x, std::vector<float> & probabilities) const;
+        
+        /**
+         * Returns the number of requests that have been dispatched.
+         *
+         * @return The number of requests
+         */
+        int getNumRequests() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return numRequests;
+        }
+        
+        /**
+         * Returns the number of batches that have been dispatched.
+         *
+         * @return The number of batches
+         */
+        int getNumBatches() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return numBatches;
+        }
+        
+        /**
+         * Reads the wrapped classifier from a stream.
+         *
+         * @param stream The stream to read the classifier from
+         */
+        virtual void read(std::istream & stream);
+        
+        /**
+         * Writes the wrapped classifier to a stream.
+         *
+         * @param stream The stream to write the classifier to
+         */
+        virtual void write(std::ostream & stream) const;
+    
+    private:
+        /**
+         * A pending request
+         */
+        struct Request {
+            DataPoint x;
+            std::promise< std::vector<float> > result;
+            std::chrono::steady_clock::time_point arrival;
+        };
+        
+        /**
+         * The main loop of the scheduler thread
+         */
+        void schedule();
+        
+        /**
+         * Evaluates a batch and completes its requests.
+         *
+         * @param classifier The classifier
+         * @param batch The batch
+         */
+        static void evaluate(AbstractClassifier::ptr classifier, std::shared_ptr< std::vector<Request> > batch);
+        
+        /**
+         * The wrapped classifier
+         */
+        AbstractClassifier::ptr classifier;
+        /**
+         * The pool the batches are evaluated on
+         */
+        ThreadPool::ptr pool;
+        /**
+         * The maximum waiting time in microseconds
+         */
+        int maxWait;
+        /**
+         * The maximum batch size
+         */
+        int maxBatchSize;
+        /**
+         * The requests of the current batch
+         */
+        mutable std::vector<Request> pending;
+        /**
+         * The number of dispatched requests
+         */
+        int numRequests;
+        /**
+         * The number of dispatched batches
+         */
+        int numBatches;
+        /**
+         * Whether the scheduler is shutting down
+         */
+        bool stopping;
+        /**
+         * Guards the pending requests and the configuration
+         */
+        mutable std::mutex mutex;
+        /**
+         * Signals new requests and shutdown
+         */
+        mutable std::condition_variable condition;
+        /**
+         * The scheduler thread
+         */
+        std::thread scheduler;
+    };
+    
+    /**
+     * Evaluates the trees of a large forest in parallel for every single 
+     * request. The trees are split into tasks of consecutive trees; the 
+     * calling thread and up to all threads of a persistent pool claim tasks 
+     * and accumulate partial posteriors, which are summed once all tasks are
+     * done. The calling thread always takes part, such that a busy pool only
+     * delays but never blocks a request. The partial posteriors lie in 
+     * separate cache lines. 
+     */
+    template <class TreeType>
+    class TreeParallelClassifier : public AbstractClassifier {
+    public:
+        typedef std::shared_ptr< TreeParallelClassifier<TreeType> > ptr;
+        
+        /**
+         * Constructor
+         * 
+         * @param _forest The forest
+         * @param _pool The pool the trees are evaluated on
+         */
+        TreeParallelClassifier(typename RandomForest<TreeType>::ptr _forest, ThreadPool::ptr _pool) : 
+                forest(_forest), 
+                pool(_pool), 
+                treesPerTask(64)
+        {
+            updateNumClasses();
+        }
+        
+        /**
+         * Sets the number of consecutive trees evaluated by one task. 
+         * 
+         * @param _treesPerTask The number of trees per task
+         */
+        void setTreesPerTask(int _treesPerTask)
+        {
+            BOOST_ASSERT_MSG(_treesPerTask > 0, "The number of trees per task must be positive.");
+            treesPerTask = _treesPerTask;
+        }
+        
+        /**
+         * Returns the number of consecutive trees evaluated by one task. 
+         * 
+         * @return The number of trees per task
+         */
+        int getTreesPerTask() const
+        {
+            return treesPerTask;
+        }
+        
+        /**
+         * Returns the class log posterior log(p(c | x)). 
+         * 
+         * @param x The data point
+         * @param probabilities A vector of log posterior probabilities
+         */
+        virtual void classLogPosterior(const DataPoint & x, std::vector<float> & probabilities) const
+        {
+            const int T = forest->getSize();
+            const int numTasks = (T + treesPerTask - 1)/treesPerTask;
+            
+            if (numTasks <= 1)
+            {
+                forest->classLogPosterior(x, probabilities);
+                return;
+            }
+            
+            auto request = std::make_shared<Request>();
+            request->forest = forest.get();
+            request->x = &x;
+            request->treesPerTask = treesPerTask;
+            request->numTasks = numTasks;
+            request->nextTask = 0;
+            request->remaining = numTasks;
+            request->done = false;
+            // Pad every partial posterior to whole cache lines and leave one 
+            // line in between, independent of the alignment of the buffer
+            request->stride = (numClasses + 15)/16*16 + 16;
+            request->partials.assign(numTasks*request->stride, 0);
+            
+            const int numHelpers = std::min(pool->getNumThreads(), numTasks - 1);
+            for (int i = 0; i < numHelpers; i++)
+            {
+                pool->enqueue([request] () {
+                    run(*request);
+                });
+            }
+            
+            run(*request);
+            
+            {
+                std::unique_lock<std::mutex> lock(request->mutex);
+                request->condition.wait(lock, [&request] { return request->done; });
+            }
+            
+            // Reduce the partial posteriors
+            probabilities.assign(numClasses, 0);
+            for (int t = 0; t < numTasks; t++)
+            {
+                const float* partial = &request->partials[t*request->stride];
+                for (int c = 0; c < numClasses; c++)
+                {
+                    probabilities[c] += partial[c];
+                }
+            }
+        }
+        
+        /**
+         * Reads a forest from a stream and classifies with it from then on. 
+         * The forest given to the constructor is left unchanged. 
+         * 
+         * @param stream The stream to read the forest from
+         */
+        virtual void read(std::istream & stream)
+        {
+            // RandomForest::read appends to the existing trees
+            typename RandomForest<TreeType>::ptr newForest = std::make_shared< RandomForest<TreeType> >();
+            newForest->read(stream);
+            forest = newForest;
+            updateNumClasses();
+        }
+        
+        /**
+         * Writes the forest to a stream. 
+         * 
+         * @param stream The stream to write the forest to
+         */
+        virtual void write(std::ostream & stream) const
+        {
+            forest->write(stream);
+        }
+        
+    private:
+        /**
+         * Determines the number of classes from the first tree of the forest.
+         */
+        void updateNumClasses()
+        {
+            BOOST_ASSERT_MSG(forest->getSize() > 0, "Cannot classify with an empty forest.");
+            
+            // All leaf histograms have one entry per class
+            std::shared_ptr<TreeType> tree = forest->getTree(0);
+            int leaf = 0;
+            while (!tree->getNodeConfig(leaf).isLeafNode())
+            {
+                leaf = tree->getNodeConfig(leaf).getLeftChild();
+            }
+            numClasses = static_cast<int>(tree->getNodeData(leaf).histogram.size());
+        }
+        
+        /**
+         * The state of a single request shared by all threads working on it
+         */
+        struct Request {
+            const RandomForest<TreeType>* forest;
+            const DataPoint* x;
+            int treesPerTask;
+            int numTasks;
+            int stride;
+            std::atomic<int> nextTask;
+            std::atomic<int> remaining;
+            std::vector<float> partials;
+            std::mutex mutex;
+            std::condition_variable condition;
+            bool done;
+        };
+        
+        /**
+         * Claims and evaluates tasks until none are left. 
+         * 
+         * @param request The request
+         */
+        static void run(Request & request)
+        {
+            while (true)
+            {
+                const int task = request.nextTask.fetch_add(1);
+                if (task >= request.numTasks)
+                {
+                    return;
+                }
+                
+                float* partial = &request.partials[task*request.stride];
+                const int end = std::min((task + 1)*request.treesPerTask, request.forest->getSize());
+                for (int i = task*request.treesPerTask; i < end; i++)
+                {
+                    const TreeType & tree = *request.forest->getTree(i);
+                    const std::vector<float> & hist = tree.getNodeData(tree.findLeafNode(*request.x)).histogram;
+                    
+                    for (size_t c = 0; c < hist.size(); c++)
+                    {
+                        partial[c] += hist[c];
+                    }
+                }
+                
+                if (request.remaining.fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> lock(request.mutex);
+                    request.done = true;
+                    request.condition.notify_one();
+                }
+            }
+        }
+        
+        /**
+         * The forest
+         */
+        typename RandomForest<TreeType>::ptr forest;
+        /**
+         * The pool the trees are evaluated on
+         */
+        ThreadPool::ptr pool;
+        /**
+         * The number of trees per task
+         */
+        int treesPerTask;
+        /**
+         * The number of classes
+         */
+        int numClasses;
+    };
+    
+    /**
+     * Memorizes the posteriors of a classifier for repeated inputs. The 
+     * cache is keyed by a hash of the input, which can be quantized such 
+     * that nearly identical inputs share an entry; the posterior of the 
+     * first input seen is returned for all of them. Entries are evicted in 
+     * least recently used order once the memory bound is reached. The 
+     * cache is split into shards with their own locks. 
+     */
+    class CachedClassifier : public AbstractClassifier {
+    public:
+        typedef std::shared_ptr<CachedClassifier> ptr;
+        
+        /**
+         * The number of shards
+         */
+        const static int NUM_SHARDS = 16;
+        
+        /**
+         * Constructor
+         * 
+         * @param _classifier The classifier whose posteriors are cached
+         */
+        CachedClassifier(AbstractClassifier::ptr _classifier);
+        
+        /**
+         * Sets the maximum memory used by the entries. Existing entries are 
+         * evicted on the next insertion into their shard. Must not be called
+         * while the cache is in use. 
+         * 
+         * @param _maxMemory The memory bound in bytes
+         */
+        void setMaxMemory(size_t _maxMemory)
+        {
+            maxMemory = _maxMemory;
+        }
+        
+        /**
+         * Returns the maximum memory used by the entries. 
+         * 
+         * @return The memory bound in bytes
+         */
+        size_t getMaxMemory() const
+        {
+            return maxMemory;
+        }
+        
+        /**
+         * Sets the quantization step. Inputs are rounded to multiples of the 
+         * step before looking them up. A step of 0 only matches identical 
+         * inputs. Must not be called while the cache is in use; clear the 
+         * cache after changing the step. 
+         * 
+         * @param _quantization The quantization step
+         */
+        void setQuantization(float _quantization)
+        {
+            BOOST_ASSERT_MSG(_quantization >= 0, "The quantization step must be non-negative.");
+            quantization = _quantization;
+        }
+        
+        /**
+         * Returns the quantization step. 
+         * 
+         * @return The quantization step
+         */
+        float getQuantization() const
+        {
+            return quantization;
+        }
+        
+        /**
+         * Returns the class log posterior log(p(c | x)). 
+         * 
+         * @param x The data point
+         * @param probabilities A vector of log posterior probabilities
+         */
+        virtual void classLogPosterior(const DataPoint & x, std::vector<float> & probabilities) const;
+        
+        /**
+         * Removes all entries. 
+         */
+        void clear();
+        
+        /**
+         * Returns the number of lookups that were answered from the cache. 
+         * 
+         * @return The number of hits
+         */
+        uint64_t getNumHits() const
+        {
+            return numHits.load(std::memory_order_relaxed);
+        }
+        
+        /**
+         * Returns the number of lookups that required evaluating the 
+         * classifier. 
+         * 
+         * @return The number of misses
+         */
+        uint64_t getNumMisses() const
+        {
+            return numMisses.load(std::memory_order_relaxed);
+        }
+        
+        /**
+         * Returns the fraction of lookups answered from the cache. 
+         * 
+         * @return The hit rate
+         */
+        float getHitRate() const;
+        
+        /**
+         * Returns the memory currently used by the entries. 
+         * 
+         * @return The used memory in bytes
+         */
+        size_t getMemoryUsage() const;
+        
+        /**
+         * Reads the wrapped classifier from a stream and clears the cache. 
+         * 
+         * @param stream The stream to read the classifier from
+         */
+        virtual void read(std::istream & stream);
+        
+        /**
+         * Writes the wrapped classifier to a stream. 
+         * 
+         * @param stream The stream to write the classifier to
+         */
+        virtual void write(std::ostream & stream) const;
+        
+    private:
+        /**
+         * A cached posterior
+         */
+        struct Entry {
+            uint64_t hash;
+            std::vector<float> key;
+            std::vector<float> probabilities;
+        };
+        
+        /**
+         * A shard of the cache. The list is in least recently used order. 
+         */
+        struct Shard {
+            std::mutex mutex;
+            std::list<Entry> entries;
+            std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+            size_t memory;
+        };
+        
+        /**
+         * Computes the (quantized) key of a data point and its hash. 
+         * 
+         * @param x The data point
+         * @param key The key
+         * @return The hash of the key
+         */
+        uint64_t computeKey(const DataPoint & x, std::vector<float> & key) const;
+        
+        /**
+         * Returns the memory occupied by an entry. 
+         * 
+         * @param entry The entry
+         * @return The memory in bytes
+         */
+        static size_t getMemory(const Entry & entry);
+        
+        /**
+         * The wrapped classifier
+         */
+        AbstractClassifier::ptr classifier;
+        /**
+         * The memory bound in bytes
+         */
+        size_t maxMemory;
+        /**
+         * The quantization step
+         */
+        float quantization;
+        /**
+         * The shards
+         */
+        mutable Shard shards[NUM_SHARDS];
+        /**
+         * The number of hits
+         */
+        mutable std::atomic<uint64_t> numHits;
+        /**
+         * The number of misses
+         */
+        mutable std::atomic<uint64_t> numMisses;
+    };
+    
+    /**
+     * A thread-safe histogram of latencies. Bucket b counts the latencies in
+     * [2^b, 2^(b+1)) microseconds; bucket 0 also contains latencies below
+     * one microsecond. 
+     */
+    class LatencyHistogram {
+    public:
+        typedef std::shared_ptr<LatencyHistogram> ptr;
+        
+        /**
+         * The number of buckets
+         */
+        const static int NUM_BUCKETS = 32;
+        
+        LatencyHistogram();
+        
+        /**
+         * Records a latency. 
+         * 
+         * @param microseconds The latency in microseconds
+         */
+        void record(int64_t microseconds);
+        
+        /**
+         * Returns the number of recorded latencies. 
+         * 
+         * @return The number of recorded latencies
+         */
+        int64_t getCount() const;
+        
+        /**
+         * Returns the number of latencies in a bucket. 
+         * 
+         * @param b The bucket
+         * @return The number of latencies in the bucket
+         */
+        int64_t getBucketCount(int b) const
+        {
+            BOOST_ASSERT_MSG(0 <= b && b < NUM_BUCKETS, "Invalid bucket.");
+            return buckets[b].load(std::memory_order_relaxed);
+        }
+        
+        /**
+         * Returns an upper bound on the given percentile. 
+         * 
+         * @param p The percentile in [0, 100]
+         * @return The upper end of the bucket containing the percentile in microseconds
+         */
+        int64_t getPercentile(float p) const;
+        
+        /**
+         * Resets all buckets. 
+         */
+        void reset();
+        
+        /**
+         * Prints the non-empty buckets and the common percentiles. 
+         * 
+         * @param stream The stream to print to
+         */
+        void print(std::ostream & stream) const;
+        
+    private:
+        /**
+         * The buckets
+         */
+        std::atomic<int64_t> buckets[NUM_BUCKETS];
+    };
+}
+
+#endif
@@ -4,11 +4,16 @@
 #include <vector>
 #include <functional>
 #include <type_traits>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cstdint>
 
 #include "util.h"
 #include "error_handling.h"
 #include "io.h"
 #include "data.h"
+#include "memory.h"
 
 namespace libf {
     /**
@@ -137,6 +142,217 @@ namespace libf {
         virtual void write(std::ostream & stream) const = 0;
     };
     
+    /**
+     * Counts how often the leaves of a tree are reached. Every thread counts
+     * into its own block, such that profiling does not add contention; the 
+     * blocks are merged on demand. Since the path to a leaf is unique, the 
+     * visit counts of the inner nodes follow from the leaf hits (see 
+     * AbstractTree::getNodeVisits). 
+     */
+    class TreeProfiler {
+    public:
+        typedef std::shared_ptr<TreeProfiler> ptr;
+        
+        /**
+         * Constructor
+         * 
+         * @param _numNodes The number of nodes of the profiled tree
+         */
+        TreeProfiler(int _numNodes) : id(nextId()), slot(acquireSlot()), numNodes(_numNodes) {}
+        
+        /**
+         * Destructor
+         */
+        ~TreeProfiler()
+        {
+            releaseSlot(slot);
+        }
+        
+        /**
+         * Returns the number of nodes of the profiled tree. 
+         * 
+         * @return The number of nodes
+         */
+        int getNumNodes() const
+        {
+            return numNodes;
+        }
+        
+        /**
+         * Records that a leaf has been reached. 
+         * 
+         * @param leaf The index of the leaf
+         */
+        void recordLeaf(int leaf)
+        {
+            BOOST_ASSERT_MSG(0 <= leaf && leaf < numNodes, "Invalid node index.");
+            
+            // Only the owning thread writes to a block, so no atomic 
+            // read-modify-write is necessary
+            std::atomic<uint64_t> & counter = getBlock()[leaf];
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        
+        /**
+         * Merges the leaf hits of all threads. 
+         * 
+         * @param hits The number of hits of every node (0 for inner nodes)
+         */
+        void getLeafHits(std::vector<uint64_t> & hits) const
+        {
+            hits.assign(numNodes, 0);
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t b = 0; b < blocks.size(); b++)
+            {
+                for (int v = 0; v < numNodes; v++)
+                {
+                    hits[v] += blocks[b][v].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        
+        /**
+         * Resets all counters. 
+         */
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t b = 0; b < blocks.size(); b++)
+            {
+                for (int v = 0; v < numNodes; v++)
+                {
+                    blocks[b][v].store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+        
+    private:
+        typedef std::unique_ptr< std::atomic<uint64_t>[] > Block;
+        
+        /**
+         * The block of a thread for the profiler with the given id
+         */
+        struct ThreadBlock {
+            uint64_t id;
+            std::atomic<uint64_t>* block;
+        };
+        
+        /**
+         * The slots that are not used by a living profiler
+         */
+        struct SlotRegistry {
+            SlotRegistry() : numSlots(0) {}
+            
+            std::mutex mutex;
+            std::vector<int> freeSlots;
+            int numSlots;
+        };
+        
+        /**
+         * Returns a unique id for every profiler. 
+         */
+        static uint64_t nextId()
+        {
+            static std::atomic<uint64_t> counter(0);
+            return counter++;
+        }
+        
+        /**
+         * Returns the registry of the slots. 
+         */
+        static SlotRegistry & getSlotRegistry()
+        {
+            static SlotRegistry registry;
+            return registry;
+        }
+        
+        /**
+         * Returns a slot that is not used by any living profiler. The slots
+         * are dense, such that every thread can find its blocks with a 
+         * single index lookup. 
+         */
+        static int acquireSlot()
+        {
+            SlotRegistry & registry = getSlotRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            
+            if (registry.freeSlots.size() == 0)
+            {
+                return registry.numSlots++;
+            }
+            
+            const int slot = registry.freeSlots.back();
+            registry.freeSlots.pop_back();
+            return slot;
+        }
+        
+        /**
+         * Returns a slot to the registry. 
+         */
+        static void releaseSlot(int slot)
+        {
+            SlotRegistry & registry = getSlotRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.freeSlots.push_back(slot);
+        }
+        
+        /**
+         * Returns the counters of the calling thread. 
+         */
+        std::atomic<uint64_t>* getBlock()
+        {
+            static thread_local std::vector<ThreadBlock> threadBlocks;
+            
+            if (slot >= static_cast<int>(threadBlocks.size()))
+            {
+                const ThreadBlock empty = {0, 0};
+                threadBlocks.resize(slot + 1, empty);
+            }
+            
+            // Slots are reused by later profilers, the id tells whether the
+            // block belongs to this one
+            ThreadBlock & entry = threadBlocks[slot];
+            if (entry.block == 0 || entry.id != id)
+            {
+                Block newBlock(new std::atomic<uint64_t>[numNodes]);
+                for (int v = 0; v < numNodes; v++)
+                {
+                    newBlock[v].store(0, std::memory_order_relaxed);
+                }
+                
+                entry.id = id;
+                entry.block = newBlock.get();
+                
+                std::lock_guard<std::mutex> lock(mutex);
+                blocks.push_back(std::move(newBlock));
+            }
+            
+            return entry.block;
+        }
+        
+        /**
+         * The id of this profiler
+         */
+        const uint64_t id;
+        /**
+         * The slot of this profiler in the blocks of the threads
+         */
+        const int slot;
+        /**
+         * The number of nodes
+         */
+        const int numNodes;
+        /**
+         * The counters of all threads
+         */
+        std::vector<Block> blocks;
+        /**
+         * Guards the list of blocks
+         */
+        mutable std::mutex mutex;
+    };
+    
     /**
      * This is the base class for all split trees. Each node in a tree has three
      * data unit associated with it:
@@ -302,11 +518,102 @@ namespace libf {
          */
         virtual int findLeafNode(const DataPoint & x) const = 0;
         
+        /**
+         * Enables profiling. Every leaf reached by findLeafNode and the 
+         * batched kernels is counted. The tree must not be changed while 
+         * profiling is enabled. 
+         */
+        void enableProfiling()
+        {
+            profiler = std::make_shared<TreeProfiler>(getNumNodes());
+        }
+        
+        /**
+         * Disables profiling and discards the counters. 
+         */
+        void disableProfiling()
+        {
+            profiler.reset();
+        }
+        
+        /**
+         * Returns the profiler or an empty pointer if profiling is disabled. 
+         * 
+         * @return The profiler
+         */
+        TreeProfiler::ptr getProfiler() const
+        {
+            return profiler;
+        }
+        
+        /**
+         * Records that a leaf has been reached if profiling is enabled. 
+         * 
+         * @param leaf The index of the leaf
+         * @return The index of the leaf
+         */
+        int profileLeaf(int leaf) const
+        {
+            if (profiler)
+            {
+                profiler->recordLeaf(leaf);
+            }
+            return leaf;
+        }
+        
+        /**
+         * Returns how often every node has been visited since profiling was 
+         * enabled. 
+         * 
+         * @param visits The number of visits of every node
+         */
+        void getNodeVisits(std::vector<uint64_t> & visits) const
+        {
+            BOOST_ASSERT_MSG(profiler, "Profiling is disabled.");
+            BOOST_ASSERT_MSG(profiler->getNumNodes() == getNumNodes(), "The tree has changed since profiling was enabled.");
+            
+            profiler->getLeafHits(visits);
+            
+            // Children always have larger indices than their parents
+            for (int v = getNumNodes() - 1; v >= 0; v--)
+            {
+                if (!getNodeConfig(v).isLeafNode())
+                {
+                    visits[v] = visits[getNodeConfig(v).getLeftChild()] + visits[getNodeConfig(v).getRightChild()];
+                }
+            }
+        }
+        
+        /**
+         * Writes the profile as CSV with the columns node, depth, leaf, visits
+         * and the fraction of the visits of the root. 
+         * 
+         * @param stream The stream to write to
+         * @param prefix Prepended to every row, e.g. a tree index
+         */
+        void writeProfile(std::ostream & stream, const std::string & prefix = "") const
+        {
+            std::vector<uint64_t> visits;
+            getNodeVisits(visits);
+            
+            for (int v = 0; v < getNumNodes(); v++)
+            {
+                stream << prefix << v << "," << getNodeConfig(v).getDepth() << "," 
+                        << getNodeConfig(v).isLeafNode() << "," << visits[v] << ","
+                        << (visits[0] > 0 ? visits[v]/static_cast<double>(visits[0]) : 0) << std::endl;
+            }
+        }
+        
     private:
         /**
-         * The node array
+         * The node array. It is allocated from the default memory resource
+         * at the time the tree is created. 
          */
-        std::vector< std::pair<Config, Data> > nodes;
+        std::vector< std::pair<Config, Data>, Allocator< std::pair<Config, Data> > > nodes;
+        /**
+         * The profiler if profiling is enabled
+         */
+        TreeProfiler::ptr profiler;
     };
     
     /**
@@ -443,7 +750,190 @@ namespace libf {
                 }
             }
 
-            return node;
+            return this->profileLeaf(node);
+        }
+        
+        /**
+         * Passes a data point through the tree whose features are computed 
+         * on demand. Only the features tested on the path are evaluated, and
+         * no DataPoint has to be materialized. 
+         * 
+         * @param feature A function object that returns the d-th feature
+         * @return The index of the leaf node the data point ends up in
+         */
+        template <class FeatureFunction>
+        int findLeafNodeLazy(const FeatureFunction & feature) const
+        {
+            int node = 0;
+            
+            while (!this->getNodeConfig(node).isLeafNode())
+            {
+                const AxisAlignedSplitTreeNodeConfig & config = this->getNodeConfig(node);
+                
+                if (feature(config.getSplitFeature()) < config.getThreshold())
+                {
+                    node = config.getLeftChild();
+                }
+                else
+                {
+                    node = config.getRightChild();
+                }
+            }
+            
+            return this->profileLeaf(node);
+        }
+    };
+    
+    /**
+     * This is the node configuration for trees with categorical splits. A 
+     * node either performs an ordinary threshold split or, if a category set
+     * is given, sends all points whose category x(feature) is contained in 
+     * the set to the left child. Categories are non-negative integers stored
+     * as floats; the set is a bitset. 
+     */
+    class CategoricalSplitTreeNodeConfig : public AxisAlignedSplitTreeNodeConfig {
+    public:
+        CategoricalSplitTreeNodeConfig() : AxisAlignedSplitTreeNodeConfig() {}
+        
+        virtual ~CategoricalSplitTreeNodeConfig() {}
+        
+        /**
+         * Returns true if this node performs a categorical split. 
+         * 
+         * @return True if the node has a category set
+         */
+        bool isCategorical() const
+        {
+            return categories.size() > 0;
+        }
+        
+        /**
+         * Sets the categories that go to the left child. An empty list turns
+         * the node into a threshold split. 
+         * 
+         * @param leftCategories The categories going to the left
+         */
+        void setLeftCategories(const std::vector<int> & leftCategories)
+        {
+            categories.clear();
+            for (size_t i = 0; i < leftCategories.size(); i++)
+            {
+                BOOST_ASSERT_MSG(leftCategories[i] >= 0, "Categories must be non-negative.");
+                const size_t word = leftCategories[i]/64;
+                if (word >= categories.size())
+                {
+                    categories.resize(word + 1, 0);
+                }
+                categories[word] |= static_cast<uint64_t>(1) << (leftCategories[i]%64);
+            }
+        }
+        
+        /**
+         * Returns true if the given category goes to the left child.
+         * 
+         * @param category The category
+         * @return True if the category is in the left set
+         */
+        bool isLeftCategory(int category) const
+        {
+            if (category < 0 || category/64 >= static_cast<int>(categories.size()))
+            {
+                return false;
+            }
+            return (categories[category/64] >> (category%64)) & 1;
+        }
+        
+        /**
+         * Returns true if the data point is passed to the left child.
+         * 
+         * @param x The data point
+         * @return True if x goes to the left child
+         */
+        bool goesLeft(const DataPoint & x) const
+        {
+            const float value = x(getSplitFeature());
+            if (isCategorical())
+            {
+                return isLeftCategory(static_cast<int>(value));
+            }
+            return value < getThreshold();
+        }
+        
+        /**
+         * Reads the tree from a stream. 
+         * 
+         * @param stream The stream to read the tree from
+         */
+        void read(std::istream & stream)
+        {
+            AxisAlignedSplitTreeNodeConfig::read(stream);
+            readBinary(stream, categories);
+        }
+        
+        /**
+         * Writes the tree to a stream
+         * 
+         * @param stream The stream to write the tree to.
+         */
+        void write(std::ostream & stream) const
+        {
+            AxisAlignedSplitTreeNodeConfig::write(stream);
+            writeBinary(stream, categories);
+        }
+        
+    private:
+        /**
+         * The bitset of categories that go to the left child
+         */
+        std::vector<uint64_t> categories;
+    };
+    
+    /**
+     * This is a base class for trees that split the space using axis aligned
+     * threshold splits on numerical features and subset splits on 
+     * categorical features. 
+     */
+    template <class Base>
+    class AbstractCategoricalSplitTree : public Base {
+    public:
+        /**
+         * Creates an empty split tree.
+         */
+        AbstractCategoricalSplitTree() : Base() {}
+        
+        /**
+         * Destructor.
+         */
+        virtual ~AbstractCategoricalSplitTree() {}
+        
+        /**
+         * Passes the data point through the tree and returns the index of the
+         * leaf node it ends up in. 
+         * 
+         * @param x The data point to pass down the tree
+         * @return The index of the leaf node v ends up in
+         */
+        virtual int findLeafNode(const DataPoint & x) const
+        {
+            // Select the root node as current node
+            int node = 0;
+
+            // Follow the tree until we hit a leaf node
+            while (!this->getNodeConfig(node).isLeafNode())
+            {
+                const CategoricalSplitTreeNodeConfig & config = this->getNodeConfig(node);
+                
+                if (config.goesLeft(x))
+                {
+                    node = config.getLeftChild();
+                }
+                else
+                {
+                    node = config.getRightChild();
+                }
+            }
+
+            return this->profileLeaf(node);
         }
     };
     
@@ -666,7 +1156,7 @@ namespace libf {
                 }
             }
 
-            return node;
+            return this->profileLeaf(node);
         }
     };
     
@@ -762,6 +1252,43 @@ namespace libf {
             trees.erase(trees.begin() + i);
         }
         
+        /**
+         * Enables profiling on all trees. 
+         */
+        void enableProfiling()
+        {
+            for (int i = 0; i < getSize(); i++)
+            {
+                getTree(i)->enableProfiling();
+            }
+        }
+        
+        /**
+         * Disables profiling on all trees. 
+         */
+        void disableProfiling()
+        {
+            for (int i = 0; i < getSize(); i++)
+            {
+                getTree(i)->disableProfiling();
+            }
+        }
+        
+        /**
+         * Writes the profiles of all trees as CSV with the columns tree, node,
+         * depth, leaf, visits and the fraction of the visits of the root. 
+         * 
+         * @param stream The stream to write to
+         */
+        void writeProfile(std::ostream & stream) const
+        {
+            stream << "tree,node,depth,leaf,visits,fraction" << std::endl;
+            for (int i = 0; i < getSize(); i++)
+            {
+                getTree(i)->writeProfile(stream, std::to_string(i) + ",");
+            }
+        }
+        
     private:
         /**
          * The individual decision trees. 
@@ -819,7 +1346,7 @@ namespace libf {
                 }
             }
 
-            return node;
+            return this->profileLeaf(node);
         }
     };
     
@@ -6,6 +6,9 @@
 #include "fastlog/fastlog.h"
 #include <vector>
 #include <iostream>
+#include <string>
+#include <random>
+#include <cstdint>
 #include <Eigen/Dense>
 #include <Eigen/LU>
 
@@ -107,6 +110,45 @@ namespace libf {
             }
         }
         
+        /**
+         * Applies a permutation to the vector in place. The semantics are the
+         * same as for permute(permutation, in, out), i.e. the i-th element is
+         * moved to position permutation[i]. The permutation is decomposed 
+         * into its cycles, and each cycle is rotated by moving (not copying)
+         * the elements. Thus, only one temporary element and one bit per
+         * element are needed. 
+         * 
+         * @param permutation The permutation of the vector entries as a list of images
+         * @param v The vector to permute
+         */
+        template <class T>
+        static void permuteInPlace(const std::vector<int> & permutation, std::vector<T> & v) throw (AssertionException)
+        {
+            BOOST_ASSERT_MSG(permutation.size() == v.size(), "The permutation has invalid length.");
+            BOOST_ASSERT_MSG(isValidPermutation(permutation), "The given vector does not encode a valid permutation.");
+            
+            const int N = static_cast<int>(permutation.size());
+            std::vector<bool> visited(N, false);
+            
+            for (int i = 0; i < N; i++)
+            {
+                if (visited[i] || permutation[i] == i)
+                {
+                    continue;
+                }
+                
+                // Follow the cycle starting at i
+                T temp = std::move(v[i]);
+                visited[i] = true;
+                for (int j = permutation[i]; j != i; j = permutation[j])
+                {
+                    std::swap(temp, v[j]);
+                    visited[j] = true;
+                }
+                v[i] = std::move(temp);
+            }
+        }
+        
         /**
          * Computes the Hamming distance between two vectors of equal size. The
          * Hamming Distance is defined as the number of unequal entries of 
@@ -284,6 +326,60 @@ namespace libf {
             std::uniform_int_distribution<int> d(0, static_cast<int>(v.size()) - 1);
             return v[d(g)];
         }
+        
+        /**
+         * Samples M distinct integers from [0, N-1] using Floyd's algorithm. 
+         * The result is sorted in ascending order, which gives a cache 
+         * friendly access pattern. This requires O(M log M) time and O(M) 
+         * memory independent of N.
+         * 
+         * @param N The size of the range to sample from
+         * @param M The number of samples (at most N)
+         * @param result The sampled integers
+         * @param g The generator
+         */
+        static void sampleWithoutReplacement(int N, int M, std::vector<int> & result, std::mt19937 & g);
+        
+        /**
+         * Converts a single precision float to an IEEE 754 half precision
+         * float (rounded to nearest even). Values that are too large are 
+         * mapped to infinity.
+         * 
+         * @param value The float to convert
+         * @return The bit pattern of the half precision float
+         */
+        static uint16_t floatToHalf(float value);
+        
+        /**
+         * Converts an IEEE 754 half precision float to a single precision
+         * float. 
+         * 
+         * @param value The bit pattern of the half precision float
+         * @return The corresponding float
+         */
+        static float halfToFloat(uint16_t value);
+        
+        /**
+         * Appends a decimal representation of a float that reads back to the
+         * same value. At most 9 significant digits are written; digits are 
+         * dropped as long as the rounded value stays safely within the 
+         * rounding interval of the float. This is usually, but not always,
+         * the shortest representation: Decimals close to the bounds of the 
+         * interval are not considered. Integral values are formatted without
+         * going through printf. 
+         * 
+         * @param buffer The string to append to
+         * @param value The float to format
+         */
+        static void appendFloat(std::string & buffer, float value);
+        
+        /**
+         * Appends the decimal representation of an integer.
+         * 
+         * @param buffer The string to append to
+         * @param value The integer to format
+         */
+        static void appendInt(std::string & buffer, int value);
     };
     
     /**
@@ -516,6 +612,54 @@ namespace libf {
             }
         }
         
+        /**
+         * Adds w instances of class i while updating entropy information.
+         * 
+         * @param i The bin to which the points shall be added
+         * @param w The number of points (weight)
+         */
+        void add(const int i, const int w)
+        {
+            BOOST_ASSERT_MSG(i >= 0 && i < bins, "Invalid bin bin index.");
+            BOOST_ASSERT_MSG(w >= 0, "The weight must be non-negative.");
+
+            totalEntropy += LIBF_ENTROPY(mass);
+            mass += w;
+            totalEntropy -= LIBF_ENTROPY(mass);
+            histogram[i] += w;
+            totalEntropy -= entropies[i];
+            entropies[i] = LIBF_ENTROPY(histogram[i]); 
+            totalEntropy += entropies[i];
+        }
+        
+        /**
+         * Removes w instances of class i while updating entropy information.
+         * 
+         * @param i The bin from which the points shall be removed
+         * @param w The number of points (weight)
+         */
+        void sub(const int i, const int w)
+        {
+            BOOST_ASSERT_MSG(i >= 0 && i < bins, "Invalid bin bin index.");
+            BOOST_ASSERT_MSG(at(i) >= w, "Bin does not contain enough points.");
+
+            totalEntropy += LIBF_ENTROPY(mass);
+            mass -= w;
+            totalEntropy -= LIBF_ENTROPY(mass);
+
+            histogram[i] -= w;
+            totalEntropy -= entropies[i];
+            if (histogram[i] < 1)
+            {
+                entropies[i] = 0;
+            }
+            else
+            {
+                entropies[i] = LIBF_ENTROPY(histogram[i]); 
+                totalEntropy += entropies[i];
+            }
+        }
+        
         /**
          * Returns the total mass of the histogram.
          * 
@@ -628,7 +772,12 @@ namespace libf {
          */
         virtual ~EfficientCovarianceMatrix() {};
         
-        EfficientCovarianceMatrix operator=(const EfficientCovarianceMatrix & other)
+        /**
+         * Copies the estimates into the existing buffers. Learners assign
+         * once per candidate feature, so this must not allocate when the
+         * dimensions agree.
+         */
+        EfficientCovarianceMatrix & operator=(const EfficientCovarianceMatrix & other)
         {
             mean = other.mean;
             covariance = other.covariance;
@@ -636,12 +785,12 @@ namespace libf {
             mass = other.mass;
             // TODO: does currently not consider caching!
             
-            trueCovariance = Eigen::MatrixXf::Zero(dimensions, dimensions);
+            trueCovariance.setZero(dimensions, dimensions);
             covarianceDeterminant = 0;
             cachedTrueCovariance = false;
             cachedDeterminant = false;
             
-            trueMean = Eigen::VectorXf::Zero(dimensions);
+            trueMean.setZero(dimensions);
             cachedTrueMean = false;
             
             return *this;
@@ -776,7 +925,7 @@ namespace libf {
         {
             if (!cachedTrueCovariance)
             {
-                trueCovariance = (mean*mean.transpose())/(mass*mass); // (mean/mass)*(mean.transpose()/mass)
+                trueCovariance.noalias() = (mean*mean.transpose())/(mass*mass); // (mean/mass)*(mean.transpose()/mass)
                 trueCovariance = covariance/(mass - 1) - trueCovariance; // covariance/mass - (mean/mass)*(mean.transpose()/mass)
                 
                 for (int i = 0; i < trueCovariance.rows(); i++)
@@ -804,7 +953,9 @@ namespace libf {
         {
             if (!cachedDeterminant)
             {
-                covarianceDeterminant = getCovariance().determinant();
+                // The decomposition keeps its buffers between calls
+                lu.compute(getCovariance());
+                covarianceDeterminant = lu.determinant();
                 
 //                getCovariance();
 //                covarianceDeterminant = 0;
@@ -863,6 +1014,10 @@ namespace libf {
          * Cached covariance determinant.
          */
         float covarianceDeterminant;
+        /**
+         * The decomposition used for the determinant.
+         */
+        Eigen::PartialPivLU<Eigen::MatrixXf> lu;
         /**
          T* he mean is also cached.
          */
@@ -25,6 +25,16 @@ void AbstractClassifier::classify(AbstractDataStorage::ptr storage, std::vector<
     }
 }
 
+void AbstractClassifier::classLogPosteriors(AbstractDataStorage::ptr storage, std::vector< std::vector<float> > & probabilities) const
+{
+    probabilities.resize(storage->getSize());
+    
+    for (int i = 0; i < storage->getSize(); i++)
+    {
+        classLogPosterior(storage->getDataPoint(i), probabilities[i]);
+    }
+}
+
 int AbstractClassifier::classify(const DataPoint & x) const
 {
     // Get the class posterior
@@ -1,6 +1,7 @@
 #include "libforest/data.h"
 #include "libforest/classifier.h"
 #include "libforest/util.h"
+#include "libforest/memory.h"
 #include "libforest/learning.h"
 #include "libforest/learning_tools.h"
 #include "libforest/classifier_learning.h"
@@ -13,45 +14,1195 @@
 #include <iomanip>
 #include <queue>
 #include <stack>
+#include <mutex>
 
 using namespace libf;
 
 static std::random_device rd;
 static std::mt19937 g(rd());
 
+////////////////////////////////////////////////////////////////////////////////
+/// AbstractTreeClassifierLearner
+////////////////////////////////////////////////////////////////////////////////
+
+const int AbstractTreeClassifierLearner::SUBSAMPLING_NONE;
+const int AbstractTreeClassifierLearner::SUBSAMPLING_UNIFORM;
+const int AbstractTreeClassifierLearner::SUBSAMPLING_STRATIFIED;
+const int AbstractTreeClassifierLearner::SUBSAMPLING_BALANCED;
+
+AbstractDataStorage::ptr AbstractTreeClassifierLearner::subsample(AbstractDataStorage::ptr storage) const
+{
+    if (subsamplingMethod == SUBSAMPLING_NONE)
+    {
+        return storage;
+    }
+    
+    // Weighted storages are sampled as the examples they stand for
+    const int total = storage->getTotalWeight();
+    int N = numSubsamplingExamples;
+    if (N < 0 || N > total)
+    {
+        N = total;
+    }
+    
+    switch (subsamplingMethod)
+    {
+        case SUBSAMPLING_STRATIFIED:
+        case SUBSAMPLING_BALANCED:
+        {
+            const bool balanced = (subsamplingMethod == SUBSAMPLING_BALANCED);
+            if (classIndex && classIndexStorage == storage)
+            {
+                return storage->stratifiedSubsample(N, balanced, *classIndex);
+            }
+            return storage->stratifiedSubsample(N, balanced);
+        }
+        default:
+            return storage->subsample(N);
+    }
+}
+
+void AbstractTreeClassifierLearner::prepareSubsampling(AbstractDataStorage::ptr storage)
+{
+    if (subsamplingMethod == SUBSAMPLING_STRATIFIED || subsamplingMethod == SUBSAMPLING_BALANCED)
+    {
+        classIndex = std::make_shared<ClassIndex>(*storage);
+        classIndexStorage = storage;
+    }
+}
+
+void AbstractTreeClassifierLearner::releaseSubsampling()
+{
+    classIndex.reset();
+    classIndexStorage.reset();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// DecisionTreeLearner
 ////////////////////////////////////////////////////////////////////////////////
 
 /**
- * Updates the leaf node histograms using a smoothing parameter
+ * Updates the leaf node histograms using a smoothing parameter
+ */
+inline void updateLeafNodeHistogram(std::vector<float> & leafNodeHistogram, const EfficientEntropyHistogram & hist, float smoothing, bool useBootstrap)
+{
+    const int C = hist.getSize();
+    
+    leafNodeHistogram.resize(C);
+    BOOST_ASSERT(leafNodeHistogram.size() > 0);
+    
+    if(!useBootstrap)
+    {
+        for (int c = 0; c < C; c++)
+        {
+            leafNodeHistogram[c] = std::log((hist.at(c) + smoothing)/(hist.getMass() + hist.getSize() * smoothing));
+        }
+    }
+}
+
+/**
+ * The best split of a node found so far
+ */
+struct BestSplit {
+    BestSplit() : 
+            threshold(0), 
+            feature(-1), 
+            objective(1e35), 
+            leftMass(0), 
+            rightMass(0), 
+            leftCount(0), 
+            rightCount(0) {}
+    
+    float threshold;
+    int feature;
+    float objective;
+    /**
+     * The (weighted) masses of the children
+     */
+    int leftMass;
+    int rightMass;
+    /**
+     * The number of examples of the children
+     */
+    int leftCount;
+    int rightCount;
+};
+
+/**
+ * Returns true if a split was found and both children are large enough.
+ */
+static bool isValidSplit(const BestSplit & best, int minChildSplitExamples)
+{
+    return best.feature >= 0 && best.leftMass >= minChildSplitExamples && best.rightMass >= minChildSplitExamples
+            && best.leftCount > 0 && best.rightCount > 0;
+}
+
+/**
+ * The split objective of the single output learners: The summed entropies 
+ * of the class histograms left and right of a threshold. 
+ */
+class EntropyObjective {
+public:
+    EntropyObjective(AbstractDataStorage::ptr _storage) : 
+            storage(_storage), 
+            hist(_storage->getClasscount()), 
+            left(_storage->getClasscount()), 
+            right(_storage->getClasscount()) {}
+    
+    /**
+     * Sets the examples the following scans are performed on. 
+     */
+    void setExamples(const int* examples, int M)
+    {
+        hist.reset();
+        for (int m = 0; m < M; m++)
+        {
+            hist.add(storage->getClassLabel(examples[m]), storage->getWeight(examples[m]));
+        }
+    }
+    
+    /**
+     * Returns the class histogram of the examples. 
+     */
+    const EfficientEntropyHistogram & getHistogram() const
+    {
+        return hist;
+    }
+    
+    /**
+     * Starts a scan with all examples right of the threshold. 
+     */
+    void beginScan()
+    {
+        left.reset();
+        right = hist;
+    }
+    
+    /**
+     * Moves an example to the left of the threshold. 
+     */
+    void moveLeft(int n)
+    {
+        moveClassLeft(storage->getClassLabel(n), storage->getWeight(n));
+    }
+    
+    /**
+     * Moves some weight of a class to the left of the threshold. 
+     */
+    void moveClassLeft(int c, int weight)
+    {
+        left.add(c, weight);
+        right.sub(c, weight);
+    }
+    
+    float getObjective() const
+    {
+        return left.getEntropy() + right.getEntropy();
+    }
+    
+    int getLeftMass() const
+    {
+        return left.getMass();
+    }
+    
+    int getRightMass() const
+    {
+        return right.getMass();
+    }
+    
+private:
+    AbstractDataStorage::ptr storage;
+    EfficientEntropyHistogram hist;
+    EfficientEntropyHistogram left;
+    EfficientEntropyHistogram right;
+};
+
+/**
+ * Searches the best threshold of a feature on the first M examples of a 
+ * node. The examples are sorted by the feature and every threshold between
+ * two distinct neighboring values is evaluated with the objective (see 
+ * EntropyObjective for the interface). 
+ */
+template <class Objective>
+static void searchThreshold(AbstractDataStorage::ptr storage, int* examples, int M, int feature, Objective & objective, BestSplit & best)
+{
+    FeatureComparator cp;
+    cp.storage = storage;
+    cp.feature = feature;
+    std::sort(examples, examples + M, cp);
+    
+    objective.beginScan();
+    
+    float leftValue = storage->getDataPoint(examples[0])(feature);
+    for (int m = 1; m < M; m++)
+    {
+        // Move the last point to the left
+        objective.moveLeft(examples[m - 1]);
+        
+        const float rightValue = storage->getDataPoint(examples[m])(feature);
+        
+        // Skip this split, if the two points lie too close together
+        const float diff = std::abs(rightValue - leftValue);
+        if (diff < 1e-6f*std::max(std::abs(rightValue+1e-6), std::abs(leftValue+1e-6)))
+        {
+            leftValue = rightValue;
+            continue;
+        }
+        
+        const float localObjective = objective.getObjective();
+        if (localObjective < best.objective)
+        {
+            best.threshold = 0.5f*(leftValue + rightValue);
+            best.feature = feature;
+            best.objective = localObjective;
+            best.leftMass = objective.getLeftMass();
+            best.rightMass = objective.getRightMass();
+            best.leftCount = m;
+            best.rightCount = M - m;
+        }
+        
+        leftValue = rightValue;
+    }
+}
+
+/**
+ * Returns true if a data point is passed to the left child of a node.
+ */
+static bool goesLeft(const AxisAlignedSplitTreeNodeConfig & config, const DataPoint & x)
+{
+    return x(config.getSplitFeature()) < config.getThreshold();
+}
+
+static bool goesLeft(const CategoricalSplitTreeNodeConfig & config, const DataPoint & x)
+{
+    return config.goesLeft(x);
+}
+
+/**
+ * Grows a tree depth first. This is the node loop the decision tree 
+ * learners share: For every node, chooseSplit(node, examples, N) either 
+ * turns the node into a leaf and returns false, or sets up the split of 
+ * the node and returns true. The examples are then passed on to the 
+ * children. chooseSplit may reorder the examples. 
+ */
+template <class Tree, class State, class ChooseSplit>
+static void growTree(Tree & tree, AbstractDataStorage::ptr storage, State & state, ChooseSplit chooseSplit)
+{
+    const int N = storage->getSize();
+    state.total = N;
+    
+    tree.addNode();
+    
+    // This is the list of nodes that still have to be split
+    std::vector<int> splitStack;
+    splitStack.push_back(0);
+    
+    // The training examples of the nodes that still have to be split, 
+    // indexed by node
+    std::vector< std::vector<int> > trainingExamples;
+    trainingExamples.reserve(LIBF_GRAPH_BUFFER_SIZE);
+    trainingExamples.push_back(std::vector<int>(N));
+    for (int n = 0; n < N; n++)
+    {
+        trainingExamples[0][n] = n;
+    }
+    
+    while (splitStack.size() > 0)
+    {
+        const int node = splitStack.back();
+        splitStack.pop_back();
+        
+        state.numNodes = tree.getNumNodes();
+        state.depth = std::max(state.depth, tree.getNodeConfig(node).getDepth());
+        
+        // The node does not need its examples afterwards
+        std::vector<int> examples;
+        examples.swap(trainingExamples[node]);
+        const int M = static_cast<int>(examples.size());
+        
+        if (!chooseSplit(node, examples.data(), M))
+        {
+            state.processed += M;
+            continue;
+        }
+        
+        // Distribute the examples
+        std::vector<int> leftList;
+        std::vector<int> rightList;
+        for (int m = 0; m < M; m++)
+        {
+            const int n = examples[m];
+            if (goesLeft(tree.getNodeConfig(node), storage->getDataPoint(n)))
+            {
+                leftList.push_back(n);
+            }
+            else
+            {
+                rightList.push_back(n);
+            }
+        }
+        
+        const int leftChild = tree.splitNode(node);
+        trainingExamples.push_back(std::vector<int>());
+        trainingExamples.push_back(std::vector<int>());
+        trainingExamples[leftChild].swap(leftList);
+        trainingExamples[leftChild + 1].swap(rightList);
+        
+        splitStack.push_back(leftChild);
+        splitStack.push_back(leftChild + 1);
+    }
+}
+
+DecisionTree::ptr DecisionTreeLearner::learn(AbstractDataStorage::ptr dataStorage, DecisionTreeLearner::State & state)
+{
+    state.reset();
+    state.started = true;
+    
+    // Draw the training subset for this tree (if subsampling is enabled)
+    dataStorage = subsample(dataStorage);
+    
+    BOOST_ASSERT_MSG(numFeatures <= dataStorage->getDimensionality(), "The number of feature evaluations must not exceed the feature dimension.");
+    
+    AbstractDataStorage::ptr storage;
+    // If we use bootstrap sampling, then this array contains the results of 
+    // the sampler. We use it later in order to refine the leaf node histograms
+    std::vector<bool> sampled;
+    
+    // Check if data set related parameters have been set
+    int _numBootstrapExamples = numBootstrapExamples;
+    int _numFeatures = numFeatures;
+    if (_numBootstrapExamples < 0)
+    {
+        _numBootstrapExamples = dataStorage->getTotalWeight();
+    }
+    if (_numFeatures < 0)
+    {
+        _numFeatures = std::sqrt(dataStorage->getDimensionality());
+    }
+    
+    if (useBootstrap)
+    {
+        storage = dataStorage->bootstrap(_numBootstrapExamples, sampled);
+    }
+    else
+    {
+        storage = dataStorage;
+    }
+    
+    if (useLevelWiseTraining)
+    {
+        DecisionTree::ptr tree = learnLevelWise(storage, _numFeatures, state);
+        
+        if (useBootstrap)
+        {
+            TreeLearningTools::updateHistograms(tree, dataStorage, smoothingParameter);
+        }
+        
+        state.terminated = true;
+        return tree;
+    }
+    
+    const int D = storage->getDimensionality();
+    
+    // Set up a new tree. 
+    DecisionTree::ptr tree = std::make_shared<DecisionTree>();
+    
+    // Set up the array of possible features, we use it in order to sample
+    // the features without replacement
+    std::vector<int> sampledFeatures(D);
+    for (int d = 0; d < D; d++)
+    {
+        sampledFeatures[d] = d;
+    }
+    
+    // Used to draw the examples large nodes choose their split on
+    std::mt19937 g(rd());
+    
+    EntropyObjective objective(storage);
+    
+    growTree(*tree, storage, state, [&](int node, int* trainingExampleList, int N) -> bool {
+        objective.setExamples(trainingExampleList, N);
+        const EfficientEntropyHistogram hist = objective.getHistogram();
+        
+        // Don't split this node
+        //  If the number of examples is too small
+        //  If the training examples are all of the same class
+        //  If the maximum depth is reached
+        if (hist.getMass() < minSplitExamples || hist.isPure() || tree->getNodeConfig(node).getDepth() >= maxDepth)
+        {
+            updateLeafNodeHistogram(tree->getNodeData(node).histogram, hist, smoothingParameter, useBootstrap);
+            return false;
+        }
+        
+        // At large nodes, the split is chosen on a random subset of the
+        // examples. We move the subset to the front of the list.
+        int M = N;
+        if (maxSplitExamples > 0 && N > maxSplitExamples)
+        {
+            M = maxSplitExamples;
+            for (int m = 0; m < M; m++)
+            {
+                std::uniform_int_distribution<int> dist(m, N - 1);
+                std::swap(trainingExampleList[m], trainingExampleList[dist(g)]);
+            }
+            objective.setExamples(trainingExampleList, M);
+        }
+        
+        // Sample random features
+        std::shuffle(sampledFeatures.begin(), sampledFeatures.end(), std::default_random_engine(rd()));
+        
+        // Optimize over all features
+        BestSplit best;
+        for (int f = 0; f < _numFeatures; f++)
+        {
+            searchThreshold(storage, trainingExampleList, M, sampledFeatures[f], objective, best);
+        }
+        
+        // If the split was chosen on a subset, determine the children of
+        // all examples
+        if (M < N && best.feature >= 0)
+        {
+            best.leftMass = 0;
+            best.leftCount = 0;
+            for (int m = 0; m < N; m++)
+            {
+                const int n = trainingExampleList[m];
+                if (storage->getDataPoint(n)(best.feature) < best.threshold)
+                {
+                    best.leftMass += storage->getWeight(n);
+                    best.leftCount++;
+                }
+            }
+            
+            best.rightCount = N - best.leftCount;
+            best.rightMass = hist.getMass() - best.leftMass;
+        }
+        
+        // Did we find good split values?
+        if (!isValidSplit(best, minChildSplitExamples))
+        {
+            updateLeafNodeHistogram(tree->getNodeData(node).histogram, hist, smoothingParameter, useBootstrap);
+            return false;
+        }
+        
+        // Ok, split the node
+        tree->getNodeConfig(node).setThreshold(best.threshold);
+        tree->getNodeConfig(node).setSplitFeature(best.feature);
+        return true;
+    });
+    
+    // If we use bootstrap, we use all the training examples for the 
+    // histograms
+    if (useBootstrap)
+    {
+        TreeLearningTools::updateHistograms(tree, dataStorage, smoothingParameter);
+    }
+    
+    state.terminated = true;
+    
+    return tree;
+}
+
+/**
+ * A node at the current level during level-wise training
+ */
+struct FrontierNode {
+    /**
+     * The tree node
+     */
+    int node;
+    /**
+     * The number of examples at the node
+     */
+    int size;
+    /**
+     * The class histogram of all examples at the node
+     */
+    EfficientEntropyHistogram hist;
+    /**
+     * The histograms left and right of the current threshold
+     */
+    EfficientEntropyHistogram left;
+    EfficientEntropyHistogram right;
+    /**
+     * The number of examples scanned for the current feature
+     */
+    int count;
+    /**
+     * The last example scanned for the current feature
+     */
+    float leftValue;
+    int leftClass;
+    int leftWeight;
+    /**
+     * The best split so far
+     */
+    float bestThreshold;
+    int bestFeature;
+    float bestObjective;
+    int bestLeftMass;
+    int bestRightMass;
+};
+
+struct DecisionTreeLearner::PresortedColumns {
+    PresortedColumns(std::shared_ptr<const DataStorage> _storage) : 
+            storage(_storage), 
+            columns(_storage->getDimensionality()), 
+            locks(_storage->getDimensionality()), 
+            numUsers(0) {}
+    
+    /**
+     * Returns the d-th column and sorts it on first use. 
+     */
+    const std::vector<int> & getColumn(int d)
+    {
+        std::lock_guard<std::mutex> lock(locks[d]);
+        
+        std::vector<int> & column = columns[d];
+        if (column.size() == 0)
+        {
+            const int N = storage->getSize();
+            column.resize(N);
+            for (int n = 0; n < N; n++)
+            {
+                column[n] = n;
+            }
+            
+            const DataStorage & base = *storage;
+            std::sort(column.begin(), column.end(), [&base, d](int lhs, int rhs) {
+                return base.getDataPoint(lhs)(d) < base.getDataPoint(rhs)(d);
+            });
+        }
+        
+        return column;
+    }
+    
+    /**
+     * The sorted data set
+     */
+    std::shared_ptr<const DataStorage> storage;
+    /**
+     * The indices of the data points sorted by each feature
+     */
+    std::vector< std::vector<int> > columns;
+    /**
+     * Guard the sorting of the columns
+     */
+    std::vector<std::mutex> locks;
+    /**
+     * The number of trees that currently use the columns
+     */
+    int numUsers;
+};
+
+/**
+ * Guards the presorted columns of all decision tree learners
+ */
+static std::mutex presortedColumnsMutex;
+
+DecisionTree::ptr DecisionTreeLearner::learnLevelWise(AbstractDataStorage::ptr storage, int _numFeatures, DecisionTreeLearner::State & state)
+{
+    const int N = storage->getSize();
+    const int D = storage->getDimensionality();
+    const int C = storage->getClasscount();
+    
+    state.total = N;
+    
+    // Share the sorted columns with the trees that are learned on the same
+    // data set at the same time
+    std::shared_ptr<const DataStorage> base = storage->getBaseStorage();
+    std::shared_ptr<PresortedColumns> columns;
+    {
+        std::lock_guard<std::mutex> lock(presortedColumnsMutex);
+        if (presortedColumns && presortedColumns->storage == base)
+        {
+            columns = presortedColumns;
+        }
+        else
+        {
+            columns = std::make_shared<PresortedColumns>(base);
+            if (!presortedColumns)
+            {
+                presortedColumns = columns;
+            }
+        }
+        columns->numUsers++;
+    }
+    
+    // Release the columns once the last tree that uses them is done
+    struct Release {
+        ~Release()
+        {
+            std::lock_guard<std::mutex> lock(presortedColumnsMutex);
+            if (--columns->numUsers == 0 && learner->presortedColumns == columns)
+            {
+                learner->presortedColumns.reset();
+            }
+        }
+        
+        DecisionTreeLearner* learner;
+        std::shared_ptr<PresortedColumns> columns;
+    } release = {this, columns};
+    
+    // The examples of this tree are enumerated by their base index, such 
+    // that the base columns can be scanned. Base points may occur several
+    // times in bootstrap samples.
+    const int M = base->getSize();
+    std::vector<int> baseOffsets(M + 1, 0);
+    std::vector<int> baseExamples(N);
+    for (int n = 0; n < N; n++)
+    {
+        baseOffsets[storage->getBaseIndex(n) + 1]++;
+    }
+    for (int m = 0; m < M; m++)
+    {
+        baseOffsets[m + 1] += baseOffsets[m];
+    }
+    {
+        std::vector<int> next(baseOffsets.begin(), baseOffsets.end() - 1);
+        for (int n = 0; n < N; n++)
+        {
+            baseExamples[next[storage->getBaseIndex(n)]++] = n;
+        }
+    }
+    
+    DecisionTree::ptr tree = std::make_shared<DecisionTree>();
+    tree->addNode();
+    
+    // The index of the frontier node every example is at, -1 once the 
+    // example has reached a leaf
+    std::vector<int> slots(N, 0);
+    std::vector<FrontierNode> frontier(1);
+    frontier[0].node = 0;
+    
+    std::vector<int> sampledFeatures(D);
+    for (int d = 0; d < D; d++)
+    {
+        sampledFeatures[d] = d;
+    }
+    
+    std::mt19937 g(rd());
+    
+    while (frontier.size() > 0)
+    {
+        const int S = static_cast<int>(frontier.size());
+        
+        state.numNodes = tree->getNumNodes();
+        state.depth = std::max(state.depth, tree->getNodeConfig(frontier[0].node).getDepth());
+        
+        for (int s = 0; s < S; s++)
+        {
+            frontier[s].size = 0;
+            frontier[s].hist = EfficientEntropyHistogram(C);
+            frontier[s].left = EfficientEntropyHistogram(C);
+            frontier[s].right = EfficientEntropyHistogram(C);
+            frontier[s].bestThreshold = 0;
+            frontier[s].bestFeature = -1;
+            frontier[s].bestObjective = 1e35;
+        }
+        
+        // Compute the histograms of all nodes in one pass
+        for (int n = 0; n < N; n++)
+        {
+            if (slots[n] >= 0)
+            {
+                frontier[slots[n]].size++;
+                frontier[slots[n]].hist.add(storage->getClassLabel(n), storage->getWeight(n));
+            }
+        }
+        
+        // Sample the features of all nodes that may be split
+        std::vector< std::vector<int> > featureSlots(D);
+        for (int s = 0; s < S; s++)
+        {
+            const FrontierNode & v = frontier[s];
+            if (v.hist.getMass() < minSplitExamples || v.hist.isPure() || tree->getNodeConfig(v.node).getDepth() >= maxDepth)
+            {
+                continue;
+            }
+            
+            std::shuffle(sampledFeatures.begin(), sampledFeatures.end(), g);
+            for (int f = 0; f < _numFeatures; f++)
+            {
+                featureSlots[sampledFeatures[f]].push_back(s);
+            }
+        }
+        
+        // Scan every sampled column once for all nodes that sampled it
+        std::vector<bool> active(S, false);
+        for (int d = 0; d < D; d++)
+        {
+            if (featureSlots[d].size() == 0)
+            {
+                continue;
+            }
+            
+            // The columns are sorted once, when the feature is first sampled
+            const std::vector<int> & column = columns->getColumn(d);
+            
+            for (size_t i = 0; i < featureSlots[d].size(); i++)
+            {
+                FrontierNode & v = frontier[featureSlots[d][i]];
+                v.left.reset();
+                v.right = v.hist;
+                v.count = 0;
+                active[featureSlots[d][i]] = true;
+            }
+            
+            for (int i = 0; i < M; i++)
+            {
+                const int m = column[i];
+                const float rightValue = base->getDataPoint(m)(d);
+                
+                for (int k = baseOffsets[m]; k < baseOffsets[m + 1]; k++)
+                {
+                    const int n = baseExamples[k];
+                    const int s = slots[n];
+                    if (s < 0 || !active[s])
+                    {
+                        continue;
+                    }
+                    
+                    FrontierNode & v = frontier[s];
+                    if (v.count > 0)
+                    {
+                        // Move the last point to the left histogram
+                        v.left.add(v.leftClass, v.leftWeight);
+                        v.right.sub(v.leftClass, v.leftWeight);
+                        
+                        // Skip this split, if the two points lie too close together
+                        const float diff = std::abs(rightValue - v.leftValue);
+                        if (diff >= 1e-6f*std::max(std::abs(rightValue+1e-6), std::abs(v.leftValue+1e-6)))
+                        {
+                            const float localObjective = v.left.getEntropy() + v.right.getEntropy();
+                            
+                            if (localObjective < v.bestObjective)
+                            {
+                                v.bestThreshold = 0.5f*(v.leftValue + rightValue);
+                                v.bestFeature = d;
+                                v.bestObjective = localObjective;
+                                v.bestLeftMass = v.left.getMass();
+                                v.bestRightMass = v.right.getMass();
+                            }
+                        }
+                    }
+                    
+                    v.leftValue = rightValue;
+                    v.leftClass = storage->getClassLabel(n);
+                    v.leftWeight = storage->getWeight(n);
+                    v.count++;
+                }
+            }
+            
+            for (size_t i = 0; i < featureSlots[d].size(); i++)
+            {
+                active[featureSlots[d][i]] = false;
+            }
+        }
+        
+        // Split the nodes and set up the next level
+        std::vector<FrontierNode> next;
+        std::vector<int> childSlots(S, -1);
+        for (int s = 0; s < S; s++)
+        {
+            const FrontierNode & v = frontier[s];
+            
+            if (v.bestFeature < 0 || v.bestLeftMass < minChildSplitExamples || v.bestRightMass < minChildSplitExamples)
+            {
+                updateLeafNodeHistogram(tree->getNodeData(v.node).histogram, v.hist, smoothingParameter, useBootstrap);
+                BOOST_ASSERT(tree->getNodeData(v.node).histogram.size() > 0);
+                state.processed += v.size;
+                continue;
+            }
+            
+            tree->getNodeConfig(v.node).setThreshold(v.bestThreshold);
+            tree->getNodeConfig(v.node).setSplitFeature(v.bestFeature);
+            const int leftChild = tree->splitNode(v.node);
+            
+            childSlots[s] = static_cast<int>(next.size());
+            next.push_back(FrontierNode());
+            next.back().node = leftChild;
+            next.push_back(FrontierNode());
+            next.back().node = leftChild + 1;
+        }
+        
+        // Route the examples to the children
+        for (int n = 0; n < N; n++)
+        {
+            const int s = slots[n];
+            if (s < 0)
+            {
+                continue;
+            }
+            
+            if (childSlots[s] < 0)
+            {
+                slots[n] = -1;
+            }
+            else
+            {
+                const FrontierNode & v = frontier[s];
+                slots[n] = childSlots[s] + (storage->getDataPoint(n)(v.bestFeature) < v.bestThreshold ? 0 : 1);
+            }
+        }
+        
+        frontier.swap(next);
+    }
+    
+    return tree;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// MultiOutputDecisionTreeLearner
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Recomputes the leaf histograms of all outputs of a multi-output tree on a
+ * data storage
+ */
+static void updateMultiOutputHistograms(MultiOutputDecisionTree::ptr tree, AbstractDataStorage::ptr storage, const LabelMatrix & labels, float smoothing)
+{
+    const int K = labels.getNumOutputs();
+    
+    for (int v = 0; v < tree->getNumNodes(); v++)
+    {
+        if (tree->getNodeConfig(v).isLeafNode())
+        {
+            std::vector< std::vector<float> > & hists = tree->getNodeData(v).histograms;
+            hists.resize(K);
+            for (int k = 0; k < K; k++)
+            {
+                hists[k].assign(labels.getClasscount(k), 0);
+            }
+        }
+    }
+    
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        std::vector< std::vector<float> > & hists = tree->getNodeData(tree->findLeafNode(storage->getDataPoint(n))).histograms;
+        for (int k = 0; k < K; k++)
+        {
+            hists[k][labels.getLabel(storage->getBaseIndex(n), k)] += storage->getWeight(n);
+        }
+    }
+    
+    for (int v = 0; v < tree->getNumNodes(); v++)
+    {
+        if (tree->getNodeConfig(v).isLeafNode())
+        {
+            std::vector< std::vector<float> > & hists = tree->getNodeData(v).histograms;
+            for (int k = 0; k < K; k++)
+            {
+                const int C = static_cast<int>(hists[k].size());
+                float total = 0;
+                for (int c = 0; c < C; c++)
+                {
+                    total += hists[k][c];
+                }
+                for (int c = 0; c < C; c++)
+                {
+                    hists[k][c] = std::log((hists[k][c] + smoothing)/(total + C*smoothing));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * The split objective of the multi-output learner: The summed entropies of
+ * all outputs left and right of a threshold. 
+ */
+class MultiOutputEntropyObjective {
+public:
+    /**
+     * @param _storage The training examples
+     * @param _exampleLabels The K labels of every training example, row-major
+     * @param labels The label matrix (for the number of classes)
+     */
+    MultiOutputEntropyObjective(AbstractDataStorage::ptr _storage, const std::vector<int> & _exampleLabels, const LabelMatrix & labels) : 
+            storage(_storage), 
+            exampleLabels(_exampleLabels), 
+            K(labels.getNumOutputs())
+    {
+        for (int k = 0; k < K; k++)
+        {
+            hists.push_back(EfficientEntropyHistogram(labels.getClasscount(k)));
+            left.push_back(EfficientEntropyHistogram(labels.getClasscount(k)));
+            right.push_back(EfficientEntropyHistogram(labels.getClasscount(k)));
+        }
+    }
+    
+    /**
+     * Sets the examples the following scans are performed on. 
+     */
+    void setExamples(const int* examples, int M)
+    {
+        for (int k = 0; k < K; k++)
+        {
+            hists[k].reset();
+            for (int m = 0; m < M; m++)
+            {
+                hists[k].add(exampleLabels[examples[m]*K + k], storage->getWeight(examples[m]));
+            }
+        }
+    }
+    
+    /**
+     * Returns the class histograms of the examples, one per output. 
+     */
+    const std::vector<EfficientEntropyHistogram> & getHistograms() const
+    {
+        return hists;
+    }
+    
+    /**
+     * Returns true if the examples are pure in all outputs. 
+     */
+    bool isPure() const
+    {
+        for (int k = 0; k < K; k++)
+        {
+            if (!hists[k].isPure())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    /**
+     * Starts a scan with all examples right of the threshold. 
+     */
+    void beginScan()
+    {
+        for (int k = 0; k < K; k++)
+        {
+            left[k].reset();
+            right[k] = hists[k];
+        }
+    }
+    
+    /**
+     * Moves an example to the left of the threshold. 
+     */
+    void moveLeft(int n)
+    {
+        for (int k = 0; k < K; k++)
+        {
+            left[k].add(exampleLabels[n*K + k], storage->getWeight(n));
+            right[k].sub(exampleLabels[n*K + k], storage->getWeight(n));
+        }
+    }
+    
+    float getObjective() const
+    {
+        float objective = 0;
+        for (int k = 0; k < K; k++)
+        {
+            objective += left[k].getEntropy() + right[k].getEntropy();
+        }
+        return objective;
+    }
+    
+    int getLeftMass() const
+    {
+        return left[0].getMass();
+    }
+    
+    int getRightMass() const
+    {
+        return right[0].getMass();
+    }
+    
+private:
+    AbstractDataStorage::ptr storage;
+    const std::vector<int> & exampleLabels;
+    int K;
+    std::vector<EfficientEntropyHistogram> hists;
+    std::vector<EfficientEntropyHistogram> left;
+    std::vector<EfficientEntropyHistogram> right;
+};
+
+/**
+ * Throws if the subsampling method depends on the class labels of the 
+ * storage. These are not used by multi-output learners, so there is nothing
+ * to stratify by. 
+ */
+static void checkMultiOutputSubsampling(int subsamplingMethod)
+{
+    if (subsamplingMethod == AbstractTreeClassifierLearner::SUBSAMPLING_STRATIFIED || subsamplingMethod == AbstractTreeClassifierLearner::SUBSAMPLING_BALANCED)
+    {
+        throw ConfigurationException("Stratified subsampling is not supported for multiple outputs.");
+    }
+}
+
+void MultiOutputDecisionTreeLearner::prepareSubsampling(AbstractDataStorage::ptr storage)
+{
+    checkMultiOutputSubsampling(subsamplingMethod);
+    AbstractTreeClassifierLearner::prepareSubsampling(storage);
+}
+
+MultiOutputDecisionTree::ptr MultiOutputDecisionTreeLearner::learn(AbstractDataStorage::ptr dataStorage, MultiOutputDecisionTreeLearner::State & state)
+{
+    BOOST_ASSERT_MSG(labels, "The labels have not been set.");
+    
+    checkMultiOutputSubsampling(subsamplingMethod);
+    
+    state.reset();
+    state.started = true;
+    
+    // Draw the training subset for this tree (if subsampling is enabled)
+    dataStorage = subsample(dataStorage);
+    
+    BOOST_ASSERT_MSG(numFeatures <= dataStorage->getDimensionality(), "The number of feature evaluations must not exceed the feature dimension.");
+    
+    AbstractDataStorage::ptr storage;
+    std::vector<bool> sampled;
+    
+    int _numBootstrapExamples = numBootstrapExamples;
+    int _numFeatures = numFeatures;
+    if (_numBootstrapExamples < 0)
+    {
+        _numBootstrapExamples = dataStorage->getTotalWeight();
+    }
+    if (_numFeatures < 0)
+    {
+        _numFeatures = std::sqrt(dataStorage->getDimensionality());
+    }
+    
+    if (useBootstrap)
+    {
+        storage = dataStorage->bootstrap(_numBootstrapExamples, sampled);
+    }
+    else
+    {
+        storage = dataStorage;
+    }
+    
+    const int N = storage->getSize();
+    const int D = storage->getDimensionality();
+    const int K = labels->getNumOutputs();
+    
+    // Look up the labels of all training examples once
+    std::vector<int> exampleLabels(N*K);
+    for (int n = 0; n < N; n++)
+    {
+        const int i = storage->getBaseIndex(n);
+        for (int k = 0; k < K; k++)
+        {
+            exampleLabels[n*K + k] = labels->getLabel(i, k);
+        }
+    }
+    
+    MultiOutputDecisionTree::ptr tree = std::make_shared<MultiOutputDecisionTree>();
+    
+    std::vector<int> sampledFeatures(D);
+    for (int d = 0; d < D; d++)
+    {
+        sampledFeatures[d] = d;
+    }
+    
+    std::mt19937 g(rd());
+    
+    MultiOutputEntropyObjective objective(storage, exampleLabels, *labels);
+    
+    growTree(*tree, storage, state, [&](int node, int* exampleList, int M) -> bool {
+        objective.setExamples(exampleList, M);
+        const std::vector<EfficientEntropyHistogram> & hists = objective.getHistograms();
+        
+        // Only split if the node is large enough, not pure in all outputs
+        // and not at the maximum depth
+        BestSplit best;
+        if (hists[0].getMass() >= minSplitExamples && !objective.isPure() && tree->getNodeConfig(node).getDepth() < maxDepth)
+        {
+            std::shuffle(sampledFeatures.begin(), sampledFeatures.end(), g);
+            
+            for (int f = 0; f < _numFeatures; f++)
+            {
+                searchThreshold(storage, exampleList, M, sampledFeatures[f], objective, best);
+            }
+        }
+        
+        // Did we find good split values?
+        if (!isValidSplit(best, minChildSplitExamples))
+        {
+            std::vector< std::vector<float> > & leafHistograms = tree->getNodeData(node).histograms;
+            leafHistograms.resize(K);
+            for (int k = 0; k < K; k++)
+            {
+                updateLeafNodeHistogram(leafHistograms[k], hists[k], smoothingParameter, useBootstrap);
+            }
+            return false;
+        }
+        
+        tree->getNodeConfig(node).setThreshold(best.threshold);
+        tree->getNodeConfig(node).setSplitFeature(best.feature);
+        return true;
+    });
+    
+    // If we use bootstrap, we use all the training examples for the 
+    // histograms
+    if (useBootstrap)
+    {
+        updateMultiOutputHistograms(tree, dataStorage, *labels, smoothingParameter);
+    }
+    
+    state.terminated = true;
+    
+    return tree;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CategoricalDecisionTreeLearner
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Checks that every categorical feature of a storage only takes the values
+ * 0, ..., K-1
  */
-inline void updateLeafNodeHistogram(std::vector<float> & leafNodeHistogram, const EfficientEntropyHistogram & hist, float smoothing, bool useBootstrap)
+static void validateCategories(const AbstractDataStorage & storage, const std::vector<int> & numCategories)
 {
-    const int C = hist.getSize();
-    
-    leafNodeHistogram.resize(C);
-    BOOST_ASSERT(leafNodeHistogram.size() > 0);
+    if (static_cast<int>(numCategories.size()) > storage.getDimensionality())
+    {
+        throw ConfigurationException("There are more categorical features than dimensions.");
+    }
     
-    if(!useBootstrap)
+    for (size_t d = 0; d < numCategories.size(); d++)
     {
-        for (int c = 0; c < C; c++)
+        const int K = numCategories[d];
+        if (K < 0)
         {
-            leafNodeHistogram[c] = std::log((hist.at(c) + smoothing)/(hist.getMass() + hist.getSize() * smoothing));
+            throw ConfigurationException("The number of categories must be non-negative.");
+        }
+        if (K == 0)
+        {
+            continue;
+        }
+        
+        for (int n = 0; n < storage.getSize(); n++)
+        {
+            const float value = storage.getDataPoint(n)(d);
+            if (!(0 <= value && value < K) || value != std::floor(value))
+            {
+                throw ConfigurationException("A categorical feature is not in [0, K-1].");
+            }
         }
     }
 }
 
-DecisionTree::ptr DecisionTreeLearner::learn(AbstractDataStorage::ptr dataStorage, DecisionTreeLearner::State & state)
+CategoricalDecisionTree::ptr CategoricalDecisionTreeLearner::learn(AbstractDataStorage::ptr dataStorage, CategoricalDecisionTreeLearner::State & state)
 {
     state.reset();
     state.started = true;
     
+    validateCategories(*dataStorage, numCategories);
+    
+    // Draw the training subset for this tree (if subsampling is enabled)
+    dataStorage = subsample(dataStorage);
+    
     BOOST_ASSERT_MSG(numFeatures <= dataStorage->getDimensionality(), "The number of feature evaluations must not exceed the feature dimension.");
     
     AbstractDataStorage::ptr storage;
-    // If we use bootstrap sampling, then this array contains the results of 
-    // the sampler. We use it later in order to refine the leaf node histograms
     std::vector<bool> sampled;
     
     // Check if data set related parameters have been set
@@ -59,7 +1210,7 @@ DecisionTree::ptr DecisionTreeLearner::learn(AbstractDataStorage::ptr dataStorag
     int _numFeatures = numFeatures;
     if (_numBootstrapExamples < 0)
     {
-        _numBootstrapExamples = dataStorage->getSize();
+        _numBootstrapExamples = dataStorage->getTotalWeight();
     }
     if (_numFeatures < 0)
     {
@@ -75,227 +1226,153 @@ DecisionTree::ptr DecisionTreeLearner::learn(AbstractDataStorage::ptr dataStorag
         storage = dataStorage;
     }
     
-    // Get the number of training examples and the dimensionality of the data set
     const int D = storage->getDimensionality();
     const int C = storage->getClasscount();
     
-    state.total = storage->getSize();
-    
-    // Set up a new tree. 
-    DecisionTree::ptr tree = std::make_shared<DecisionTree>();
-    tree->addNode();
-    
-    // This is the list of nodes that still have to be split
-    std::vector<int> splitStack;
-    splitStack.reserve(static_cast<int>(fastlog2(storage->getSize())));
-    
-    // Add the root node to the list of nodes that still have to be split
-    splitStack.push_back(0);
-    
-    // This matrix stores the training examples for certain nodes. 
-    std::vector< int* > trainingExamples;
-    std::vector< int > trainingExamplesSizes;
-    trainingExamples.reserve(LIBF_GRAPH_BUFFER_SIZE);
-    trainingExamplesSizes.reserve(LIBF_GRAPH_BUFFER_SIZE);
-    
-    // Add all training example to the root node
-    trainingExamplesSizes.push_back(storage->getSize());
-    trainingExamples.push_back(new int[trainingExamplesSizes[0]]);
-    for (int n = 0; n < storage->getSize(); n++)
-    {
-        trainingExamples[0][n] = n;
-    }
-    
-    // We use these arrays during training for the left and right histograms
-    EfficientEntropyHistogram leftHistogram(C);
-    EfficientEntropyHistogram rightHistogram(C);
+    // Pad the number of categories with numerical features
+    std::vector<int> categories(numCategories);
+    categories.resize(D, 0);
     
-    // We use this in order to sort the data points
-    FeatureComparator cp;
-    cp.storage = storage;
+    CategoricalDecisionTree::ptr tree = std::make_shared<CategoricalDecisionTree>();
     
-    // Set up the array of possible features, we use it in order to sample
-    // the features without replacement
     std::vector<int> sampledFeatures(D);
     for (int d = 0; d < D; d++)
     {
         sampledFeatures[d] = d;
     }
     
-    // Start training
-    while (splitStack.size() > 0)
-    {
-        // Extract an element from the queue
-        const int node = splitStack.back();
-        splitStack.pop_back();
-        
-        state.numNodes = tree->getNumNodes();
-        state.depth = std::max(state.depth, tree->getNodeConfig(node).getDepth());
-        
-        // Get the training example list
-        int* trainingExampleList = trainingExamples[node];
-        const int N = trainingExamplesSizes[node];
-
-        // Set up the right histogram
-        // Because we start with the threshold being at the left most position
-        // The right child node contains all training examples
+    EntropyObjective objective(storage);
+    
+    // Per category statistics: class histograms, masses and example counts
+    std::vector<int> categoryHistograms;
+    std::vector<int> categoryMasses;
+    std::vector<int> categoryCounts;
+    std::vector<int> categoryOrder;
+    std::vector<float> categoryRates;
+    std::vector<int> bestLeftCategories;
+    
+    growTree(*tree, storage, state, [&](int node, int* trainingExampleList, int N) -> bool {
+        objective.setExamples(trainingExampleList, N);
+        const EfficientEntropyHistogram & hist = objective.getHistogram();
         
-        EfficientEntropyHistogram hist(C);
-        for (int m = 0; m < N; m++)
+        if (hist.getMass() < minSplitExamples || hist.isPure() || tree->getNodeConfig(node).getDepth() >= maxDepth)
         {
-            // Get the class label of this training example
-            hist.addOne(storage->getClassLabel(trainingExampleList[m]));
+            updateLeafNodeHistogram(tree->getNodeData(node).histogram, hist, smoothingParameter, useBootstrap);
+            return false;
         }
         
-        // Don't split this node
-        //  If the number of examples is too small
-        //  If the training examples are all of the same class
-        //  If the maximum depth is reached
-        if (hist.getMass() < minSplitExamples || hist.isPure() || tree->getNodeConfig(node).getDepth() >= maxDepth)
+        // The class whose rate is used to order the categories
+        int rateClass = 1;
+        if (C != 2)
         {
-            // Resize and initialize the leaf node histogram
-            updateLeafNodeHistogram(tree->getNodeData(node).histogram, hist, smoothingParameter, useBootstrap);
-            BOOST_ASSERT(tree->getNodeData(node).histogram.size() > 0);
-            state.processed += N;
-            delete[] trainingExampleList;
-            continue;
+            rateClass = 0;
+            for (int c = 1; c < C; c++)
+            {
+                if (hist.at(c) > hist.at(rateClass))
+                {
+                    rateClass = c;
+                }
+            }
         }
         
-        // These are the parameters we optimize
-        float bestThreshold = 0;
-        int bestFeature = -1;
-        float bestObjective = 1e35;
-        int bestLeftMass = 0;
-        int bestRightMass = N;
-
-        // Sample random features
+        BestSplit best;
+        bestLeftCategories.clear();
+        
         std::shuffle(sampledFeatures.begin(), sampledFeatures.end(), std::default_random_engine(rd()));
         
-        // Optimize over all features
         for (int f = 0; f < _numFeatures; f++)
         {
             const int feature = sampledFeatures[f];
+            const int K = categories[feature];
             
-            cp.feature = feature;
-            std::sort(trainingExampleList, trainingExampleList + N, cp);
-            
-            // Initialize the histograms
-            leftHistogram.reset();
-            rightHistogram = hist;
+            if (K == 0)
+            {
+                // Numerical feature: Search the best threshold
+                const float objectiveBefore = best.objective;
+                searchThreshold(storage, trainingExampleList, N, feature, objective, best);
+                if (best.objective < objectiveBefore)
+                {
+                    bestLeftCategories.clear();
+                }
+                continue;
+            }
             
-            float leftValue = storage->getDataPoint(trainingExampleList[0])(feature);
-            int leftClass = storage->getClassLabel(trainingExampleList[0]);
+            // Categorical feature: Collect the class histograms per category
+            categoryHistograms.assign(K*C, 0);
+            categoryMasses.assign(K, 0);
+            categoryCounts.assign(K, 0);
             
-            // Test different thresholds
-            // Go over all examples in this node
-            for (int m = 1; m < N; m++)
+            for (int m = 0; m < N; m++)
             {
                 const int n = trainingExampleList[m];
+                const int category = static_cast<int>(storage->getDataPoint(n)(feature));
+                const int weight = storage->getWeight(n);
                 
-                // Move the last point to the left histogram
-                leftHistogram.addOne(leftClass);
-                rightHistogram.subOne(leftClass);
-                        
-                // It does
-                // Get the two feature values
-                const float rightValue = storage->getDataPoint(n)(feature);
-                
-                // Skip this split, if the two points lie too close together
-                const float diff = std::abs(rightValue - leftValue);
-                
-                if (diff < 1e-6f*std::max(std::abs(rightValue+1e-6), std::abs(leftValue+1e-6)))
-                {
-                    leftValue = rightValue;
-                    leftClass = storage->getClassLabel(n);
-                    continue;
-                }
-                
-                // Get the objective function
-                const float localObjective = leftHistogram.getEntropy()
-                        + rightHistogram.getEntropy();
-                
-                if (localObjective < bestObjective)
+                categoryHistograms[category*C + storage->getClassLabel(n)] += weight;
+                categoryMasses[category] += weight;
+                categoryCounts[category]++;
+            }
+            
+            // Sort the non-empty categories by their class rate
+            categoryOrder.clear();
+            categoryRates.assign(K, 0);
+            for (int k = 0; k < K; k++)
+            {
+                if (categoryCounts[k] > 0)
                 {
-                    // Get the threshold value
-                    bestThreshold = (leftValue + rightValue);
-                    bestFeature = feature;
-                    bestObjective = localObjective;
-                    bestLeftMass = leftHistogram.getMass();
-                    bestRightMass = rightHistogram.getMass();
+                    categoryOrder.push_back(k);
+                    categoryRates[k] = categoryHistograms[k*C + rateClass]/static_cast<float>(categoryMasses[k]);
                 }
-                
-                leftValue = rightValue;
-                leftClass = storage->getClassLabel(n);
             }
-        }
-        
-        // We spare the additional multiplication at each iteration.
-        bestThreshold *= 0.5f;
-        
-        // Did we find good split values?
-        if (bestFeature < 0 || bestLeftMass < minChildSplitExamples || bestRightMass < minChildSplitExamples)
-        {
-            // We didn't
-            // Don't split
-            updateLeafNodeHistogram(tree->getNodeData(node).histogram, hist, smoothingParameter, useBootstrap);
-            BOOST_ASSERT(tree->getNodeData(node).histogram.size() > 0);
-            state.processed += N;
-            delete[] trainingExampleList;
-            continue;
-        }
-        
-        // Set up the data lists for the child nodes
-        trainingExamplesSizes.push_back(bestLeftMass);
-        trainingExamplesSizes.push_back(bestRightMass);
-        trainingExamples.push_back(new int[bestLeftMass]);
-        trainingExamples.push_back(new int[bestRightMass]);
-        
-        int* leftList = trainingExamples[trainingExamples.size() - 2];
-        int* rightList = trainingExamples[trainingExamples.size() - 1];
-        
-        // Sort the points
-        for (int m = 0; m < N; m++)
-        {
-            const int n = trainingExampleList[m];
-            const float featureValue = storage->getDataPoint(n)(bestFeature);
             
-            BOOST_ASSERT(!std::isnan(featureValue));
+            std::sort(categoryOrder.begin(), categoryOrder.end(), [&categoryRates](int a, int b) {
+                return categoryRates[a] < categoryRates[b];
+            });
             
-            if (featureValue < bestThreshold)
-            {
-                leftList[--bestLeftMass] = n;
-            }
-            else
+            // Move the categories to the left one after another
+            objective.beginScan();
+            int leftCount = 0;
+            for (int i = 0; i < static_cast<int>(categoryOrder.size()) - 1; i++)
             {
-                rightList[--bestRightMass] = n;
+                const int k = categoryOrder[i];
+                for (int c = 0; c < C; c++)
+                {
+                    const int weight = categoryHistograms[k*C + c];
+                    if (weight > 0)
+                    {
+                        objective.moveClassLeft(c, weight);
+                    }
+                }
+                leftCount += categoryCounts[k];
+                
+                const float localObjective = objective.getObjective();
+                if (localObjective < best.objective)
+                {
+                    best.threshold = 0;
+                    best.feature = feature;
+                    best.objective = localObjective;
+                    best.leftMass = objective.getLeftMass();
+                    best.rightMass = objective.getRightMass();
+                    best.leftCount = leftCount;
+                    best.rightCount = N - leftCount;
+                    bestLeftCategories.assign(categoryOrder.begin(), categoryOrder.begin() + i + 1);
+                }
             }
         }
         
-        if (bestLeftMass != 0 || bestRightMass != 0)
+        if (!isValidSplit(best, minChildSplitExamples))
         {
-            for (int m = 0; m < N; m++)
-            {
-                const int n = trainingExampleList[m];
-                const float featureValue = storage->getDataPoint(n)(bestFeature);
-                std::cout << featureValue << "\n";
-            }
-            std::cout << bestFeature << "\n";
-            std::cout << bestThreshold << "\n";
+            updateLeafNodeHistogram(tree->getNodeData(node).histogram, hist, smoothingParameter, useBootstrap);
+            return false;
         }
-        BOOST_ASSERT(bestLeftMass == 0);
-        BOOST_ASSERT(bestRightMass == 0);
-        
-        // Ok, split the node
-        tree->getNodeConfig(node).setThreshold(bestThreshold);
-        tree->getNodeConfig(node).setSplitFeature(bestFeature);
-        const int leftChild = tree->splitNode(node);
-        
-        // Prepare to split the child nodes
-        splitStack.push_back(leftChild);
-        splitStack.push_back(leftChild + 1);
         
-        delete[] trainingExampleList;
-    }
+        // Set up the split
+        CategoricalSplitTreeNodeConfig & config = tree->getNodeConfig(node);
+        config.setSplitFeature(best.feature);
+        config.setThreshold(best.threshold);
+        config.setLeftCategories(bestLeftCategories);
+        return true;
+    });
     
     // If we use bootstrap, we use all the training examples for the 
     // histograms
@@ -318,6 +1395,9 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
     state.reset();
     state.started = true;
     
+    // Draw the training subset for this tree (if subsampling is enabled)
+    dataStorage = subsample(dataStorage);
+    
     AbstractDataStorage::ptr storage;
     // If we use bootstrap sampling, then this array contains the results of 
     // the sampler. We use it later in order to refine the leaf node histograms
@@ -325,7 +1405,8 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
     
     if (useBootstrap)
     {
-        storage = dataStorage->bootstrap(numBootstrapExamples, sampled);
+        const int _numBootstrapExamples = numBootstrapExamples < 0 ? dataStorage->getTotalWeight() : numBootstrapExamples;
+        storage = dataStorage->bootstrap(_numBootstrapExamples, sampled);
     }
     else
     {
@@ -375,6 +1456,10 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
     
     const int sparsity = 3;
     
+    // The candidate projections are drawn into the same scratch vector
+    ScratchArena::Scope scratch;
+    DataPoint & projection = scratch.getVector(D);
+    
     // Start training
     while (splitStack.size() > 0)
     {
@@ -401,7 +1486,7 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
         {
             const int c = storage->getClassLabel(trainingExampleList[m]);
             // Get the class label of this training example
-            hist.addOne(c);
+            hist.add(c, storage->getWeight(trainingExampleList[m]));
             sortedPointIndices[c].push_back(trainingExampleList[m]);
         }
         
@@ -434,13 +1519,16 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
         float bestObjective = 1e35;
         int bestLeftMass = 0;
         int bestRightMass = N;
+        // The masses are weighted, these are the actual number of examples
+        int bestLeftCount = 0;
+        int bestRightCount = N;
         DataPoint bestProjection(D);
 
         // Optimize over all features
         for (int f = 0; f < numFeatures; f++)
         {
             // Sample a projection dimension
-            DataPoint projection = DataPoint::Zero(D);
+            projection.setZero();
 #if 0
             float length = 0;
             for (int d = 0; d < D; d++)
@@ -461,6 +1549,7 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
             // Initialize the histograms
             leftHistogram.reset();
             rightHistogram = hist;
+            int leftCount = 0;
             
             // Set up the array of projection values
             for (int m = 0; m < N; m++)
@@ -471,8 +1560,9 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
                 if (inner < 0)
                 {
                     // Move the last point to the left histogram
-                    leftHistogram.addOne(storage->getClassLabel(n));
-                    rightHistogram.subOne(storage->getClassLabel(n));
+                    leftHistogram.add(storage->getClassLabel(n), storage->getWeight(n));
+                    rightHistogram.sub(storage->getClassLabel(n), storage->getWeight(n));
+                    leftCount++;
                 }
             }
             
@@ -487,6 +1577,8 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
                 bestObjective = localObjective;
                 bestLeftMass = leftHistogram.getMass();
                 bestRightMass = rightHistogram.getMass();
+                bestLeftCount = leftCount;
+                bestRightCount = N - leftCount;
             }
         }
         
@@ -503,10 +1595,10 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
         }
         
         // Set up the data lists for the child nodes
-        trainingExamplesSizes.push_back(bestLeftMass);
-        trainingExamplesSizes.push_back(bestRightMass);
-        trainingExamples.push_back(new int[bestLeftMass]);
-        trainingExamples.push_back(new int[bestRightMass]);
+        trainingExamplesSizes.push_back(bestLeftCount);
+        trainingExamplesSizes.push_back(bestRightCount);
+        trainingExamples.push_back(new int[bestLeftCount]);
+        trainingExamples.push_back(new int[bestRightCount]);
         
         int* leftList = trainingExamples[trainingExamples.size() - 2];
         int* rightList = trainingExamples[trainingExamples.size() - 1];
@@ -519,11 +1611,11 @@ ProjectiveDecisionTree::ptr ProjectiveDecisionTreeLearner::learn(AbstractDataSto
             
             if (inner < 0)
             {
-                leftList[--bestLeftMass] = n;
+                leftList[--bestLeftCount] = n;
             }
             else
             {
-                rightList[--bestRightMass] = n;
+                rightList[--bestRightCount] = n;
             }
         }
         
@@ -559,6 +1651,9 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
     state.reset();
     state.started = true;
     
+    // Draw the training subset for this tree (if subsampling is enabled)
+    dataStorage = subsample(dataStorage);
+    
     AbstractDataStorage::ptr storage;
     // If we use bootstrap sampling, then this array contains the results of 
     // the sampler. We use it later in order to refine the leaf node histograms
@@ -566,7 +1661,8 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
     
     if (useBootstrap)
     {
-        storage = dataStorage->bootstrap(numBootstrapExamples, sampled);
+        const int _numBootstrapExamples = numBootstrapExamples < 0 ? dataStorage->getTotalWeight() : numBootstrapExamples;
+        storage = dataStorage->bootstrap(_numBootstrapExamples, sampled);
     }
     else
     {
@@ -637,7 +1733,7 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
         {
             const int c = storage->getClassLabel(trainingExampleList[m]);
             // Get the class label of this training example
-            hist.addOne(c);
+            hist.add(c, storage->getWeight(trainingExampleList[m]));
             sortedPointIndices[c].push_back(trainingExampleList[m]);
         }
         
@@ -671,6 +1767,9 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
         float bestObjective = 1e35;
         int bestLeftMass = 0;
         int bestRightMass = N;
+        // The masses are weighted, these are the actual number of examples
+        int bestLeftCount = 0;
+        int bestRightCount = N;
         DataPoint bestProjection1(D);
         DataPoint bestProjection2(D);
 
@@ -692,6 +1791,7 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
             // Initialize the histograms
             leftHistogram.reset();
             rightHistogram = hist;
+            int leftCount = 0;
             
             // Set up the array of projection values
             for (int m = 0; m < N; m++)
@@ -704,8 +1804,9 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
                 if (inner < threshold)
                 {
                     // Move the last point to the left histogram
-                    leftHistogram.addOne(storage->getClassLabel(n));
-                    rightHistogram.subOne(storage->getClassLabel(n));
+                    leftHistogram.add(storage->getClassLabel(n), storage->getWeight(n));
+                    rightHistogram.sub(storage->getClassLabel(n), storage->getWeight(n));
+                    leftCount++;
                 }
             }
             
@@ -722,6 +1823,8 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
                 bestObjective = localObjective;
                 bestLeftMass = leftHistogram.getMass();
                 bestRightMass = rightHistogram.getMass();
+                bestLeftCount = leftCount;
+                bestRightCount = N - leftCount;
             }
         }
         
@@ -738,10 +1841,10 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
         }
         
         // Set up the data lists for the child nodes
-        trainingExamplesSizes.push_back(bestLeftMass);
-        trainingExamplesSizes.push_back(bestRightMass);
-        trainingExamples.push_back(new int[bestLeftMass]);
-        trainingExamples.push_back(new int[bestRightMass]);
+        trainingExamplesSizes.push_back(bestLeftCount);
+        trainingExamplesSizes.push_back(bestRightCount);
+        trainingExamples.push_back(new int[bestLeftCount]);
+        trainingExamples.push_back(new int[bestRightCount]);
         
         int* leftList = trainingExamples[trainingExamples.size() - 2];
         int* rightList = trainingExamples[trainingExamples.size() - 1];
@@ -756,11 +1859,11 @@ DotProductDecisionTree::ptr DotProductDecisionTreeLearner::learn(AbstractDataSto
             
             if (inner < bestThreshold)
             {
-                leftList[--bestLeftMass] = n;
+                leftList[--bestLeftCount] = n;
             }
             else
             {
-                rightList[--bestRightMass] = n;
+                rightList[--bestRightCount] = n;
             }
         }
         
@@ -927,6 +2030,8 @@ OnlineDecisionTree::ptr OnlineDecisionTreeLearner::learn(AbstractDataStorage::pt
             std::poisson_distribution<int> poisson(bootstrapLambda);
             K = poisson(g); // May also give zero.
         }
+        // Weighted points count as multiple identical points
+        K *= storage->getWeight(n);
         
         for (int k = 0; k < K; k++)
         {
@@ -9,6 +9,13 @@
 #include <random>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <unordered_set>
 
 using namespace libf;
 
@@ -108,43 +115,231 @@ int AbstractDataStorage::getDimensionality() const
     }
 }
 
+int AbstractDataStorage::getTotalWeight() const
+{
+    if (!isWeighted())
+    {
+        return getSize();
+    }
+    
+    int total = 0;
+    for (int n = 0; n < getSize(); n++)
+    {
+        total += getWeight(n);
+    }
+    return total;
+}
+
 ReferenceDataStorage::ptr AbstractDataStorage::excerpt(int begin, int end) const
 {
     BOOST_ASSERT_MSG(begin >= 0 && begin <= end, "Invalid indices.");
     BOOST_ASSERT_MSG(end < getSize(), "Invalid indices.");
     
-    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(shared_from_this());
+    // Reference the base storage directly in order to keep views flat
+    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(getBaseStorage());
     
     // Add the data points
     for (int n = begin; n <= end; n++)
     {
-        storage->addDataPoint(n);
+        storage->addDataPoint(getBaseIndex(n), getWeight(n));
     }
     
     return storage;
 }
 
+/**
+ * Adds the data points hit by a sample of weight units to a reference 
+ * storage. The units of the given points are numbered consecutively, i.e. 
+ * points[0] spans the units [0, w_0 - 1], points[1] the units 
+ * [w_0, w_0 + w_1 - 1] and so on. Every hit point is added once with the
+ * number of its sampled units as weight. 
+ */
+static void addSampledUnits(const AbstractDataStorage & storage, const std::vector<int> & points, const std::vector<int> & units, ReferenceDataStorage & result)
+{
+    BOOST_ASSERT_MSG(std::is_sorted(units.begin(), units.end()), "The sampled units must be sorted.");
+    
+    size_t u = 0;
+    int end = 0;
+    for (size_t i = 0; i < points.size() && u < units.size(); i++)
+    {
+        end += storage.getWeight(points[i]);
+        
+        int count = 0;
+        for (; u < units.size() && units[u] < end; u++)
+        {
+            count++;
+        }
+        
+        if (count > 0)
+        {
+            result.addDataPoint(storage.getBaseIndex(points[i]), count);
+        }
+    }
+}
+
 ReferenceDataStorage::ptr AbstractDataStorage::bootstrap(int N, std::vector<bool> & sampled) const
 {
     BOOST_ASSERT_MSG(N >= 0, "The number of bootstrap examples must be non-negative.");
     
-    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(shared_from_this());
+    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(getBaseStorage());
     
     // Set up a probability distribution
     std::mt19937 g(rd());
     
-    std::uniform_int_distribution<int> distribution(0, getSize() - 1);
-    
     // Initialize the flag array
     sampled.resize(getSize(), false);
     
-    // Add the points
+    if (!isWeighted())
+    {
+        std::uniform_int_distribution<int> distribution(0, getSize() - 1);
+        
+        // Add the points
+        for (int i = 0; i < N; i++)
+        {
+            // Select some point
+            const int n = distribution(g);
+            sampled[n] = true;
+            storage->addDataPoint(getBaseIndex(n), 1);
+        }
+        
+        return storage;
+    }
+    
+    // Draw the examples the points stand for: Point n is hit by a draw from
+    // [0, W - 1] if the draw falls into its range of the cumulative weights
+    std::vector<int> cumulativeWeights(getSize());
+    int total = 0;
+    for (int n = 0; n < getSize(); n++)
+    {
+        total += getWeight(n);
+        cumulativeWeights[n] = total;
+    }
+    
+    std::uniform_int_distribution<int> distribution(0, total - 1);
+    std::vector<int> counts(getSize(), 0);
     for (int i = 0; i < N; i++)
     {
-        // Select some point
-        const int n = distribution(g);
-        sampled[n] = true;
-        storage->addDataPoint(n);
+        const int unit = distribution(g);
+        const int n = std::upper_bound(cumulativeWeights.begin(), cumulativeWeights.end(), unit) - cumulativeWeights.begin();
+        counts[n]++;
+    }
+    
+    // Add every drawn point once
+    for (int n = 0; n < getSize(); n++)
+    {
+        if (counts[n] > 0)
+        {
+            sampled[n] = true;
+            storage->addDataPoint(getBaseIndex(n), counts[n]);
+        }
+    }
+    
+    return storage;
+}
+
+ReferenceDataStorage::ptr AbstractDataStorage::subsample(int N) const
+{
+    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(getBaseStorage());
+    
+    std::mt19937 g(rd());
+    std::vector<int> indices;
+    
+    if (!isWeighted())
+    {
+        BOOST_ASSERT_MSG(0 <= N && N <= getSize(), "The number of subsampled examples must be in [0, size].");
+        
+        Util::sampleWithoutReplacement(getSize(), N, indices, g);
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            storage->addDataPoint(getBaseIndex(indices[i]), 1);
+        }
+        
+        return storage;
+    }
+    
+    const int total = getTotalWeight();
+    BOOST_ASSERT_MSG(0 <= N && N <= total, "The number of subsampled examples must be in [0, total weight].");
+    
+    std::vector<int> points(getSize());
+    for (int n = 0; n < getSize(); n++)
+    {
+        points[n] = n;
+    }
+    
+    Util::sampleWithoutReplacement(total, N, indices, g);
+    addSampledUnits(*this, points, indices, *storage);
+    
+    return storage;
+}
+
+ReferenceDataStorage::ptr AbstractDataStorage::stratifiedSubsample(int N, bool balanced) const
+{
+    return stratifiedSubsample(N, balanced, ClassIndex(*this));
+}
+
+ReferenceDataStorage::ptr AbstractDataStorage::stratifiedSubsample(int N, bool balanced, const ClassIndex & classIndex) const
+{
+    BOOST_ASSERT_MSG(N >= 0, "The number of subsampled examples must be non-negative.");
+    BOOST_ASSERT_MSG(classIndex.getClasscount() == getClasscount(), "The class index does not belong to this storage.");
+    
+    const int C = classIndex.getClasscount();
+    
+    // Visit the classes from the smallest to the largest one, such that the
+    // points the small classes cannot contribute are left to the large ones
+    std::vector<int> classes;
+    int labeled = 0;
+    for (int c = 0; c < C; c++)
+    {
+        if (classIndex.getClassWeight(c) > 0)
+        {
+            classes.push_back(c);
+            labeled += classIndex.getClassWeight(c);
+        }
+    }
+    std::sort(classes.begin(), classes.end(), [&classIndex](int lhs, int rhs) {
+        return classIndex.getClassWeight(lhs) < classIndex.getClassWeight(rhs);
+    });
+    
+    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(getBaseStorage());
+    if (labeled == 0)
+    {
+        return storage;
+    }
+    
+    std::mt19937 g(rd());
+    std::vector<int> sampled;
+    int remaining = N;
+    for (size_t i = 0; i < classes.size(); i++)
+    {
+        const int c = classes[i];
+        const int size = classIndex.getClassWeight(c);
+        
+        int M;
+        if (balanced)
+        {
+            // Split the remaining points evenly among the remaining classes
+            M = remaining/static_cast<int>(classes.size() - i);
+        }
+        else
+        {
+            M = static_cast<int>(std::round(N*static_cast<float>(size)/labeled));
+        }
+        M = std::min(M, size);
+        remaining -= M;
+        
+        // Draw the examples of the class; a point that stands for several 
+        // drawn examples is added once
+        Util::sampleWithoutReplacement(size, M, sampled, g);
+        for (int m = 0; m < M; )
+        {
+            const int n = classIndex.getPoint(c, sampled[m]);
+            int count = 0;
+            for (; m < M && classIndex.getPoint(c, sampled[m]) == n; m++)
+            {
+                count++;
+            }
+            storage->addDataPoint(getBaseIndex(n), count);
+        }
     }
     
     return storage;
@@ -172,20 +367,20 @@ DataStorage::ptr AbstractDataStorage::hardCopy() const
     const int N = this->getSize();
     for (int n = 0; n < N; n++)
     {
-        result->addDataPoint(this->getDataPoint(n), this->getClassLabel(n));
+        result->addDataPoint(this->getDataPoint(n), this->getClassLabel(n), this->getWeight(n));
     }
     return result;
 }
 
 ReferenceDataStorage::ptr AbstractDataStorage::filter(const std::function<bool(const DataPoint &, int)> & f) const
 {
-    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(shared_from_this());
+    ReferenceDataStorage::ptr storage = std::make_shared<ReferenceDataStorage>(getBaseStorage());
     const int N = this->getSize();
     for (int n = 0; n < N; n++)
     {
         if (f(this->getDataPoint(n), this->getClassLabel(n)))
         {
-            storage->addDataPoint(n);
+            storage->addDataPoint(getBaseIndex(n), getWeight(n));
         }
     }
     return storage;
@@ -229,20 +424,110 @@ bool DataStorage::isConsistent() const
 
 void DataStorage::permute(const std::vector<int> & permutation)
 {
-    // We need to copy the class labels because the permutation cannot 
-    // be done in place
-    std::vector<int> classLabelsCopy(classLabels);
-    Util::permute(permutation, classLabelsCopy, classLabels);
-    std::vector<DataPoint> dataPointsCopy(dataPoints);
-    Util::permute(permutation, dataPointsCopy, dataPoints);
+    // The data points are moved along the cycles of the permutation, thus
+    // no copy of the storage is needed
+    Util::permuteInPlace(permutation, classLabels);
+    Util::permuteInPlace(permutation, dataPoints);
+    if (weights.size() > 0)
+    {
+        Util::permuteInPlace(permutation, weights);
+    }
+}
+
+/**
+ * Removes all entries of v whose flag is set by moving the remaining entries
+ * to the front. 
+ */
+template <class T>
+static void compact(std::vector<T> & v, const std::vector<bool> & remove)
+{
+    size_t k = 0;
+    for (size_t i = 0; i < v.size(); i++)
+    {
+        if (!remove[i])
+        {
+            if (k != i)
+            {
+                v[k] = std::move(v[i]);
+            }
+            k++;
+        }
+    }
+    v.resize(k);
+}
+
+/**
+ * Converts a list of indices into removal flags.
+ */
+static void indicesToFlags(const std::vector<int> & indices, int N, std::vector<bool> & remove)
+{
+    remove.assign(N, false);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        BOOST_ASSERT_MSG(0 <= indices[i] && indices[i] < N, "The data point index is out of bounds.");
+        remove[indices[i]] = true;
+    }
+}
+
+void DataStorage::removeDataPoints(const std::vector<int> & indices)
+{
+    std::vector<bool> remove;
+    indicesToFlags(indices, getSize(), remove);
+    
+    compact(dataPoints, remove);
+    compact(classLabels, remove);
+    if (weights.size() > 0)
+    {
+        compact(weights, remove);
+    }
 }
 
 void DataStorage::addDataPoints(AbstractDataStorage::ptr storage)
 {
     for (int n = 0; n < storage->getSize(); n++)
     {
-        this->addDataPoint(storage->getDataPoint(n), storage->getClassLabel(n));
+        this->addDataPoint(storage->getDataPoint(n), storage->getClassLabel(n), storage->getWeight(n));
+    }
+}
+
+void DataStorage::moveDataPoints(DataStorage & storage)
+{
+    if (this->getSize() == 0)
+    {
+        dataPoints.swap(storage.dataPoints);
+        classLabels.swap(storage.classLabels);
+        weights.swap(storage.weights);
+        std::swap(classcount, storage.classcount);
+    }
+    else
+    {
+        BOOST_ASSERT_MSG(storage.getSize() == 0 || getDataPoint(0).size() == storage.getDataPoint(0).size(), "The dimensionality of the new points does not match the one of the existing points.");
+        
+        // Only materialize the weights if either storage is weighted
+        if (weights.size() > 0 || storage.weights.size() > 0)
+        {
+            weights.resize(dataPoints.size(), 1);
+            if (storage.weights.size() > 0)
+            {
+                weights.insert(weights.end(), storage.weights.begin(), storage.weights.end());
+            }
+            else
+            {
+                weights.resize(dataPoints.size() + storage.dataPoints.size(), 1);
+            }
+        }
+        
+        dataPoints.insert(dataPoints.end(), 
+                std::make_move_iterator(storage.dataPoints.begin()), 
+                std::make_move_iterator(storage.dataPoints.end()));
+        classLabels.insert(classLabels.end(), storage.classLabels.begin(), storage.classLabels.end());
+        classcount = std::max(classcount, storage.classcount);
     }
+    
+    storage.dataPoints.clear();
+    storage.classLabels.clear();
+    storage.weights.clear();
+    storage.classcount = 0;
 }
 
 void DataStorage::mapInPlace(const std::function<void(DataPoint&, int&) >& f)
@@ -265,216 +550,433 @@ void DataStorage::mapInPlace(const std::function<void(DataPoint&, int&) >& f)
 /// ReferenceDataStorage
 ////////////////////////////////////////////////////////////////////////////////
 
-void ReferenceDataStorage::permute(const std::vector<int> & permutation)
+void ReferenceDataStorage::addDataPoint(int n)
 {
-    // We need to copy the class labels because the permutation cannot 
-    // be done in place
-    std::vector<int> dataPointIndicesCopy(dataPointIndices);
-    Util::permute(permutation, dataPointIndicesCopy, dataPointIndices);
+    if (!hasParentView)
+    {
+        BOOST_ASSERT_MSG(0 <= n && n < dataStorage->getSize(), "Invalid data point index from reference storage.");
+        addBaseDataPoint(n, dataStorage->DataStorage::getWeight(n));
+        return;
+    }
+    
+    AbstractDataStorage::const_ptr parent = lockParentView();
+    BOOST_ASSERT_MSG(0 <= n && n < parent->getSize(), "Invalid data point index from reference storage.");
+    addBaseDataPoint(parent->getBaseIndex(n), parent->getWeight(n));
 }
 
-////////////////////////////////////////////////////////////////////////////////
-/// AbstractDataReader
-////////////////////////////////////////////////////////////////////////////////
+void ReferenceDataStorage::addDataPoint(int n, int weight)
+{
+    if (!hasParentView)
+    {
+        BOOST_ASSERT_MSG(0 <= n && n < dataStorage->getSize(), "Invalid data point index from reference storage.");
+        addBaseDataPoint(n, weight);
+        return;
+    }
+    
+    AbstractDataStorage::const_ptr parent = lockParentView();
+    BOOST_ASSERT_MSG(0 <= n && n < parent->getSize(), "Invalid data point index from reference storage.");
+    addBaseDataPoint(parent->getBaseIndex(n), weight);
+}
 
-void AbstractDataReader::read(const std::string& filename, DataStorage::ptr dataStorage) throw(IOException)
+void ReferenceDataStorage::addBaseDataPoint(int index, int weight)
 {
-    // Try to open the file
-    std::ifstream stream(filename, std::ios::binary);
+    BOOST_ASSERT_MSG(weight > 0, "Weights must be positive.");
     
-    // Check if we could open the file
-    if (!stream.is_open())
+    // The weights are only stored once a weight differs from the base storage
+    const bool storeWeights = weights.size() > 0 || weight != dataStorage->DataStorage::getWeight(index);
+    if (storeWeights && weights.size() == 0)
     {
-        throw IOException("Could not open file.");
+        weights.resize(getSize());
+        for (int i = 0; i < getSize(); i++)
+        {
+            weights[i] = dataStorage->DataStorage::getWeight(dataPointIndices[i]);
+        }
     }
     
-    // Read the actual data
-    read(stream, dataStorage);
+    dataPointIndices.push_back(index);
+    if (storeWeights)
+    {
+        weights.push_back(weight);
+    }
+}
+
+void ReferenceDataStorage::permute(const std::vector<int> & permutation)
+{
+    Util::permuteInPlace(permutation, dataPointIndices);
+    if (weights.size() > 0)
+    {
+        Util::permuteInPlace(permutation, weights);
+    }
+}
+
+void ReferenceDataStorage::removeDataPoints(const std::vector<int> & indices)
+{
+    std::vector<bool> remove;
+    indicesToFlags(indices, getSize(), remove);
     
-    // Close the stream
-    stream.close();
+    compact(dataPointIndices, remove);
+    if (weights.size() > 0)
+    {
+        compact(weights, remove);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// CSVDataReader
+/// ClassIndex
 ////////////////////////////////////////////////////////////////////////////////
 
-void CSVDataReader::read(std::istream & stream, DataStorage::ptr dataStorage)
+ClassIndex::ClassIndex(const AbstractDataStorage & storage) : 
+        indices(storage.getClasscount()), 
+        cumulativeWeights(storage.getClasscount())
 {
-    std::string line;
-    while (std::getline(stream,line))
+    const bool weighted = storage.isWeighted();
+    for (int n = 0; n < storage.getSize(); n++)
     {
-        // Do not consider blank line
-        if (line.size() == 0) continue;
-        
-        // Parse the line
-        std::vector<float> numbers;
-        parseLine(line, numbers);
-        
-        const int isize = static_cast<int>(numbers.size());
-        
-        // If we read class labels, the number of columns is one more than the
-        // number of dimensions
-        int dimensionality = isize;
-        if (readClassLabels)
-        {
-            dimensionality--;
-        }
-        
-        // Load the data point
-        DataPoint dataPoint(dimensionality);
-        int  label = 0;
-        
-        for (int  i = 0; i < isize; i++)
+        const int label = storage.getClassLabel(n);
+        if (label == LIBF_NO_LABEL)
         {
-            // Do we read class labels?
-            if (readClassLabels)
-            {
-                // We do
-                // Is this the label column?
-                if (i == classLabelColumnIndex)
-                {
-                    // It is
-                    // Get a preliminary class label
-                    label = static_cast<int>(numbers[i]);
-                }
-                else if (i < classLabelColumnIndex)
-                {
-                    dataPoint(i) = numbers[i];
-                }
-                else
-                {
-                    dataPoint(i - 1) = numbers[i];
-                }
-            }
-            else
-            {
-                dataPoint(i) = numbers[i];
-            }
+            continue;
         }
         
-        if (readClassLabels)
-        {
-            dataStorage->addDataPoint(dataPoint, label);
-        }
-        else
+        indices[label].push_back(n);
+        if (weighted)
         {
-            dataStorage->addDataPoint(dataPoint);
+            const int total = (cumulativeWeights[label].size() > 0 ? cumulativeWeights[label].back() : 0);
+            cumulativeWeights[label].push_back(total + storage.getWeight(n));
         }
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// AbstractFeatureProvider
+////////////////////////////////////////////////////////////////////////////////
 
-void CSVDataReader::parseLine(const std::string & line, std::vector<float> & result) const
+void AbstractFeatureProvider::computeFeatures(const std::vector< std::pair<int, int> > & requests, std::vector<float> & values)
 {
-    // Set up the iterators
-    std::string::const_iterator first = line.begin();
-    std::string::const_iterator last = line.end();
-    
-    using boost::spirit::qi::float_;
-    using boost::spirit::qi::int_;
-    using boost::spirit::qi::phrase_parse;
-    using boost::spirit::ascii::space;
-    using boost::spirit::qi::lit;
-    
-    // Parse the line using boost spirit
-    bool r = phrase_parse(
-        first, 
-        last, 
-        float_ % lit(columnSeparator), 
-        space,
-        result
-    );
-    
-    // There was a mismatch. This is not a valid LIBSVM file
-    if (first != last || !r)
+    values.resize(requests.size());
+    for (size_t i = 0; i < requests.size(); i++)
     {
-        std::cout << line << std::endl;
-        throw IOException("Invalid CSV line.");
+        values[i] = computeFeature(requests[i].first, requests[i].second);
     }
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
-/// LIBSVMDataReader
+/// FeatureMemo
 ////////////////////////////////////////////////////////////////////////////////
 
-void LIBSVMDataReader::read(std::istream& stream, DataStorage::ptr dataStorage)
+void FeatureMemo::prefetch(const std::vector< std::pair<int, int> > & requests)
 {
-    std::string line;
-    
-    // First: Parse the entire thing
-    std::vector< std::pair<int, std::vector< std::pair<int, float> > > > lines;
-    
-    // Iterate over the data points and read them
-    while (std::getline(stream, line))
+    // Only request unknown features and every feature only once
+    std::vector< std::pair<int, int> > missing;
+    std::unordered_set<size_t> requested;
+    for (size_t i = 0; i < requests.size(); i++)
     {
-        // Skip this line if it's empty or starts with a #
-        if (line.size() == 0 || line[0] == '#')
+        const size_t index = getIndex(requests[i].first, requests[i].second);
+        if (values.find(index) == values.end() && requested.insert(index).second)
         {
-            continue;
+            missing.push_back(requests[i]);
         }
-        lines.push_back(std::pair<int, std::vector< std::pair<int, float> > >());
-        
-        parseLine(line, lines.back());
     }
     
-    // Determine the dimensionality
-    int dimensionality = 0;
-    for (size_t i = 0; i < lines.size(); i++)
+    if (missing.size() == 0)
     {
-        for (size_t d = 0; d < lines[i].second.size(); d++)
-        {
-            dimensionality = std::max(dimensionality, static_cast<int>(lines[i].second[d].first));
-        }
+        return;
     }
     
-    if (dimensionality == 0 && lines.size() > 0)
-    {
-        throw IOException("Invalid LIBSVM data set. No dimensions.");
+    std::vector<float> missingValues;
+    provider->computeFeatures(missing, missingValues);
+    
+    BOOST_ASSERT_MSG(missingValues.size() == missing.size(), "The provider returned the wrong number of features.");
+    
+    // The features are only marked as known once their values are available,
+    // such that a failing provider leaves the memo unchanged
+    for (size_t i = 0; i < missing.size(); i++)
+    {
+        values[getIndex(missing[i].first, missing[i].second)] = missingValues[i];
+    }
+    numComputed += static_cast<int>(missing.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CompactDataStorage
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the size of a feature of the given type in bytes. 
+ */
+static int getFeatureSize(int featureType)
+{
+    switch (featureType)
+    {
+        case LibforestDataWriter::FEATURE_TYPE_UINT8:
+            return sizeof(uint8_t);
+        case LibforestDataWriter::FEATURE_TYPE_UINT16:
+        case LibforestDataWriter::FEATURE_TYPE_HALF:
+            return sizeof(uint16_t);
+        case LibforestDataWriter::FEATURE_TYPE_DOUBLE:
+            return sizeof(double);
+        default:
+            return sizeof(float);
+    }
+}
+
+/**
+ * Converts D features of type T to float. 
+ */
+template <typename T>
+static void widenFeatures(const unsigned char* data, float* x, int D)
+{
+    for (int d = 0; d < D; d++)
+    {
+        T value;
+        std::memcpy(&value, data + d*sizeof(T), sizeof(T));
+        x[d] = static_cast<float>(value);
+    }
+}
+
+/**
+ * Converts D features of the given type to float. 
+ */
+static void widenFeatures(const unsigned char* data, float* x, int D, int featureType)
+{
+    switch (featureType)
+    {
+        case LibforestDataWriter::FEATURE_TYPE_UINT8:
+            widenFeatures<uint8_t>(data, x, D);
+            break;
+        case LibforestDataWriter::FEATURE_TYPE_UINT16:
+            widenFeatures<uint16_t>(data, x, D);
+            break;
+        case LibforestDataWriter::FEATURE_TYPE_HALF:
+            for (int d = 0; d < D; d++)
+            {
+                uint16_t half;
+                std::memcpy(&half, data + d*sizeof(uint16_t), sizeof(uint16_t));
+                x[d] = Util::halfToFloat(half);
+            }
+            break;
+        case LibforestDataWriter::FEATURE_TYPE_DOUBLE:
+            widenFeatures<double>(data, x, D);
+            break;
+        default:
+            std::memcpy(x, data, D*sizeof(float));
+            break;
+    }
+}
+
+/**
+ * Converts D features to type T. Integer types are rounded and clamped.
+ */
+template <typename T>
+static void narrowFeatures(const float* x, unsigned char* data, int D)
+{
+    for (int d = 0; d < D; d++)
+    {
+        T value;
+        if (std::numeric_limits<T>::is_integer)
+        {
+            const float clamped = std::min(std::max(std::round(x[d]), 
+                    static_cast<float>(std::numeric_limits<T>::min())), 
+                    static_cast<float>(std::numeric_limits<T>::max()));
+            value = static_cast<T>(clamped);
+        }
+        else
+        {
+            value = static_cast<T>(x[d]);
+        }
+        std::memcpy(data + d*sizeof(T), &value, sizeof(T));
+    }
+}
+
+/**
+ * Converts D features to the given type. 
+ */
+static void narrowFeatures(const float* x, unsigned char* data, int D, int featureType)
+{
+    switch (featureType)
+    {
+        case LibforestDataWriter::FEATURE_TYPE_UINT8:
+            narrowFeatures<uint8_t>(x, data, D);
+            break;
+        case LibforestDataWriter::FEATURE_TYPE_UINT16:
+            narrowFeatures<uint16_t>(x, data, D);
+            break;
+        case LibforestDataWriter::FEATURE_TYPE_HALF:
+            for (int d = 0; d < D; d++)
+            {
+                const uint16_t half = Util::floatToHalf(x[d]);
+                std::memcpy(data + d*sizeof(uint16_t), &half, sizeof(uint16_t));
+            }
+            break;
+        case LibforestDataWriter::FEATURE_TYPE_DOUBLE:
+            narrowFeatures<double>(x, data, D);
+            break;
+        default:
+            std::memcpy(data, x, D*sizeof(float));
+            break;
     }
+}
+
+CompactDataStorage::CompactDataStorage(int _featureType) : 
+        featureType(_featureType), 
+        featureSize(getFeatureSize(_featureType)), 
+        D(0), 
+        classcount(0)
+{
+    BOOST_ASSERT_MSG(LibforestDataWriter::FEATURE_TYPE_UINT8 <= featureType && featureType <= LibforestDataWriter::FEATURE_TYPE_DOUBLE, "Invalid feature type.");
+}
+
+float CompactDataStorage::getFeature(int n, int d) const
+{
+    BOOST_ASSERT_MSG(0 <= n && n < getSize(), "The data point index is out of bounds.");
+    BOOST_ASSERT_MSG(0 <= d && d < D, "Invalid feature index.");
+    
+    float value;
+    widenFeatures(features.data() + (static_cast<size_t>(n)*D + d)*featureSize, &value, 1, featureType);
+    return value;
+}
+
+void CompactDataStorage::getDataPoint(int n, DataPoint & x) const
+{
+    BOOST_ASSERT_MSG(0 <= n && n < getSize(), "The data point index is out of bounds.");
+    
+    x.resize(D);
+    widenFeatures(features.data() + static_cast<size_t>(n)*D*featureSize, x.data(), D, featureType);
+}
+
+void CompactDataStorage::addDataPoint(const DataPoint & x, int label)
+{
+    BOOST_ASSERT_MSG(getSize() == 0 || x.rows() == D, "The dimensionality of the new point does not match the one of the existing points.");
+    
+    D = static_cast<int>(x.rows());
+    const size_t offset = features.size();
+    features.resize(offset + static_cast<size_t>(D)*featureSize);
+    narrowFeatures(x.data(), features.data() + offset, D, featureType);
+    
+    classLabels.push_back(label);
+    classcount = std::max(classcount, label + 1);
+}
+
+void CompactDataStorage::addRawDataPoint(const unsigned char* _features, int _D, int label)
+{
+    BOOST_ASSERT_MSG(getSize() == 0 || _D == D, "The dimensionality of the new point does not match the one of the existing points.");
     
-    // Reverse the vector. We need this for the data points to stay in the same
-    // order
-    std::reverse(lines.begin(), lines.end());
+    D = _D;
+    features.insert(features.end(), _features, _features + static_cast<size_t>(D)*featureSize);
     
-    // Create the data points
-    // We do it like this to make the transformation in-place
-    while (lines.size() > 0)
+    classLabels.push_back(label);
+    classcount = std::max(classcount, label + 1);
+}
+
+DataStorage::ptr CompactDataStorage::toDataStorage(int begin, int end) const
+{
+    BOOST_ASSERT_MSG(begin >= 0 && begin <= end + 1, "Invalid indices.");
+    BOOST_ASSERT_MSG(end < getSize(), "Invalid indices.");
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    DataPoint x;
+    for (int n = begin; n <= end; n++)
+    {
+        getDataPoint(n, x);
+        storage->addDataPoint(x, classLabels[n]);
+    }
+    
+    return storage;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// AbstractDataReader
+////////////////////////////////////////////////////////////////////////////////
+
+void AbstractDataReader::read(const std::string& filename, DataStorage::ptr dataStorage) throw(IOException)
+{
+    // Try to open the file
+    std::ifstream stream(filename, std::ios::binary);
+    
+    // Check if we could open the file
+    if (!stream.is_open())
     {
-        DataPoint x = DataPoint::Zero(dimensionality);
+        throw IOException("Could not open file.");
+    }
+    
+    // Read the actual data
+    read(stream, dataStorage);
+    
+    // Close the stream
+    stream.close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CSVDataReader
+////////////////////////////////////////////////////////////////////////////////
+
+void CSVDataReader::read(std::istream & stream, DataStorage::ptr dataStorage)
+{
+    std::string line;
+    while (std::getline(stream,line))
+    {
+        // Do not consider blank line
+        if (line.size() == 0) continue;
+        
+        // Parse the line
+        std::vector<float> numbers;
+        parseLine(line, numbers);
+        
+        const int isize = static_cast<int>(numbers.size());
         
-        for (size_t d = 0; d < lines.back().second.size(); d++)
+        // If we read class labels, the number of columns is one more than the
+        // number of dimensions
+        int dimensionality = isize;
+        if (readClassLabels)
         {
-            const int id = static_cast<int>(lines.back().second[d].first);
-            x(id-1) = lines.back().second[d].second;
+            dimensionality--;
         }
         
-        int label = lines.back().first - 1;
+        // Load the data point
+        DataPoint dataPoint(dimensionality);
+        int  label = 0;
         
-        // Do we convert binary labels?
-        if (convertBinaryLabels)
+        for (int  i = 0; i < isize; i++)
         {
-            BOOST_ASSERT_MSG(label == -2 || label == 0, "Invalid binary LIBSVM class label. Set convertBinaryLabels to false.");
-            
-            // -2 because we already subtracted 1
-            if (label == -2)
+            // Do we read class labels?
+            if (readClassLabels)
             {
-                label = 0;
+                // We do
+                // Is this the label column?
+                if (i == classLabelColumnIndex)
+                {
+                    // It is
+                    // Get a preliminary class label
+                    label = static_cast<int>(numbers[i]);
+                }
+                else if (i < classLabelColumnIndex)
+                {
+                    dataPoint(i) = numbers[i];
+                }
+                else
+                {
+                    dataPoint(i - 1) = numbers[i];
+                }
             }
             else
             {
-                label = 1;
+                dataPoint(i) = numbers[i];
             }
         }
         
-        dataStorage->addDataPoint(x, label);
-        
-        lines.pop_back();
+        if (readClassLabels)
+        {
+            dataStorage->addDataPoint(dataPoint, label);
+        }
+        else
+        {
+            dataStorage->addDataPoint(dataPoint);
+        }
     }
 }
 
-void LIBSVMDataReader::parseLine(const std::string & line, std::pair<int, std::vector< std::pair<int, float> > > & result) const
+
+void CSVDataReader::parseLine(const std::string & line, std::vector<float> & result) const
 {
     // Set up the iterators
     std::string::const_iterator first = line.begin();
@@ -482,22 +984,457 @@ void LIBSVMDataReader::parseLine(const std::string & line, std::pair<int, std::v
     
     using boost::spirit::qi::float_;
     using boost::spirit::qi::int_;
-    using boost::spirit::qi::lit;
     using boost::spirit::qi::phrase_parse;
     using boost::spirit::ascii::space;
+    using boost::spirit::qi::lit;
+    
     // Parse the line using boost spirit
-    bool r = phrase_parse(
-        first, 
-        last, 
-        int_ >> -(lit('.')>>+lit('0')) >> *(int_ >> ':' >> float_),
-        space,
-        result
-    );
+    bool r;
+    if (columnSeparator.find_first_not_of(" \t") == std::string::npos)
+    {
+        // Whitespace separators would be consumed by the skipper
+        r = phrase_parse(
+            first, 
+            last, 
+            +float_, 
+            space,
+            result
+        );
+    }
+    else
+    {
+        r = phrase_parse(
+            first, 
+            last, 
+            float_ % lit(columnSeparator), 
+            space,
+            result
+        );
+    }
     
     // There was a mismatch. This is not a valid LIBSVM file
     if (first != last || !r)
     {
-        throw IOException("Invalid LIBSVM line.");
+        std::cout << line << std::endl;
+        throw IOException("Invalid CSV line.");
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// LIBSVMDataReader
+////////////////////////////////////////////////////////////////////////////////
+
+const int LIBSVMDataReader::BYTES_PER_CHUNK;
+
+/**
+ * The data points parsed from a chunk of a LIBSVM file in compressed sparse 
+ * row format. 
+ */
+struct LIBSVMFragment {
+    LIBSVMFragment() : maxIndex(0), valid(true) {}
+    
+    /**
+     * The raw labels of the rows
+     */
+    std::vector<int> labels;
+    /**
+     * The entries of row n are at rowOffsets[n], ..., rowOffsets[n+1]-1
+     */
+    std::vector<int> rowOffsets;
+    /**
+     * The feature indices (1-based)
+     */
+    std::vector<int> indices;
+    /**
+     * The feature values
+     */
+    std::vector<float> values;
+    /**
+     * The largest feature index in the chunk
+     */
+    int maxIndex;
+    /**
+     * False if the chunk contains an invalid line
+     */
+    bool valid;
+};
+
+/**
+ * Parses an unsigned integer. Returns false if there is no digit.
+ */
+static inline bool scanUnsigned(const char* & p, const char* end, int & result)
+{
+    const char* begin = p;
+    int64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9' && value <= std::numeric_limits<int>::max())
+    {
+        value = 10*value + (*p - '0');
+        p++;
+    }
+    result = static_cast<int>(value);
+    return p != begin && value <= std::numeric_limits<int>::max();
+}
+
+/**
+ * Parses a decimal floating point number. Numbers with up to 15 significant
+ * digits and a decimal exponent in [-22, 22] are converted with a single,
+ * correctly rounded double operation; all others fall back to strtod. Up to
+ * 19 digits are accumulated in order to detect the fast case. 
+ * 
+ * Note: The result is rounded to double first and then to float. For 
+ * decimals very close to the midpoint between two floats, this double 
+ * rounding can differ from strtof in the last bit. 
+ */
+static inline bool scanFloat(const char* & p, const char* end, float & result)
+{
+    const char* begin = p;
+    
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    
+    uint64_t mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+    
+    // Integer part
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        anyDigit = true;
+        if (mantissa > 0 || *p != '0')
+        {
+            if (numDigits < 19)
+            {
+                mantissa = 10*mantissa + (*p - '0');
+            }
+            else
+            {
+                exponent++;
+            }
+            numDigits++;
+        }
+        p++;
+    }
+    
+    // Fractional part
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            anyDigit = true;
+            if (mantissa > 0 || *p != '0')
+            {
+                if (numDigits < 19)
+                {
+                    mantissa = 10*mantissa + (*p - '0');
+                    exponent--;
+                }
+                numDigits++;
+            }
+            else
+            {
+                exponent--;
+            }
+            p++;
+        }
+    }
+    
+    if (!anyDigit)
+    {
+        // Special values like inf and nan, the chunk is not null terminated
+        const std::string special(begin, std::min(end, begin + 16));
+        char* next;
+        result = std::strtof(special.c_str(), &next);
+        p = begin + (next - special.c_str());
+        return next != special.c_str();
+    }
+    
+    // Exponent
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* exponentBegin = p;
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negativeExponent = (*p == '-');
+            p++;
+        }
+        int explicitExponent;
+        if (!scanUnsigned(p, end, explicitExponent))
+        {
+            // Not an exponent, e.g. "1e"
+            p = exponentBegin;
+        }
+        else
+        {
+            exponent += (negativeExponent ? -explicitExponent : explicitExponent);
+        }
+    }
+    
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    
+    if (numDigits <= 15 && exponent >= -22 && exponent <= 22)
+    {
+        // The mantissa and the power are exact doubles
+        double value = static_cast<double>(mantissa);
+        value = (exponent < 0 ? value/powers[-exponent] : value*powers[exponent]);
+        result = static_cast<float>(negative ? -value : value);
+    }
+    else
+    {
+        result = static_cast<float>(std::strtod(std::string(begin, p).c_str(), 0));
+    }
+    
+    return true;
+}
+
+/**
+ * Parses the lines in [begin, end) into a fragment. 
+ */
+static void scanLIBSVMChunk(const char* begin, const char* end, LIBSVMFragment & fragment)
+{
+    fragment.rowOffsets.push_back(0);
+    
+    const char* p = begin;
+    while (p < end)
+    {
+        // Find the end of the line
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (lineEnd == 0)
+        {
+            lineEnd = end;
+        }
+        
+        // Skip leading white spaces
+        while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+        {
+            p++;
+        }
+        
+        // Skip this line if it's empty or a comment
+        if (p == lineEnd || *p == '#')
+        {
+            p = lineEnd + 1;
+            continue;
+        }
+        
+        // The label is an integer that may be followed by .0
+        bool negative = false;
+        if (*p == '-' || *p == '+')
+        {
+            negative = (*p == '-');
+            p++;
+        }
+        int label;
+        if (!scanUnsigned(p, lineEnd, label))
+        {
+            fragment.valid = false;
+            return;
+        }
+        if (p < lineEnd && *p == '.')
+        {
+            p++;
+            while (p < lineEnd && *p == '0')
+            {
+                p++;
+            }
+        }
+        fragment.labels.push_back(negative ? -label : label);
+        
+        // Parse the index:value pairs
+        while (true)
+        {
+            if (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r')
+            {
+                fragment.valid = false;
+                return;
+            }
+            while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+            {
+                p++;
+            }
+            if (p == lineEnd)
+            {
+                break;
+            }
+            
+            int index;
+            float value;
+            if (!scanUnsigned(p, lineEnd, index) || p == lineEnd || *p != ':')
+            {
+                fragment.valid = false;
+                return;
+            }
+            p++;
+            if (!scanFloat(p, lineEnd, value))
+            {
+                fragment.valid = false;
+                return;
+            }
+            
+            fragment.indices.push_back(index);
+            fragment.values.push_back(value);
+            fragment.maxIndex = std::max(fragment.maxIndex, index);
+        }
+        
+        fragment.rowOffsets.push_back(static_cast<int>(fragment.indices.size()));
+        p = lineEnd + 1;
+    }
+}
+
+void LIBSVMDataReader::read(std::istream& stream, DataStorage::ptr dataStorage)
+{
+    // The file is read in blocks of one chunk per thread. Every thread parses
+    // its chunk into a sparse fragment. The dimensionality is only known
+    // after the last block, so dense data points are created at the end.
+    std::vector<LIBSVMFragment> fragments;
+    
+    size_t blockSize = static_cast<size_t>(BYTES_PER_CHUNK)*numThreads;
+    std::vector<char> block;
+    size_t carry = 0;
+    
+    while (true)
+    {
+        block.resize(carry + blockSize);
+        stream.read(block.data() + carry, blockSize);
+        const size_t size = carry + static_cast<size_t>(stream.gcount());
+        const bool last = (size < block.size());
+        
+        if (size == 0)
+        {
+            break;
+        }
+        
+        // Only parse complete lines, the remainder is carried to the next 
+        // block
+        size_t parseSize = size;
+        if (!last)
+        {
+            while (parseSize > 0 && block[parseSize - 1] != '\n')
+            {
+                parseSize--;
+            }
+            if (parseSize == 0)
+            {
+                // A single line is longer than the block
+                carry = size;
+                blockSize *= 2;
+                continue;
+            }
+        }
+        
+        // Split the block into chunks at line boundaries
+        std::vector<size_t> bounds(numThreads + 1, parseSize);
+        bounds[0] = 0;
+        for (int t = 1; t < numThreads; t++)
+        {
+            size_t bound = std::max(bounds[t - 1], parseSize/numThreads*t);
+            while (bound < parseSize && bound > 0 && block[bound - 1] != '\n')
+            {
+                bound++;
+            }
+            bounds[t] = bound;
+        }
+        
+        const size_t offset = fragments.size();
+        fragments.resize(offset + numThreads);
+        
+        #pragma omp parallel for num_threads(numThreads)
+        for (int t = 0; t < numThreads; t++)
+        {
+            scanLIBSVMChunk(block.data() + bounds[t], block.data() + bounds[t + 1], fragments[offset + t]);
+        }
+        
+        for (int t = 0; t < numThreads; t++)
+        {
+            if (!fragments[offset + t].valid)
+            {
+                throw IOException("Invalid LIBSVM line.");
+            }
+        }
+        
+        if (last)
+        {
+            break;
+        }
+        
+        // Move the incomplete line to the front
+        carry = size - parseSize;
+        std::memmove(block.data(), block.data() + parseSize, carry);
+    }
+    
+    // Determine the dimensionality
+    int maxIndex = 0;
+    int numRows = 0;
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+        maxIndex = std::max(maxIndex, fragments[i].maxIndex);
+        numRows += static_cast<int>(fragments[i].labels.size());
+    }
+    
+    if (dimensionality > 0 && maxIndex > dimensionality)
+    {
+        throw IOException("Invalid LIBSVM data set. Feature index exceeds the dimensionality.");
+    }
+    
+    const int D = (dimensionality > 0 ? dimensionality : maxIndex);
+    
+    if (D == 0 && numRows > 0)
+    {
+        throw IOException("Invalid LIBSVM data set. No dimensions.");
+    }
+    
+    // Create the data points in order
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+        LIBSVMFragment & fragment = fragments[i];
+        
+        for (size_t n = 0; n < fragment.labels.size(); n++)
+        {
+            DataPoint x = DataPoint::Zero(D);
+            
+            for (int k = fragment.rowOffsets[n]; k < fragment.rowOffsets[n + 1]; k++)
+            {
+                if (fragment.indices[k] < 1)
+                {
+                    throw IOException("Invalid LIBSVM data set. Feature indices start at 1.");
+                }
+                x(fragment.indices[k] - 1) = fragment.values[k];
+            }
+            
+            int label = fragment.labels[n] - 1;
+            
+            // Do we convert binary labels?
+            if (convertBinaryLabels)
+            {
+                BOOST_ASSERT_MSG(label == -2 || label == 0, "Invalid binary LIBSVM class label. Set convertBinaryLabels to false.");
+                
+                // -2 because we already subtracted 1
+                if (label == -2)
+                {
+                    label = 0;
+                }
+                else
+                {
+                    label = 1;
+                }
+            }
+            
+            dataStorage->addDataPoint(x, label);
+        }
+        
+        // Release the fragment as soon as it has been converted
+        fragment = LIBSVMFragment();
     }
 }
 
@@ -507,24 +1444,51 @@ void LIBSVMDataReader::parseLine(const std::string & line, std::pair<int, std::v
 
 void LibforestDataReader::read(std::istream& stream, DataStorage::ptr dataStorage)
 {
-    // Read the number of data points
     int N;
+    int featureType;
+    readHeader(stream, N, featureType);
+    readDataPoints(stream, dataStorage, featureType, N);
+}
+
+void LibforestDataReader::readHeader(std::istream& stream, int & N, int & featureType) throw(IOException)
+{
+    // Read the number of data points or the format tag
     readBinary(stream, N);
     
+    featureType = LibforestDataWriter::FEATURE_TYPE_FLOAT;
+    if (N == LibforestDataWriter::FORMAT_TAG)
+    {
+        readBinary(stream, featureType);
+        readBinary(stream, N);
+        
+        if (featureType < LibforestDataWriter::FEATURE_TYPE_UINT8 || featureType > LibforestDataWriter::FEATURE_TYPE_DOUBLE)
+        {
+            throw IOException("Unknown feature type in data file.");
+        }
+    }
+}
+
+void LibforestDataReader::readDataPoints(std::istream& stream, DataStorage::ptr dataStorage, int featureType, int M)
+{
     // Read the data set
-    for (int n = 0; n < N; n++)
+    for (int n = 0; n < M; n++)
     {
         // Read the class label
         int label;
         readBinary(stream, label);
         // Set up the data point
         DataPoint v;
-        readDataPoint(stream, v);
+        readDataPoint(stream, v, featureType);
         dataStorage->addDataPoint(v, label);
     }
 }
 
 void LibforestDataReader::readDataPoint(std::istream& stream, DataPoint& v)
+{
+    readDataPoint(stream, v, LibforestDataWriter::FEATURE_TYPE_FLOAT);
+}
+
+void LibforestDataReader::readDataPoint(std::istream& stream, DataPoint& v, int featureType)
 {
     // Read the dimensionality
     int D;
@@ -533,17 +1497,239 @@ void LibforestDataReader::readDataPoint(std::istream& stream, DataPoint& v)
     // Resize the data point
     v.resize(D);
     
-    // Load the content
-    for (int d = 0; d < D; d++)
+    // Load the content in a single block
+    if (featureType == LibforestDataWriter::FEATURE_TYPE_FLOAT)
     {
-        readBinary(stream, v(d));
+        stream.read(reinterpret_cast<char*>(v.data()), D*sizeof(float));
+    }
+    else
+    {
+        std::vector<unsigned char> buffer(static_cast<size_t>(D)*getFeatureSize(featureType));
+        stream.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+        widenFeatures(buffer.data(), v.data(), D, featureType);
     }
 }
 
+void LibforestDataReader::read(std::istream & stream, CompactDataStorage::ptr dataStorage)
+{
+    int N;
+    int featureType;
+    readHeader(stream, N, featureType);
+    
+    std::vector<unsigned char> buffer;
+    DataPoint v;
+    for (int n = 0; n < N; n++)
+    {
+        int label;
+        readBinary(stream, label);
+        
+        if (featureType == dataStorage->getFeatureType())
+        {
+            // Copy the features without conversion
+            int D;
+            readBinary(stream, D);
+            buffer.resize(static_cast<size_t>(D)*getFeatureSize(featureType));
+            stream.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+            dataStorage->addRawDataPoint(buffer.data(), D, label);
+        }
+        else
+        {
+            readDataPoint(stream, v, featureType);
+            dataStorage->addDataPoint(v, label);
+        }
+    }
+}
+
+void LibforestDataReader::read(const std::string & filename, CompactDataStorage::ptr dataStorage) throw(IOException)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    if (!stream.is_open())
+    {
+        throw IOException("Could not open file.");
+    }
+    
+    read(stream, dataStorage);
+    stream.close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CachedDataReader
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Updates a 64 bit FNV-1a style checksum with a block of bytes. Full words 
+ * are consumed at once, which is considerably faster than byte-wise hashing
+ * on large files. 
+ */
+static uint64_t updateChecksum(uint64_t hash, const char* data, size_t length)
+{
+    const uint64_t prime = 1099511628211ULL;
+    
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(uint64_t));
+        hash = (hash ^ word)*prime;
+    }
+    for (; i < length; i++)
+    {
+        hash = (hash ^ static_cast<unsigned char>(data[i]))*prime;
+    }
+    
+    return hash;
+}
+
+std::string CachedDataReader::getCacheFilename(const std::string & filename) const throw(IOException)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    if (!stream.is_open())
+    {
+        throw IOException("Could not open file.");
+    }
+    
+    uint64_t hash = 14695981039346656037ULL;
+    
+    std::vector<char> buffer(1 << 20);
+    while (stream)
+    {
+        stream.read(buffer.data(), buffer.size());
+        hash = updateChecksum(hash, buffer.data(), static_cast<size_t>(stream.gcount()));
+    }
+    
+    // Separate the content from the key, such that the two cannot be shifted
+    // against each other
+    const char separator = 0;
+    hash = updateChecksum(hash, &separator, 1);
+    hash = updateChecksum(hash, pipelineKey.data(), pipelineKey.size());
+    
+    std::stringstream name;
+    name << boost::filesystem::path(filename).filename().string() << "-" 
+            << std::hex << std::setw(16) << std::setfill('0') << hash << ".dat";
+    
+    return (boost::filesystem::path(cacheDirectory) / name.str()).string();
+}
+
+bool CachedDataReader::readCache(const std::string & cacheFilename, DataStorage::ptr storage) const
+{
+    std::ifstream stream(cacheFilename, std::ios::binary);
+    if (!stream.is_open())
+    {
+        return false;
+    }
+    
+    LibforestDataReader cacheReader;
+    cacheReader.read(stream, storage);
+    
+    // The weights follow the data points. They are only stored if the 
+    // data set is weighted. 
+    int numWeights = -1;
+    readBinary(stream, numWeights);
+    if (!stream || (numWeights != 0 && numWeights != storage->getSize()))
+    {
+        // Incomplete or outdated cache file
+        return false;
+    }
+    
+    std::vector<int> weights(numWeights);
+    stream.read(reinterpret_cast<char*>(weights.data()), numWeights*sizeof(int));
+    if (!stream)
+    {
+        return false;
+    }
+    
+    for (int n = 0; n < numWeights; n++)
+    {
+        storage->setWeight(n, weights[n]);
+    }
+    
+    return true;
+}
+
+void CachedDataReader::writeCache(const std::string & cacheFilename, DataStorage::ptr storage) const throw(IOException)
+{
+    std::ofstream stream(cacheFilename, std::ios::binary);
+    if (!stream.is_open())
+    {
+        throw IOException("Could not open cache file.");
+    }
+    
+    LibforestDataWriter cacheWriter;
+    cacheWriter.write(stream, storage);
+    
+    const int N = storage->getSize();
+    const int numWeights = storage->isWeighted() ? N : 0;
+    writeBinary(stream, numWeights);
+    for (int n = 0; n < numWeights; n++)
+    {
+        writeBinary(stream, storage->getWeight(n));
+    }
+    
+    stream.close();
+    if (!stream)
+    {
+        throw IOException("Could not write cache file.");
+    }
+}
+
+void CachedDataReader::read(std::istream & stream, DataStorage::ptr dataStorage)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    reader->read(stream, storage);
+    if (pipeline)
+    {
+        pipeline(storage);
+    }
+    dataStorage->moveDataPoints(*storage);
+}
+
+void CachedDataReader::read(const std::string & filename, DataStorage::ptr dataStorage) throw(IOException)
+{
+    const std::string cacheFilename = getCacheFilename(filename);
+    
+    if (boost::filesystem::exists(cacheFilename))
+    {
+        DataStorage::ptr storage = DataStorage::Factory::create();
+        if (readCache(cacheFilename, storage))
+        {
+            dataStorage->moveDataPoints(*storage);
+            return;
+        }
+    }
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    reader->read(filename, storage);
+    if (pipeline)
+    {
+        pipeline(storage);
+    }
+    
+    // Write to a temporary file first, such that concurrent jobs never see
+    // incomplete cache files
+    boost::system::error_code error;
+    boost::filesystem::create_directories(cacheDirectory, error);
+    
+    const boost::filesystem::path temporary = cacheFilename + "." + boost::filesystem::unique_path().string();
+    try
+    {
+        writeCache(temporary.string(), storage);
+        boost::filesystem::rename(temporary, cacheFilename);
+    }
+    catch (...)
+    {
+        // Failing to cache the data set is not an error
+        boost::filesystem::remove(temporary, error);
+    }
+    
+    dataStorage->moveDataPoints(*storage);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// AbstractDataWriter
 ////////////////////////////////////////////////////////////////////////////////
 
+const int AbstractDataWriter::ROWS_PER_CHUNK;
+
 void AbstractDataWriter::write(const std::string & filename, DataStorage::ptr dataStorage) throw(IOException)
 {
     // Open the file
@@ -557,14 +1743,48 @@ void AbstractDataWriter::write(const std::string & filename, DataStorage::ptr da
     stream.close();
 }
 
+void AbstractDataWriter::write(std::ostream & stream, DataStorage::ptr dataStorage)
+{
+    writeHeader(stream, dataStorage->getSize());
+    writeDataPoints(stream, dataStorage);
+}
+
+void AbstractDataWriter::writeRows(std::ostream & stream, int N, const std::function<void(int, std::string &)> & formatRow) const
+{
+    // Every thread formats one chunk into its own buffer. The buffers are
+    // then written in order with one large write per chunk. 
+    std::vector<std::string> buffers(numThreads);
+    
+    for (int begin = 0; begin < N; begin += numThreads*ROWS_PER_CHUNK)
+    {
+        #pragma omp parallel for num_threads(numThreads)
+        for (int t = 0; t < numThreads; t++)
+        {
+            std::string & buffer = buffers[t];
+            buffer.clear();
+            
+            const int first = std::min(N, begin + t*ROWS_PER_CHUNK);
+            const int last = std::min(N, first + ROWS_PER_CHUNK);
+            for (int n = first; n < last; n++)
+            {
+                formatRow(n, buffer);
+            }
+        }
+        
+        for (int t = 0; t < numThreads; t++)
+        {
+            stream.write(buffers[t].data(), buffers[t].size());
+        }
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// CSVDataWriter
 ////////////////////////////////////////////////////////////////////////////////
 
-void CSVDataWriter::write(std::ostream& stream, DataStorage::ptr dataStorage)
+void CSVDataWriter::writeDataPoints(std::ostream& stream, DataStorage::ptr dataStorage)
 {
-    for (int n = 0; n < dataStorage->getSize(); n++)
-    {
+    writeRows(stream, dataStorage->getSize(), [this, &dataStorage](int n, std::string & buffer) {
         const DataPoint & v = dataStorage->getDataPoint(n);
         
         // Do we write class labels?
@@ -575,21 +1795,21 @@ void CSVDataWriter::write(std::ostream& stream, DataStorage::ptr dataStorage)
             {
                 if (d < classLabelColumnIndex)
                 {
-                    stream << v(d);
+                    Util::appendFloat(buffer, v(d));
                 }
                 else if (d == classLabelColumnIndex)
                 {
-                    stream << dataStorage->getClassLabel(n);
+                    Util::appendInt(buffer, dataStorage->getClassLabel(n));
                 }
                 else
                 {
-                    stream << v(d-1);
+                    Util::appendFloat(buffer, v(d-1));
                 }
                 
                 // Write the column separator?
                 if (d < v.rows())
                 {
-                    stream << columnSeparator;
+                    buffer += columnSeparator;
                 }
             }
         }
@@ -598,67 +1818,100 @@ void CSVDataWriter::write(std::ostream& stream, DataStorage::ptr dataStorage)
             // Do not write class labels
             for (int d = 0; d < v.rows(); d++)
             {
-                stream << v(d);
+                Util::appendFloat(buffer, v(d));
                 
                 // Write the column separator?
                 if (d < v.rows()-1)
                 {
-                    stream << columnSeparator;
+                    buffer += columnSeparator;
                 }
             }
         }
-        stream << std::endl;
-    }
+        buffer.push_back('\n');
+    });
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// LibforestDataWriter
 ////////////////////////////////////////////////////////////////////////////////
 
-void LibforestDataWriter::write(std::ostream& stream, DataStorage::ptr dataStorage)
+const int LibforestDataWriter::FORMAT_TAG;
+const int LibforestDataWriter::FEATURE_TYPE_UINT8;
+const int LibforestDataWriter::FEATURE_TYPE_UINT16;
+const int LibforestDataWriter::FEATURE_TYPE_HALF;
+const int LibforestDataWriter::FEATURE_TYPE_FLOAT;
+const int LibforestDataWriter::FEATURE_TYPE_DOUBLE;
+
+void LibforestDataWriter::writeHeader(std::ostream& stream, int N)
 {
-    // Write the number of data points
-    writeBinary(stream, dataStorage->getSize());
-    // Write the content
-    for (int n = 0; n < dataStorage->getSize(); n++)
+    // Float files are written in the legacy format 
+    if (featureType != FEATURE_TYPE_FLOAT)
     {
-        writeBinary(stream, dataStorage->getClassLabel(n));
-        writeDataPoint(stream, dataStorage->getDataPoint(n));
+        writeBinary(stream, static_cast<int>(FORMAT_TAG));
+        writeBinary(stream, featureType);
     }
+    
+    // Write the number of data points
+    writeBinary(stream, N);
 }
 
-void LibforestDataWriter::writeDataPoint(std::ostream& stream, DataPoint& v)
+void LibforestDataWriter::writeDataPoints(std::ostream& stream, DataStorage::ptr dataStorage)
 {
-    writeBinary(stream, static_cast<int>(v.rows()));
-    for (int d = 0; d < v.rows(); d++)
-    {
-        writeBinary(stream, v(d));
-    }
+    writeRows(stream, dataStorage->getSize(), [this, &dataStorage](int n, std::string & buffer) {
+        const int label = dataStorage->getClassLabel(n);
+        buffer.append(reinterpret_cast<const char*>(&label), sizeof(int));
+        writeDataPoint(buffer, dataStorage->getDataPoint(n));
+    });
+}
+
+void LibforestDataWriter::writeDataPoint(std::string & buffer, const DataPoint & v) const
+{
+    const int D = static_cast<int>(v.rows());
+    buffer.append(reinterpret_cast<const char*>(&D), sizeof(int));
+    
+    const size_t offset = buffer.size();
+    buffer.resize(offset + static_cast<size_t>(D)*getFeatureSize(featureType));
+    narrowFeatures(v.data(), reinterpret_cast<unsigned char*>(&buffer[offset]), D, featureType);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// LIBSVMDataWriter
 ////////////////////////////////////////////////////////////////////////////////
 
-void LIBSVMDataWriter::write(std::ostream& stream, DataStorage::ptr dataStorage)
+void LIBSVMDataWriter::writeHeader(std::ostream& stream, int N)
 {
-    stream << "# " << dataStorage->getSize() << " data points" << std::endl;
-    
-    for (int n = 0; n < dataStorage->getSize(); n++)
-    {
-        stream << dataStorage->getClassLabel(n) + 1 << " ";
-        writeDataPoint(stream, dataStorage->getDataPoint(n));
-        stream << std::endl;
-    }
+    // The count is padded to a fixed width such that the header can be 
+    // rewritten in place
+    stream << "# " << std::setw(10) << N << " data points" << std::endl;
+}
+
+void LIBSVMDataWriter::writeDataPoints(std::ostream& stream, DataStorage::ptr dataStorage)
+{
+    writeRows(stream, dataStorage->getSize(), [this, &dataStorage](int n, std::string & buffer) {
+        Util::appendInt(buffer, dataStorage->getClassLabel(n) + 1);
+        buffer.push_back(' ');
+        writeDataPoint(buffer, dataStorage->getDataPoint(n));
+        buffer.push_back('\n');
+    });
 }
 
 void LIBSVMDataWriter::writeDataPoint(std::ostream& stream, const DataPoint& v)
+{
+    std::string buffer;
+    writeDataPoint(buffer, v);
+    stream.write(buffer.data(), buffer.size());
+}
+
+void LIBSVMDataWriter::writeDataPoint(std::string & buffer, const DataPoint & v) const
 {
     for (int d = 0; d < v.rows(); d++)
     {
         if (std::abs(v(d)) > 1e-15)
         {
-            stream << (d+1) << ':' << v(d) << ' ';
+            Util::appendInt(buffer, d+1);
+            buffer.push_back(':');
+            Util::appendFloat(buffer, v(d));
+            buffer.push_back(' ');
         }
     }
-}
\ No newline at end of file
+}
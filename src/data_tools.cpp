@@ -1,8 +1,16 @@
 #include "libforest/data_tools.h"
 #include "libforest/io.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
 using namespace libf;
 
+static std::random_device rd;
+
 ////////////////////////////////////////////////////////////////////////////////
 /// KMeans
 ////////////////////////////////////////////////////////////////////////////////
@@ -28,6 +36,13 @@ inline float computeDistance(const DataPoint & x, const DataPoint & y)
 
 float KMeans::cluster(DataStorage::ptr storage, 
         DataStorage::ptr _centers, std::vector<int> & labels)
+{
+    std::mt19937 g(rd());
+    return cluster(storage, _centers, labels, g);
+}
+
+float KMeans::cluster(DataStorage::ptr storage, 
+        DataStorage::ptr _centers, std::vector<int> & labels, std::mt19937 & g)
 {
     BOOST_ASSERT_MSG(storage->getSize() > 0, "Cannot run k-means on an empty data storage.");
     
@@ -73,10 +88,10 @@ float KMeans::cluster(DataStorage::ptr storage,
                 switch(centerInitMethod)
                 {
                     case CENTERS_RANDOM:
-                        initCentersRandom(storage, centers);
+                        initCentersRandom(storage, centers, g);
                         break;
                     case CENTERS_PP:
-                        initCentersPP(storage, centers);
+                        initCentersPP(storage, centers, g);
                         break;
                 }
 
@@ -196,7 +211,7 @@ float KMeans::cluster(DataStorage::ptr storage,
         
         if (error < bestError)
         {
-            _centers = centers->hardCopy();
+            *_centers = *centers;
             bestError = error;
             for (int n = 0; n < N; n++)
             {
@@ -209,11 +224,13 @@ float KMeans::cluster(DataStorage::ptr storage,
 }
 
 void KMeans::initCentersPP(AbstractDataStorage::ptr storage, 
-        DataStorage::ptr centers)
+        DataStorage::ptr centers, std::mt19937 & g)
 {
     const int N = storage->getSize();
     const int K = numClusters;  
     
+    std::uniform_real_distribution<float> uniform(0, 1);
+    
     // K-means++ initialization.
     for (int k = 0; k < K; k++)
     {
@@ -271,31 +288,31 @@ void KMeans::initCentersPP(AbstractDataStorage::ptr storage,
         }
 
         // Choose random number in [0,1];
-        float r = std::rand()/static_cast<float>(RAND_MAX);
+        float r = uniform(g);
 
-        // Find the corresponding data point index.
+        // Find the first data point whose cumulative probability reaches r.
         int n = 0;
-        while (r > probabilityCumSum[n]) {
+        while (n < N - 1 && r > probabilityCumSum[n]) {
             n++;
         }
 
-        // We overstepped the drawn point by one.
-        n = std::max(0, n - 1);
         DataPoint center(storage->getDataPoint(n)); // Copy the center!
         centers->getDataPoint(k) = center;
     }
 }
 
 void KMeans::initCentersRandom(AbstractDataStorage::ptr storage, 
-        DataStorage::ptr centers)
+        DataStorage::ptr centers, std::mt19937 & g)
 {
     const int N = storage->getSize();
     const int K = numClusters;
     
+    std::uniform_int_distribution<int> uniform(0, N - 1);
+    
     for (int k = 0; k < K; k++)
     {
         // Centers are chosen uniformly at random.
-        int n = std::rand()%N;
+        int n = uniform(g);
         
         DataPoint center(storage->getDataPoint(n)); // Copy the center!
         centers->getDataPoint(k) = center;
@@ -303,6 +320,191 @@ void KMeans::initCentersRandom(AbstractDataStorage::ptr storage,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+/// HierarchicalKMeans
+////////////////////////////////////////////////////////////////////////////////
+
+void HierarchicalKMeans::cluster(AbstractDataStorage::ptr storage)
+{
+    BOOST_ASSERT_MSG(storage->getSize() > 0, "Cannot cluster an empty data storage.");
+    
+    const int N = storage->getSize();
+    const int D = storage->getDimensionality();
+    const int B = branchingFactor;
+    
+    // The root center is the mean of all points
+    std::vector<DataPoint> nodeCenters(1, DataPoint::Zero(D));
+    for (int n = 0; n < N; n++)
+    {
+        nodeCenters[0] += storage->getDataPoint(n);
+    }
+    nodeCenters[0] /= N;
+    
+    firstChild.assign(1, 0);
+    numChildren.assign(1, 0);
+    
+    // The nodes at the current level and their points
+    std::vector<int> level(1, 0);
+    std::vector< std::vector<int> > points(1, std::vector<int>(N));
+    for (int n = 0; n < N; n++)
+    {
+        points[0][n] = n;
+    }
+    
+    for (int l = 0; l < depth && level.size() > 0; l++)
+    {
+        const int S = static_cast<int>(level.size());
+        std::vector<DataStorage::ptr> childCenters(S);
+        std::vector< std::vector<int> > childLabels(S);
+        
+        // Every node draws its initial centers from its own generator, the
+        // threads must not share one
+        std::vector<unsigned int> seeds(S);
+        for (int s = 0; s < S; s++)
+        {
+            seeds[s] = rd();
+        }
+        
+        // The nodes of a level are clustered independently
+        #pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+        for (int s = 0; s < S; s++)
+        {
+            const int M = static_cast<int>(points[s].size());
+            if (M <= B)
+            {
+                continue;
+            }
+            
+            DataStorage::ptr nodeStorage = DataStorage::Factory::create();
+            for (int m = 0; m < M; m++)
+            {
+                nodeStorage->addDataPoint(storage->getDataPoint(points[s][m]));
+            }
+            
+            KMeans nodeKMeans(kmeans);
+            nodeKMeans.setNumClusters(B);
+            
+            std::mt19937 g(seeds[s]);
+            childCenters[s] = DataStorage::Factory::create();
+            nodeKMeans.cluster(nodeStorage, childCenters[s], childLabels[s], g);
+        }
+        
+        // Add the children of every clustered node next to each other
+        std::vector<int> nextLevel;
+        std::vector< std::vector<int> > nextPoints;
+        for (int s = 0; s < S; s++)
+        {
+            if (!childCenters[s])
+            {
+                continue;
+            }
+            
+            const int node = level[s];
+            const int first = static_cast<int>(nodeCenters.size());
+            const int offset = static_cast<int>(nextLevel.size());
+            firstChild[node] = first;
+            numChildren[node] = B;
+            
+            for (int k = 0; k < B; k++)
+            {
+                nodeCenters.push_back(childCenters[s]->getDataPoint(k));
+                firstChild.push_back(0);
+                numChildren.push_back(0);
+                nextLevel.push_back(first + k);
+                nextPoints.push_back(std::vector<int>());
+            }
+            
+            for (size_t m = 0; m < points[s].size(); m++)
+            {
+                nextPoints[offset + childLabels[s][m]].push_back(points[s][m]);
+            }
+        }
+        
+        level.swap(nextLevel);
+        points.swap(nextPoints);
+    }
+    
+    const int V = static_cast<int>(nodeCenters.size());
+    centers.resize(D, V);
+    for (int v = 0; v < V; v++)
+    {
+        centers.col(v) = nodeCenters[v];
+    }
+    
+    // Number the leaves
+    words.assign(V, -1);
+    numWords = 0;
+    for (int v = 0; v < V; v++)
+    {
+        if (firstChild[v] == 0)
+        {
+            words[v] = numWords++;
+        }
+    }
+}
+
+int HierarchicalKMeans::assign(const DataPoint & x) const
+{
+    BOOST_ASSERT_MSG(getNumNodes() > 0, "The vocabulary tree has not been built.");
+    BOOST_ASSERT_MSG(x.rows() == centers.rows(), "The dimensionality does not match the vocabulary tree.");
+    
+    int node = 0;
+    while (firstChild[node] != 0)
+    {
+        const int first = firstChild[node];
+        
+        int bestChild = first;
+        float minDistance = 1e35;
+        for (int k = 0; k < numChildren[node]; k++)
+        {
+            const float distance = (centers.col(first + k) - x).squaredNorm();
+            if (distance < minDistance)
+            {
+                minDistance = distance;
+                bestChild = first + k;
+            }
+        }
+        
+        node = bestChild;
+    }
+    
+    return words[node];
+}
+
+void HierarchicalKMeans::assign(AbstractDataStorage::ptr storage, std::vector<int> & result) const
+{
+    const int N = storage->getSize();
+    result.resize(N);
+    
+    #pragma omp parallel for num_threads(numThreads)
+    for (int n = 0; n < N; n++)
+    {
+        result[n] = assign(storage->getDataPoint(n));
+    }
+}
+
+void HierarchicalKMeans::read(std::istream & stream)
+{
+    readBinary(stream, branchingFactor);
+    readBinary(stream, depth);
+    readBinary(stream, firstChild);
+    readBinary(stream, numChildren);
+    readBinary(stream, words);
+    readBinary(stream, centers);
+    readBinary(stream, numWords);
+}
+
+void HierarchicalKMeans::write(std::ostream & stream) const
+{
+    writeBinary(stream, branchingFactor);
+    writeBinary(stream, depth);
+    writeBinary(stream, firstChild);
+    writeBinary(stream, numChildren);
+    writeBinary(stream, words);
+    writeBinary(stream, centers);
+    writeBinary(stream, numWords);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// ClassStatisticsTool
 ////////////////////////////////////////////////////////////////////////////////
@@ -347,6 +549,108 @@ void ClassStatisticsTool::measureAndPrint(AbstractDataStorage::ptr storage) cons
     print(result);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// DeduplicateTool
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Hashes a data point and its class label (FNV-1a over 32 bit words).
+ */
+static uint64_t hashRow(const DataPoint & x, int label)
+{
+    uint64_t hash = 14695981039346656037ull;
+    
+    hash ^= static_cast<uint32_t>(label);
+    hash *= 1099511628211ull;
+    
+    for (int d = 0; d < x.rows(); d++)
+    {
+        // Adding 0 maps -0 to 0, so equal values have equal hashes
+        const float value = x(d) + 0.0f;
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        
+        hash ^= bits;
+        hash *= 1099511628211ull;
+    }
+    
+    return hash;
+}
+
+DataStorage::ptr DeduplicateTool::apply(AbstractDataStorage::ptr storage) const
+{
+    const int N = storage->getSize();
+    
+    // Hash all rows in parallel
+    std::vector<uint64_t> hashes(N);
+    
+    #pragma omp parallel for num_threads(numThreads)
+    for (int n = 0; n < N; n++)
+    {
+        hashes[n] = hashRow(storage->getDataPoint(n), storage->getClassLabel(n));
+    }
+    
+    // Every thread groups the rows of its own hash shard. A unique row is 
+    // represented by the index of its first occurrence and its weight.
+    std::vector< std::vector< std::pair<int, int> > > shards(numThreads);
+    
+    #pragma omp parallel for num_threads(numThreads)
+    for (int t = 0; t < numThreads; t++)
+    {
+        std::vector< std::pair<int, int> > & unique = shards[t];
+        // Maps hashes to indices in unique
+        std::unordered_multimap<uint64_t, int> seen;
+        
+        for (int n = 0; n < N; n++)
+        {
+            if (static_cast<int>(hashes[n] % numThreads) != t)
+            {
+                continue;
+            }
+            
+            const DataPoint & x = storage->getDataPoint(n);
+            const int label = storage->getClassLabel(n);
+            
+            // Compare to all rows with the same hash
+            bool found = false;
+            auto range = seen.equal_range(hashes[n]);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const int first = unique[it->second].first;
+                if (storage->getClassLabel(first) == label && storage->getDataPoint(first) == x)
+                {
+                    unique[it->second].second += storage->getWeight(n);
+                    found = true;
+                    break;
+                }
+            }
+            
+            if (!found)
+            {
+                seen.insert(std::make_pair(hashes[n], static_cast<int>(unique.size())));
+                unique.push_back(std::make_pair(n, storage->getWeight(n)));
+            }
+        }
+    }
+    
+    // Merge the shards and restore the original order
+    std::vector< std::pair<int, int> > unique;
+    for (int t = 0; t < numThreads; t++)
+    {
+        unique.insert(unique.end(), shards[t].begin(), shards[t].end());
+    }
+    std::sort(unique.begin(), unique.end());
+    
+    DataStorage::ptr result = DataStorage::Factory::create();
+    for (size_t u = 0; u < unique.size(); u++)
+    {
+        const int n = unique[u].first;
+        result->addDataPoint(storage->getDataPoint(n), storage->getClassLabel(n), unique[u].second);
+    }
+    
+    return result;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// ZScoreNormalizer
 ////////////////////////////////////////////////////////////////////////////////
@@ -540,4 +844,125 @@ void PCA::write(std::ostream& stream) const
 {
     writeBinary(stream, V);
     writeBinary(stream, mean);
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// RandomProjection
+////////////////////////////////////////////////////////////////////////////////
+
+const int RandomProjection::METHOD_GAUSSIAN;
+const int RandomProjection::METHOD_ACHLIOPTAS;
+const int RandomProjection::METHOD_VERY_SPARSE;
+
+void RandomProjection::learn(AbstractDataStorage::ptr storage)
+{
+    const int D = storage->getDimensionality();
+    const int M = numDimensions;
+    
+    std::mt19937 g(rd());
+    
+    inputDimensionality = D;
+    R.resize(0, 0);
+    rowOffsets.clear();
+    columns.clear();
+    values.clear();
+    
+    if (method == METHOD_GAUSSIAN)
+    {
+        std::normal_distribution<float> normal(0, 1/std::sqrt(static_cast<float>(M)));
+        
+        R.resize(M, D);
+        for (int d = 0; d < D; d++)
+        {
+            for (int m = 0; m < M; m++)
+            {
+                R(m, d) = normal(g);
+            }
+        }
+        return;
+    }
+    
+    // Every entry is non zero with probability 1/s
+    const float s = (method == METHOD_ACHLIOPTAS ? 3.0f : std::max(1.0f, std::sqrt(static_cast<float>(D))));
+    const float scale = std::sqrt(s/M);
+    
+    std::binomial_distribution<int> numNonZeros(D, 1/s);
+    std::bernoulli_distribution sign(0.5);
+    std::vector<int> sampled;
+    
+    rowOffsets.reserve(M + 1);
+    rowOffsets.push_back(0);
+    for (int m = 0; m < M; m++)
+    {
+        // Draw the number of non zero entries first and then their positions
+        // instead of drawing every single entry
+        Util::sampleWithoutReplacement(D, numNonZeros(g), sampled, g);
+        
+        for (size_t i = 0; i < sampled.size(); i++)
+        {
+            columns.push_back(sampled[i]);
+            values.push_back(sign(g) ? scale : -scale);
+        }
+        rowOffsets.push_back(static_cast<int>(columns.size()));
+    }
+}
+
+void RandomProjection::project(const DataPoint & x, DataPoint & result) const
+{
+    BOOST_ASSERT_MSG(inputDimensionality > 0, "The projection has not been learned.");
+    BOOST_ASSERT_MSG(x.rows() == inputDimensionality, "The dimensionality does not match the projection.");
+    
+    if (method == METHOD_GAUSSIAN)
+    {
+        result = R*x;
+        return;
+    }
+    
+    const int M = static_cast<int>(rowOffsets.size()) - 1;
+    result.resize(M);
+    
+    for (int m = 0; m < M; m++)
+    {
+        float sum = 0;
+        for (int i = rowOffsets[m]; i < rowOffsets[m + 1]; i++)
+        {
+            sum += values[i]*x(columns[i]);
+        }
+        result(m) = sum;
+    }
+}
+
+void RandomProjection::apply(DataStorage::ptr storage) const
+{
+    const int N = storage->getSize();
+    
+    #pragma omp parallel for num_threads(numThreads)
+    for (int n = 0; n < N; n++)
+    {
+        DataPoint temp;
+        project(storage->getDataPoint(n), temp);
+        storage->getDataPoint(n).swap(temp);
+    }
+}
+
+void RandomProjection::read(std::istream& stream)
+{
+    readBinary(stream, method);
+    readBinary(stream, numDimensions);
+    readBinary(stream, inputDimensionality);
+    readBinary(stream, R);
+    readBinary(stream, rowOffsets);
+    readBinary(stream, columns);
+    readBinary(stream, values);
+}
+
+void RandomProjection::write(std::ostream& stream) const
+{
+    writeBinary(stream, method);
+    writeBinary(stream, numDimensions);
+    writeBinary(stream, inputDimensionality);
+    writeBinary(stream, R);
+    writeBinary(stream, rowOffsets);
+    writeBinary(stream, columns);
+    writeBinary(stream, values);
+}
@@ -2,6 +2,7 @@
 #include "libforest/data.h"
 #include "libforest/io.h"
 #include "libforest/util.h"
+#include "libforest/memory.h"
 #include "fastlog/fastlog.h"
 #include <ios>
 #include <iostream>
@@ -93,7 +94,8 @@ float KernelDensityEstimator::estimate(const DataPoint & x)
     assert(bandwidth.rows() == D);
     
     float p_x = 0;
-    DataPoint x_bar(D);
+    ScratchArena::Scope scratch;
+    DataPoint & x_bar = scratch.getVector(D);
     
     for (int n = 0; n < N; n++)
     {
@@ -287,10 +289,14 @@ float Gaussian::evaluate(const DataPoint & x)
         cachedDeterminant = true;
     }
     
-    Eigen::VectorXf offset = x - mean;
+    ScratchArena::Scope scratch;
+    Eigen::VectorXf & offset = scratch.getVector(mean.rows());
+    Eigen::VectorXf & product = scratch.getVector(mean.rows());
+    offset = x - mean;
+    product.noalias() = covarianceInverse*offset;
     
     float p = 1/std::sqrt(pow(2*M_PI, mean.rows())*covarianceDeterminant)
-            * std::exp(- (1./2.) * offset.transpose()*covarianceInverse*offset);
+            * std::exp(- (1./2.) * offset.dot(product));
     
     return p;
 }
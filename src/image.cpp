@@ -0,0 +1,315 @@
+#include "libforest/image.h"
+#include "libforest/io.h"
+
+#include <cmath>
+#include <random>
+
+using namespace libf;
+
+static std::random_device rd;
+
+////////////////////////////////////////////////////////////////////////////////
+/// FeatureImage
+////////////////////////////////////////////////////////////////////////////////
+
+FeatureImage::FeatureImage(const cv::Mat & image) :
+        width(image.cols),
+        height(image.rows),
+        numChannels(image.channels())
+{
+    BOOST_ASSERT_MSG(!image.empty(), "Cannot create a feature image from an empty image.");
+    
+    cv::Mat converted;
+    image.convertTo(converted, CV_32F);
+    
+    pixels.resize(numChannels*height*width);
+    for (int y = 0; y < height; y++)
+    {
+        const float* row = converted.ptr<float>(y);
+        for (int x = 0; x < width; x++)
+        {
+            for (int c = 0; c < numChannels; c++)
+            {
+                pixels[(c*height + y)*width + x] = row[x*numChannels + c];
+            }
+        }
+    }
+    
+    computeIntegralImages();
+}
+
+FeatureImage::FeatureImage(int _width, int _height, int _numChannels, const std::vector<float> & data) :
+        width(_width),
+        height(_height),
+        numChannels(_numChannels)
+{
+    BOOST_ASSERT_MSG(width > 0 && height > 0 && numChannels > 0, "Invalid image size.");
+    BOOST_ASSERT_MSG(static_cast<int>(data.size()) == width*height*numChannels, "Data does not match the image size.");
+    
+    pixels.resize(numChannels*height*width);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            for (int c = 0; c < numChannels; c++)
+            {
+                pixels[(c*height + y)*width + x] = data[(y*width + x)*numChannels + c];
+            }
+        }
+    }
+    
+    computeIntegralImages();
+}
+
+void FeatureImage::computeIntegralImages()
+{
+    const int stride = width + 1;
+    integral.assign(numChannels*(height + 1)*stride, 0);
+    
+    for (int c = 0; c < numChannels; c++)
+    {
+        const float* plane = &pixels[c*height*width];
+        double* I = &integral[c*(height + 1)*stride];
+        
+        for (int y = 0; y < height; y++)
+        {
+            double rowSum = 0;
+            for (int x = 0; x < width; x++)
+            {
+                rowSum += plane[y*width + x];
+                I[(y + 1)*stride + x + 1] = I[y*stride + x + 1] + rowSum;
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// ImageFeatureBank
+////////////////////////////////////////////////////////////////////////////////
+
+void ImageFeatureBank::generate(int numFeatures, int numChannels, int maxOffset, int maxRadius)
+{
+    BOOST_ASSERT_MSG(numFeatures > 0, "The number of features must be positive.");
+    BOOST_ASSERT_MSG(numChannels > 0, "The number of channels must be positive.");
+    BOOST_ASSERT_MSG(maxOffset >= 0 && maxRadius >= 0, "Offsets and radii must be non-negative.");
+    
+    std::mt19937 g(rd());
+    std::uniform_int_distribution<int> typeDist(FEATURE_PIXEL, FEATURE_BOX_DIFFERENCE);
+    std::uniform_int_distribution<int> channelDist(0, numChannels - 1);
+    std::uniform_int_distribution<int> offsetDist(-maxOffset, maxOffset);
+    std::uniform_int_distribution<int> radiusDist(0, maxRadius);
+    
+    for (int i = 0; i < numFeatures; i++)
+    {
+        PixelFeature feature;
+        feature.type = typeDist(g);
+        feature.channel = channelDist(g);
+        feature.dx1 = offsetDist(g);
+        feature.dy1 = offsetDist(g);
+        feature.dx2 = offsetDist(g);
+        feature.dy2 = offsetDist(g);
+        feature.radius1 = radiusDist(g);
+        feature.radius2 = radiusDist(g);
+        
+        features.push_back(feature);
+    }
+}
+
+void ImageFeatureBank::extract(const FeatureImage & image, int x, int y, DataPoint & result) const
+{
+    const int D = getSize();
+    result.resize(D);
+    
+    for (int d = 0; d < D; d++)
+    {
+        result(d) = evaluate(image, d, x, y);
+    }
+}
+
+void ImageFeatureBank::extract(const FeatureImage & image, const cv::Mat & labels, int stride, DataStorage::ptr storage) const
+{
+    BOOST_ASSERT_MSG(labels.rows == image.getHeight() && labels.cols == image.getWidth(), "The label image does not match the image size.");
+    BOOST_ASSERT_MSG(stride > 0, "The stride must be positive.");
+    
+    cv::Mat converted;
+    labels.convertTo(converted, CV_32S);
+    
+    for (int y = 0; y < image.getHeight(); y += stride)
+    {
+        const int* row = converted.ptr<int>(y);
+        for (int x = 0; x < image.getWidth(); x += stride)
+        {
+            if (row[x] < 0)
+            {
+                continue;
+            }
+            
+            DataPoint point;
+            extract(image, x, y, point);
+            storage->addDataPoint(point, row[x]);
+        }
+    }
+}
+
+void ImageFeatureBank::read(std::istream & stream)
+{
+    int size;
+    readBinary(stream, size);
+    features.resize(size);
+    
+    for (int i = 0; i < size; i++)
+    {
+        readBinary(stream, features[i].type);
+        readBinary(stream, features[i].channel);
+        readBinary(stream, features[i].dx1);
+        readBinary(stream, features[i].dy1);
+        readBinary(stream, features[i].dx2);
+        readBinary(stream, features[i].dy2);
+        readBinary(stream, features[i].radius1);
+        readBinary(stream, features[i].radius2);
+    }
+}
+
+void ImageFeatureBank::write(std::ostream & stream) const
+{
+    writeBinary(stream, getSize());
+    
+    for (int i = 0; i < getSize(); i++)
+    {
+        writeBinary(stream, features[i].type);
+        writeBinary(stream, features[i].channel);
+        writeBinary(stream, features[i].dx1);
+        writeBinary(stream, features[i].dy1);
+        writeBinary(stream, features[i].dx2);
+        writeBinary(stream, features[i].dy2);
+        writeBinary(stream, features[i].radius1);
+        writeBinary(stream, features[i].radius2);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// PixelClassifier
+////////////////////////////////////////////////////////////////////////////////
+
+void PixelClassifier::posteriorMap(const FeatureImage & image, std::vector<float> & posteriors, int & C) const
+{
+    BOOST_ASSERT_MSG(forest->getSize() > 0, "Cannot classify with an empty forest.");
+    
+    const int W = image.getWidth();
+    const int H = image.getHeight();
+    const int T = forest->getSize();
+    
+    // Determine the number of classes from the first leaf histogram
+    {
+        DecisionTree::ptr tree = forest->getTree(0);
+        int leaf = 0;
+        while (!tree->getNodeConfig(leaf).isLeafNode())
+        {
+            leaf = tree->getNodeConfig(leaf).getLeftChild();
+        }
+        C = static_cast<int>(tree->getNodeData(leaf).histogram.size());
+    }
+    
+    posteriors.resize(W*H*C);
+    
+    const int tilesX = (W + tileSize - 1)/tileSize;
+    const int tilesY = (H + tileSize - 1)/tileSize;
+    const int numTiles = tilesX*tilesY;
+    
+    // Tiles are small enough to keep the integral images of the neighbourhood
+    // in cache, and they balance well across threads
+    #pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+    for (int tile = 0; tile < numTiles; tile++)
+    {
+        const int x0 = (tile % tilesX)*tileSize;
+        const int y0 = (tile / tilesX)*tileSize;
+        const int x1 = std::min(x0 + tileSize, W);
+        const int y1 = std::min(y0 + tileSize, H);
+        
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                float* p = &posteriors[(y*W + x)*C];
+                std::fill(p, p + C, 0.0f);
+                
+                // Only the features on the path through each tree are computed
+                auto feature = [&](int d) { return featureBank->evaluate(image, d, x, y); };
+                
+                for (int t = 0; t < T; t++)
+                {
+                    const DecisionTree & tree = *forest->getTree(t);
+                    const std::vector<float> & hist = tree.getNodeData(tree.findLeafNodeLazy(feature)).histogram;
+                    
+                    for (int c = 0; c < C; c++)
+                    {
+                        p[c] += hist[c];
+                    }
+                }
+                
+                // Normalize the summed log posteriors
+                float max = p[0];
+                for (int c = 1; c < C; c++)
+                {
+                    max = std::max(max, p[c]);
+                }
+                
+                float total = 0;
+                for (int c = 0; c < C; c++)
+                {
+                    p[c] = std::exp(p[c] - max);
+                    total += p[c];
+                }
+                for (int c = 0; c < C; c++)
+                {
+                    p[c] /= total;
+                }
+            }
+        }
+    }
+}
+
+void PixelClassifier::posteriorMap(const FeatureImage & image, std::vector<cv::Mat> & posteriors) const
+{
+    std::vector<float> map;
+    int C;
+    posteriorMap(image, map, C);
+    
+    const int W = image.getWidth();
+    const int H = image.getHeight();
+    
+    posteriors.resize(C);
+    for (int c = 0; c < C; c++)
+    {
+        posteriors[c] = cv::Mat(H, W, CV_32F);
+        for (int y = 0; y < H; y++)
+        {
+            float* row = posteriors[c].ptr<float>(y);
+            for (int x = 0; x < W; x++)
+            {
+                row[x] = map[(y*W + x)*C + c];
+            }
+        }
+    }
+}
+
+void PixelClassifier::classify(const FeatureImage & image, cv::Mat & labels) const
+{
+    std::vector<float> map;
+    int C;
+    posteriorMap(image, map, C);
+    
+    const int W = image.getWidth();
+    const int H = image.getHeight();
+    
+    labels = cv::Mat(H, W, CV_32S);
+    for (int y = 0; y < H; y++)
+    {
+        int* row = labels.ptr<int>(y);
+        for (int x = 0; x < W; x++)
+        {
+            const float* p = &map[(y*W + x)*C];
+            row[x] = static_cast<int>(std::max_element(p, p + C) - p);
+        }
+    }
+}
@@ -0,0 +1,221 @@
+#include "libforest/memory.h"
+#include "libforest/error_handling.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <sys/mman.h>
+
+using namespace libf;
+
+static AbstractMemoryResource::ptr defaultResource = std::make_shared<HeapMemoryResource>();
+static std::mutex defaultResourceMutex;
+
+////////////////////////////////////////////////////////////////////////////////
+/// AbstractMemoryResource
+////////////////////////////////////////////////////////////////////////////////
+
+AbstractMemoryResource::ptr AbstractMemoryResource::getDefault()
+{
+    std::lock_guard<std::mutex> lock(defaultResourceMutex);
+    return defaultResource;
+}
+
+void AbstractMemoryResource::setDefault(AbstractMemoryResource::ptr resource)
+{
+    BOOST_ASSERT_MSG(resource, "The default resource must not be empty.");
+    
+    std::lock_guard<std::mutex> lock(defaultResourceMutex);
+    defaultResource = resource;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// HeapMemoryResource
+////////////////////////////////////////////////////////////////////////////////
+
+void* HeapMemoryResource::allocate(size_t bytes)
+{
+    void* p = std::malloc(bytes > 0 ? bytes : 1);
+    if (p == 0)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void HeapMemoryResource::deallocate(void* p, size_t bytes)
+{
+    std::free(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// HugePageMemoryResource
+////////////////////////////////////////////////////////////////////////////////
+
+const size_t HugePageMemoryResource::HUGE_PAGE_SIZE;
+
+inline size_t roundUpToHugePage(size_t bytes)
+{
+    const size_t size = HugePageMemoryResource::HUGE_PAGE_SIZE;
+    return (bytes + size - 1)/size*size;
+}
+
+void* HugePageMemoryResource::allocate(size_t bytes)
+{
+    if (bytes < minSize)
+    {
+        void* p = std::malloc(bytes > 0 ? bytes : 1);
+        if (p == 0)
+        {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    
+    // Map one additional page in order to align the memory to huge pages
+    const size_t size = roundUpToHugePage(bytes);
+    const size_t mappedSize = size + HUGE_PAGE_SIZE;
+    void* mapped = mmap(0, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+    
+    const uintptr_t start = reinterpret_cast<uintptr_t>(mapped);
+    const uintptr_t aligned = roundUpToHugePage(start);
+    
+    // Unmap the unaligned head and the remaining tail
+    if (aligned > start)
+    {
+        munmap(mapped, aligned - start);
+    }
+    if (start + mappedSize > aligned + size)
+    {
+        munmap(reinterpret_cast<void*>(aligned + size), start + mappedSize - aligned - size);
+    }
+    
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+    
+    return reinterpret_cast<void*>(aligned);
+}
+
+void HugePageMemoryResource::deallocate(void* p, size_t bytes)
+{
+    if (bytes < minSize)
+    {
+        std::free(p);
+    }
+    else
+    {
+        munmap(p, roundUpToHugePage(bytes));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// ArenaMemoryResource
+////////////////////////////////////////////////////////////////////////////////
+
+ArenaMemoryResource::~ArenaMemoryResource()
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        upstream->deallocate(blocks[i].first, blocks[i].second);
+    }
+}
+
+void* ArenaMemoryResource::allocate(size_t bytes)
+{
+    // Keep every allocation aligned for any fundamental type
+    const size_t alignment = alignof(std::max_align_t);
+    bytes = (bytes + alignment - 1)/alignment*alignment;
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    if (blocks.size() == 0 || offset + bytes > blocks.back().second)
+    {
+        const size_t size = std::max(blockSize, bytes);
+        blocks.push_back(std::make_pair(static_cast<char*>(upstream->allocate(size)), size));
+        offset = 0;
+    }
+    
+    void* p = blocks.back().first + offset;
+    offset += bytes;
+    used += bytes;
+    
+    return p;
+}
+
+void ArenaMemoryResource::deallocate(void* p, size_t bytes)
+{
+    // The memory is released with the arena
+}
+
+size_t ArenaMemoryResource::getUsedMemory() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+size_t ArenaMemoryResource::getReservedMemory() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    size_t reserved = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        reserved += blocks[i].second;
+    }
+    return reserved;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// ScratchArena
+////////////////////////////////////////////////////////////////////////////////
+
+ScratchArena & ScratchArena::local()
+{
+    static thread_local ScratchArena arena;
+    return arena;
+}
+
+size_t ScratchArena::getReservedMemory() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < vectors.size(); i++)
+    {
+        bytes += vectors[i].size()*sizeof(float);
+    }
+    for (size_t i = 0; i < matrices.size(); i++)
+    {
+        bytes += matrices[i].size()*sizeof(float);
+    }
+    return bytes;
+}
+
+Eigen::VectorXf & ScratchArena::Scope::getVector(int rows)
+{
+    if (arena.numVectors == arena.vectors.size())
+    {
+        arena.vectors.push_back(Eigen::VectorXf());
+    }
+    
+    // Resizing to the same size does not reallocate
+    Eigen::VectorXf & vector = arena.vectors[arena.numVectors++];
+    vector.resize(rows);
+    return vector;
+}
+
+Eigen::MatrixXf & ScratchArena::Scope::getMatrix(int rows, int cols)
+{
+    if (arena.numMatrices == arena.matrices.size())
+    {
+        arena.matrices.push_back(Eigen::MatrixXf());
+    }
+    
+    Eigen::MatrixXf & matrix = arena.matrices[arena.numMatrices++];
+    matrix.resize(rows, cols);
+    return matrix;
+}
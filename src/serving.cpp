@@ -0,0 +1,444 @@
+#include "libforest/serving.h"
+
+#include <algorithm>
+#include <iterator>
+#include <iomanip>
+#include <cmath>
+#include <cstring>
+
+using namespace libf;
+
+////////////////////////////////////////////////////////////////////////////////
+/// ThreadPool
+////////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool(int numThreads) : stopping(false)
+{
+    BOOST_ASSERT_MSG(numThreads > 0, "The number of threads must be positive.");
+    
+    for (int i = 0; i < numThreads; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        BOOST_ASSERT_MSG(!stopping, "Cannot enqueue tasks while the pool is shutting down.");
+        tasks.push_back(task);
+    }
+    condition.notify_one();
+}
+
+void ThreadPool::work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || tasks.size() > 0; });
+            
+            // Remaining tasks are finished before shutting down
+            if (tasks.size() == 0)
+            {
+                return;
+            }
+            
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        
+        task();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// MicroBatchingClassifier
+////////////////////////////////////////////////////////////////////////////////
+
+MicroBatchingClassifier::MicroBatchingClassifier(AbstractClassifier::ptr _classifier, ThreadPool::ptr _pool) : 
+        classifier(_classifier), 
+        pool(_pool), 
+        maxWait(200), 
+        maxBatchSize(64), 
+        numRequests(0), 
+        numBatches(0), 
+        stopping(false)
+{
+    scheduler = std::thread(&MicroBatchingClassifier::schedule, this);
+}
+
+MicroBatchingClassifier::~MicroBatchingClassifier()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    scheduler.join();
+}
+
+std::future< std::vector<float> > MicroBatchingClassifier::submit(const DataPoint & x) const
+{
+    Request request;
+    request.x = x;
+    request.arrival = std::chrono::steady_clock::now();
+    std::future< std::vector<float> > result = request.result.get_future();
+    
+    bool wakeUp;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(request));
+        
+        // The scheduler only needs to know about the first and the last 
+        // request of a batch
+        wakeUp = pending.size() == 1 || static_cast<int>(pending.size()) >= maxBatchSize;
+    }
+    if (wakeUp)
+    {
+        condition.notify_one();
+    }
+    
+    return result;
+}
+
+void MicroBatchingClassifier::classLogPosterior(const DataPoint & x, std::vector<float> & probabilities) const
+{
+    probabilities = submit(x).get();
+}
+
+void MicroBatchingClassifier::schedule()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    
+    while (true)
+    {
+        // Wait for the first request of the next batch
+        condition.wait(lock, [this] { return stopping || pending.size() > 0; });
+        
+        if (pending.size() == 0)
+        {
+            return;
+        }
+        
+        // Wait until the batch is full or its first request is due
+        const std::chrono::steady_clock::time_point deadline = pending.front().arrival + std::chrono::microseconds(maxWait);
+        condition.wait_until(lock, deadline, [this] { 
+            return stopping || static_cast<int>(pending.size()) >= maxBatchSize; 
+        });
+        
+        auto batch = std::make_shared< std::vector<Request> >();
+        if (static_cast<int>(pending.size()) <= maxBatchSize)
+        {
+            batch->swap(pending);
+        }
+        else
+        {
+            batch->reserve(maxBatchSize);
+            std::move(pending.begin(), pending.begin() + maxBatchSize, std::back_inserter(*batch));
+            pending.erase(pending.begin(), pending.begin() + maxBatchSize);
+        }
+        
+        numRequests += static_cast<int>(batch->size());
+        numBatches++;
+        
+        lock.unlock();
+        
+        // The batch must not refer to this object as it may be destroyed 
+        // before the batch is evaluated
+        AbstractClassifier::ptr batchClassifier = classifier;
+        pool->enqueue([batchClassifier, batch] () {
+            evaluate(batchClassifier, batch);
+        });
+        
+        lock.lock();
+    }
+}
+
+void MicroBatchingClassifier::evaluate(AbstractClassifier::ptr classifier, std::shared_ptr< std::vector<Request> > batch)
+{
+    std::vector< std::vector<float> > probabilities;
+    try
+    {
+        DataStorage::ptr storage = DataStorage::Factory::create();
+        for (size_t i = 0; i < batch->size(); i++)
+        {
+            storage->addDataPoint((*batch)[i].x);
+        }
+        
+        classifier->classLogPosteriors(storage, probabilities);
+    }
+    catch (...)
+    {
+        for (size_t i = 0; i < batch->size(); i++)
+        {
+            (*batch)[i].result.set_exception(std::current_exception());
+        }
+        return;
+    }
+    
+    for (size_t i = 0; i < batch->size(); i++)
+    {
+        (*batch)[i].result.set_value(std::move(probabilities[i]));
+    }
+}
+
+void MicroBatchingClassifier::read(std::istream & stream)
+{
+    classifier->read(stream);
+}
+
+void MicroBatchingClassifier::write(std::ostream & stream) const
+{
+    classifier->write(stream);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// LatencyHistogram
+////////////////////////////////////////////////////////////////////////////////
+
+const int LatencyHistogram::NUM_BUCKETS;
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::record(int64_t microseconds)
+{
+    int b = 0;
+    while (b < NUM_BUCKETS - 1 && (microseconds >> (b + 1)) > 0)
+    {
+        b++;
+    }
+    
+    buckets[b].fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::getCount() const
+{
+    int64_t count = 0;
+    for (int b = 0; b < NUM_BUCKETS; b++)
+    {
+        count += getBucketCount(b);
+    }
+    return count;
+}
+
+int64_t LatencyHistogram::getPercentile(float p) const
+{
+    BOOST_ASSERT_MSG(0 <= p && p <= 100, "Invalid percentile.");
+    
+    const int64_t count = getCount();
+    const int64_t rank = static_cast<int64_t>(std::ceil(p/100*count));
+    
+    int64_t cumulative = 0;
+    for (int b = 0; b < NUM_BUCKETS; b++)
+    {
+        cumulative += getBucketCount(b);
+        if (cumulative >= rank && cumulative > 0)
+        {
+            return static_cast<int64_t>(1) << (b + 1);
+        }
+    }
+    
+    return 0;
+}
+
+void LatencyHistogram::reset()
+{
+    for (int b = 0; b < NUM_BUCKETS; b++)
+    {
+        buckets[b].store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::print(std::ostream & stream) const
+{
+    const int64_t count = getCount();
+    stream << "requests: " << count << std::endl;
+    
+    for (int b = 0; b < NUM_BUCKETS; b++)
+    {
+        const int64_t bucketCount = getBucketCount(b);
+        if (bucketCount > 0)
+        {
+            stream << "  < " << std::setw(10) << (static_cast<int64_t>(1) << (b + 1)) << " us: " 
+                    << std::setw(10) << bucketCount << std::endl;
+        }
+    }
+    
+    if (count > 0)
+    {
+        stream << "p50 < " << getPercentile(50) << " us, "
+                << "p90 < " << getPercentile(90) << " us, "
+                << "p99 < " << getPercentile(99) << " us" << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CachedClassifier
+////////////////////////////////////////////////////////////////////////////////
+
+const int CachedClassifier::NUM_SHARDS;
+
+CachedClassifier::CachedClassifier(AbstractClassifier::ptr _classifier) : 
+        classifier(_classifier), 
+        maxMemory(64 << 20), 
+        quantization(0), 
+        numHits(0), 
+        numMisses(0)
+{
+    for (int s = 0; s < NUM_SHARDS; s++)
+    {
+        shards[s].memory = 0;
+    }
+}
+
+uint64_t CachedClassifier::computeKey(const DataPoint & x, std::vector<float> & key) const
+{
+    const int D = x.rows();
+    key.resize(D);
+    
+    uint64_t hash = 14695981039346656037ull;
+    for (int d = 0; d < D; d++)
+    {
+        key[d] = quantization > 0 ? std::round(x(d)/quantization) : x(d);
+        
+        // Treat 0 and -0 alike
+        if (key[d] == 0)
+        {
+            key[d] = 0;
+        }
+        
+        uint32_t bits;
+        std::memcpy(&bits, &key[d], sizeof(bits));
+        hash = (hash ^ bits)*1099511628211ull;
+    }
+    
+    // Mix the high bits into the low bits that select the shard
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    
+    return hash;
+}
+
+size_t CachedClassifier::getMemory(const Entry & entry)
+{
+    // The list node and the index entry add roughly four pointers
+    return sizeof(Entry) + 4*sizeof(void*) 
+            + (entry.key.capacity() + entry.probabilities.capacity())*sizeof(float);
+}
+
+void CachedClassifier::classLogPosterior(const DataPoint & x, std::vector<float> & probabilities) const
+{
+    Entry entry;
+    entry.hash = computeKey(x, entry.key);
+    Shard & shard = shards[entry.hash % NUM_SHARDS];
+    
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(entry.hash);
+        if (it != shard.index.end() && it->second->key == entry.key)
+        {
+            // Move the entry to the back of the list
+            shard.entries.splice(shard.entries.end(), shard.entries, it->second);
+            probabilities = it->second->probabilities;
+            numHits.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    
+    // Evaluate the classifier without holding the lock
+    numMisses.fetch_add(1, std::memory_order_relaxed);
+    classifier->classLogPosterior(x, probabilities);
+    entry.probabilities = probabilities;
+    
+    const size_t memory = getMemory(entry);
+    const size_t maxShardMemory = maxMemory/NUM_SHARDS;
+    if (memory > maxShardMemory)
+    {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    
+    // Another thread may have inserted the same hash in the meantime
+    auto it = shard.index.find(entry.hash);
+    if (it != shard.index.end())
+    {
+        shard.memory -= getMemory(*it->second);
+        shard.entries.erase(it->second);
+        shard.index.erase(it);
+    }
+    
+    // Evict the least recently used entries
+    while (shard.entries.size() > 0 && shard.memory + memory > maxShardMemory)
+    {
+        shard.memory -= getMemory(shard.entries.front());
+        shard.index.erase(shard.entries.front().hash);
+        shard.entries.pop_front();
+    }
+    
+    shard.entries.push_back(std::move(entry));
+    shard.index[shard.entries.back().hash] = std::prev(shard.entries.end());
+    shard.memory += memory;
+}
+
+void CachedClassifier::clear()
+{
+    for (int s = 0; s < NUM_SHARDS; s++)
+    {
+        std::lock_guard<std::mutex> lock(shards[s].mutex);
+        shards[s].entries.clear();
+        shards[s].index.clear();
+        shards[s].memory = 0;
+    }
+}
+
+float CachedClassifier::getHitRate() const
+{
+    const uint64_t hits = getNumHits();
+    const uint64_t total = hits + getNumMisses();
+    return total > 0 ? hits/static_cast<float>(total) : 0;
+}
+
+size_t CachedClassifier::getMemoryUsage() const
+{
+    size_t memory = 0;
+    for (int s = 0; s < NUM_SHARDS; s++)
+    {
+        std::lock_guard<std::mutex> lock(shards[s].mutex);
+        memory += shards[s].memory;
+    }
+    return memory;
+}
+
+void CachedClassifier::read(std::istream & stream)
+{
+    classifier->read(stream);
+    clear();
+}
+
+void CachedClassifier::write(std::ostream & stream) const
+{
+    classifier->write(stream);
+}
@@ -1,6 +1,12 @@
 #include "libforest/util.h"
 #include <random>
 #include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <unordered_set>
 
 static std::random_device rd;
 
@@ -23,6 +29,295 @@ void Util::generateRandomPermutation(int N, std::vector<int> & sigma)
     std::shuffle(sigma.begin(), sigma.end(), std::default_random_engine(rd()));
 }
 
+void Util::sampleWithoutReplacement(int N, int M, std::vector<int> & result, std::mt19937 & g)
+{
+    BOOST_ASSERT_MSG(0 <= M && M <= N, "Cannot sample more elements than available.");
+    
+    std::unordered_set<int> selected;
+    selected.reserve(M);
+    
+    // Floyd's algorithm: In step j, pick an element from [0, j]; if it was 
+    // already picked, take j itself
+    for (int j = N - M; j < N; j++)
+    {
+        std::uniform_int_distribution<int> dist(0, j);
+        const int t = dist(g);
+        if (!selected.insert(t).second)
+        {
+            selected.insert(j);
+        }
+    }
+    
+    // Sorting the indices results in a more cache friendly access pattern
+    result.assign(selected.begin(), selected.end());
+    std::sort(result.begin(), result.end());
+}
+
+uint16_t Util::floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    
+    const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    const uint32_t exponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    
+    // NaN and infinity
+    if (exponent == 0xFF)
+    {
+        return sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0);
+    }
+    
+    const int halfExponent = static_cast<int>(exponent) - 127 + 15;
+    
+    // Overflow => infinity
+    if (halfExponent >= 0x1F)
+    {
+        return sign | 0x7C00;
+    }
+    
+    // Subnormal half or zero
+    if (halfExponent <= 0)
+    {
+        if (halfExponent < -10)
+        {
+            return sign;
+        }
+        
+        mantissa |= 0x800000;
+        const int shift = 14 - halfExponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+        {
+            half++;
+        }
+        return sign | static_cast<uint16_t>(half);
+    }
+    
+    uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        // This may carry into the exponent which correctly rounds up to 
+        // infinity
+        half++;
+    }
+    return sign | static_cast<uint16_t>(half);
+}
+
+float Util::halfToFloat(uint16_t value)
+{
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1F;
+    uint32_t mantissa = value & 0x3FF;
+    
+    uint32_t bits;
+    if (exponent == 0x1F)
+    {
+        // NaN and infinity
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    }
+    else if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // Normalize the subnormal half
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3FF;
+            bits = sign | (exponent << 23) | (mantissa << 13);
+        }
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+    
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void Util::appendInt(std::string & buffer, int value)
+{
+    char digits[12];
+    int length = 0;
+    
+    // Work on the unsigned magnitude such that INT_MIN does not overflow
+    uint32_t magnitude = static_cast<uint32_t>(value);
+    if (value < 0)
+    {
+        buffer.push_back('-');
+        magnitude = 0u - magnitude;
+    }
+    
+    do
+    {
+        digits[length++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    }
+    while (magnitude > 0);
+    
+    while (length > 0)
+    {
+        buffer.push_back(digits[--length]);
+    }
+}
+
+/**
+ * Returns 10^e as double. Exact for |e| <= 22.
+ */
+static double powerOfTen(int e)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    
+    double result = 1;
+    int magnitude = std::abs(e);
+    while (magnitude > 22)
+    {
+        result *= powers[22];
+        magnitude -= 22;
+    }
+    result *= powers[magnitude];
+    
+    return (e < 0 ? 1/result : result);
+}
+
+void Util::appendFloat(std::string & buffer, float value)
+{
+    if (!std::isfinite(value))
+    {
+        buffer += (std::isnan(value) ? "nan" : (value < 0 ? "-inf" : "inf"));
+        return;
+    }
+    
+    if (std::signbit(value))
+    {
+        buffer.push_back('-');
+        value = -value;
+    }
+    
+    // Fast path for integral values, e.g. pixel intensities and counts. 
+    // Below 2^24 all integers are floats, so all digits are significant.
+    if (value == std::floor(value) && value < 16777216.0f)
+    {
+        appendInt(buffer, static_cast<int>(value));
+        return;
+    }
+    
+    // Any decimal strictly within the rounding interval of value reads back
+    // to value. The interval bounds are exact in double precision. 
+    const double x = value;
+    const double lower = 0.5*(x + std::nextafter(value, 0.0f));
+    const float next = std::nextafter(value, std::numeric_limits<float>::infinity());
+    // Above the largest float, the interval is symmetric
+    const double upper = (std::isinf(next) ? 2*x - lower : 0.5*(x + next));
+    // Safety margin for the rounding errors of the double arithmetic below
+    const double margin = 1e-14*x;
+    
+    // Compute 9 significant digits, these always identify a float
+    int exponent = static_cast<int>(std::floor(std::log10(x)));
+    uint64_t digits = static_cast<uint64_t>(std::llround(x*powerOfTen(8 - exponent)));
+    if (digits >= 1000000000ULL)
+    {
+        exponent++;
+        digits = static_cast<uint64_t>(std::llround(x*powerOfTen(8 - exponent)));
+    }
+    else if (digits < 100000000ULL)
+    {
+        exponent--;
+        digits = static_cast<uint64_t>(std::llround(x*powerOfTen(8 - exponent)));
+    }
+    
+    // Find the shortest rounded digit sequence within the rounding interval
+    // (minus the safety margin)
+    int numDigits = 9;
+    uint64_t shortestDigits = digits;
+    int shortestExponent = exponent;
+    uint64_t divisor = 10;
+    for (int k = 8; k >= 1; k--, divisor *= 10)
+    {
+        const uint64_t candidate = (digits + divisor/2)/divisor;
+        const double candidateValue = static_cast<double>(candidate*divisor)*powerOfTen(exponent - 8);
+        if (lower + margin < candidateValue && candidateValue < upper - margin)
+        {
+            numDigits = k;
+            shortestDigits = candidate;
+            shortestExponent = exponent;
+            // Rounding up may add a digit, e.g. 9.99 -> 10.0
+            if (candidate*divisor >= 1000000000ULL)
+            {
+                shortestDigits /= 10;
+                shortestExponent++;
+            }
+        }
+    }
+    digits = shortestDigits;
+    exponent = shortestExponent;
+    
+    // Strip trailing zeros
+    while (numDigits > 1 && digits % 10 == 0)
+    {
+        digits /= 10;
+        numDigits--;
+    }
+    
+    char text[16];
+    for (int i = numDigits - 1; i >= 0; i--)
+    {
+        text[i] = static_cast<char>('0' + digits % 10);
+        digits /= 10;
+    }
+    
+    if (-5 <= exponent && exponent < 0)
+    {
+        // 0.000ddd
+        buffer += "0.";
+        buffer.append(-exponent - 1, '0');
+        buffer.append(text, numDigits);
+    }
+    else if (0 <= exponent && exponent < 9)
+    {
+        // ddd.ddd
+        if (numDigits <= exponent + 1)
+        {
+            buffer.append(text, numDigits);
+            buffer.append(exponent + 1 - numDigits, '0');
+        }
+        else
+        {
+            buffer.append(text, exponent + 1);
+            buffer.push_back('.');
+            buffer.append(text + exponent + 1, numDigits - exponent - 1);
+        }
+    }
+    else
+    {
+        // d.ddde+xx
+        buffer.push_back(text[0]);
+        if (numDigits > 1)
+        {
+            buffer.push_back('.');
+            buffer.append(text + 1, numDigits - 1);
+        }
+        buffer.push_back('e');
+        appendInt(buffer, exponent);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// GUIUtil
 ////////////////////////////////////////////////////////////////////////////////
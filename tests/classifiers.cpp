@@ -0,0 +1,1011 @@
+#include <sstream>
+#include <thread>
+#include <stdexcept>
+#include <fstream>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <boost/filesystem.hpp>
+
+#include "gtest/gtest.h"
+#include "libforest/data.h"
+#include "libforest/classifier.h"
+#include "libforest/classifier_learning.h"
+#include "libforest/classifier_learning_tools.h"
+#include "libforest/image.h"
+#include "libforest/serving.h"
+
+using namespace libf;
+
+/**
+ * Creates N points with D standard normal features that are labeled by the 
+ * sign of the first feature and learns a random forest with T trees on them.
+ * 
+ * @param N The number of data points
+ * @param D The dimensionality
+ * @param T The number of trees
+ * @param storage The created data points
+ * @param maxDepth The maximum depth of the trees
+ * @return The learned forest
+ */
+static RandomForest<DecisionTree>::ptr makeGaussianForest(int N, int D, int T, DataStorage::ptr & storage, int maxDepth = 100)
+{
+    std::mt19937 g(0);
+    std::normal_distribution<float> normal;
+    
+    storage = DataStorage::Factory::create();
+    for (int n = 0; n < N; n++)
+    {
+        DataPoint x(D);
+        for (int d = 0; d < D; d++)
+        {
+            x(d) = normal(g);
+        }
+        storage->addDataPoint(x, x(0) > 0 ? 1 : 0);
+    }
+    
+    RandomForestLearner<DecisionTreeLearner> learner;
+    learner.setNumTrees(T);
+    learner.getTreeLearner().setMaxDepth(maxDepth);
+    return learner.learn(storage);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "CategoricalSplitTreeNodeConfig"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(CategoricalSplitTreeNodeConfig, goesLeft)
+{
+    CategoricalSplitTreeNodeConfig config;
+    config.setSplitFeature(1);
+    config.setThreshold(0.5f);
+    
+    DataPoint x(2);
+    x << 0, 65;
+    
+    // Numerical split
+    ASSERT_FALSE(config.isCategorical());
+    ASSERT_FALSE(config.goesLeft(x));
+    
+    std::vector<int> left;
+    left.push_back(3);
+    left.push_back(65);
+    config.setLeftCategories(left);
+    
+    ASSERT_TRUE(config.isCategorical());
+    ASSERT_TRUE(config.isLeftCategory(3));
+    ASSERT_TRUE(config.isLeftCategory(65));
+    ASSERT_FALSE(config.isLeftCategory(64));
+    ASSERT_FALSE(config.isLeftCategory(1000));
+    ASSERT_TRUE(config.goesLeft(x));
+    
+    x(1) = 4;
+    ASSERT_FALSE(config.goesLeft(x));
+}
+
+TEST(CategoricalSplitTreeNodeConfig, readWrite)
+{
+    CategoricalSplitTreeNodeConfig config;
+    config.setSplitFeature(2);
+    std::vector<int> left;
+    left.push_back(1);
+    left.push_back(70);
+    config.setLeftCategories(left);
+    
+    std::stringstream stream;
+    config.write(stream);
+    
+    CategoricalSplitTreeNodeConfig read;
+    read.read(stream);
+    
+    ASSERT_EQ(read.getSplitFeature(), 2);
+    ASSERT_TRUE(read.isCategorical());
+    for (int k = 0; k < 100; k++)
+    {
+        ASSERT_EQ(read.isLeftCategory(k), config.isLeftCategory(k));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "CategoricalDecisionTreeLearner"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(CategoricalDecisionTreeLearner, learn_subsetSplit)
+{
+    // The label depends on a non-contiguous subset of the categories, such
+    // that no single threshold separates the classes
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < 100; n++)
+    {
+        DataPoint x(1);
+        x(0) = n % 6;
+        storage->addDataPoint(x, (n % 6) % 2);
+    }
+    
+    std::vector<int> numCategories;
+    numCategories.push_back(6);
+    
+    CategoricalDecisionTreeLearner learner;
+    learner.setUseBootstrap(false);
+    learner.setNumFeatures(1);
+    learner.setNumCategories(numCategories);
+    
+    CategoricalDecisionTree::ptr tree = learner.learn(storage);
+    
+    // A single subset split separates the classes
+    ASSERT_EQ(tree->getNumNodes(), 3);
+    ASSERT_TRUE(tree->getNodeConfig(0).isCategorical());
+    
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        ASSERT_EQ(tree->classify(storage->getDataPoint(n)), storage->getClassLabel(n));
+    }
+}
+
+TEST(CategoricalDecisionTreeLearner, learn_invalidCategories)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < 10; n++)
+    {
+        DataPoint x(1);
+        x(0) = n;
+        storage->addDataPoint(x, n % 2);
+    }
+    
+    CategoricalDecisionTreeLearner learner;
+    learner.setNumFeatures(1);
+    
+    // The feature takes 10 values
+    learner.setNumCategories(std::vector<int>(1, 5));
+    ASSERT_THROW(learner.learn(storage), ConfigurationException);
+    
+    // There is only one feature
+    learner.setNumCategories(std::vector<int>(2, 10));
+    ASSERT_THROW(learner.learn(storage), ConfigurationException);
+    
+    learner.setNumCategories(std::vector<int>(1, 10));
+    ASSERT_NO_THROW(learner.learn(storage));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "PixelClassifier"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(PixelClassifier, posteriorMap)
+{
+    const int W = 23;
+    const int H = 17;
+    
+    std::mt19937 g(0);
+    std::uniform_real_distribution<float> dist(0, 1);
+    
+    std::vector<float> data(W*H*2);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = dist(g);
+    }
+    FeatureImage image(W, H, 2, data);
+    
+    ImageFeatureBank::ptr bank = std::make_shared<ImageFeatureBank>();
+    bank->generate(16, 2, 4, 2);
+    
+    // Label the pixels by their brightness in the first channel
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    std::vector<DataPoint> points(W*H);
+    for (int y = 0; y < H; y++)
+    {
+        for (int x = 0; x < W; x++)
+        {
+            bank->extract(image, x, y, points[y*W + x]);
+            storage->addDataPoint(points[y*W + x], image.getPixel(0, x, y) < 0.5f ? 0 : 1);
+        }
+    }
+    
+    RandomForestLearner<DecisionTreeLearner> learner;
+    learner.setNumTrees(4);
+    learner.getTreeLearner().setNumFeatures(4);
+    RandomForest<DecisionTree>::ptr forest = learner.learn(storage);
+    
+    PixelClassifier classifier(forest, bank);
+    classifier.setTileSize(5);
+    
+    std::vector<float> posteriors;
+    int C;
+    classifier.posteriorMap(image, posteriors, C);
+    ASSERT_EQ(C, 2);
+    
+    // The lazy evaluation must agree with classifying materialized points
+    for (int n = 0; n < W*H; n++)
+    {
+        std::vector<float> expected;
+        forest->classLogPosterior(points[n], expected);
+        
+        const float p1 = 1/(1 + std::exp(expected[0] - expected[1]));
+        ASSERT_NEAR(posteriors[2*n + 1], p1, 1e-5);
+        ASSERT_NEAR(posteriors[2*n] + posteriors[2*n + 1], 1, 1e-5);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for lazy feature evaluation
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Provides the features of a data storage and counts the requests.
+ */
+class CountingFeatureProvider : public AbstractFeatureProvider {
+public:
+    CountingFeatureProvider(DataStorage::ptr _storage) : storage(_storage), numRequests(0), numBatches(0), failing(false) {}
+    
+    int getSize() const
+    {
+        return storage->getSize();
+    }
+    
+    int getDimensionality() const
+    {
+        return storage->getDimensionality();
+    }
+    
+    float computeFeature(int n, int d)
+    {
+        numRequests++;
+        return storage->getDataPoint(n)(d);
+    }
+    
+    void computeFeatures(const std::vector< std::pair<int, int> > & requests, std::vector<float> & values)
+    {
+        numBatches++;
+        if (failing)
+        {
+            throw std::runtime_error("Feature computation failed.");
+        }
+        AbstractFeatureProvider::computeFeatures(requests, values);
+    }
+    
+    DataStorage::ptr storage;
+    int numRequests;
+    int numBatches;
+    bool failing;
+};
+
+TEST(FeatureMemo, prefetch)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < 3; n++)
+    {
+        storage->addDataPoint(DataPoint::Constant(4, static_cast<float>(n)), 0);
+    }
+    
+    auto provider = std::make_shared<CountingFeatureProvider>(storage);
+    FeatureMemo memo(provider);
+    
+    std::vector< std::pair<int, int> > requests;
+    requests.push_back(std::make_pair(1, 2));
+    requests.push_back(std::make_pair(2, 3));
+    requests.push_back(std::make_pair(1, 2));
+    
+    // A failing provider leaves the memo unchanged
+    provider->failing = true;
+    ASSERT_THROW(memo.prefetch(requests), std::runtime_error);
+    ASSERT_FALSE(memo.isComputed(1, 2));
+    ASSERT_EQ(memo.getNumComputed(), 0);
+    
+    provider->failing = false;
+    memo.prefetch(requests);
+    ASSERT_TRUE(memo.isComputed(1, 2));
+    ASSERT_TRUE(memo.isComputed(2, 3));
+    ASSERT_FALSE(memo.isComputed(0, 0));
+    ASSERT_EQ(memo.getNumComputed(), 2);
+    ASSERT_EQ(provider->numRequests, 2);
+    ASSERT_FLOAT_EQ(memo.get(2, 3), 2.0f);
+    ASSERT_EQ(provider->numRequests, 2);
+}
+
+TEST(RandomForest, classLogPosteriorLazy)
+{
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(200, 50, 5, storage, 4);
+    
+    // Single point with a per-request memo
+    auto provider = std::make_shared<CountingFeatureProvider>(storage);
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        FeatureMemo memo(provider);
+        std::vector<float> lazy, expected;
+        forest->classLogPosteriorLazy([&](int d) { return memo.get(n, d); }, lazy);
+        forest->classLogPosterior(storage->getDataPoint(n), expected);
+        
+        ASSERT_EQ(lazy, expected);
+        ASSERT_LE(memo.getNumComputed(), 5*4);
+    }
+    
+    // Batch mode requests every feature at most once, one batch per level
+    provider = std::make_shared<CountingFeatureProvider>(storage);
+    FeatureMemo memo(provider);
+    std::vector< std::vector<float> > lazy;
+    forest->classLogPosteriorLazy(memo, lazy);
+    
+    ASSERT_EQ(provider->numRequests, memo.getNumComputed());
+    ASSERT_LT(provider->numRequests, storage->getSize()*storage->getDimensionality());
+    ASSERT_LE(provider->numBatches, 4);
+    
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        std::vector<float> expected;
+        forest->classLogPosterior(storage->getDataPoint(n), expected);
+        ASSERT_EQ(lazy[n], expected);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "MicroBatchingClassifier"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(MicroBatchingClassifier, submit)
+{
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(300, 5, 5, storage);
+    
+    ThreadPool::ptr pool = std::make_shared<ThreadPool>(2);
+    MicroBatchingClassifier::ptr scheduler = std::make_shared<MicroBatchingClassifier>(forest, pool);
+    scheduler->setMaxWait(10000);
+    scheduler->setMaxBatchSize(32);
+    
+    // Submit all points at once, such that they are coalesced
+    std::vector< std::future< std::vector<float> > > futures;
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        futures.push_back(scheduler->submit(storage->getDataPoint(n)));
+    }
+    
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        std::vector<float> expected;
+        forest->classLogPosterior(storage->getDataPoint(n), expected);
+        ASSERT_EQ(futures[n].get(), expected);
+    }
+    
+    ASSERT_EQ(scheduler->getNumRequests(), storage->getSize());
+    ASSERT_LT(scheduler->getNumBatches(), storage->getSize());
+    
+    // The batched kernel agrees with single point evaluation
+    std::vector< std::vector<float> > batched;
+    forest->classLogPosteriors(storage, batched);
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        std::vector<float> expected;
+        forest->classLogPosterior(storage->getDataPoint(n), expected);
+        ASSERT_EQ(batched[n], expected);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "LatencyHistogram"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(LatencyHistogram, getPercentile)
+{
+    LatencyHistogram histogram;
+    ASSERT_EQ(histogram.getCount(), 0);
+    
+    for (int i = 0; i < 90; i++)
+    {
+        histogram.record(3);
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        histogram.record(1000);
+    }
+    
+    ASSERT_EQ(histogram.getCount(), 100);
+    ASSERT_EQ(histogram.getBucketCount(1), 90);
+    ASSERT_EQ(histogram.getBucketCount(9), 10);
+    ASSERT_EQ(histogram.getPercentile(50), 4);
+    ASSERT_EQ(histogram.getPercentile(90), 4);
+    ASSERT_EQ(histogram.getPercentile(99), 1024);
+    
+    histogram.reset();
+    ASSERT_EQ(histogram.getCount(), 0);
+}
+
+#ifdef LIBF_SERVE_BINARY
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the prediction daemon (examples/serve.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Writes a forest with T trees on 3 dimensional data. 
+ */
+static void writeServeModel(const std::string & filename, int T)
+{
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(200, 3, T, storage);
+    
+    // Replace the model atomically
+    const std::string temporary = filename + ".tmp";
+    std::ofstream stream(temporary, std::ios::binary);
+    forest->write(stream);
+    stream.close();
+    boost::filesystem::rename(temporary, filename);
+}
+
+TEST(Serve, stdinStdout)
+{
+    const boost::filesystem::path directory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("libforest-serve-%%%%%%%%");
+    boost::filesystem::create_directories(directory);
+    const std::string model = (directory / "model.dat").string();
+    writeServeModel(model, 3);
+    
+    int requests[2];
+    int responses[2];
+    ASSERT_EQ(pipe(requests), 0);
+    ASSERT_EQ(pipe(responses), 0);
+    
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        dup2(requests[0], STDIN_FILENO);
+        dup2(responses[1], STDOUT_FILENO);
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO);
+        close(requests[1]);
+        close(responses[0]);
+        
+        execl(LIBF_SERVE_BINARY, LIBF_SERVE_BINARY, "--model", model.c_str(), "--reload-interval", "20", static_cast<char*>(0));
+        _exit(127);
+    }
+    close(requests[0]);
+    close(responses[1]);
+    
+    auto send = [&requests] (const std::vector<int> & header, const std::vector<float> & data) {
+        ASSERT_EQ(write(requests[1], header.data(), header.size()*sizeof(int)), static_cast<ssize_t>(header.size()*sizeof(int)));
+        ASSERT_EQ(write(requests[1], data.data(), data.size()*sizeof(float)), static_cast<ssize_t>(data.size()*sizeof(float)));
+    };
+    auto receive = [&responses] (void* buffer, size_t size) {
+        char* data = static_cast<char*>(buffer);
+        while (size > 0)
+        {
+            const ssize_t count = read(responses[0], data, size);
+            if (count <= 0)
+            {
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    };
+    auto getStats = [&] () {
+        send(std::vector<int>(1, 2), std::vector<float>());
+        int header[2];
+        EXPECT_TRUE(receive(header, sizeof(header)));
+        EXPECT_EQ(header[0], 0);
+        std::string text(header[1], ' ');
+        EXPECT_TRUE(receive(&text[0], text.size()));
+        return text;
+    };
+    
+    // Classify two points
+    std::vector<int> header = {1, 2, 3};
+    std::vector<float> points = {1, 0, 0, -1, 0, 0};
+    send(header, points);
+    
+    int response[3];
+    ASSERT_TRUE(receive(response, sizeof(response)));
+    ASSERT_EQ(response[0], 0);
+    ASSERT_EQ(response[1], 2);
+    ASSERT_EQ(response[2], 2);
+    
+    std::vector<float> probabilities(4);
+    ASSERT_TRUE(receive(probabilities.data(), probabilities.size()*sizeof(float)));
+    ASSERT_NEAR(probabilities[0] + probabilities[1], 1, 1e-5);
+    ASSERT_GT(probabilities[1], probabilities[0]);
+    ASSERT_GT(probabilities[2], probabilities[3]);
+    
+    // A rewritten model is picked up
+    ASSERT_NE(getStats().find("trees: 3"), std::string::npos);
+    writeServeModel(model, 5);
+    
+    bool reloaded = false;
+    for (int i = 0; i < 200 && !reloaded; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        reloaded = getStats().find("trees: 5") != std::string::npos;
+    }
+    ASSERT_TRUE(reloaded);
+    
+    // Closing the input shuts the daemon down
+    close(requests[1]);
+    int status;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+    close(responses[0]);
+    
+    boost::filesystem::remove_all(directory);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "TreeParallelClassifier"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(TreeParallelClassifier, classLogPosterior)
+{
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(200, 5, 37, storage);
+    
+    ThreadPool::ptr pool = std::make_shared<ThreadPool>(3);
+    TreeParallelClassifier<DecisionTree> classifier(forest, pool);
+    classifier.setTreesPerTask(5);
+    
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        std::vector<float> parallel, expected;
+        classifier.classLogPosterior(storage->getDataPoint(n), parallel);
+        forest->classLogPosterior(storage->getDataPoint(n), expected);
+        
+        ASSERT_EQ(parallel.size(), expected.size());
+        for (size_t c = 0; c < expected.size(); c++)
+        {
+            ASSERT_NEAR(parallel[c], expected[c], 1e-3);
+        }
+    }
+}
+
+TEST(TreeParallelClassifier, read_numClasses)
+{
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(200, 5, 37, storage);
+    
+    ThreadPool::ptr pool = std::make_shared<ThreadPool>(3);
+    TreeParallelClassifier<DecisionTree> classifier(forest, pool);
+    classifier.setTreesPerTask(5);
+    
+    // Read a forest with three instead of two classes
+    DataStorage::ptr relabeled = DataStorage::Factory::create();
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        const DataPoint & x = storage->getDataPoint(n);
+        relabeled->addDataPoint(x, x(1) > 0.5f ? 2 : storage->getClassLabel(n));
+    }
+    RandomForestLearner<DecisionTreeLearner> learner;
+    learner.setNumTrees(37);
+    RandomForest<DecisionTree>::ptr other = learner.learn(relabeled);
+    
+    std::stringstream stream;
+    other->write(stream);
+    classifier.read(stream);
+    
+    for (int n = 0; n < relabeled->getSize(); n++)
+    {
+        std::vector<float> parallel, expected;
+        classifier.classLogPosterior(relabeled->getDataPoint(n), parallel);
+        other->classLogPosterior(relabeled->getDataPoint(n), expected);
+        
+        ASSERT_EQ(parallel.size(), 3u);
+        ASSERT_EQ(parallel.size(), expected.size());
+        for (size_t c = 0; c < expected.size(); c++)
+        {
+            ASSERT_NEAR(parallel[c], expected[c], 1e-3);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "TreeProfiler"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(TreeProfiler, getNodeVisits)
+{
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(400, 3, 3, storage);
+    forest->enableProfiling();
+    
+    // Count on several threads
+    std::vector<int> results;
+    std::thread other([&] () {
+        std::vector<int> otherResults;
+        forest->classify(storage, otherResults);
+    });
+    forest->classify(storage, results);
+    other.join();
+    
+    for (int i = 0; i < forest->getSize(); i++)
+    {
+        DecisionTree::ptr tree = forest->getTree(i);
+        std::vector<uint64_t> visits;
+        tree->getNodeVisits(visits);
+        
+        ASSERT_EQ(visits[0], static_cast<uint64_t>(2*storage->getSize()));
+        
+        // Every inner node is visited as often as its children together
+        for (int v = 0; v < tree->getNumNodes(); v++)
+        {
+            if (!tree->getNodeConfig(v).isLeafNode())
+            {
+                const int left = tree->getNodeConfig(v).getLeftChild();
+                ASSERT_EQ(visits[v], visits[left] + visits[left + 1]);
+            }
+        }
+        
+        tree->getProfiler()->reset();
+        tree->getNodeVisits(visits);
+        ASSERT_EQ(visits[0], 0u);
+    }
+    
+    std::stringstream stream;
+    forest->writeProfile(stream);
+    std::string header;
+    std::getline(stream, header);
+    ASSERT_EQ(header, "tree,node,depth,leaf,visits,fraction");
+}
+
+TEST(TreeProfiler, recordLeaf)
+{
+    // A profiler that reuses the slot of a destroyed one starts from zero
+    {
+        TreeProfiler first(3);
+        first.recordLeaf(1);
+    }
+    
+    TreeProfiler second(3);
+    second.recordLeaf(2);
+    second.recordLeaf(2);
+    
+    std::vector<uint64_t> hits;
+    second.getLeafHits(hits);
+    ASSERT_EQ(hits[0], 0u);
+    ASSERT_EQ(hits[1], 0u);
+    ASSERT_EQ(hits[2], 2u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "CachedClassifier"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(CachedClassifier, classLogPosterior)
+{
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(100, 4, 3, storage);
+    
+    CachedClassifier cache(forest);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int n = 0; n < storage->getSize(); n++)
+        {
+            std::vector<float> cached, expected;
+            cache.classLogPosterior(storage->getDataPoint(n), cached);
+            forest->classLogPosterior(storage->getDataPoint(n), expected);
+            ASSERT_EQ(cached, expected);
+        }
+    }
+    
+    ASSERT_EQ(cache.getNumMisses(), 100u);
+    ASSERT_EQ(cache.getNumHits(), 100u);
+    ASSERT_FLOAT_EQ(cache.getHitRate(), 0.5f);
+    
+    // Quantized inputs share an entry
+    cache.clear();
+    cache.setQuantization(0.01f);
+    DataPoint x = storage->getDataPoint(0);
+    std::vector<float> probabilities;
+    cache.classLogPosterior(x, probabilities);
+    x(1) += 0.0001f;
+    cache.classLogPosterior(x, probabilities);
+    ASSERT_EQ(cache.getNumHits(), 101u);
+    
+    // The memory bound is respected
+    cache.clear();
+    cache.setMaxMemory(CachedClassifier::NUM_SHARDS*512);
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        cache.classLogPosterior(storage->getDataPoint(n), probabilities);
+    }
+    ASSERT_GT(cache.getMemoryUsage(), 0u);
+    ASSERT_LE(cache.getMemoryUsage(), static_cast<size_t>(CachedClassifier::NUM_SHARDS*512));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for trees allocated from memory resources
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(DecisionTree, defaultMemoryResource)
+{
+    ArenaMemoryResource::ptr arena = std::make_shared<ArenaMemoryResource>(1 << 20, std::make_shared<HugePageMemoryResource>());
+    AbstractMemoryResource::ptr previous = AbstractMemoryResource::getDefault();
+    AbstractMemoryResource::setDefault(arena);
+    
+    DataStorage::ptr storage;
+    RandomForest<DecisionTree>::ptr forest = makeGaussianForest(200, 3, 4, storage);
+    
+    AbstractMemoryResource::setDefault(previous);
+    ASSERT_GT(arena->getUsedMemory(), 0u);
+    
+    // A copy on the heap classifies identically
+    std::stringstream stream;
+    forest->write(stream);
+    RandomForest<DecisionTree> copy;
+    copy.read(stream);
+    
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        ASSERT_EQ(forest->classify(storage->getDataPoint(n)), copy.classify(storage->getDataPoint(n)));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for LeafRefitter
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(LeafRefitter, refit)
+{
+    std::mt19937 g(0);
+    std::normal_distribution<float> normal;
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    DataStorage::ptr first = DataStorage::Factory::create();
+    DataStorage::ptr second = DataStorage::Factory::create();
+    for (int n = 0; n < 300; n++)
+    {
+        DataPoint x(2);
+        x(0) = normal(g);
+        x(1) = normal(g);
+        const int label = x(0) + 0.5f*normal(g) > 0 ? 1 : (x(1) > 1 ? 2 : 0);
+        
+        storage->addDataPoint(x, label);
+        (n % 2 == 0 ? first : second)->addDataPoint(x, label);
+    }
+    
+    RandomForestLearner<DecisionTreeLearner> learner;
+    learner.setNumTrees(4);
+    RandomForest<DecisionTree>::ptr forest = learner.learn(storage);
+    
+    // Refitting with two batches gives the same leaves as recomputing them
+    LeafRefitter<DecisionTree> refitter(forest, 3);
+    refitter.setSmoothingParameter(1);
+    refitter.update(first);
+    refitter.update(second);
+    refitter.refit();
+    
+    std::stringstream stream;
+    forest->write(stream);
+    RandomForest<DecisionTree> reference;
+    reference.read(stream);
+    for (int t = 0; t < reference.getSize(); t++)
+    {
+        TreeLearningTools::updateHistograms(reference.getTree(t), storage, 1);
+    }
+    
+    for (int t = 0; t < forest->getSize(); t++)
+    {
+        for (int v = 0; v < forest->getTree(t)->getNumNodes(); v++)
+        {
+            if (forest->getTree(t)->getNodeConfig(v).isLeafNode())
+            {
+                const std::vector<float> & a = forest->getTree(t)->getNodeData(v).histogram;
+                const std::vector<float> & b = reference.getTree(t)->getNodeData(v).histogram;
+                
+                ASSERT_EQ(a.size(), b.size());
+                for (size_t c = 0; c < a.size(); c++)
+                {
+                    ASSERT_NEAR(a[c], b[c], 1e-5);
+                }
+            }
+        }
+    }
+    
+    // The counts survive a round trip
+    std::stringstream counts;
+    refitter.write(counts);
+    LeafRefitter<DecisionTree> restored(forest, 3);
+    restored.read(counts);
+    for (int v = 0; v < forest->getTree(0)->getNumNodes(); v++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            ASSERT_EQ(restored.getCount(0, v, c), refitter.getCount(0, v, c));
+        }
+    }
+    
+    // Counts for a different number of classes are rejected
+    std::stringstream otherCounts;
+    refitter.write(otherCounts);
+    LeafRefitter<DecisionTree> mismatched(forest, 4);
+    ASSERT_THROW(mismatched.read(otherCounts), IOException);
+    
+    // Seeding with the training data gives the same counts
+    LeafRefitter<DecisionTree> seeded(forest, storage);
+    for (int t = 0; t < forest->getSize(); t++)
+    {
+        for (int v = 0; v < forest->getTree(t)->getNumNodes(); v++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                ASSERT_EQ(seeded.getCount(t, v, c), refitter.getCount(t, v, c));
+            }
+        }
+    }
+}
+
+TEST(DecisionTreeLearner, maxSplitExamples)
+{
+    std::mt19937 g(0);
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < 2000; n++)
+    {
+        DataPoint x(2);
+        x(0) = uniform(g);
+        x(1) = uniform(g);
+        storage->addDataPoint(x, (x(0) > 0.2f) != (x(1) > -0.3f) ? 1 : 0);
+    }
+    
+    DecisionTreeLearner learner;
+    learner.setNumFeatures(2);
+    learner.setMaxSplitExamples(100);
+    DecisionTree::ptr tree = learner.learn(storage);
+    
+    // Every example reached a leaf whose histogram was computed on all
+    // examples, so the training set is fit almost perfectly
+    int correct = 0;
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        if (tree->classify(storage->getDataPoint(n)) == storage->getClassLabel(n))
+        {
+            correct++;
+        }
+    }
+    ASSERT_GT(correct, 0.98f*storage->getSize());
+}
+
+TEST(DecisionTreeLearner, useLevelWiseTraining)
+{
+    std::mt19937 g(0);
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < 2000; n++)
+    {
+        DataPoint x(3);
+        x(0) = uniform(g);
+        x(1) = uniform(g);
+        x(2) = uniform(g);
+        storage->addDataPoint(x, (x(0) > 0.2f) != (x(1) > -0.3f) ? 1 : 0);
+    }
+    
+    DecisionTreeLearner learner;
+    learner.setNumFeatures(3);
+    learner.setUseLevelWiseTraining(true);
+    DecisionTree::ptr tree = learner.learn(storage);
+    
+    int correct = 0;
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        if (tree->classify(storage->getDataPoint(n)) == storage->getClassLabel(n))
+        {
+            correct++;
+        }
+    }
+    ASSERT_EQ(correct, storage->getSize());
+    
+    // Every leaf has a histogram
+    for (int v = 0; v < tree->getNumNodes(); v++)
+    {
+        if (tree->getNodeConfig(v).isLeafNode())
+        {
+            ASSERT_EQ(static_cast<int>(tree->getNodeData(v).histogram.size()), 2);
+        }
+    }
+    
+    // With all features, the first split is the same as in depth-first 
+    // training
+    learner.setUseLevelWiseTraining(false);
+    DecisionTree::ptr reference = learner.learn(storage);
+    ASSERT_EQ(tree->getNodeConfig(0).getSplitFeature(), reference->getNodeConfig(0).getSplitFeature());
+    ASSERT_NEAR(tree->getNodeConfig(0).getThreshold(), reference->getNodeConfig(0).getThreshold(), 1e-5);
+    
+    // The trees of a forest share the sorted columns of the data set, also
+    // for bootstrap samples with repeated points
+    RandomForestLearner<DecisionTreeLearner> forestLearner;
+    forestLearner.setNumTrees(8);
+    forestLearner.setNumThreads(4);
+    forestLearner.getTreeLearner().setNumFeatures(2);
+    forestLearner.getTreeLearner().setUseBootstrap(true);
+    forestLearner.getTreeLearner().setUseLevelWiseTraining(true);
+    RandomForest<DecisionTree>::ptr forest = forestLearner.learn(storage);
+    
+    correct = 0;
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        if (forest->classify(storage->getDataPoint(n)) == storage->getClassLabel(n))
+        {
+            correct++;
+        }
+    }
+    ASSERT_GT(correct, 0.98f*storage->getSize());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for multi-output forests
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(MultiOutputDecisionTreeLearner, learn)
+{
+    std::mt19937 g(0);
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    LabelMatrix::ptr labels = std::make_shared<LabelMatrix>(2);
+    for (int n = 0; n < 1000; n++)
+    {
+        DataPoint x(2);
+        x(0) = uniform(g);
+        x(1) = uniform(g);
+        storage->addDataPoint(x);
+        
+        std::vector<int> y(2);
+        y[0] = x(0) > 0 ? 1 : 0;
+        y[1] = x(1) < -0.5f ? 0 : (x(1) < 0.5f ? 1 : 2);
+        labels->addLabels(y);
+    }
+    
+    RandomForestLearner<MultiOutputDecisionTreeLearner> learner;
+    learner.setNumTrees(5);
+    learner.getTreeLearner().setNumFeatures(2);
+    learner.getTreeLearner().setUseBootstrap(true);
+    learner.getTreeLearner().setLabels(labels);
+    RandomForest<MultiOutputDecisionTree>::ptr forest = learner.learn(storage);
+    
+    std::stringstream stream;
+    forest->write(stream);
+    RandomForest<MultiOutputDecisionTree> copy;
+    copy.read(stream);
+    
+    int correct = 0;
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        std::vector<int> predicted;
+        copy.classifyOutputs(storage->getDataPoint(n), predicted);
+        
+        ASSERT_EQ(predicted.size(), 2u);
+        if (predicted[0] == labels->getLabel(n, 0) && predicted[1] == labels->getLabel(n, 1))
+        {
+            correct++;
+        }
+        
+        // The plain classifier predicts the first output
+        ASSERT_EQ(forest->classify(storage->getDataPoint(n)), predicted[0]);
+    }
+    ASSERT_GT(correct, 0.97f*storage->getSize());
+}
+
+TEST(MultiOutputDecisionTreeLearner, learn_stratifiedSubsampling)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    LabelMatrix::ptr labels = std::make_shared<LabelMatrix>(2);
+    for (int n = 0; n < 10; n++)
+    {
+        DataPoint x(1);
+        x(0) = n;
+        storage->addDataPoint(x);
+        labels->addLabels(std::vector<int>(2, n % 2));
+    }
+    
+    // The storage has no class labels to stratify by
+    RandomForestLearner<MultiOutputDecisionTreeLearner> learner;
+    learner.setNumTrees(2);
+    learner.getTreeLearner().setLabels(labels);
+    learner.getTreeLearner().setSubsamplingMethod(AbstractTreeClassifierLearner::SUBSAMPLING_STRATIFIED);
+    ASSERT_THROW(learner.learn(storage), ConfigurationException);
+    
+    learner.getTreeLearner().setSubsamplingMethod(AbstractTreeClassifierLearner::SUBSAMPLING_BALANCED);
+    ASSERT_THROW(learner.getTreeLearner().learn(storage), ConfigurationException);
+    
+    learner.getTreeLearner().setSubsamplingMethod(AbstractTreeClassifierLearner::SUBSAMPLING_UNIFORM);
+    ASSERT_NO_THROW(learner.learn(storage));
+}
@@ -1,9 +1,12 @@
 
 #include <random>
 #include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
 
 #include "gtest/gtest.h"
 #include "libforest/data.h"
+#include "libforest/data_tools.h"
 #include "libforest/io.h"
 
 using namespace libf;
@@ -333,6 +336,165 @@ TEST(DataStorage, bootstrap)
     }
 }
 
+TEST(DataStorage, subsample)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    
+    for (int n = 0; n < 100; n++)
+    {
+        DataPoint x(1);
+        x(0) = n;
+        storage->addDataPoint(x, n % 2);
+    }
+    
+    auto sample = storage->subsample(30);
+    
+    ASSERT_EQ(sample->getSize(), 30);
+    
+    // All points must be distinct
+    std::vector<bool> seen(100, false);
+    for (int n = 0; n < sample->getSize(); n++)
+    {
+        const int index = static_cast<int>(sample->getDataPoint(n)(0));
+        ASSERT_FALSE(seen[index]);
+        seen[index] = true;
+    }
+}
+
+TEST(DataStorage, stratifiedSubsample)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    
+    // 80 points of class 0, 20 points of class 1
+    for (int n = 0; n < 100; n++)
+    {
+        DataPoint x(1);
+        x(0) = n;
+        storage->addDataPoint(x, n < 80 ? 0 : 1);
+    }
+    
+    auto stratified = storage->stratifiedSubsample(50, false);
+    auto balanced = storage->stratifiedSubsample(30, true);
+    
+    int stratifiedCounts[2] = {0, 0};
+    for (int n = 0; n < stratified->getSize(); n++)
+    {
+        stratifiedCounts[stratified->getClassLabel(n)]++;
+    }
+    int balancedCounts[2] = {0, 0};
+    for (int n = 0; n < balanced->getSize(); n++)
+    {
+        balancedCounts[balanced->getClassLabel(n)]++;
+    }
+    
+    ASSERT_EQ(stratifiedCounts[0], 40);
+    ASSERT_EQ(stratifiedCounts[1], 10);
+    ASSERT_EQ(balancedCounts[0], 15);
+    ASSERT_EQ(balancedCounts[1], 15);
+    
+    // The remainder and the points missing in small classes are drawn from
+    // the larger classes
+    ClassIndex classIndex(*storage);
+    ASSERT_EQ(classIndex.getClassWeight(0), 80);
+    ASSERT_EQ(classIndex.getClassWeight(1), 20);
+    
+    auto odd = storage->stratifiedSubsample(31, true, classIndex);
+    auto large = storage->stratifiedSubsample(60, true, classIndex);
+    
+    int oddCounts[2] = {0, 0};
+    for (int n = 0; n < odd->getSize(); n++)
+    {
+        oddCounts[odd->getClassLabel(n)]++;
+    }
+    int largeCounts[2] = {0, 0};
+    for (int n = 0; n < large->getSize(); n++)
+    {
+        largeCounts[large->getClassLabel(n)]++;
+    }
+    
+    ASSERT_EQ(oddCounts[0], 16);
+    ASSERT_EQ(oddCounts[1], 15);
+    ASSERT_EQ(largeCounts[0], 40);
+    ASSERT_EQ(largeCounts[1], 20);
+}
+
+TEST(DataStorage, weights)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    DataPoint x(1), y(1), z(1);
+    x(0) = 1; y(0) = 2; z(0) = 3;
+    
+    storage->addDataPoint(x, 0);
+    ASSERT_FALSE(storage->isWeighted());
+    
+    storage->addDataPoint(y, 1, 4);
+    storage->addDataPoint(z, 2);
+    
+    ASSERT_TRUE(storage->isWeighted());
+    ASSERT_EQ(storage->getWeight(0), 1);
+    ASSERT_EQ(storage->getWeight(1), 4);
+    ASSERT_EQ(storage->getWeight(2), 1);
+    
+    // Weights are permuted along with the points
+    storage->permute(std::vector<int>({2,0,1}));
+    ASSERT_EQ(storage->getWeight(0), 4);
+    ASSERT_EQ(storage->getDataPoint(0), y);
+    
+    // Reference storages forward the weights
+    auto copy = storage->copy();
+    ASSERT_EQ(copy->getWeight(0), 4);
+}
+
+TEST(DataStorage, weightedSampling)
+{
+    // 8 examples of class 0 and 2 examples of class 1
+    DataStorage::ptr duplicated = DataStorage::Factory::create();
+    DataPoint x(1), y(1);
+    x(0) = 1; y(0) = 2;
+    for (int n = 0; n < 10; n++)
+    {
+        duplicated->addDataPoint(n < 8 ? x : y, n < 8 ? 0 : 1);
+    }
+    
+    DeduplicateTool tool;
+    DataStorage::ptr deduplicated = tool.apply(duplicated);
+    ASSERT_EQ(deduplicated->getSize(), 2);
+    ASSERT_EQ(deduplicated->getTotalWeight(), 10);
+    
+    // Both storages must yield the same class frequencies
+    float duplicatedCounts[2] = {0, 0};
+    float deduplicatedCounts[2] = {0, 0};
+    for (int i = 0; i < 2000; i++)
+    {
+        std::vector<bool> sampled;
+        auto sample = duplicated->bootstrap(duplicated->getTotalWeight(), sampled);
+        for (int n = 0; n < sample->getSize(); n++)
+        {
+            duplicatedCounts[sample->getClassLabel(n)] += sample->getWeight(n);
+        }
+    
+        sample = deduplicated->bootstrap(deduplicated->getTotalWeight(), sampled);
+        ASSERT_EQ(sample->getTotalWeight(), 10);
+        for (int n = 0; n < sample->getSize(); n++)
+        {
+            deduplicatedCounts[sample->getClassLabel(n)] += sample->getWeight(n);
+        }
+    }
+    
+    const float duplicatedFrequency = duplicatedCounts[0]/(duplicatedCounts[0] + duplicatedCounts[1]);
+    const float deduplicatedFrequency = deduplicatedCounts[0]/(deduplicatedCounts[0] + deduplicatedCounts[1]);
+    ASSERT_NEAR(duplicatedFrequency, 0.8f, 0.02f);
+    ASSERT_NEAR(deduplicatedFrequency, 0.8f, 0.02f);
+    
+    // Subsampling draws from the examples as well
+    auto sample = deduplicated->subsample(9);
+    ASSERT_EQ(sample->getTotalWeight(), 9);
+    for (int n = 0; n < sample->getSize(); n++)
+    {
+        ASSERT_LE(sample->getWeight(n), deduplicated->getWeight(sample->getClassLabel(n)));
+    }
+}
+
 TEST(DataStorage, permute)
 {
     DataStorage::ptr storage = DataStorage::Factory::create();
@@ -355,6 +517,73 @@ TEST(DataStorage, permute)
     ASSERT_EQ(storage->getClassLabel(2), LIBF_NO_LABEL);
 }
 
+TEST(DataStorage, permute_cycle)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    DataPoint x(1), y(1), z(1), w(1);
+    x(0) = 1; y(0) = 2; z(0) = 3; w(0) = 4;
+    
+    storage->addDataPoint(x, 0);
+    storage->addDataPoint(y, 1);
+    storage->addDataPoint(z, 2);
+    storage->addDataPoint(w, 3);
+    
+    // 0 -> 1 -> 2 -> 0 is a cycle, 3 is a fixed point
+    std::vector<int> sigma({1,2,0,3});
+    
+    storage->permute(sigma);
+    
+    ASSERT_EQ(storage->getDataPoint(0), z);
+    ASSERT_EQ(storage->getClassLabel(0), 2);
+    ASSERT_EQ(storage->getDataPoint(1), x);
+    ASSERT_EQ(storage->getClassLabel(1), 0);
+    ASSERT_EQ(storage->getDataPoint(2), y);
+    ASSERT_EQ(storage->getClassLabel(2), 1);
+    ASSERT_EQ(storage->getDataPoint(3), w);
+    ASSERT_EQ(storage->getClassLabel(3), 3);
+}
+
+TEST(DataStorage, removeDataPoints)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    
+    for (int n = 0; n < 6; n++)
+    {
+        DataPoint x(1);
+        x(0) = n;
+        storage->addDataPoint(x, n);
+    }
+    
+    storage->removeDataPoints(std::vector<int>({4, 0, 2}));
+    
+    ASSERT_EQ(storage->getSize(), 3);
+    ASSERT_EQ(storage->getClassLabel(0), 1);
+    ASSERT_EQ(storage->getClassLabel(1), 3);
+    ASSERT_EQ(storage->getClassLabel(2), 5);
+    ASSERT_EQ(storage->getDataPoint(0)(0), 1);
+    ASSERT_EQ(storage->getDataPoint(1)(0), 3);
+    ASSERT_EQ(storage->getDataPoint(2)(0), 5);
+}
+
+TEST(DataStorage, swapRemoveDataPoint)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    DataPoint x(1), y(1), z(1);
+    x(0) = 1; y(0) = 2; z(0) = 3;
+    
+    storage->addDataPoint(x, 0);
+    storage->addDataPoint(y, 1);
+    storage->addDataPoint(z, 2);
+    
+    storage->swapRemoveDataPoint(0);
+    
+    ASSERT_EQ(storage->getSize(), 2);
+    ASSERT_EQ(storage->getDataPoint(0), z);
+    ASSERT_EQ(storage->getClassLabel(0), 2);
+    ASSERT_EQ(storage->getDataPoint(1), y);
+    ASSERT_EQ(storage->getClassLabel(1), 1);
+}
+
 TEST(DataStorage, copy)
 {
     DataStorage::ptr storage = DataStorage::Factory::create();
@@ -434,6 +663,36 @@ TEST(DataStorage, addDataPoints)
     ASSERT_EQ(storage1->getClassLabel(2), 2);
 }
 
+TEST(DataStorage, moveDataPoints)
+{
+    DataStorage::ptr storage1 = DataStorage::Factory::create();
+    DataStorage::ptr storage2 = DataStorage::Factory::create();
+    DataStorage::ptr storage3 = DataStorage::Factory::create();
+    DataPoint x(1), y(1), z(1);
+    x(0) = 1; y(0) = 2, z(0) = 3;
+    
+    storage2->addDataPoint(x, 0);
+    storage2->addDataPoint(y, 1, 3);
+    storage3->addDataPoint(z, 2);
+    
+    // Moving into an empty storage takes over the contents
+    storage1->moveDataPoints(*storage2);
+    ASSERT_EQ(storage2->getSize(), 0);
+    ASSERT_EQ(storage2->getClasscount(), 0);
+    ASSERT_EQ(storage1->getSize(), 2);
+    ASSERT_EQ(storage1->getClasscount(), 2);
+    ASSERT_EQ(storage1->getWeight(1), 3);
+    
+    storage1->moveDataPoints(*storage3);
+    ASSERT_EQ(storage3->getSize(), 0);
+    ASSERT_EQ(storage1->getSize(), 3);
+    ASSERT_EQ(storage1->getDataPoint(2), z);
+    ASSERT_EQ(storage1->getClassLabel(2), 2);
+    ASSERT_EQ(storage1->getClasscount(), 3);
+    ASSERT_EQ(storage1->getWeight(1), 3);
+    ASSERT_EQ(storage1->getWeight(2), 1);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Unit tests for the class "ReferenceDataStorage"
 ////////////////////////////////////////////////////////////////////////////////
@@ -536,6 +795,150 @@ TEST(ReferenceDataStorage, permute)
     ASSERT_EQ(refStorage->getDataPoint(2), z);
 }
 
+TEST(ReferenceDataStorage, nestedViewsAreFlat)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    
+    for (int n = 0; n < 10; n++)
+    {
+        DataPoint x(1);
+        x(0) = n;
+        storage->addDataPoint(x, n);
+    }
+    
+    // excerpt -> filter -> excerpt
+    auto view = storage->excerpt(2, 9)->filter([](const DataPoint & x, int label) {
+        return label % 2 == 0;
+    })->excerpt(1, 2);
+    
+    ASSERT_EQ(view->getBaseStorage(), storage);
+    ASSERT_EQ(view->getSize(), 2);
+    ASSERT_EQ(view->getClassLabel(0), 4);
+    ASSERT_EQ(view->getClassLabel(1), 6);
+    ASSERT_EQ(view->getBaseIndex(1), 6);
+    
+    // Reference storages on top of reference storages are flat as well
+    ReferenceDataStorage::ptr refStorage = std::make_shared<ReferenceDataStorage>(view);
+    refStorage->addDataPoint(1);
+    
+    ASSERT_EQ(refStorage->getBaseStorage(), storage);
+    ASSERT_EQ(refStorage->getDataPoint(0)(0), 6);
+    
+    // The view does not outlive its last owner
+    std::weak_ptr<ReferenceDataStorage> weakView = view;
+    view.reset();
+    ASSERT_TRUE(weakView.expired());
+    ASSERT_EQ(refStorage->getDataPoint(0)(0), 6);
+}
+
+TEST(ReferenceDataStorage, removeDataPoints)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    DataPoint x(1), y(1), z(1);
+    x(0) = 1; y(0) = 2; z(0) = 3;
+    
+    storage->addDataPoint(x, 0);
+    storage->addDataPoint(y, 1);
+    storage->addDataPoint(z, 2);
+    
+    ReferenceDataStorage::ptr refStorage = std::make_shared<ReferenceDataStorage>(storage);
+    for(int n = 0; n < 3; n++) refStorage->addDataPoint(n);
+    
+    refStorage->removeDataPoints(std::vector<int>({1}));
+    
+    ASSERT_EQ(refStorage->getSize(), 2);
+    ASSERT_EQ(storage->getSize(), 3);
+    ASSERT_EQ(refStorage->getDataPoint(0), x);
+    ASSERT_EQ(refStorage->getDataPoint(1), z);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "DeduplicateTool"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(DeduplicateTool, apply)
+{
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    DataPoint x(2), y(2);
+    x << 1, 2;
+    y << 3, 4;
+    
+    storage->addDataPoint(x, 0);
+    storage->addDataPoint(y, 0);
+    storage->addDataPoint(x, 0);
+    storage->addDataPoint(x, 1);
+    storage->addDataPoint(y, 0, 3);
+    
+    DeduplicateTool tool;
+    tool.setNumThreads(2);
+    DataStorage::ptr result = tool.apply(storage);
+    
+    ASSERT_EQ(result->getSize(), 3);
+    ASSERT_EQ(result->getDataPoint(0), x);
+    ASSERT_EQ(result->getClassLabel(0), 0);
+    ASSERT_EQ(result->getWeight(0), 2);
+    ASSERT_EQ(result->getDataPoint(1), y);
+    ASSERT_EQ(result->getClassLabel(1), 0);
+    ASSERT_EQ(result->getWeight(1), 4);
+    ASSERT_EQ(result->getDataPoint(2), x);
+    ASSERT_EQ(result->getClassLabel(2), 1);
+    ASSERT_EQ(result->getWeight(2), 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "RandomProjection"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(RandomProjection, apply_readWrite)
+{
+    std::random_device rd;
+    std::mt19937 g(rd());
+    std::uniform_real_distribution<float> entryDist(0.0f, 1.0f);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < 20; n++)
+    {
+        DataPoint x(400);
+        for (int d = 0; d < 400; d++)
+        {
+            x(d) = entryDist(g);
+        }
+        storage->addDataPoint(x, n % 2);
+    }
+    
+    const int methods[] = {RandomProjection::METHOD_GAUSSIAN, RandomProjection::METHOD_ACHLIOPTAS, RandomProjection::METHOD_VERY_SPARSE};
+    for (int i = 0; i < 3; i++)
+    {
+        RandomProjection projection;
+        projection.setMethod(methods[i]);
+        projection.setNumDimensions(32);
+        projection.learn(storage);
+        
+        std::stringstream stream;
+        projection.write(stream);
+        RandomProjection read;
+        read.read(stream);
+        ASSERT_EQ(read.getInputDimensionality(), 400);
+        
+        DataStorage::ptr projected = storage->hardCopy();
+        projection.apply(projected);
+        
+        ASSERT_EQ(projected->getDimensionality(), 32);
+        ASSERT_EQ(projected->getClassLabel(1), 1);
+        
+        for (int n = 0; n < storage->getSize(); n++)
+        {
+            DataPoint x;
+            read.project(storage->getDataPoint(n), x);
+            ASSERT_EQ(x.rows(), 32);
+            for (int d = 0; d < 32; d++)
+            {
+                ASSERT_FLOAT_EQ(x(d), projected->getDataPoint(n)(d));
+            }
+        }
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Unit tests for the class "CSVDataReader" and "CSVDataWriter"
 ////////////////////////////////////////////////////////////////////////////////
@@ -765,6 +1168,228 @@ TEST(LibforestData, readWrite_unlabeledData)
     }
 }
 
+TEST(LibforestData, readWrite_uint8)
+{
+    // Create a data set with 8 bit features
+    std::random_device rd;
+    std::mt19937 g(rd());
+    std::uniform_int_distribution<int> entryDist(0, 255);
+    std::uniform_int_distribution<int> labelDist(0, 30);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    
+    const int N = 1000;
+    const int D = 80;
+    
+    for (int n = 0; n < N; n++)
+    {
+        DataPoint x(D);
+        
+        for (int d = 0; d < D; d++)
+        {
+            x(d) = entryDist(g);
+        }
+        
+        storage->addDataPoint(x, labelDist(g));
+    }
+    
+    LibforestDataReader reader;
+    LibforestDataWriter writer;
+    writer.setFeatureType(LibforestDataWriter::FEATURE_TYPE_UINT8);
+    
+    writer.write("data.dat", storage);
+    
+    DataStorage::ptr readStorage = DataStorage::Factory::create();
+    
+    reader.read("data.dat", readStorage);
+    
+    ASSERT_EQ(readStorage->getSize(), N);
+    for (int n = 0; n < N; n++)
+    {
+        ASSERT_EQ(readStorage->getClassLabel(n), storage->getClassLabel(n));
+        for (int d = 0; d < D; d++)
+        {
+            ASSERT_FLOAT_EQ(readStorage->getDataPoint(n)(d), storage->getDataPoint(n)(d));
+        }
+    }
+}
+
+TEST(LibforestData, readWrite_parts)
+{
+    DataStorage::ptr first = DataStorage::Factory::create();
+    DataStorage::ptr second = DataStorage::Factory::create();
+    for (int n = 0; n < 10; n++)
+    {
+        DataPoint x(3);
+        x << n, 2*n, 3*n;
+        (n < 4 ? first : second)->addDataPoint(x, n % 3);
+    }
+    
+    // Write the data set in two parts and fix the header afterwards
+    LibforestDataWriter writer;
+    writer.setFeatureType(LibforestDataWriter::FEATURE_TYPE_UINT16);
+    
+    std::stringstream stream;
+    writer.writeHeader(stream, 0);
+    writer.writeDataPoints(stream, first);
+    writer.writeDataPoints(stream, second);
+    stream.seekp(0);
+    writer.writeHeader(stream, 10);
+    
+    // Read the data set in parts
+    LibforestDataReader reader;
+    int N;
+    int featureType;
+    reader.readHeader(stream, N, featureType);
+    
+    ASSERT_EQ(N, 10);
+    ASSERT_EQ(featureType, static_cast<int>(LibforestDataWriter::FEATURE_TYPE_UINT16));
+    
+    DataStorage::ptr readStorage = DataStorage::Factory::create();
+    reader.readDataPoints(stream, readStorage, featureType, 3);
+    reader.readDataPoints(stream, readStorage, featureType, 7);
+    
+    ASSERT_EQ(readStorage->getSize(), 10);
+    for (int n = 0; n < 10; n++)
+    {
+        ASSERT_EQ(readStorage->getClassLabel(n), n % 3);
+        ASSERT_FLOAT_EQ(readStorage->getDataPoint(n)(2), 3*n);
+    }
+}
+
+TEST(LibforestData, readWrite_half)
+{
+    // Create a data set
+    std::random_device rd;
+    std::mt19937 g(rd());
+    std::uniform_real_distribution<float> entryDist(0.0f, 10.0f);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    
+    const int N = 1000;
+    const int D = 80;
+    
+    for (int n = 0; n < N; n++)
+    {
+        DataPoint x(D);
+        
+        for (int d = 0; d < D; d++)
+        {
+            x(d) = entryDist(g);
+        }
+        
+        storage->addDataPoint(x);
+    }
+    
+    LibforestDataReader reader;
+    LibforestDataWriter writer;
+    writer.setFeatureType(LibforestDataWriter::FEATURE_TYPE_HALF);
+    
+    writer.write("data.dat", storage);
+    
+    DataStorage::ptr readStorage = DataStorage::Factory::create();
+    
+    reader.read("data.dat", readStorage);
+    
+    ASSERT_EQ(readStorage->getSize(), N);
+    for (int n = 0; n < N; n++)
+    {
+        ASSERT_EQ(readStorage->getClassLabel(n), storage->getClassLabel(n));
+        for (int d = 0; d < D; d++)
+        {
+            // Half precision has 11 significant bits
+            ASSERT_NEAR(readStorage->getDataPoint(n)(d), storage->getDataPoint(n)(d), 1e-2);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "CompactDataStorage"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(CompactDataStorage, read)
+{
+    std::mt19937 g(0);
+    std::uniform_int_distribution<int> entryDist(0, 255);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    for (int n = 0; n < 100; n++)
+    {
+        DataPoint x(20);
+        for (int d = 0; d < 20; d++)
+        {
+            x(d) = entryDist(g);
+        }
+        storage->addDataPoint(x, n % 3);
+    }
+    
+    LibforestDataWriter writer;
+    writer.setFeatureType(LibforestDataWriter::FEATURE_TYPE_UINT8);
+    std::stringstream stream;
+    writer.write(stream, storage);
+    
+    // The features are kept with one byte each
+    LibforestDataReader reader;
+    CompactDataStorage::ptr compact = std::make_shared<CompactDataStorage>(LibforestDataWriter::FEATURE_TYPE_UINT8);
+    reader.read(stream, compact);
+    
+    ASSERT_EQ(compact->getSize(), 100);
+    ASSERT_EQ(compact->getDimensionality(), 20);
+    ASSERT_EQ(compact->getClasscount(), 3);
+    ASSERT_EQ(compact->getFeatureBytes(), static_cast<size_t>(100*20));
+    
+    DataStorage::ptr widened = compact->toDataStorage();
+    ASSERT_EQ(widened->getSize(), 100);
+    for (int n = 0; n < 100; n++)
+    {
+        ASSERT_EQ(compact->getClassLabel(n), storage->getClassLabel(n));
+        ASSERT_EQ(widened->getClassLabel(n), storage->getClassLabel(n));
+        for (int d = 0; d < 20; d++)
+        {
+            ASSERT_FLOAT_EQ(compact->getFeature(n, d), storage->getDataPoint(n)(d));
+            ASSERT_FLOAT_EQ(widened->getDataPoint(n)(d), storage->getDataPoint(n)(d));
+        }
+    }
+    
+    // Files with other feature types are converted
+    stream.clear();
+    stream.seekg(0);
+    CompactDataStorage::ptr half = std::make_shared<CompactDataStorage>(LibforestDataWriter::FEATURE_TYPE_HALF);
+    reader.read(stream, half);
+    
+    ASSERT_EQ(half->getFeatureBytes(), static_cast<size_t>(100*20*2));
+    DataPoint x;
+    half->getDataPoint(7, x);
+    ASSERT_EQ(x.rows(), 20);
+    for (int d = 0; d < 20; d++)
+    {
+        // Half precision represents all integers up to 2048
+        ASSERT_FLOAT_EQ(x(d), storage->getDataPoint(7)(d));
+    }
+    
+    // Integer features are rounded and clamped
+    CompactDataStorage added(LibforestDataWriter::FEATURE_TYPE_UINT8);
+    DataPoint y(3);
+    y << -4, 3.6f, 300;
+    added.addDataPoint(y, 1);
+    ASSERT_FLOAT_EQ(added.getFeature(0, 0), 0);
+    ASSERT_FLOAT_EQ(added.getFeature(0, 1), 4);
+    ASSERT_FLOAT_EQ(added.getFeature(0, 2), 255);
+    
+    // The features are allocated from the default resource
+    ArenaMemoryResource::ptr arena = std::make_shared<ArenaMemoryResource>(1 << 16);
+    AbstractMemoryResource::ptr previous = AbstractMemoryResource::getDefault();
+    AbstractMemoryResource::setDefault(arena);
+    CompactDataStorage::ptr arenaStorage = std::make_shared<CompactDataStorage>(LibforestDataWriter::FEATURE_TYPE_UINT8);
+    AbstractMemoryResource::setDefault(previous);
+    
+    stream.clear();
+    stream.seekg(0);
+    reader.read(stream, arenaStorage);
+    ASSERT_GE(arena->getUsedMemory(), arenaStorage->getFeatureBytes());
+    ASSERT_FLOAT_EQ(arenaStorage->getFeature(7, 3), storage->getDataPoint(7)(3));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Unit tests for the class "LIBSVMDataWriter" and "LIBSVMDataReader"
 ////////////////////////////////////////////////////////////////////////////////
@@ -878,6 +1503,43 @@ TEST(LIBSVM, read_labeledDataZeros)
 }
 
 
+TEST(LIBSVM, read_multithreaded)
+{
+    // Comments, blank lines, exponents and a line without line break
+    std::stringstream stream;
+    stream << "# comment" << std::endl;
+    stream << "1 1:1e-3 3:-.5 " << std::endl;
+    stream << std::endl;
+    for (int n = 0; n < 1000; n++)
+    {
+        stream << (n % 2 + 1) << " 2:" << n << "\t5:0.25" << std::endl;
+    }
+    stream << "2 4:1.5E2";
+    
+    LIBSVMDataReader reader;
+    reader.setNumThreads(4);
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    reader.read(stream, storage);
+    
+    ASSERT_EQ(storage->getSize(), 1002);
+    ASSERT_EQ(storage->getDimensionality(), 5);
+    
+    ASSERT_FLOAT_EQ(storage->getDataPoint(0)(0), 1e-3f);
+    ASSERT_FLOAT_EQ(storage->getDataPoint(0)(2), -0.5f);
+    for (int n = 0; n < 1000; n++)
+    {
+        ASSERT_EQ(storage->getClassLabel(n + 1), n % 2);
+        ASSERT_FLOAT_EQ(storage->getDataPoint(n + 1)(1), n);
+        ASSERT_FLOAT_EQ(storage->getDataPoint(n + 1)(4), 0.25f);
+    }
+    ASSERT_FLOAT_EQ(storage->getDataPoint(1001)(3), 150.0f);
+    
+    // Invalid lines are reported
+    std::stringstream invalid("1 3:1,4:2");
+    ASSERT_THROW(reader.read(invalid, storage), IOException);
+}
+
 TEST(LIBSVM, read_binaryData)
 {
     // Create a data small CSV file
@@ -953,3 +1615,125 @@ TEST(LIBSVM, readWrite_unlabeledData)
     }
 }
 
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the class "CachedDataReader"
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(CachedDataReader, read)
+{
+    // Start without cache files from previous runs
+    boost::filesystem::remove_all("cache-test");
+    boost::filesystem::create_directories("cache-test");
+    
+    const std::string filename = "cache-test/cached.csv";
+    std::ofstream file(filename);
+    file << "0,1.5,2\n1,3,-4.25\n0,5,6\n0,1.5,2\n";
+    file.close();
+    
+    int numPipelineCalls = 0;
+    
+    CachedDataReader reader(std::make_shared<CSVDataReader>());
+    reader.setCacheDirectory("cache-test/cache");
+    reader.setPipeline("scale-2-deduplicate", [&numPipelineCalls](DataStorage::ptr storage) {
+        numPipelineCalls++;
+        for (int n = 0; n < storage->getSize(); n++)
+        {
+            storage->getDataPoint(n) *= 2;
+        }
+        
+        DeduplicateTool tool;
+        *storage = *tool.apply(storage);
+    });
+    
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    reader.read(filename, storage);
+    
+    ASSERT_EQ(numPipelineCalls, 1);
+    ASSERT_EQ(storage->getSize(), 3);
+    ASSERT_TRUE(storage->isWeighted());
+    ASSERT_FLOAT_EQ(storage->getDataPoint(1)(1), -8.5f);
+    
+    // The second read is served from the cache
+    DataStorage::ptr cachedStorage = DataStorage::Factory::create();
+    reader.read(filename, cachedStorage);
+    
+    ASSERT_EQ(numPipelineCalls, 1);
+    ASSERT_EQ(cachedStorage->getSize(), 3);
+    for (int n = 0; n < 3; n++)
+    {
+        ASSERT_EQ(cachedStorage->getClassLabel(n), storage->getClassLabel(n));
+        ASSERT_EQ(cachedStorage->getWeight(n), storage->getWeight(n));
+        for (int d = 0; d < 2; d++)
+        {
+            ASSERT_FLOAT_EQ(cachedStorage->getDataPoint(n)(d), storage->getDataPoint(n)(d));
+        }
+    }
+    
+    // A different pipeline key results in a different cache file
+    const std::string cacheFilename = reader.getCacheFilename(filename);
+    reader.setPipeline("scale-3", [&numPipelineCalls](DataStorage::ptr storage) {
+        numPipelineCalls++;
+    });
+    ASSERT_NE(reader.getCacheFilename(filename), cacheFilename);
+    
+    boost::filesystem::remove_all("cache-test");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for HierarchicalKMeans
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(HierarchicalKMeans, assign)
+{
+    std::mt19937 g(0);
+    std::normal_distribution<float> normal(0, 0.1f);
+    
+    // 4 groups of 4 blobs each
+    DataStorage::ptr storage = DataStorage::Factory::create();
+    std::vector<int> blobs;
+    for (int n = 0; n < 1600; n++)
+    {
+        const int blob = n % 16;
+        DataPoint x(2);
+        x(0) = 100*(blob / 4) + 10*(blob % 2) + normal(g);
+        x(1) = 10*((blob % 4) / 2) + normal(g);
+        storage->addDataPoint(x);
+        blobs.push_back(blob);
+    }
+    
+    HierarchicalKMeans vocabulary;
+    vocabulary.setBranchingFactor(4);
+    vocabulary.setDepth(2);
+    vocabulary.cluster(storage);
+    
+    ASSERT_EQ(vocabulary.getNumWords(), 16);
+    ASSERT_EQ(vocabulary.getNumNodes(), 21);
+    
+    std::vector<int> words;
+    vocabulary.assign(storage, words);
+    
+    // Every blob is a word of its own
+    std::vector<int> blobWords(16, -1);
+    std::vector<bool> used(16, false);
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        if (blobWords[blobs[n]] < 0)
+        {
+            ASSERT_FALSE(used[words[n]]);
+            blobWords[blobs[n]] = words[n];
+            used[words[n]] = true;
+        }
+        ASSERT_EQ(words[n], blobWords[blobs[n]]);
+    }
+    
+    // The words survive a round trip
+    std::stringstream stream;
+    vocabulary.write(stream);
+    HierarchicalKMeans copy;
+    copy.read(stream);
+    for (int n = 0; n < storage->getSize(); n++)
+    {
+        ASSERT_EQ(copy.assign(storage->getDataPoint(n)), words[n]);
+    }
+}
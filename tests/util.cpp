@@ -1,6 +1,7 @@
 
 #include "gtest/gtest.h"
 #include "libforest/util.h"
+#include "libforest/memory.h"
 
 using namespace libf;
 
@@ -86,6 +87,51 @@ TEST(Util, permute_invalidPermutation_3)
     ASSERT_THROW(Util::permute(sigma, v, v), AssertionException);
 }
 
+/**
+ * Tests if the in place permutation yields the same result as the out of 
+ * place permutation.
+ */
+TEST(Util, permuteInPlace_sameAsPermute)
+{
+    std::vector<int> sigma({3,0,4,1,2,6,5,7});
+    std::vector<int> v({10,11,12,13,14,15,16,17});
+    std::vector<int> out;
+    
+    Util::permute(sigma, v, out);
+    Util::permuteInPlace(sigma, v);
+    
+    ASSERT_EQ(v, out);
+}
+
+/**
+ * Tests if sampling without replacement yields sorted, distinct samples.
+ */
+TEST(Util, sampleWithoutReplacement)
+{
+    std::mt19937 g(0);
+    std::vector<int> result;
+    
+    Util::sampleWithoutReplacement(1000, 100, result, g);
+    
+    ASSERT_EQ(static_cast<int>(result.size()), 100);
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        ASSERT_GE(result[i], 0);
+        ASSERT_LT(result[i], 1000);
+        if (i > 0)
+        {
+            ASSERT_LT(result[i - 1], result[i]);
+        }
+    }
+    
+    // Sampling all elements must return the whole range
+    Util::sampleWithoutReplacement(10, 10, result, g);
+    for (int i = 0; i < 10; i++)
+    {
+        ASSERT_EQ(result[i], i);
+    }
+}
+
 /**
  * Tests if the hamming distance can be computed
  */
@@ -125,6 +171,63 @@ TEST(Util, hammingDist_correctly_3)
     ASSERT_EQ(static_cast<int>(distance), 1);
 }
 
+/**
+ * Tests if values that are representable in half precision survive the 
+ * conversion.
+ */
+TEST(Util, floatToHalf_exact)
+{
+    const float values[] = {0.0f, -0.0f, 1.0f, -2.5f, 0.5f, 65504.0f, 1024.0f, 6.103515625e-05f, 5.9604645e-08f};
+    
+    for (int i = 0; i < 9; i++)
+    {
+        ASSERT_EQ(Util::halfToFloat(Util::floatToHalf(values[i])), values[i]);
+    }
+}
+
+/**
+ * Tests if too large values are mapped to infinity and others are rounded.
+ */
+TEST(Util, floatToHalf_rounding)
+{
+    ASSERT_TRUE(std::isinf(Util::halfToFloat(Util::floatToHalf(1e6f))));
+    ASSERT_NEAR(Util::halfToFloat(Util::floatToHalf(3.14159f)), 3.14159f, 2e-3);
+}
+
+/**
+ * Tests the formatting of simple floats and integers.
+ */
+TEST(Util, appendFloat_format)
+{
+    std::string buffer;
+    Util::appendFloat(buffer, 0.1f);
+    buffer.push_back(' ');
+    Util::appendFloat(buffer, -3);
+    buffer.push_back(' ');
+    Util::appendFloat(buffer, 255);
+    buffer.push_back(' ');
+    Util::appendInt(buffer, -2147483647 - 1);
+    
+    ASSERT_EQ(buffer, "0.1 -3 255 -2147483648");
+}
+
+/**
+ * Tests if formatted floats read back to the same value.
+ */
+TEST(Util, appendFloat_roundtrip)
+{
+    std::mt19937 g(42);
+    std::uniform_real_distribution<float> dist(-1e5f, 1e5f);
+    
+    for (int i = 0; i < 10000; i++)
+    {
+        const float value = dist(g)/(1 + i % 1000);
+        std::string buffer;
+        Util::appendFloat(buffer, value);
+        ASSERT_EQ(std::strtof(buffer.c_str(), 0), value);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Unit tests for the class "EfficientEntropyHistogram"
 ////////////////////////////////////////////////////////////////////////////////
@@ -404,3 +507,100 @@ TEST(EfficientEntropyHistogram, isPure_multipleNonEmptyBin)
     
     ASSERT_FALSE(hist.isPure());
 }
+
+/**
+ * Tests if adding a weighted point is the same as adding several points.
+ */
+TEST(EfficientEntropyHistogram, add_weighted)
+{
+    EfficientEntropyHistogram weighted(3);
+    EfficientEntropyHistogram unweighted(3);
+    
+    weighted.add(0, 3);
+    weighted.add(2, 2);
+    for (int i = 0; i < 3; i++) unweighted.addOne(0);
+    for (int i = 0; i < 2; i++) unweighted.addOne(2);
+    
+    ASSERT_EQ(weighted.at(0), 3);
+    ASSERT_EQ(weighted.at(2), 2);
+    ASSERT_FLOAT_EQ(weighted.getMass(), unweighted.getMass());
+    ASSERT_FLOAT_EQ(weighted.getEntropy(), unweighted.getEntropy());
+    
+    weighted.sub(0, 2);
+    unweighted.subOne(0);
+    unweighted.subOne(0);
+    
+    ASSERT_EQ(weighted.at(0), 1);
+    ASSERT_FLOAT_EQ(weighted.getMass(), unweighted.getMass());
+    ASSERT_FLOAT_EQ(weighted.getEntropy(), unweighted.getEntropy());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Unit tests for the memory resources
+////////////////////////////////////////////////////////////////////////////////
+
+TEST(ArenaMemoryResource, allocate)
+{
+    ArenaMemoryResource::ptr arena = std::make_shared<ArenaMemoryResource>(1024);
+    
+    std::vector<int, Allocator<int> > v((Allocator<int>(arena)));
+    for (int i = 0; i < 1000; i++)
+    {
+        v.push_back(i);
+    }
+    for (int i = 0; i < 1000; i++)
+    {
+        ASSERT_EQ(v[i], i);
+    }
+    
+    void* p = arena->allocate(3);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % alignof(std::max_align_t), 0u);
+    ASSERT_GE(arena->getReservedMemory(), arena->getUsedMemory());
+}
+
+TEST(HugePageMemoryResource, allocate)
+{
+    HugePageMemoryResource resource;
+    const size_t size = 3*HugePageMemoryResource::HUGE_PAGE_SIZE + 5;
+    
+    char* p = static_cast<char*>(resource.allocate(size));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % HugePageMemoryResource::HUGE_PAGE_SIZE, 0u);
+    
+    p[0] = 1;
+    p[size - 1] = 2;
+    ASSERT_EQ(p[0] + p[size - 1], 3);
+    resource.deallocate(p, size);
+    
+    // Small allocations come from the heap
+    void* q = resource.allocate(16);
+    resource.deallocate(q, 16);
+    
+    HugePageMemoryResource small(1024);
+    ASSERT_EQ(small.getMinSize(), 1024u);
+    char* r = static_cast<char*>(small.allocate(4096));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(r) % HugePageMemoryResource::HUGE_PAGE_SIZE, 0u);
+    small.deallocate(r, 4096);
+}
+
+TEST(ScratchArena, Scope)
+{
+    const float* data;
+    {
+        ScratchArena::Scope scope;
+        Eigen::VectorXf & a = scope.getVector(10);
+        data = a.data();
+        
+        {
+            ScratchArena::Scope nested;
+            Eigen::VectorXf & b = nested.getVector(10);
+            ASSERT_NE(a.data(), b.data());
+        }
+    }
+    
+    // The next scope reuses the buffers without reallocating
+    ScratchArena::Scope scope;
+    Eigen::VectorXf & c = scope.getVector(10);
+    ASSERT_EQ(c.data(), data);
+    ASSERT_EQ(scope.getMatrix(3, 4).size(), 12);
+    ASSERT_GE(ScratchArena::local().getReservedMemory(), 32*sizeof(float));
+}